@@ -68,19 +68,14 @@ struct cluster {
                parlay::random &rnd, size_t cluster_size, F f, long MSTDeg,
                indexType first, indexType second) {
     // Split points based on which of the two points are closer.
-    auto closer_first =
-        parlay::filter(parlay::make_slice(active_indices), [&](size_t ind) {
-          distanceType dist_first = Points[ind].distance(Points[first]);
-          distanceType dist_second = Points[ind].distance(Points[second]);
-          return dist_first <= dist_second;
-        });
-
-    auto closer_second =
-        parlay::filter(parlay::make_slice(active_indices), [&](size_t ind) {
-          distanceType dist_first = Points[ind].distance(Points[first]);
-          distanceType dist_second = Points[ind].distance(Points[second]);
-          return dist_second < dist_first;
-        });
+    auto first_closer = parlay::map(active_indices, [&](size_t ind) {
+      distanceType dist_first = Points[ind].distance(Points[first]);
+      distanceType dist_second = Points[ind].distance(Points[second]);
+      return dist_first <= dist_second;
+    });
+    auto closer_first = parlay::pack(active_indices, first_closer);
+    auto closer_second = parlay::pack(
+        active_indices, parlay::map(first_closer, [](bool b) { return !b; }));
 
     auto left_rnd = rnd.fork(0);
     auto right_rnd = rnd.fork(1);
@@ -143,13 +138,19 @@ struct cluster {
     random_clustering(G, Points, active_indices, rnd, cluster_size, f, MSTDeg);
   }
 
+  // The trees are built concurrently, and f is also passed the number
+  // of the tree each leaf belongs to.
   template <typename F>
   void multiple_clustertrees(GraphI &G, PR &Points, long cluster_size,
                              long num_clusters, F f, long MSTDeg) {
-    for (long i = 0; i < num_clusters; i++) {
-      random_clustering_wrapper(G, Points, cluster_size, f, MSTDeg);
-      std::cout << "Built cluster " << i << " of " << num_clusters << std::endl;
-    }
+    parlay::parallel_for(0, num_clusters, [&](long i) {
+      auto leaf = [&](GraphI &G, PR &Points,
+                      parlay::sequence<size_t> &active_indices, long MSTDeg) {
+        f(G, Points, active_indices, MSTDeg, i);
+      };
+      random_clustering_wrapper(G, Points, cluster_size, leaf, MSTDeg);
+    }, 1);
+    std::cout << "Built " << num_clusters << " cluster trees" << std::endl;
   }
 };
 
@@ -23,11 +23,15 @@
 #include <math.h>
 
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
 #include <queue>
 #include <random>
 #include <set>
 
 #include "../utils/graph.h"
+#include "../utils/knn_graph.h"
 #include "clusterEdge.h"
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
@@ -111,158 +115,158 @@ struct hcnng_index {
 
   hcnng_index() {}
 
-  static void remove_edge_duplicates(indexType p, GraphI &G) {
-    parlay::sequence<indexType> points;
-    for (indexType i = 0; i < G[p].size(); i++) {
-      points.push_back(G[p][i]);
-    }
-    auto np = parlay::remove_duplicates(points);
-    G[p].update_neighbors(np);
-  }
-
-  void remove_all_duplicates(GraphI &G) {
-    parlay::parallel_for(0, G.size(),
-                         [&](size_t i) { remove_edge_duplicates(i, G); });
-  }
-
-  // inserts each edge after checking for duplicates
-  static void process_edges(GraphI &G, parlay::sequence<edge> edges) {
-    long maxDeg = G.max_degree();
-    auto grouped = parlay::group_by_key(edges);
-    parlay::parallel_for(0, grouped.size(), [&](size_t i) {
-      int32_t index = grouped[i].first;
-      for (auto c : grouped[i].second) {
-        if (G[index].size() < maxDeg) {
-          G[index].append_neighbor(c);
-        } else {
-          remove_edge_duplicates(index, G);
-          G[index].append_neighbor(c);
-        }
-      }
-    });
-  }
-
-  // parameters dim and K are just to interface with the cluster tree code
-  static void MSTk(GraphI &G, PR &Points,
-                   parlay::sequence<size_t> &active_indices, long MSTDeg) {
-    // preprocessing for Kruskal's
+  // The candidate edges of a leaf: the m nearest other points of each
+  // point, as edges (i, j) with i < j between positions in
+  // active_indices, sorted by distance and then by endpoints.  For
+  // plain Euclidean and inner product points the distances are
+  // computed like a matrix multiply by exact_knn_lists.  Otherwise the
+  // points are compared a pair of tiles at a time, so the points of
+  // both tiles stay in cache, and each distance is computed once and
+  // offered to both of its points.
+  static parlay::sequence<labelled_edge> candidate_edges(
+      PR &Points, parlay::sequence<size_t> &active_indices, size_t m) {
+    using entry = std::pair<distanceType, indexType>;
     size_t N = active_indices.size();
-    long dim = Points.dimension();
-    DisjointSet disjset(N);
-    size_t m = 10;
-    auto less = [&](labelled_edge a, labelled_edge b) {
-      return a.second < b.second;
-    };
-    parlay::sequence<labelled_edge> candidate_edges(N * m, kNullEdge);
-    parlay::parallel_for(0, N, [&](size_t i) {
-      std::priority_queue<labelled_edge, std::vector<labelled_edge>,
-                          decltype(less)>
-          Q(less);
-      for (indexType j = i + 1; j < N; j++) {
-        distanceType dist_ij =
-            Points[active_indices[i]].distance(Points[active_indices[j]]);
-        if (Q.size() >= m) {
-          distanceType topdist = Q.top().second;
-          if (dist_ij < topdist) {
-            labelled_edge e;
-            e = std::make_pair(std::make_pair(i, j), dist_ij);
-            Q.pop();
-            Q.push(e);
+    m = std::min(m, N == 0 ? 0 : N - 1);
+    parlay::sequence<entry> lists;
+    if constexpr (plain_distance<Point>::value) {
+      lists = exact_knn_lists<indexType>(Points, active_indices, m);
+    } else {
+      size_t tile = 32;
+      lists = parlay::sequence<entry>(N * m);
+      parlay::sequence<size_t> sizes(N, 0);
+      auto push = [&](size_t i, entry e) {
+        entry *heap = lists.begin() + i * m;
+        if (sizes[i] < m) {
+          heap[sizes[i]++] = e;
+          std::push_heap(heap, heap + sizes[i]);
+        } else if (e < heap[0]) {
+          std::pop_heap(heap, heap + m);
+          heap[m - 1] = e;
+          std::push_heap(heap, heap + m);
+        }
+      };
+      for (size_t a = 0; a < N; a += tile) {
+        for (size_t b = a; b < N; b += tile) {
+          for (size_t i = a; i < std::min(N, a + tile); i++) {
+            auto p = Points[active_indices[i]];
+            for (size_t j = std::max(b, i + 1); j < std::min(N, b + tile); j++) {
+              distanceType dist = p.distance(Points[active_indices[j]]);
+              push(i, entry(dist, j));
+              push(j, entry(dist, i));
+            }
           }
-        } else {
-          labelled_edge e;
-          e = std::make_pair(std::make_pair(i, j), dist_ij);
-          Q.push(e);
         }
       }
-      indexType limit = std::min(Q.size(), m);
-      for (indexType j = 0; j < limit; j++) {
-        candidate_edges[i * m + j] = Q.top();
-        Q.pop();
-      }
+    }
+    auto edges = parlay::tabulate(N * m, [&](size_t l) {
+      indexType i = l / m;
+      auto [dist, j] = lists[l];
+      return labelled_edge(edge(std::min(i, j), std::max(i, j)), dist);
     });
+    auto less = [&](labelled_edge a, labelled_edge b) {
+      return a.second < b.second || (a.second == b.second && a.first < b.first);
+    };
+    return parlay::unique(parlay::sort(edges, less));
+  }
 
-    parlay::sort_inplace(candidate_edges, less);
-
-    auto degrees =
-        parlay::tabulate(active_indices.size(), [&](size_t i) { return 0; });
-    parlay::sequence<edge> MST_edges = parlay::sequence<edge>();
-    // modified Kruskal's algorithm
-    for (indexType i = 0; i < candidate_edges.size(); i++) {
-      // Since we sorted, any null edges form the suffix.
-      if (candidate_edges[i].second == kNullDist) break;
-      labelled_edge e_l = candidate_edges[i];
-      edge e = e_l.first;
-      if ((disjset.find(e.first) != disjset.find(e.second)) &&
-          (degrees[e.first] < MSTDeg) && (degrees[e.second] < MSTDeg)) {
-        MST_edges.push_back(
-            std::make_pair(active_indices[e.first], active_indices[e.second]));
-        MST_edges.push_back(
-            std::make_pair(active_indices[e.second], active_indices[e.first]));
-        degrees[e.first] += 1;
-        degrees[e.second] += 1;
-        disjset._union(e.first, e.second);
-      }
-      if (i % N == 0) {
-        if (disjset.is_full()) {
-          break;
+  // Minimum spanning forest of the candidate edges in which no vertex
+  // has degree more than MSTDeg, built Boruvka style.  In each round
+  // the edges inside a component or at a full vertex are dropped, every
+  // component picks its lightest remaining edge (in parallel), and the
+  // picked edges are added lightest first if they still join two
+  // components and neither endpoint is full.  The lightest remaining
+  // edge is always added, so the rounds make progress, and the number
+  // of components typically halves each round.
+  static parlay::sequence<edge> bounded_degree_mst(
+      parlay::sequence<labelled_edge> edges, size_t N, long MSTDeg) {
+    DisjointSet disjset(N);
+    parlay::sequence<long> degrees(N, 0);
+    parlay::sequence<edge> MST_edges;
+    std::unique_ptr<std::atomic<size_t>[]> best(new std::atomic<size_t>[N]);
+    size_t none = std::numeric_limits<size_t>::max();
+    while (true) {
+      disjset.flatten();
+      auto &comp = disjset.parent;
+      edges = parlay::filter(edges, [&](labelled_edge e) {
+        auto [u, v] = e.first;
+        return comp[u] != comp[v] && degrees[u] < MSTDeg && degrees[v] < MSTDeg;
+      });
+      if (edges.size() == 0) break;
+      parlay::parallel_for(0, N, [&](size_t i) { best[i] = none; });
+      parlay::parallel_for(0, edges.size(), [&](size_t i) {
+        auto [u, v] = edges[i].first;
+        parlay::write_min(&best[comp[u]], i, std::less<size_t>());
+        parlay::write_min(&best[comp[v]], i, std::less<size_t>());
+      });
+      auto picked = parlay::remove_duplicates_ordered(
+          parlay::filter(parlay::tabulate(N, [&](size_t i) { return best[i].load(); }),
+                         [&](size_t i) { return i != none; }));
+      for (size_t i : picked) {
+        auto [u, v] = edges[i].first;
+        if (disjset.find(u) != disjset.find(v) && degrees[u] < MSTDeg &&
+            degrees[v] < MSTDeg) {
+          MST_edges.push_back(edges[i].first);
+          degrees[u] += 1;
+          degrees[v] += 1;
+          disjset._union(disjset.find(u), disjset.find(v));
         }
       }
     }
-    process_edges(G, std::move(MST_edges));
+    return MST_edges;
   }
 
-  // robustPrune routine as found in DiskANN paper, with the exception that the
-  // new candidate set is added to the field new_nbhs instead of directly
-  // replacing the out_nbh of p
-  void robustPrune(indexType p, PR &Points, GraphI &G, double alpha) {
-    // add out neighbors of p to the candidate set.
-    parlay::sequence<pid> candidates;
-    for (size_t i = 0; i < G[p].size(); i++) {
-      candidates.push_back(
-          std::make_pair(G[p][i], Points[p].distance(Points[G[p][i]])));
-    }
-
-    // Sort the candidate set in reverse order according to distance from p.
-    auto less = [&](pid a, pid b) { return a.second < b.second; };
-    parlay::sort_inplace(candidates, less);
-
-    parlay::sequence<int> new_nbhs = parlay::sequence<int>();
-
-    size_t candidate_idx = 0;
-    while (new_nbhs.size() < G.max_degree() &&
-           candidate_idx < candidates.size()) {
-      // Don't need to do modifications.
-      indexType p_star = candidates[candidate_idx].first;
-      candidate_idx++;
-      if (p_star == p || p_star == kNullId) continue;
-
-      new_nbhs.push_back(p_star);
-
-      for (size_t i = candidate_idx; i < candidates.size(); i++) {
-        indexType p_prime = candidates[i].first;
-        if (p_prime != kNullId) {
-          distanceType dist_starprime =
-              Points[p_star].distance(Points[p_prime]);
-          distanceType dist_pprime = candidates[i].second;
-          if (alpha * dist_starprime <= dist_pprime)
-            candidates[i].first = kNullId;
-        }
-      }
+  // Adds the bounded degree MST of a leaf of cluster tree number tree
+  // to G.  Row v of G has MSTDeg slots for each tree (see build_index),
+  // and the leaves of a tree are disjoint, so the trees can be built
+  // concurrently.
+  static void MSTk(GraphI &G, PR &Points,
+                   parlay::sequence<size_t> &active_indices, long MSTDeg,
+                   long tree) {
+    size_t N = active_indices.size();
+    size_t m = 10;
+    auto MST_edges = bounded_degree_mst(candidate_edges(Points, active_indices, m),
+                                        N, MSTDeg);
+    parlay::sequence<long> degrees(N, 0);
+    auto add = [&](indexType u, indexType v) {
+      G[active_indices[u]].begin()[tree * MSTDeg + degrees[u]++] = active_indices[v];
+    };
+    for (auto [u, v] : MST_edges) {
+      add(u, v);
+      add(v, u);
     }
-    G[p].update_neighbors(new_nbhs);
   }
 
   void build_index(GraphI &G, PR &Points, long cluster_rounds,
                    long cluster_size, long MSTDeg) {
+    // each tree fills its own MSTDeg slots of every row, so a graph
+    // with fewer slots can only hold fewer trees
+    if (MSTDeg <= 0 || G.max_degree() < MSTDeg) {
+      std::cout << "ERROR: HCNNG needs mst_deg between 1 and the graph's max degree "
+                << G.max_degree() << ", got " << MSTDeg << std::endl;
+      abort();
+    }
+    if (G.max_degree() < cluster_rounds * MSTDeg) {
+      std::cout << "Warning: a graph of max degree " << G.max_degree() << " holds "
+                << G.max_degree() / MSTDeg << " trees of mst_deg " << MSTDeg
+                << ", building that many instead of num_clusters = "
+                << cluster_rounds << std::endl;
+      cluster_rounds = G.max_degree() / MSTDeg;
+    }
+    // every slot starts empty, and the trees fill in their own slots
+    parlay::sequence<indexType> empty(G.max_degree(), kNullId);
+    parlay::parallel_for(0, G.size(), [&](size_t i) { G[i].update_neighbors(empty); });
     cluster<Point, PointRange, indexType> C;
     C.multiple_clustertrees(G, Points, cluster_size, cluster_rounds, MSTk,
                             MSTDeg);
-    remove_all_duplicates(G);
-    // TODO: enable optional pruning (what is below now works, but
-    // should be connected cleanly)
-    // parlay::parallel_for(0, G.size(), [&] (size_t i){robustPrune(i, Points,
-    // G, 1.1);});
+    // keep the filled slots, without duplicates
+    parlay::parallel_for(0, G.size(), [&](size_t i) {
+      auto ngh = parlay::filter(parlay::make_slice(G[i].begin(), G[i].end()),
+                                [&](indexType j) { return j != kNullId; });
+      G[i].update_neighbors(parlay::remove_duplicates_ordered(ngh));
+    });
+    // the degree is bounded only by cluster_rounds * MSTDeg; see
+    // prune_graph in prune.h to prune it further
   }
 };
 
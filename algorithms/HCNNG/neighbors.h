@@ -32,6 +32,7 @@
 #include "../utils/parse_results.h"
 #include "../utils/check_nn_recall.h"
 #include "../utils/graph.h"
+#include "../utils/prune.h"
 #include "hcnng_index.h"
 
 namespace parlayANN {
@@ -53,11 +54,19 @@ void ANN(Graph<indexType> &G, long k, BuildParams &BP,
   } else{idx_time=0;}
   std::string name = "HCNNG";
   std::string params = "Trees = " + std::to_string(BP.num_clusters);
+  if (BP.prune_degree > 0) {
+    prune_and_report(G, Points, BP.prune_degree, BP.prune_alpha);
+    idx_time += t.next_time();
+    params += ", pruned to R = " + std::to_string(BP.prune_degree);
+  }
   auto [avg_deg, max_deg] = graph_stats_(G);
   Graph_ G_(name, params, G.size(), avg_deg, max_deg, idx_time);
   G_.print();
-  if(Query_Points.size() != 0)
-    search_and_parse(G_, G, Points, Query_Points, GT, res_file, k, BP.verbose);
+  if(Query_Points.size() != 0) {
+    search_settings<indexType> S(BP);
+    S.entry_points = build_entry_points<indexType>(Points, BP.entry_points);
+    search_and_parse(G_, G, Points, Query_Points, GT, res_file, k, S);
+  }
 }
 
 } // end namespace
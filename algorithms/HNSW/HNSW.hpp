@@ -21,7 +21,9 @@
 #include <iterator>
 #include <type_traits>
 #include <limits>
+#include <optional>
 #include <thread>
+#include <cstring>
 // #include "parallelize.h"
 #include <parlay/parallel.h>
 #include <parlay/primitives.h>
@@ -29,6 +31,7 @@
 #include <parlay/random.h>
 #include "debug.hpp"
 #include "../utils/beamSearch.h"
+#include "../utils/mmap.h"
 #define DEBUG_OUTPUT 0
 #if DEBUG_OUTPUT
 #define debug_output(...) fprintf(stderr, __VA_ARGS__)
@@ -78,8 +81,10 @@ public:
 		const T &q, uint32_t k, uint32_t ef, const search_control &ctrl={}
 	);
 	// parlay::sequence<std::tuple<uint32_t,uint32_t,float>> search_ex(const T &q, uint32_t k, uint32_t ef, uint64_t verbose=0);
-	// save the current model to a file
-	void save(const std::string &filename_model) const;
+	// save the current model to a file, in the flat layout (version 4)
+	// unless version 3 is asked for
+	void save(const std::string &filename_model, uint32_t version=4) const;
+	void save_flat(std::ofstream &model) const;
 public:
 	typedef uint32_t type_index;
 
@@ -138,6 +143,59 @@ public:
 	uint32_t n;
 	Allocator<node> allocator;
 	parlay::sequence<node> node_pool;
+
+	using edge_slice = parlay::slice<const node_id*, const node_id*>;
+
+	/*
+		Read-only adjacency of a model loaded from a version 4 file, pointing
+		into the mapped file. Level 0 is one CSR block over all nodes. The
+		upper levels are a second CSR block over (node, level) slots, where
+		the slot of u at level l>0 is upper_slot[u]+l-1.
+		The `neighbors` of the nodes are not allocated while it is in use.
+	*/
+	struct flat_layout{
+		std::shared_ptr<char> file;
+		const uint64_t *offsets0;
+		const node_id *edges0;
+		const uint64_t *upper_slot;
+		const uint64_t *upper_offsets;
+		const node_id *upper_edges;
+
+		edge_slice edges(node_id pu, uint32_t l) const{
+			if(l==0)
+				return parlay::make_slice(edges0+offsets0[pu], edges0+offsets0[pu+1]);
+			const uint64_t s = upper_slot[pu]+l-1;
+			return parlay::make_slice(upper_edges+upper_offsets[s], upper_edges+upper_offsets[s+1]);
+		}
+	};
+	std::optional<flat_layout> flat;
+
+	// neighbors of pu at level l, from whichever layout is in use
+	edge_slice edges(node_id pu, uint32_t l) const
+	{
+		if(flat)
+			return flat->edges(pu, l);
+		const auto &nbh = neighbourhood(get_node(pu), l);
+		return parlay::make_slice(nbh.data(), nbh.data()+nbh.size());
+	}
+
+	// copy the flat layout into per-node neighbor lists so that the graph
+	// can be updated
+	void unflatten()
+	{
+		if(!flat) return;
+		parlay::parallel_for(0, n, [&](size_t i){
+			node &u = get_node(i);
+			u.neighbors = new parlay::sequence<node_id>[u.level+1];
+			for(uint32_t l=0; l<=u.level; ++l)
+			{
+				auto nbh = flat->edges(i, l);
+				u.neighbors[l] = parlay::sequence<node_id>(nbh.begin(), nbh.end());
+			}
+		});
+		flat.reset();
+	}
+
 	mutable parlay::sequence<size_t> total_visited = parlay::sequence<size_t>(parlay::num_workers());
 	mutable parlay::sequence<size_t> total_eval = parlay::sequence<size_t>(parlay::num_workers());
 	mutable parlay::sequence<size_t> total_size_C = parlay::sequence<size_t>(parlay::num_workers());
@@ -198,23 +256,22 @@ public:
 	};
 
 	struct graph{
-		template<class Nbh>
 		struct edgeRange{
-			edgeRange(Nbh &nbh) : nbh(nbh){
+			edgeRange(edge_slice nbh) : nbh(nbh){
 			}
-			decltype(auto) operator[](node_id pu) const{
-				return nbh.get()[pu];
+			node_id operator[](size_t i) const{
+				return nbh[i];
 			}
 			auto size() const{
-				return nbh.get().size();
+				return nbh.size();
 			}
 			void prefetch() const{
 				int l = (size() * sizeof(node_id))/64;
 				for (int i=0; i < l; i++)
-					__builtin_prefetch((char*) nbh.get().data() + i*64);
+					__builtin_prefetch((const char*) nbh.begin() + i*64);
 			}
 
-			std::reference_wrapper<Nbh> nbh;
+			edge_slice nbh;
 		};
 
 		using nid_t = node_id;
@@ -229,20 +286,14 @@ public:
 		decltype(auto) get_node(node_id pu) const{
 			return hnsw.get().get_node(pu);
 		}
-		decltype(auto) get_edges(node_id pu){
-			return hnsw.get().neighbourhood(hnsw.get().get_node(pu),l);
-		}
-		decltype(auto) get_edges(node_id pu) const{
-			return hnsw.get().neighbourhood(hnsw.get().get_node(pu),l);
+		edge_slice get_edges(node_id pu) const{
+			return hnsw.get().edges(pu,l);
 		}
 
 		uint32_t max_degree() const{
 			return hnsw.get().get_threshold_m(l);
 		}
 
-		auto operator[](node_id pu){
-			return edgeRange(get_edges(pu));
-		}
 		auto operator[](node_id pu) const{
 			return edgeRange(get_edges(pu));
 		}
@@ -255,6 +306,9 @@ public:
 	template<typename Iter>
 	void insert(Iter begin, Iter end, bool from_blank);
 
+	template<typename G>
+	void load_flat(const std::string &filename_model, G getter);
+
 	template<typename Queue>
 	void select_neighbors_simple_impl(const T &u, Queue &C, uint32_t M)
 	{
@@ -535,10 +589,10 @@ public:
 	{
 		parlay::sequence<uint32_t> res;
 		res.reserve(node_pool.size());
-		for(const node &e : node_pool)
+		for(node_id pu=0; pu<n; ++pu)
 		{
-			if(e.level>=level)
-				res.push_back(e.neighbors[level].size());
+			if(get_node(pu).level>=level)
+				res.push_back(edges(pu,level).size());
 		}
 		return res;
 	}
@@ -552,10 +606,10 @@ public:
 			res = new uint32_t[n];
 			for(uint32_t i=0; i<n; ++i)
 				res[i] = 0;
-			for(const node_id pu : node_pool)
+			for(node_id pu=0; pu<n; ++pu)
 			{
 				if(get_node(pu).level<level) continue;
-				for(const node_id pv : get_node(pu).neighbors[level])
+				for(const node_id pv : edges(pu,level))
 					res[U::get_id(get_node(pv).data)]++;
 			}
 		}
@@ -572,7 +626,7 @@ public:
 		auto cnt_each = parlay::delayed_seq<size_t>(n, [&](size_t i){
 			node_id pu = i;
 			return get_node(pu).level<l? 0:
-				neighbourhood(get_node(pu),l).size();
+				edges(pu,l).size();
 		});
 		return parlay::reduce(cnt_each, parlay::addm<size_t>());
 	}
@@ -591,7 +645,7 @@ public:
 		auto cnt_each = parlay::delayed_seq<size_t>(n, [&](size_t i){
 			node_id pu = i;
 			return get_node(pu).level<l? 0:
-				neighbourhood(get_node(pu),l).size();
+				edges(pu,l).size();
 		});
 		return parlay::reduce(cnt_each, parlay::maxm<size_t>());
 	}
@@ -632,6 +686,20 @@ template<typename U, template<typename> class Allocator>
 template<typename G>
 HNSW<U,Allocator>::HNSW(const std::string &filename_model, G getter)
 {
+	// version 4 models are mapped rather than read
+	{
+		std::ifstream header(filename_model, std::ios::binary);
+		char model_type[4];
+		uint32_t version = 0;
+		header.read(model_type, 4);
+		header.read((char*)&version, sizeof(version));
+		if(header && !strncmp(model_type,"HNSW",4) && version==4)
+		{
+			load_flat(filename_model, getter);
+			return;
+		}
+	}
+
 	std::ifstream model(filename_model, std::ios::binary);
 	if(!model.is_open())
 		throw std::runtime_error("Failed to open the model");
@@ -743,6 +811,70 @@ HNSW<U,Allocator>::HNSW(const std::string &filename_model, G getter)
 	}
 }
 
+template<typename U, template<typename> class Allocator>
+template<typename G>
+void HNSW<U,Allocator>::load_flat(const std::string &filename_model, G getter)
+{
+	auto mapped = mmapStringFromFile(filename_model.c_str());
+	char *begin = mapped.first;
+	size_t length = mapped.second;
+	std::shared_ptr<char> file(begin, [length](char *p){munmap(p, length);});
+
+	size_t pos = 8; // past the model type and version
+	auto take = [&](size_t bytes) -> const char*{
+		if(pos+bytes>length)
+			throw std::runtime_error("Truncated model");
+		const char *p = begin+pos;
+		pos += bytes;
+		return p;
+	};
+	auto read = [&](auto &data){
+		std::memcpy(&data, take(sizeof(data)), sizeof(data));
+	};
+	// arrays start at multiples of 8 bytes
+	auto read_array = [&](auto *&data, size_t size){
+		using T = std::remove_const_t<std::remove_reference_t<decltype(*data)>>;
+		pos = (pos+7)/8*8;
+		data = (const T*)take(size*sizeof(T));
+	};
+
+	size_t code_U, size_node;
+	read(code_U);
+	read(size_node);
+	read(dim);
+	read(m_l);
+	read(m);
+	read(ef_construction);
+	read(alpha);
+	read(n);
+	printf("Flat model: n = %u, dim = %u, m = %u, efc = %u\n", n, dim, m, ef_construction);
+
+	const uint32_t *levels, *ids;
+	read_array(levels, n);
+	read_array(ids, n);
+	flat_layout f;
+	f.file = file;
+	read_array(f.offsets0, n+1);
+	read_array(f.edges0, f.offsets0[n]);
+	read_array(f.upper_slot, n+1);
+	read_array(f.upper_offsets, f.upper_slot[n]+1);
+	read_array(f.upper_edges, f.upper_offsets[f.upper_slot[n]]);
+	const uint64_t *size_entrance;
+	const node_id *eps;
+	read_array(size_entrance, 1);
+	read_array(eps, *size_entrance);
+	entrance = parlay::sequence<node_id>(eps, eps+*size_entrance);
+
+	node_pool = parlay::sequence<node>(n);
+	parlay::parallel_for(0, n, [&](size_t i){
+		node &u = get_node(i);
+		u.level = levels[i];
+		u.neighbors = nullptr;
+		u.data = getter(ids[i]);
+	});
+	flat = std::move(f);
+}
+
 template<typename U, template<typename> class Allocator>
 template<typename Iter>
 HNSW<U,Allocator>::HNSW(Iter begin, Iter end, uint32_t dim_, float m_l_, uint32_t m_, uint32_t ef_construction_, float alpha_, float batch_base)
@@ -827,6 +959,7 @@ template<typename U, template<typename> class Allocator>
 template<typename Iter>
 void HNSW<U,Allocator>::insert(Iter begin, Iter end, bool from_blank)
 {
+	unflatten();
 	const auto level_ep = get_node(entrance[0]).level;
 	const auto size_batch = std::distance(begin,end);
 	auto node_new = std::make_unique<node_id[]>(size_batch);
@@ -1183,11 +1316,11 @@ auto HNSW<U,Allocator>::search_layer_bak(const node &u, const parlay::sequence<n
 			dist_in_search[*ctrl.log_dist].push_back(t);
 		}
 
-		const auto &c = get_node(C.begin()->u);
+		const node_id c = C.begin()->u;
 		// std::pop_heap(C.begin(), C.end(), nearest());
 		// C.pop_back();
 		C.erase(C.begin());
-		for(node_id pv: neighbourhood(c, l_c))
+		for(node_id pv: edges(c, l_c))
 		{
 		#ifdef USE_HASHTBL
 			const auto id = U::get_id(get_node(pv).data);
@@ -1474,7 +1607,7 @@ auto HNSW<U,Allocator>::beam_search_ex(const node &u, const parlay::sequence<nod
 			}
 			return true;
 		};
-		for(node_id pv : neighbourhood(get_node(current_vtx),l_c))
+		for(node_id pv : edges(current_vtx,l_c))
 			// current_vtx.out_neighbors().foreach_cond(f);
 			f(current_vtx, pv);
 
@@ -1613,8 +1746,11 @@ parlay::sequence<std::pair<uint32_t,float>> HNSW<U,Allocator>::search(
 }
 
 template<typename U, template<typename> class Allocator>
-void HNSW<U,Allocator>::save(const std::string &filename_model) const
+void HNSW<U,Allocator>::save(const std::string &filename_model, uint32_t version) const
 {
+	if(version!=3 && version!=4)
+		throw std::runtime_error("Unsupported version");
+
 	std::ofstream model(filename_model, std::ios::binary);
 	if(!model.is_open())
 		throw std::runtime_error("Failed to create the model");
@@ -1653,7 +1789,7 @@ void HNSW<U,Allocator>::save(const std::string &filename_model) const
 	};
 	// write header (version number, type info, etc)
 	write("HNSW", 4);
-	write(uint32_t(3)); // version
+	write(version);
 	write(typeid(U).hash_code()^sizeof(U));
 	fprintf(stderr, "U type written %s\n", typeid(U).name());
 	write(sizeof(node));
@@ -1664,18 +1800,24 @@ void HNSW<U,Allocator>::save(const std::string &filename_model) const
 	write(ef_construction);
 	write(alpha);
 	write(n);
+	if(version==4)
+	{
+		save_flat(model);
+		return;
+	}
 	// write indices
 	for(const auto &u : node_pool)
 	{
 		write(u.level);
 		write(uint32_t(U::get_id(u.data)));
 	}
-	for(const auto &u : node_pool)
+	for(node_id pu=0; pu<n; ++pu)
 	{
-		for(uint32_t l=0; l<=u.level; ++l)
+		for(uint32_t l=0; l<=get_node(pu).level; ++l)
 		{
-			write(u.neighbors[l].size());
-			for(node_id pv : u.neighbors[l])
+			auto nbh = edges(pu,l);
+			write(nbh.size());
+			for(node_id pv : nbh)
 				write(pv);
 		}
 	}
@@ -1683,7 +1825,63 @@ void HNSW<U,Allocator>::save(const std::string &filename_model) const
 	write(entrance.size());
 	for(node_id pu : entrance)
 		write(pu);
-} 
+}
+
+template<typename U, template<typename> class Allocator>
+void HNSW<U,Allocator>::save_flat(std::ofstream &model) const
+{
+	// arrays start at multiples of 8 bytes, see load_flat
+	auto write_array = [&](const auto &seq){
+		while(model.tellp()%8!=0)
+			model.put(0);
+		model.write((const char*)seq.data(), seq.size()*sizeof(seq[0]));
+	};
+	// offsets of a CSR block with the given degrees, and its edges
+	auto csr = [&](size_t size, auto degree, auto copy){
+		auto [offsets, total] = parlay::scan(parlay::delayed_seq<uint64_t>(size, degree));
+		offsets.push_back(total);
+		parlay::sequence<node_id> edges(total);
+		copy(offsets, edges);
+		write_array(offsets);
+		write_array(edges);
+	};
+
+	write_array(parlay::tabulate(n, [&](size_t i){return get_node(i).level;}));
+	write_array(parlay::tabulate(n, [&](size_t i){return uint32_t(U::get_id(get_node(i).data));}));
+	csr(n, [&](size_t i){return edges(i,0).size();},
+		[&](const auto &offsets, auto &nbh){
+			parlay::parallel_for(0, n, [&](size_t i){
+				auto e = edges(i,0);
+				std::copy(e.begin(), e.end(), nbh.begin()+offsets[i]);
+			});
+		});
+
+	auto scanned = parlay::scan(parlay::delayed_seq<uint64_t>(n, [&](size_t i){
+		return uint64_t(get_node(i).level);
+	}));
+	auto &upper_slot = scanned.first;
+	const uint64_t slots = scanned.second;
+	upper_slot.push_back(slots);
+	write_array(upper_slot);
+	parlay::sequence<uint64_t> degree(slots);
+	parlay::parallel_for(0, n, [&](size_t i){
+		for(uint32_t l=1; l<=get_node(i).level; ++l)
+			degree[upper_slot[i]+l-1] = edges(i,l).size();
+	});
+	csr(slots, [&](size_t s){return degree[s];},
+		[&](const auto &offsets, auto &nbh){
+			parlay::parallel_for(0, n, [&](size_t i){
+				for(uint32_t l=1; l<=get_node(i).level; ++l)
+				{
+					auto e = edges(i,l);
+					std::copy(e.begin(), e.end(), nbh.begin()+offsets[upper_slot[i]+l-1]);
+				}
+			});
+		});
+
+	write_array(parlay::sequence<uint64_t>(1, entrance.size()));
+	write_array(entrance);
+}
 
 } // namespace HNSW
 
@@ -0,0 +1,71 @@
+#include "algorithms/HNSW/HNSW.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/point_range.h"
+#include "algorithms/utils/test_points.h"
+#include "algorithms/utils/types.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using Point = Euclidian_Point<float>;
+using PR = PointRange<Point>;
+using Index = ANN::HNSW<Desc_HNSW<float, Point>>;
+
+// the neighbor lists of every node at every level
+std::vector<std::vector<uint32_t>> Lists(const Index& I) {
+  std::vector<std::vector<uint32_t>> lists;
+  for (uint32_t u = 0; u < I.n; u++)
+    for (uint32_t l = 0; l <= I.get_node(u).level; l++) {
+      auto e = I.edges(u, l);
+      lists.emplace_back(e.begin(), e.end());
+    }
+  return lists;
+}
+
+// A model saved as version 3 (per-node lists) and as version 4 (flat
+// and mapped) loads back with the same graph and the same results.
+TEST(HNSWTest, VersionsRoundTrip) {
+  PR Points = RandomPoints<Point>(2000, 16, 1);
+  PR Queries = RandomPoints<Point>(50, 16, 2);
+  auto ps = parlay::delayed_seq<Point>(Points.size(), [&] (size_t i) {return Points[i];});
+  Index I(ps.begin(), ps.end(), Points.dimension(), 0.36, 16, 64, 1.2);
+
+  std::string v3 = testing::TempDir() + "/hnsw_test_v3";
+  std::string v4 = testing::TempDir() + "/hnsw_test_v4";
+  I.save(v3, 3);
+  I.save(v4, 4);
+  auto getter = [&] (uint32_t i) {return Points[i];};
+  Index I3(v3, getter);
+  Index I4(v4, getter);
+  EXPECT_FALSE(I3.flat.has_value());
+  EXPECT_TRUE(I4.flat.has_value());
+
+  ASSERT_EQ(I3.n, I.n);
+  ASSERT_EQ(I4.n, I.n);
+  EXPECT_EQ(I3.entrance, I.entrance);
+  EXPECT_EQ(I4.entrance, I.entrance);
+  for (uint32_t u = 0; u < I.n; u++) {
+    EXPECT_EQ(I3.get_node(u).level, I.get_node(u).level);
+    EXPECT_EQ(I4.get_node(u).level, I.get_node(u).level);
+  }
+  auto lists = Lists(I);
+  EXPECT_EQ(Lists(I3), lists);
+  EXPECT_EQ(Lists(I4), lists);
+
+  for (size_t q = 0; q < Queries.size(); q++) {
+    auto r = I.search(Queries[q], 10, 40);
+    EXPECT_EQ(I3.search(Queries[q], 10, 40), r);
+    EXPECT_EQ(I4.search(Queries[q], 10, 40), r);
+  }
+  std::remove(v3.c_str());
+  std::remove(v4.c_str());
+}
+
+}  // namespace
+}  // namespace parlayANN
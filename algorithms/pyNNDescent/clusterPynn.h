@@ -34,7 +34,6 @@
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "parlay/random.h"
-#include "../utils/union.h"
 
 namespace parlayANN {
   
@@ -47,52 +46,32 @@ struct clusterPID {
 
   clusterPID() {}
 
-  parlay::sequence<parlay::sequence<pid>> intermediate_edges;
-
+  // offers every pair of points in the leaf, with its distance
+  template<typename F>
   void naive_neighbors(PR &Points,
                        parlay::sequence<size_t>& active_indices,
-                       long maxK) {
+                       F& offer) {
     size_t n = active_indices.size();
     parlay::parallel_for(0, n, [&](size_t i) {
-      auto less = [&](pid a, pid b) { return a.second < b.second; };
-      std::priority_queue<pid, std::vector<pid>, decltype(less)> Q(less);
-      size_t index = active_indices[i];
-      // tabulate all-pairs distances between the elements in the leaf
-      for (indexType  j = 0; j < n; j++) {
-        if (j != i) {
-          distanceType dist = Points[index].distance(Points[active_indices[j]]);
-          pid e = std::make_pair(active_indices[j], dist);
-          if (Q.size() >= maxK) {
-            distanceType topdist = Q.top().second;
-            if (dist < topdist) {
-              Q.pop();
-              Q.push(e);
-            }
-          } else {
-            Q.push(e);
-          }
-        }
+      indexType u = active_indices[i];
+      auto p = Points[u];
+      for (size_t j = i + 1; j < n; j++) {
+        indexType v = active_indices[j];
+        distanceType dist = p.distance(Points[v]);
+        offer(u, v, dist);
+        offer(v, u, dist);
       }
-      size_t q = Q.size();
-      parlay::sequence<pid> sorted_edges(q);
-      for (indexType  j = 0; j < q; j++) {
-        sorted_edges[j] = Q.top();
-        Q.pop();
-      }
-      auto rev_edges = parlay::reverse(sorted_edges);
-      auto [new_best, changed] =
-          seq_union_bounded(intermediate_edges[index], rev_edges, maxK, less);
-      intermediate_edges[index] = new_best;
     });
   }
 
 
+  template<typename F>
   void random_clustering(PR &Points,
                          parlay::sequence<size_t>& active_indices,
                          parlay::random& rnd, long cluster_size,
-                         long K) {
+                         F& offer) {
     if (active_indices.size() <= cluster_size)
-      naive_neighbors(Points, active_indices, K);
+      naive_neighbors(Points, active_indices, offer);
     else {
       auto [f, s] = select_two_random(active_indices, rnd);
 
@@ -113,11 +92,11 @@ struct clusterPID {
         parlay::par_do(
             [&]() {
               random_clustering(Points, closer_first, left_rnd, cluster_size,
-                                K);
+                                offer);
             },
             [&]() {
               random_clustering(Points, closer_second, right_rnd, cluster_size,
-                                K);
+                                offer);
             });
       } else {
         // Split points based on which of the two points are closer.
@@ -139,39 +118,39 @@ struct clusterPID {
         parlay::par_do(
             [&]() {
               random_clustering(Points, closer_first, left_rnd, cluster_size, 
-                                K);
+                                offer);
             },
             [&]() {
               random_clustering(Points, closer_second, right_rnd, cluster_size,
-                                  K);
+                                  offer);
         });
 
       }
     }
   }
 
+  template<typename F>
   void random_clustering_wrapper(PR &Points,
-                                 long cluster_size, long K) {
+                                 long cluster_size, F& offer) {
     std::random_device rd;
     std::mt19937 rng(rd());
     std::uniform_int_distribution<indexType> uni(0, Points.size());
     parlay::random rnd(uni(rng));
     auto active_indices =
         parlay::tabulate(Points.size(), [&](size_t i) { return i; });
-    random_clustering(Points, active_indices, rnd, cluster_size, K);
+    random_clustering(Points, active_indices, rnd, cluster_size, offer);
   }
 
+  // offer(u, v, d) is called with the distance d of each pair of points in
+  // a leaf of one of the trees (concurrently, and from concurrent trees)
+  template<typename F>
   void multiple_clustertrees(PR &Points,
                              long cluster_size, long num_clusters,
-                             long K,
-                             parlay::sequence<parlay::sequence<pid>>& old_nbh) {
-    intermediate_edges = parlay::sequence<parlay::sequence<pid>>(Points.size());
-    for (long i = 0; i < num_clusters; i++) {
-      random_clustering_wrapper(Points, cluster_size, K);
-      std::cout << "Cluster " << i << std::endl; 
-    }
-    parlay::parallel_for(0, Points.size(),
-                         [&](size_t i) { old_nbh[i] = intermediate_edges[i]; });
+                             F offer) {
+    parlay::parallel_for(0, num_clusters, [&](long i) {
+      random_clustering_wrapper(Points, cluster_size, offer);
+    }, 1);
+    std::cout << "Built " << num_clusters << " cluster trees" << std::endl;
   }
 };
 
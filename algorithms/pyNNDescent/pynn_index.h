@@ -21,231 +21,219 @@
 // WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "parlay/random.h"
 #include "parlay/internal/get_time.h"
-#include <random>
-#include <set>
-#include <queue>
 #include <math.h>
+#include "../utils/prune.h"
 #include "clusterPynn.h"
 
 namespace parlayANN {
 
+// NN-Descent, initialized with the exact neighbors within the leaves of
+// random cluster trees.
+//
+// Each vertex keeps the K nearest neighbors found so far as a max-heap
+// by distance in a flat array of n * K slots, with empty slots holding
+// kNullId at the largest distance, so every heap is full and its root
+// is the distance to beat.  Each round samples, for each vertex, up to
+// S of its new neighbors (not yet joined) and S of its old ones, each
+// together with reverse neighbors, into flat buffers of n * S slots.  A
+// sample keeps the S candidates of smallest random priority, so it is a
+// uniform sample however many candidates a vertex has.  The local join
+// of each vertex then compares new with new and new with old
+// candidates, and offers each distance to the heaps of both points.
+//
+// Heaps and buffers are updated in place under a spin lock per vertex,
+// so the memory used is fixed: about K * (distance + id + flag) +
+// 2 * S * (priority + id) bytes per vertex, instead of per-vertex
+// sequences and global group-bys of edges.
 template<typename Point, typename PointRange, typename indexType>
 struct pyNN_index{
     using distanceType = typename Point::distanceType;
-	using GraphI = Graph<indexType>;
-	using PR = PointRange;
-    using edge = std::pair<indexType, indexType>;
-    using pid = std::pair<indexType,distanceType>;
-    using labelled_edge = std::pair<indexType, pid>;
+    using GraphI = Graph<indexType>;
+    using PR = PointRange;
+
+    struct neighbor {
+        distanceType dist;
+        indexType id;
+        bool is_new; // not yet in a local join
+    };
+    using candidate = std::pair<uint32_t, indexType>; // priority, id
+
+    static constexpr indexType kNullId = std::numeric_limits<indexType>::max();
+    static constexpr distanceType kNullDist = std::numeric_limits<distanceType>::max();
 
     long K;
-	double delta;
+    long S; // candidates sampled per vertex per round
+    double delta;
 
-    static constexpr auto less = [] (edge a, edge b) {return a.second < b.second;};
+    pyNN_index(long md, double Delta) : K(md), S(std::min<long>(md, 60)), delta(Delta) {}
 
-    pyNN_index(long md, double Delta) : K(md), delta(Delta) {}
+    size_t n = 0;
+    parlay::sequence<neighbor> heaps;
+    // the root distance of each heap, to reject most offers without locking
+    std::unique_ptr<std::atomic<distanceType>[]> worst;
+    std::unique_ptr<std::atomic<bool>[]> locks;
+    parlay::sequence<uint8_t> changed;
 
-    parlay::sequence<parlay::sequence<pid>> old_neighbors;
+    void lock(size_t v) {
+        while (locks[v].exchange(true, std::memory_order_acquire));
+    }
+    void unlock(size_t v) {locks[v].store(false, std::memory_order_release);}
+
+    static bool closer(const neighbor& a, const neighbor& b) {return a.dist < b.dist;}
+
+    // offers u, at distance d, as a new neighbor of v
+    bool push(indexType v, indexType u, distanceType d) {
+        if (u == v || d >= worst[v].load(std::memory_order_relaxed)) return false;
+        neighbor* heap = heaps.begin() + v * K;
+        bool added = false;
+        lock(v);
+        if (d < heap[0].dist &&
+            std::find_if(heap, heap + K, [&] (const neighbor& x) {return x.id == u;}) == heap + K) {
+            std::pop_heap(heap, heap + K, closer);
+            heap[K - 1] = neighbor{d, u, true};
+            std::push_heap(heap, heap + K, closer);
+            worst[v].store(heap[0].dist, std::memory_order_relaxed);
+            changed[v] = 1;
+            added = true;
+        }
+        unlock(v);
+        return added;
+    }
 
-    void push_into_queue(std::priority_queue<edge, std::vector<edge>, decltype(less)> &Q, edge p){
-        if(Q.size() < 2*K){
-            Q.push(p);
-        } else{
-            indexType highest_p = Q.top().second;
-            if(p.second < highest_p){
-                Q.pop();
-                Q.push(p);
-            }
+    // adds u to the sample buffer of v, of size s (a max-heap by priority)
+    void sample(parlay::sequence<candidate>& buffer, long s, indexType v, indexType u,
+                uint32_t priority) {
+        candidate* heap = buffer.begin() + v * s;
+        lock(v);
+        if (priority < heap[0].first &&
+            std::find_if(heap, heap + s, [&] (const candidate& x) {return x.second == u;}) == heap + s) {
+            std::pop_heap(heap, heap + s);
+            heap[s - 1] = candidate(priority, u);
+            std::push_heap(heap, heap + s);
         }
+        unlock(v);
     }
 
-    parlay::sequence<int> nn_descent(PR &Points, parlay::sequence<int> &changed){
-        auto new_changed = parlay::sequence<int>(Points.size(), 0);
-        auto rev = reverse_graph();
-        parlay::random_generator gen;
-        size_t n=Points.size();
-        std::uniform_int_distribution<indexType> dis(0, n-1);
-        int batch_size = 100000;
-        std::pair<indexType, parlay::sequence<indexType>> *begin;
-		std::pair<indexType, parlay::sequence<indexType>> *end = rev.begin();
-		int counter = 0;
-		while(end != rev.end()){
-			counter++;
-			begin = end;
-			int remaining = rev.end() - end;
-			end += std::min(remaining, batch_size);
-			nn_descent_chunk(Points, changed, new_changed, begin, end);
-		}
-        return new_changed;
+    // the ids in the sample buffer of v
+    static parlay::sequence<indexType> sampled(const parlay::sequence<candidate>& buffer, long s,
+                                               indexType v) {
+        parlay::sequence<indexType> ids;
+        for (long i = 0; i < s; i++)
+            if (buffer[v * s + i].second != kNullId) ids.push_back(buffer[v * s + i].second);
+        return ids;
     }
 
-    void nn_descent_chunk(PR &Points, parlay::sequence<int> &changed, 
-		parlay::sequence<int> &new_changed, std::pair<indexType, parlay::sequence<indexType>> *begin, 
-		std::pair<indexType, parlay::sequence<indexType>> *end){
-        size_t stride = end - begin;
-	auto less = [&] (pid a, pid b) {return a.second < b.second;};
-	auto grouped_labelled = parlay::tabulate(stride, [&] (size_t i){
-            indexType index = (begin+i)->first;
-            std::set<indexType> to_filter;
-            to_filter.insert(index);
-            for(indexType j=0; j<old_neighbors[index].size(); j++){
-                to_filter.insert(old_neighbors[index][j].first);
-            }
-            auto f = [&] (indexType a) {return (to_filter.find(a) == to_filter.end());};
-            auto filtered_candidates = parlay::filter((begin+i)->second, f);
-	    parlay::sequence<labelled_edge> edges;
-	    edges.reserve(K*2);
-	    for(indexType l=0; l<filtered_candidates.size(); l++){
-                indexType j=filtered_candidates[l];
-		distanceType j_max = old_neighbors[j][old_neighbors[j].size()-1].second;
-		for(indexType m=l+1; m<filtered_candidates.size(); m++){
-                    indexType k=filtered_candidates[m];
-		    if (changed[j] || changed[k]) {
-              distanceType dist = Points[j].distance(Points[k]);
-		      distanceType k_max = old_neighbors[k][old_neighbors[k].size()-1].second;
-		      if(dist < j_max) edges.push_back(std::make_pair(j, std::make_pair(k, dist)));
-		      if(dist < k_max) edges.push_back(std::make_pair(k, std::make_pair(j, dist)));
-		    }
-		}
-	    }
-            for(indexType l=0; l<old_neighbors[index].size(); l++){
-                indexType j = old_neighbors[index][l].first;
-                for(const indexType& k : filtered_candidates){
-		  if (changed[index] || changed[k]) {
-                    distanceType dist = Points[j].distance(Points[k]);
-                    distanceType j_max = old_neighbors[j][old_neighbors[j].size()-1].second;
-                    distanceType k_max = old_neighbors[k][old_neighbors[k].size()-1].second;
-                    if(dist < j_max) edges.push_back(std::make_pair(j, std::make_pair(k, dist)));
-                    if(dist < k_max) edges.push_back(std::make_pair(k, std::make_pair(j, dist)));
-		  }
-                }
+    // One round of NN-Descent, returning the number of vertices whose
+    // neighbors changed.
+    size_t nn_descent(PR &Points, long round){
+        candidate empty(std::numeric_limits<uint32_t>::max(), kNullId);
+        parlay::sequence<candidate> new_candidates(n * S, empty);
+        parlay::sequence<candidate> old_candidates(n * S, empty);
+        parlay::parallel_for(0, n, [&] (size_t v) {
+            for (long i = 0; i < K; i++) {
+                neighbor x = heaps[v * K + i];
+                if (x.id == kNullId) continue;
+                uint32_t priority = parlay::hash64((round * n + v) * K + i);
+                auto& buffer = x.is_new ? new_candidates : old_candidates;
+                sample(buffer, S, v, x.id, priority);
+                sample(buffer, S, x.id, v, priority);
             }
-			return edges;
-								 }, 1);
-		auto candidates = parlay::group_by_key(parlay::flatten(grouped_labelled));
-        parlay::parallel_for(0, candidates.size(), [&] (size_t i){
-            auto less2 = [&] (pid a, pid b) {
-                if(a.second < b.second) return true;
-                else if(a.second == b.second){
-                    if(a.first < b.first) return true;
-                }
-                return false;
-            };
-            parlay::sort_inplace(candidates[i].second, less2);
-            indexType cur_index=std::numeric_limits<unsigned int>::max();
-            parlay::sequence<pid> filtered_candidates;
-            for(const pid& p : candidates[i].second){
-                if(p.first!=cur_index){
-                    filtered_candidates.push_back(p);
-                    cur_index = p.first;
-                }
-            }
-            indexType index = candidates[i].first;
-            auto less3 = [&] (pid a, pid b) {return a.second < b.second;};
-            auto [new_edges, change] = seq_union_bounded(old_neighbors[index], filtered_candidates, K, less3);
-            if(change){
-                new_changed[index]=1;
-                old_neighbors[index]=new_edges;
+        });
+        // the sampled new neighbors are joined this round
+        parlay::parallel_for(0, n, [&] (size_t v) {
+            auto ids = sampled(new_candidates, S, v);
+            for (long i = 0; i < K; i++) {
+                neighbor& x = heaps[v * K + i];
+                if (x.is_new && std::find(ids.begin(), ids.end(), x.id) != ids.end())
+                    x.is_new = false;
             }
         });
-    }
 
-    parlay::sequence<std::pair<indexType, parlay::sequence<indexType>>> reverse_graph(){
-        parlay::sequence<parlay::sequence<edge>> to_group = parlay::tabulate(old_neighbors.size(), [&] (size_t i){
-            size_t s = old_neighbors[i].size();
-            parlay::sequence<edge> e(s);
-            for(indexType j=0; j<s; j++){
-                e[j] = std::make_pair(old_neighbors[i][j].first, (int) i);
+        parlay::parallel_for(0, n, [&] (size_t i) {changed[i] = 0;});
+        parlay::parallel_for(0, n, [&] (size_t v) {
+            auto new_ids = sampled(new_candidates, S, v);
+            auto old_ids = sampled(old_candidates, S, v);
+            for (size_t i = 0; i < new_ids.size(); i++) {
+                indexType a = new_ids[i];
+                auto A = Points[a];
+                auto offer = [&] (indexType b) {
+                    distanceType d = A.distance(Points[b]);
+                    push(a, b, d);
+                    push(b, a, d);
+                };
+                for (size_t j = i + 1; j < new_ids.size(); j++) offer(new_ids[j]);
+                for (indexType b : old_ids) if (b != a) offer(b);
             }
-            return e; 
-        });
-        auto sorted_graph =  parlay::group_by_key(parlay::flatten(to_group));
-        parlay::parallel_for(0, sorted_graph.size(), [&] (size_t i){
-            auto shuffled = parlay::remove_duplicates(parlay::random_shuffle(sorted_graph[i].second, i));
-            indexType upper_bound = std::min((long) shuffled.size(), K);
-            auto truncated = parlay::tabulate(upper_bound, [&] (size_t j){
-                return shuffled[j];
-            });
-            sorted_graph[i].second = truncated;
-        });
-        return sorted_graph;
+        }, 1);
+        return parlay::reduce(parlay::map(changed, [] (uint8_t c) {return (size_t) c;}));
     }
 
     int nn_descent_wrapper(PR &Points){
-		size_t n = Points.size();
-		parlay::sequence<int> changed = parlay::tabulate(n, [&] (size_t i) {return 1;});
-		int rounds = 0;
+        int rounds = 0;
         int max_rounds = std::max(10, (int) log2(Points.dimension()));
         if(Points.dimension()==256) max_rounds=20; //hack for ssnpp
-		while(parlay::reduce(changed) >= delta*n && rounds < max_rounds){
-			auto new_changed = nn_descent(Points, changed);
-			changed = new_changed;
-			rounds++;
-            std::cout << parlay::reduce(new_changed) << " elements changed" << std::endl;
-			std::cout << "Round " << rounds << " of " <<  max_rounds << " completed" << std::endl; 
-		}
-
-		std::cout << "descent converged in " << rounds << " rounds";
+        size_t num_changed = n;
+        while(num_changed >= delta*n && rounds < max_rounds){
+            num_changed = nn_descent(Points, rounds);
+            rounds++;
+            std::cout << num_changed << " elements changed" << std::endl;
+            std::cout << "Round " << rounds << " of " <<  max_rounds << " completed" << std::endl;
+        }
+
+        std::cout << "descent converged in " << rounds << " rounds";
         if(rounds < max_rounds) std::cout << " (Early termination)";
         std::cout << std::endl;
-		return rounds;
-	}
+        return rounds;
+    }
 
+    // Each vertex is alpha pruned to K over its neighbors and a sample of
+    // (up to K of) its reverse neighbors.
     void undirect_and_prune(GraphI &G, PR &Points, double alpha){
-        parlay::sequence<parlay::sequence<edge>> to_group = parlay::tabulate(old_neighbors.size(), [&] (size_t i){
-            size_t s = old_neighbors[i].size();
-            assert(s == K);
-            parlay::sequence<edge> e(s);
-            for(indexType j=0; j<s; j++){
-                e[j] = std::make_pair(old_neighbors[i][j].first, (int) i);
+        candidate empty(std::numeric_limits<uint32_t>::max(), kNullId);
+        parlay::sequence<candidate> reverse(n * K, empty);
+        parlay::parallel_for(0, n, [&] (size_t v) {
+            for (long i = 0; i < K; i++) {
+                indexType u = heaps[v * K + i].id;
+                if (u != kNullId) sample(reverse, K, u, v, parlay::hash64(v * K + i));
             }
-            return e; 
-        });
-        auto undirected_graph = parlay::group_by_key_ordered(parlay::flatten(to_group));
-        parlay::parallel_for(0, undirected_graph.size(), [&] (size_t i){
-            indexType index = undirected_graph[i].first;
-            auto filtered = parlay::remove_duplicates(undirected_graph[i].second);
-            auto undirected_pids = parlay::tabulate(filtered.size(), [&] (size_t j){
-                indexType indexU = filtered[j];
-                distanceType dist = Points[index].distance(Points[indexU]);
-                return std::make_pair(indexU, dist);
-            });
-            parlay::sort_inplace(undirected_pids, less);
-            auto less3 = [&] (pid a, pid b) {return a.second < b.second;};
-            auto merged_pids = seq_union(old_neighbors[index], undirected_pids, less3);
-            old_neighbors[index] = merged_pids;
-        });
-        parlay::parallel_for(0, G.size(), [&] (size_t i){
-            parlay::sequence<indexType> new_out = parlay::sequence<indexType>();
-			for(const pid& j : old_neighbors[i]){
-				if(new_out.size() == K) break;
-				else if(new_out.size() == 0) new_out.push_back(j.first);
-				else{
-					distanceType dist_p = j.second;
-					bool add = true;
-					for(const indexType& k : new_out){
-                        distanceType dist = Points[j.first].distance(Points[k]);
-						if(dist_p > alpha*dist) {add = false; break;}
-					}
-					if(add) new_out.push_back(j.first);
-				}
-			}
-            G[i].update_neighbors(new_out);
         });
+        parlay::parallel_for(0, n, [&] (size_t v) {
+            auto rev = sampled(reverse, K, v);
+            auto candidates = distances_from(Points, (indexType) v, rev);
+            for (long i = 0; i < K; i++) {
+                neighbor x = heaps[v * K + i];
+                if (x.id != kNullId) candidates.push_back(std::pair(x.id, x.dist));
+            }
+            G[v].update_neighbors(alpha_prune(Points, (indexType) v, std::move(candidates), K, alpha));
+        }, 1);
     }
 
-
     void build_index(GraphI &G, PR &Points, long cluster_size, long num_clusters, double alpha){
-		clusterPID<Point, PointRange, indexType> C;
-        old_neighbors = parlay::sequence<parlay::sequence<pid>>(G.size());
-		C.multiple_clustertrees(Points, cluster_size, num_clusters, K, old_neighbors);
-		nn_descent_wrapper(Points);
-		undirect_and_prune(G, Points, alpha);
-	}
+        n = G.size();
+        heaps = parlay::sequence<neighbor>(n * K, neighbor{kNullDist, kNullId, true});
+        worst = std::unique_ptr<std::atomic<distanceType>[]>(new std::atomic<distanceType>[n]);
+        locks = std::unique_ptr<std::atomic<bool>[]>(new std::atomic<bool>[n]);
+        changed = parlay::sequence<uint8_t>(n, 0);
+        parlay::parallel_for(0, n, [&] (size_t i) {
+            worst[i] = kNullDist;
+            locks[i] = false;
+        });
+        clusterPID<Point, PointRange, indexType> C;
+        C.multiple_clustertrees(Points, cluster_size, num_clusters,
+                                [&] (indexType u, indexType v, distanceType d) {push(u, v, d);});
+        nn_descent_wrapper(Points);
+        undirect_and_prune(G, Points, alpha);
+        heaps.clear();
+        worst.reset();
+        locks.reset();
+    }
 };
 
 } // end namespace
@@ -0,0 +1,122 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "types.h"
+
+namespace parlayANN {
+
+// Searching queries in batches.
+//
+// Queries are ordered so that those closest to the same neighbor of
+// the start point are adjacent, and then cut into batches.  The
+// searches of a batch run on a single worker in lock step (see
+// beam_search_batch in beamSearch.h): in each round every search
+// visits one vertex.  The searches visiting the same vertex read its
+// neighbor list once and compute the distances to their candidates
+// together (shared_distances below), so a point wanted by several of
+// them is read from memory once.  Queries of a batch tend to walk
+// through the same part of the graph, especially in the first rounds.
+// All the searches of a round prefetch their candidates before any
+// distance is computed, so their reads overlap in the memory system.
+// Each search takes the same steps as on its own, so the results are
+// the same as for unbatched search.
+
+// Orders the queries so that queries whose closest neighbor of the
+// start point is the same are adjacent.
+template<typename indexType, typename QueryRange, typename PointRange, class GT>
+parlay::sequence<size_t>
+batch_query_order(const GT& G, const QueryRange& Query_Points, const PointRange& Points,
+                  indexType start) {
+  auto ngh = G[start];
+  parlay::sequence<indexType> hub(ngh.begin(), ngh.end());
+  hub.push_back(start);
+  auto key = parlay::tabulate(Query_Points.size(), [&] (size_t i) {
+    auto q = Query_Points[i];
+    size_t best = 0;
+    auto best_d = Points[hub[0]].distance(q);
+    for (size_t j = 1; j < hub.size(); j++) {
+      auto d = Points[hub[j]].distance(q);
+      if (d < best_d) {best = j; best_d = d;}
+    }
+    return std::pair(hub[best], i);});
+  return parlay::map(parlay::sort(key), [] (auto kv) {return kv.second;});
+}
+
+// Applies f to the batches of batch_size consecutive entries of
+// order, in parallel.  f is given a slice of order.
+template<typename F>
+void for_each_batch(const parlay::sequence<size_t>& order, long batch_size, F&& f) {
+  size_t nq = order.size();
+  size_t bs = std::max<long>(batch_size, 1);
+  size_t num_batches = (nq + bs - 1) / bs;
+  parlay::parallel_for(0, num_batches, [&] (size_t b) {
+    size_t end = std::min(nq, (b + 1) * bs);
+    f(parlay::make_slice(order.begin() + b * bs, order.begin() + end));
+  }, 1);
+}
+
+// The queries x candidates distance kernel of a batch.  The searches
+// of a batch that visit the same vertex in a round take their
+// candidates from its neighbor list ngh, each a subsequence of it
+// (the neighbors it has not seen).  For each search s of slots, sets
+// out[s][j] to the distance from Points[candidates(s)[j]] to
+// queries[s].  The kernel goes through ngh once, so a candidate
+// wanted by several of the searches is read from memory once and
+// compared with all of their queries while in cache.
+template<typename PointRange, typename Edges, typename Candidates,
+         typename Queries, typename dtype>
+void shared_distances(const PointRange& Points, const Edges& ngh, long degree,
+                      const std::vector<uint32_t>& slots, const Candidates& candidates,
+                      const Queries& queries, std::vector<std::vector<dtype>>& out) {
+  if (slots.size() == 1) {
+    uint32_t s = slots[0];
+    const auto& c = candidates(s);
+    out[s].resize(c.size());
+    for (size_t j = 0; j < c.size(); j++)
+      out[s][j] = Points[c[j]].distance(queries[s]);
+    return;
+  }
+  static thread_local std::vector<size_t> next;
+  next.assign(slots.size(), 0);
+  for (auto s : slots) out[s].resize(candidates(s).size());
+  long num_elts = std::min<long>(ngh.size(), degree);
+  for (long i = 0; i < num_elts; i++) {
+    auto a = ngh[i];
+    for (size_t k = 0; k < slots.size(); k++) {
+      uint32_t s = slots[k];
+      const auto& c = candidates(s);
+      if (next[k] < c.size() && c[next[k]] == a) {
+        out[s][next[k]] = Points[a].distance(queries[s]);
+        next[k]++;
+      }
+    }
+  }
+}
+
+} // end namespace
@@ -0,0 +1,105 @@
+#include "algorithms/utils/batch_search.h"
+
+#include <random>
+#include <vector>
+
+#include "algorithms/utils/beamSearch.h"
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/graph.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using Point = Euclidian_Point<float>;
+
+struct Dataset {
+  std::vector<float> data;
+  std::vector<Point> points;
+};
+
+Dataset RandomPoints(size_t n, int d, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  Dataset D;
+  D.data.resize(n * d);
+  for (auto& x : D.data) x = dist(rng);
+  Point::parameters params(d);
+  for (size_t i = 0; i < n; i++)
+    D.points.push_back(Point((uint8_t*) (D.data.data() + i * d), i, params));
+  return D;
+}
+
+Graph<unsigned int> RandomGraph(size_t n, long max_deg, unsigned seed) {
+  std::mt19937 rng(seed);
+  Graph<unsigned int> G(max_deg, n);
+  for (size_t i = 0; i < n; i++) {
+    std::vector<unsigned int> ngh;
+    for (long j = 0; j < max_deg; j++) ngh.push_back(rng() % n);
+    G[i].update_neighbors(ngh);
+  }
+  return G;
+}
+
+class BatchSearchTest : public testing::TestWithParam<long> {};
+
+TEST_P(BatchSearchTest, MatchesBeamSearch) {
+  size_t n = 2000;
+  auto base = RandomPoints(n, 16, 1);
+  auto queries = RandomPoints(300, 16, 2);
+  auto G = RandomGraph(n, 24, 3);
+  parlay::sequence<unsigned int> starts = {0};
+  for (long Q : {10, 50}) {
+    for (long limit : {15l, (long) n}) {
+      // without and with adaptive termination
+      for (auto [patience, stop_ratio] : {std::pair{0l, 0.0}, {5l, 0.0}, {0l, 1.1}}) {
+        QueryParams QP(10, Q, 1.35, limit, G.max_degree());
+        QP.batch_size = GetParam();
+        QP.patience = patience;
+        QP.stop_ratio = stop_ratio;
+        auto results = batched_beam_search(G, queries.points, base.points, starts, QP);
+        ASSERT_EQ(results.size(), queries.points.size());
+        for (size_t i = 0; i < queries.points.size(); i++) {
+          auto [expected, cmps] = beam_search(queries.points[i], G, base.points, starts, QP);
+          EXPECT_EQ(results[i].first.first, expected.first);
+          EXPECT_EQ(results[i].first.second, expected.second);
+          EXPECT_EQ(results[i].second, cmps);
+        }
+      }
+    }
+  }
+}
+
+TEST_P(BatchSearchTest, FilteredMatchesFilteredBeamSearch) {
+  size_t n = 2000;
+  auto base = RandomPoints(n, 16, 4);
+  auto queries = RandomPoints(200, 16, 5);
+  auto G = RandomGraph(n, 24, 6);
+  parlay::sequence<unsigned int> start = {0};
+  QueryParams QP(10, 40, 1.35, n, G.max_degree());
+  auto order = batch_query_order(G, queries.points, base.points, 0u);
+  using id_dist = std::pair<unsigned int, float>;
+  using result = std::pair<std::pair<parlay::sequence<id_dist>, parlay::sequence<id_dist>>, size_t>;
+  std::vector<result> results(queries.points.size());
+  for_each_batch(order, GetParam(), [&] (auto ids) {
+    // different starting points for each query
+    std::vector<parlay::sequence<unsigned int>> starts;
+    for (size_t j = 0; j < ids.size(); j++)
+      starts.push_back({(unsigned int) ids[j], (unsigned int) (ids[j] * 7 % n)});
+    beam_search_batch(G, ids, queries.points, base.points, queries.points, base.points,
+                      starts, QP, true, [&] (size_t i, result&& r) {results[i] = r;});
+  });
+  for (size_t i = 0; i < queries.points.size(); i++) {
+    parlay::sequence<unsigned int> starts = {(unsigned int) i, (unsigned int) (i * 7 % n)};
+    auto q = queries.points[i];
+    auto expected = filtered_beam_search(G, q, base.points, q, base.points, starts, QP, true);
+    EXPECT_EQ(results[i].first.first, expected.first.first);
+    EXPECT_EQ(results[i].first.second, expected.first.second);
+    EXPECT_EQ(results[i].second, expected.second);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(BatchSizes, BatchSearchTest, testing::Values(0, 1, 7, 64, 1000));
+
+}  // namespace
+}  // namespace parlayANN
@@ -15,106 +15,112 @@
 #include "types.h"
 #include "graph.h"
 #include "stats.h"
+#include "batch_search.h"
+#include "search_context.h"
+#include "entry_points.h"
 
 namespace parlayANN {
 
-// main beam search
+// default for the keep argument of filtered_beam_search below
+struct keep_all {
+  template<typename indexType>
+  bool operator()(indexType) const {return true;}
+};
+
+// The state of a beam search, advanced one visit at a time so that
+// filtered_beam_search can run a single search and beam_search_batch
+// (below) the searches of a batch in lock step.  A step is:
+//   select()   picks and visits the closest unvisited frontier vertex,
+//              and returns false once the search is done,
+//   gather()   collects its neighbors that have not been seen (pruned),
+//   filter()   keeps those whose low quality distance is below the
+//              filter threshold (filtered), if filtering,
+//   finish()   merges those closer than the frontier into it.
+// Distances are passed to filter() and finish() by a function of the
+// position and id of the candidate, so a batch can compute them for
+// all of its searches at once.  Only neighbors for which keep(id) is
+// true are added to the frontier, which is used to restrict the
+// search to the points carrying a label (see labels.h).
 template<typename indexType, typename Point, typename PointRange,
-         typename QPoint, typename QPointRange, class GT>
-std::pair<std::pair<parlay::sequence<std::pair<indexType, typename Point::distanceType>>,
-                    parlay::sequence<std::pair<indexType, typename Point::distanceType>>>,
-          size_t>
-filtered_beam_search(const GT &G,
-                     const Point p,  const PointRange &Points,
-                     const QPoint qp, const QPointRange &Q_Points,
-                     const parlay::sequence<indexType> starting_points,
-                     const QueryParams &QP,
-                     bool use_filtering = false
-                     ) {
+         typename QPoint, typename QPointRange, class GT,
+         class Keep = keep_all>
+struct beam_search_state {
   using dtype = typename Point::distanceType;
   using id_dist = std::pair<indexType, dtype>;
-  int beamSize = QP.beamSize;
-
-  if (starting_points.size() == 0) {
-    std::cout << "beam search expects at least one start point" << std::endl;
-    abort();
+  using context = search_context<indexType, dtype>;
+
+  beam_search_state(context& ctx, const GT &G,
+                    const Point& p, const PointRange &Points,
+                    const QPoint& qp, const QPointRange &Q_Points,
+                    const parlay::sequence<indexType>& starting_points,
+                    const QueryParams &QP, bool use_filtering, Keep keep)
+    : ctx(ctx), G(G), p(p), Points(Points), qp(qp), Q_Points(Q_Points), QP(QP),
+      use_filtering(use_filtering), keep(keep), beamSize(QP.beamSize) {
+    if (starting_points.size() == 0) {
+      std::cout << "beam search expects at least one start point" << std::endl;
+      abort();
+    }
+    ctx.start(beamSize, G.max_degree(), starting_points.size());
+
+    // Frontier maintains the closest points found so far and its size
+    // is always at most beamSize.  Each entry is a (id,distance) pair.
+    // Initialized with starting points and kept sorted by distance.
+    // Alongside it frontier_visited marks the entries already visited.
+    for (auto q : starting_points) {
+      ctx.frontier.push_back(id_dist(q, Points[q].distance(p)));
+      ctx.has_been_seen(q);
+    }
+    std::sort(ctx.frontier.begin(), ctx.frontier.end(), less);
+    ctx.frontier_visited.assign(ctx.frontier.size(), false);
+
+    // Positions in the frontier of the entries that have not been visited.
+    // Use the first of these to pick next vertex to visit.
+    for (int i=0; i < ctx.frontier.size(); i++)
+      ctx.unvisited[i] = i;
+
+    dist_cmps = starting_points.size();
+    full_dist_cmps = starting_points.size();
+    remain = ctx.frontier.size();
+    stop_early = QP.k > 0 && (QP.patience > 0 || QP.stop_ratio > 0);
+    use_ratio = QP.stop_ratio > 0 && Points[0].is_metric();
   }
 
   // compare two (node_id,distance) pairs, first by distance and then id if
   // equal
-  using distanceType = typename Point::distanceType;
-  auto less = [&](id_dist a, id_dist b) {
+  // (a lambda rather than a function, so that std::sort inlines it)
+  static constexpr auto less = [] (id_dist a, id_dist b) {
     return a.second < b.second || (a.second == b.second && a.first < b.first);
   };
 
-  // used as a hash filter (can give false negative -- i.e. can say
-  // not in table when it is)
-  int bits = std::max<int>(10, std::ceil(std::log2(beamSize * beamSize)) - 2);
-  std::vector<indexType> hash_filter(1 << bits, -1);
-  auto has_been_seen = [&](indexType a) -> bool {
-    int loc = parlay::hash64_2(a) & ((1 << bits) - 1);
-    if (hash_filter[loc] == a) return true;
-    hash_filter[loc] = a;
-    return false;
-  };
-
-  // Frontier maintains the closest points found so far and its size
-  // is always at most beamSize.  Each entry is a (id,distance) pair.
-  // Initialized with starting points and kept sorted by distance.
-  std::vector<id_dist> frontier;
-  frontier.reserve(beamSize);
-  for (auto q : starting_points) {
-    frontier.push_back(id_dist(q, Points[q].distance(p)));
-    has_been_seen(q);
-  }
-  std::sort(frontier.begin(), frontier.end(), less);
-
-  // The subset of the frontier that has not been visited
-  // Use the first of these to pick next vertex to visit.
-  std::vector<id_dist> unvisited_frontier(beamSize);
-  for (int i=0; i < frontier.size(); i++)
-    unvisited_frontier[i] = frontier[i];
-
-  // maintains sorted set of visited vertices (id-distance pairs)
-  std::vector<id_dist> visited;
-  visited.reserve(2 * beamSize);
-
-  // counters
-  size_t dist_cmps = starting_points.size();
-  size_t full_dist_cmps = starting_points.size();
-  int remain = frontier.size();
-  int num_visited = 0;
-
-  // used as temporaries in the loop
-  std::vector<id_dist> new_frontier(2 * std::max<size_t>(beamSize,starting_points.size()) +
-                                    G.max_degree());
-  std::vector<id_dist> candidates;
-  candidates.reserve(G.max_degree() + beamSize);
-  std::vector<indexType> filtered;
-  filtered.reserve(G.max_degree());
-  std::vector<indexType> pruned;
-  pruned.reserve(G.max_degree());
-
-  dtype filter_threshold_sum = 0.0;
-  int filter_threshold_count = 0;
-  dtype filter_threshold;
-  indexType filter_id;
-  indexType filter_tail_mean = 0;
-
-  // offset into the unvisited_frontier vector (unvisited_frontier[offset] is the next to visit)
-  int offset = 0;
-
-  // The main loop.  Terminate beam search when the entire frontier
-  // has been visited or have reached max_visit.
-  while (remain > offset && num_visited < QP.limit) {
+  // Visits the next vertex, current.  Terminates when the entire
+  // frontier has been visited or have reached max_visit.
+  bool select() {
+    auto& frontier = ctx.frontier;
+    if (!(remain > offset && num_visited < QP.limit &&
+          !(stop_early && QP.patience > 0 && unchanged >= QP.patience)))
+      return false;
     // the next node to visit is the unvisited frontier node that is closest to p
-    id_dist current = unvisited_frontier[offset];
+    position = ctx.unvisited[offset];
+    current = frontier[position];
+    if (stop_early && use_ratio && frontier.size() >= QP.k &&
+        current.second > QP.stop_ratio * frontier[QP.k - 1].second)
+      return false;
     G[current.first].prefetch();
+
+    // software pipelining: also prefetch the edges of the next few
+    // unvisited frontier nodes, which are likely to be visited next
+    ctx.edges_prefetched_next.clear();
+    for (int j = 1; j <= QP.prefetch_depth && offset + j < remain; j++) {
+      indexType v = frontier[ctx.unvisited[offset + j]].first;
+      G[v].prefetch();
+      ctx.edges_prefetched_next.push_back(v);
+    }
+
     // add to visited set
-    auto position = std::upper_bound(visited.begin(), visited.end(), current, less);
-    visited.insert(position, current);
+    ctx.frontier_visited[position] = true;
+    ctx.visit(current);
     num_visited++;
-    bool frontier_full = frontier.size() == beamSize;
+    frontier_full = frontier.size() == beamSize;
 
     // if using filtering based on lower quality distances measure, then maintain the average
     // of low quality distance to the last point in the frontier (if frontier is full)
@@ -132,42 +138,91 @@ filtered_beam_search(const GT &G,
       filter_threshold_count++;
       filter_threshold = filter_threshold_sum / filter_threshold_count;
     }
+    return true;
+  }
 
-    // keep neighbors that have not been visited (using approximate
-    // hash). Note that if a visited node is accidentally kept due to
-    // approximate hash it will be removed below by the union.
+  // keep neighbors that have not been visited (using approximate
+  // hash). Note that if a visited node is accidentally kept due to
+  // approximate hash it will be marked as visited in the merge below.
+  template<typename Edges>
+  void gather(const Edges& ngh) {
+    auto& pruned = ctx.pruned;
     pruned.clear();
-    filtered.clear();
-    long num_elts = std::min<long>(G[current.first].size(), QP.degree_limit);
+    ctx.filtered.clear();
+    long num_elts = std::min<long>(ngh.size(), QP.degree_limit);
     for (indexType i=0; i<num_elts; i++) {
-      auto a = G[current.first][i];
-      if (has_been_seen(a) || Points[a].same_as(p)) continue;  // skip if already seen
+      auto a = ngh[i];
+      if (ctx.has_been_seen(a) || Points[a].same_as(p) || !keep(a)) continue;  // skip if already seen
       Q_Points[a].prefetch();
       pruned.push_back(a);
     }
     dist_cmps += pruned.size();
 
-    // filter using low-quality distance
-    if (use_filtering && frontier_full) {
-      for (auto a : pruned) {
-        if (frontier_full && Q_Points[a].distance(qp) >= filter_threshold) continue;
-        filtered.push_back(a);
+    // If the edges of the next node were prefetched on an earlier step
+    // they should have arrived by now, so prefetch the points of its
+    // neighbors that have not been seen while distances for this step
+    // are computed.
+    if (QP.prefetch_depth > 1 && offset + 1 < remain) {
+      indexType v = ctx.frontier[ctx.unvisited[offset + 1]].first;
+      if (std::find(ctx.edges_prefetched.begin(), ctx.edges_prefetched.end(), v) !=
+          ctx.edges_prefetched.end()) {
+        auto next_ngh = G[v];
+        long next_elts = std::min<long>(next_ngh.size(), QP.degree_limit);
+        for (indexType i=0; i<next_elts; i++) {
+          auto a = next_ngh[i];
+          if (!ctx.maybe_seen(a)) Q_Points[a].prefetch();
+        }
+      }
+    }
+    std::swap(ctx.edges_prefetched, ctx.edges_prefetched_next);
+  }
+
+  // whether filter() needs the low quality distances of pruned
+  bool filtering() const {return use_filtering && frontier_full;}
+
+  // filter using low-quality distance, q_distance(j, a) of pruned[j] = a
+  template<typename Distance>
+  void filter(const Distance& q_distance) {
+    if (filtering()) {
+      for (size_t j = 0; j < ctx.pruned.size(); j++) {
+        indexType a = ctx.pruned[j];
+        if (q_distance(j, a) >= filter_threshold) continue;
+        ctx.filtered.push_back(a);
         Points[a].prefetch();
       }
-    } else std::swap(filtered, pruned);
+    } else std::swap(ctx.filtered, ctx.pruned);
+  }
+
+  // Merges the candidates filtered[j] = a, at distance(j, a), into the
+  // frontier.
+  template<typename Distance>
+  void finish(const Distance& distance) {
+    auto& frontier = ctx.frontier;
+    auto& frontier_visited = ctx.frontier_visited;
+    auto& new_frontier = ctx.new_frontier;
+    auto& new_frontier_visited = ctx.new_frontier_visited;
+    auto& candidates = ctx.candidates;
+    auto& filtered = ctx.filtered;
 
     // Further remove if distance is greater than current
     // furthest distance in current frontier (if full).
-    distanceType cutoff = (frontier_full
-                           ? frontier[frontier.size() - 1].second
-                           : (distanceType)std::numeric_limits<int>::max());
-    for (auto a : filtered) {
-      distanceType dist = Points[a].distance(p);
+    dtype cutoff = (frontier_full
+                    ? frontier[frontier.size() - 1].second
+                    : (dtype)std::numeric_limits<int>::max());
+    bool improved = false;
+    for (size_t j = 0; j < filtered.size(); j++) {
+      indexType a = filtered[j];
+      dtype dist = distance(j, a);
       full_dist_cmps++;
       // skip if frontier not full and distance too large
       if (dist >= cutoff) continue;
       candidates.push_back(std::pair{a, dist});
+      // will enter the top k when merged (can be conservative, since a
+      // candidate can already be in the frontier)
+      if (stop_early && (frontier.size() < QP.k || less(candidates.back(), frontier[QP.k - 1])))
+        improved = true;
     }
+    unchanged = improved ? 0 : unchanged + 1;
     // If candidates insufficently full then skip rest of step until sufficiently full.
     // This iproves performance for higher accuracies (e.g. beam sizes of 100+)
     if (candidates.size() == 0 || 
@@ -175,23 +230,40 @@ filtered_beam_search(const GT &G,
          candidates.size() < beamSize/8 &&
          offset + 1 < remain)) {
       offset++;
-      continue;
+      return;
     }
     offset = 0;
 
     // sort the candidates by distance from p,
     // and remove any duplicates (to be robust for neighbor lists with duplicates)
     std::sort(candidates.begin(), candidates.end(), less);
-    auto candidates_end = std::unique(candidates.begin(), candidates.end(),
-                                      [] (auto a, auto b) {return a.first == b.first;});
-
-    // union the frontier and candidates into new_frontier, both are sorted
-    auto new_frontier_size =
-      std::set_union(frontier.begin(), frontier.end(), candidates.begin(),
-                     candidates_end, new_frontier.begin(), less) -
-      new_frontier.begin();
+    long num_candidates = std::unique(candidates.begin(), candidates.end(),
+                                      [] (auto a, auto b) {return a.first == b.first;})
+                          - candidates.begin();
+
+    // Merge the frontier and candidates into new_frontier, both are sorted.
+    // Only the first beamSize entries are kept, or more if the frontier
+    // started out larger (i.e. with more than beamSize starting points).
+    size_t bound = std::max<size_t>(beamSize, frontier.size());
+    new_frontier.resize(bound);
+    new_frontier_visited.resize(bound);
+    size_t new_frontier_size = 0;
+    long i = 0, j = 0;
+    while (new_frontier_size < bound && (i < frontier.size() || j < num_candidates)) {
+      if (j == num_candidates ||
+          (i < frontier.size() && !less(candidates[j], frontier[i]))) {
+        if (j < num_candidates && !less(frontier[i], candidates[j])) j++;
+        new_frontier_visited[new_frontier_size] = frontier_visited[i];
+        new_frontier[new_frontier_size++] = frontier[i++];
+      } else {
+        // a candidate can have been visited if missed by the seen filter
+        new_frontier_visited[new_frontier_size] = ctx.was_visited(candidates[j].first);
+        new_frontier[new_frontier_size++] = candidates[j++];
+      }
+    }
     candidates.clear();
-    
+    size_t merged_size = new_frontier_size;
+
     // trim to at most beam size
     new_frontier_size = std::min<size_t>(beamSize, new_frontier_size);
 
@@ -199,29 +271,103 @@ filtered_beam_search(const GT &G,
     // distance greater than cut * current-kth-smallest-distance.
     // Only used during query and not during build.
     if (QP.k > 0 && new_frontier_size > QP.k && Points[0].is_metric())
-      new_frontier_size = std::max<indexType>(
+      new_frontier_size = std::min<size_t>(merged_size, std::max<indexType>(
         (std::upper_bound(new_frontier.begin(),
                           new_frontier.begin() + new_frontier_size,
                           std::pair{0, QP.cut * new_frontier[QP.k].second}, less) -
-         new_frontier.begin()), frontier.size());
+         new_frontier.begin()), frontier.size()));
 
-    // copy new_frontier back to the frontier
-    frontier.clear();
-    for (indexType i = 0; i < new_frontier_size; i++)
-      frontier.push_back(new_frontier[i]);
+    // the new frontier becomes the frontier
+    new_frontier.resize(new_frontier_size);
+    new_frontier_visited.resize(new_frontier_size);
+    std::swap(frontier, new_frontier);
+    std::swap(frontier_visited, new_frontier_visited);
 
     // get the unvisited frontier
-    remain = (std::set_difference(frontier.begin(),
-                                  frontier.begin() + std::min<long>(frontier.size(), QP.beamSize),
-                                  visited.begin(),
-                                  visited.end(),
-                                  unvisited_frontier.begin(), less) -
-              unvisited_frontier.begin());
+    int num_unvisited = 0;
+    int* unvisited = ctx.unvisited.data();
+    long unvisited_end = std::min<long>(frontier.size(), QP.beamSize);
+    for (long l = 0; l < unvisited_end; l++)
+      if (!frontier_visited[l]) unvisited[num_unvisited++] = l;
+    remain = num_unvisited;
   }
 
-  return std::make_pair(std::make_pair(parlay::to_sequence(frontier),
-                                       parlay::to_sequence(visited)),
-                        full_dist_cmps);
+  // The frontier, the visited vertices sorted by distance, and the
+  // number of full distance comparisons.
+  std::pair<std::pair<parlay::sequence<id_dist>, parlay::sequence<id_dist>>, size_t>
+  results() const {
+    auto visited = copy_out(ctx.visited);
+    std::sort(visited.begin(), visited.end(), less);
+    return std::make_pair(std::make_pair(copy_out(ctx.frontier), std::move(visited)),
+                          full_dist_cmps);
+  }
+
+  context& ctx;
+  const GT& G;
+  const Point& p;
+  const PointRange& Points;
+  const QPoint& qp;
+  const QPointRange& Q_Points;
+  const QueryParams& QP;
+  bool use_filtering;
+  Keep keep;
+  int beamSize;
+  id_dist current; // the vertex visited by this step
+
+private:
+  // counters
+  size_t dist_cmps = 0;
+  size_t full_dist_cmps = 0;
+  int remain = 0;
+  int num_visited = 0;
+  int position = 0;
+  bool frontier_full = false;
+
+  dtype filter_threshold_sum = 0.0;
+  int filter_threshold_count = 0;
+  dtype filter_threshold;
+  indexType filter_id;
+  indexType filter_tail_mean = 0;
+
+  // offset into the unvisited vector (unvisited[offset] is the next to visit)
+  int offset = 0;
+
+  // adaptive termination (only when a k is given): visits since the
+  // top k last changed, and the distance ratio beyond which to stop
+  bool stop_early = false;
+  long unchanged = 0;
+  bool use_ratio = false;
+};
+
+// main beam search
+// Only neighbors for which keep(id) is true are added to the frontier,
+// which is used to restrict the search to the points carrying a
+// label (see labels.h).
+template<typename indexType, typename Point, typename PointRange,
+         typename QPoint, typename QPointRange, class GT,
+         class Keep = keep_all>
+std::pair<std::pair<parlay::sequence<std::pair<indexType, typename Point::distanceType>>,
+                    parlay::sequence<std::pair<indexType, typename Point::distanceType>>>,
+          size_t>
+filtered_beam_search(const GT &G,
+                     const Point p,  const PointRange &Points,
+                     const QPoint qp, const QPointRange &Q_Points,
+                     const parlay::sequence<indexType> starting_points,
+                     const QueryParams &QP,
+                     bool use_filtering = false,
+                     Keep keep = {}
+                     ) {
+  using dtype = typename Point::distanceType;
+  // all working state comes from this thread's reusable context
+  auto& ctx = thread_search_context<indexType, dtype>();
+  beam_search_state<indexType, Point, PointRange, QPoint, QPointRange, GT, Keep>
+    S(ctx, G, p, Points, qp, Q_Points, starting_points, QP, use_filtering, keep);
+  while (S.select()) {
+    S.gather(G[S.current.first]);
+    S.filter([&] (size_t, indexType a) {return Q_Points[a].distance(qp);});
+    S.finish([&] (size_t, indexType a) {return Points[a].distance(p);});
+  }
+  return S.results();
 }
 
 // version without filtering
@@ -233,6 +379,148 @@ beam_search(const Point p, const Graph<indexType> &G, const PointRange &Points,
   return filtered_beam_search(G, p, Points, p, Points, starting_points, QP, false);
 }
 
+// Runs the searches for the queries ids as a batch in lock step (see
+// batch_search.h): each round every search that is not done visits
+// one vertex.  The searches visiting the same vertex in a round share
+// one read of its neighbor list and compute their distances together
+// with shared_distances.
+// Query ids[j] is searched from starts[j], with the same steps as
+// filtered_beam_search, so its result, passed to done(ids[j], result),
+// is the same.  done is called once all the searches are finished.
+template<typename indexType, typename QueryRange, typename PointRange,
+         typename QQueryRange, typename QPointRange, class GT, class Ids, class Done>
+void beam_search_batch(const GT& G, const Ids& ids,
+                       const QueryRange& Queries, const PointRange& Points,
+                       const QQueryRange& Q_Queries, const QPointRange& Q_Points,
+                       const std::vector<parlay::sequence<indexType>>& starts,
+                       const QueryParams& QP, bool use_filtering, Done&& done) {
+  using Point = std::decay_t<decltype(Queries[0])>;
+  using QPoint = std::decay_t<decltype(Q_Queries[0])>;
+  using dtype = typename Point::distanceType;
+  using state = beam_search_state<indexType, Point, PointRange, QPoint, QPointRange, GT>;
+  size_t count = ids.size();
+  std::vector<Point> queries;
+  std::vector<QPoint> q_queries;
+  for (size_t s = 0; s < count; s++) {
+    queries.push_back(Queries[ids[s]]);
+    q_queries.push_back(Q_Queries[ids[s]]);
+  }
+
+  // the working state of search s comes from the thread's context s
+  auto& contexts = thread_search_contexts<indexType, dtype>(count);
+  std::vector<state> S;
+  S.reserve(count);
+  for (size_t s = 0; s < count; s++)
+    S.emplace_back(contexts[s], G, queries[s], Points, q_queries[s], Q_Points,
+                   starts[s], QP, use_filtering, keep_all{});
+
+  std::vector<std::pair<indexType, uint32_t>> visits; // (vertex, search)
+  std::vector<size_t> groups;      // start in visits of each group, and the end
+  std::vector<size_t> edges_start; // start in edges of the neighbors of each group
+  std::vector<indexType> edges;
+  std::vector<uint32_t> slots;
+  std::vector<std::vector<typename QPoint::distanceType>> q_distances(count);
+  std::vector<std::vector<dtype>> distances(count);
+  auto pruned = [&] (uint32_t s) -> const std::vector<indexType>& {return S[s].ctx.pruned;};
+  auto filtered = [&] (uint32_t s) -> const std::vector<indexType>& {return S[s].ctx.filtered;};
+  std::vector<uint32_t> active(count);
+  for (size_t s = 0; s < count; s++) active[s] = s;
+  while (active.size() > 0) {
+    visits.clear();
+    for (auto s : active)
+      if (S[s].select()) visits.push_back(std::pair(S[s].current.first, s));
+
+    // Once a single search is left (or a batch of one), the round
+    // bookkeeping is pure overhead: step it exactly like filtered_beam_search.
+    if (visits.size() == 1) {
+      auto [v, s] = visits[0];
+      S[s].gather(G[v]);
+      S[s].filter([&, s = s] (size_t, indexType a) {return Q_Points[a].distance(q_queries[s]);});
+      S[s].finish([&, s = s] (size_t, indexType a) {return Points[a].distance(queries[s]);});
+      continue;
+    }
+
+    // After sorting, the searches visiting the same vertex are adjacent
+    // and form a group, which reads the neighbor list once.  All the
+    // searches gather (and prefetch) their candidates before any
+    // distance is computed.
+    std::sort(visits.begin(), visits.end());
+    groups.clear();
+    edges_start.clear();
+    edges.clear();
+    for (size_t i = 0; i < visits.size(); i++) {
+      if (i > 0 && visits[i].first == visits[i - 1].first) continue;
+      auto ngh = G[visits[i].first];
+      groups.push_back(i);
+      edges_start.push_back(edges.size());
+      for (size_t j = 0; j < ngh.size(); j++) edges.push_back(ngh[j]);
+    }
+    groups.push_back(visits.size());
+    edges_start.push_back(edges.size());
+    auto group_edges = [&] (size_t g) {
+      return parlay::make_slice(edges.begin() + edges_start[g], edges.begin() + edges_start[g + 1]);
+    };
+    for (size_t g = 0; g + 1 < groups.size(); g++)
+      for (size_t i = groups[g]; i < groups[g + 1]; i++)
+        S[visits[i].second].gather(group_edges(g));
+
+    // low quality distances, for the searches that filter
+    for (size_t g = 0; g + 1 < groups.size(); g++) {
+      slots.clear();
+      for (size_t i = groups[g]; i < groups[g + 1]; i++)
+        if (S[visits[i].second].filtering()) slots.push_back(visits[i].second);
+      if (slots.size() > 0)
+        shared_distances(Q_Points, group_edges(g), QP.degree_limit, slots, pruned,
+                         q_queries, q_distances);
+    }
+    for (auto [v, s] : visits)
+      S[s].filter([&, s = s] (size_t j, indexType) {return q_distances[s][j];});
+
+    for (size_t g = 0; g + 1 < groups.size(); g++) {
+      slots.clear();
+      for (size_t i = groups[g]; i < groups[g + 1]; i++) slots.push_back(visits[i].second);
+      shared_distances(Points, group_edges(g), QP.degree_limit, slots, filtered,
+                       queries, distances);
+    }
+    for (auto [v, s] : visits)
+      S[s].finish([&, s = s] (size_t j, indexType) {return distances[s][j];});
+
+    active.clear();
+    for (auto [v, s] : visits) active.push_back(s);
+  }
+
+  // copy out all results before calling done, which can fork
+  std::vector<decltype(S[0].results())> results;
+  for (size_t s = 0; s < count; s++) results.push_back(S[s].results());
+  for (size_t s = 0; s < count; s++) done(ids[s], std::move(results[s]));
+}
+
+// Searches all queries in locality-ordered batches of QP.batch_size
+// (see batch_search.h).  The result for query i is the same as that
+// of beam_search on Query_Points[i].
+template<typename indexType, typename QueryRange, typename PointRange, class GT>
+auto batched_beam_search(const GT& G,
+                         const QueryRange& Query_Points,
+                         const PointRange& Points,
+                         const parlay::sequence<indexType>& starting_points,
+                         const QueryParams& QP) {
+  using Point = std::decay_t<decltype(Query_Points[0])>;
+  using id_dist = std::pair<indexType, typename Point::distanceType>;
+  using result = std::pair<std::pair<parlay::sequence<id_dist>, parlay::sequence<id_dist>>, size_t>;
+  if (starting_points.size() == 0) {
+    std::cout << "beam search expects at least one start point" << std::endl;
+    abort();
+  }
+  auto order = batch_query_order(G, Query_Points, Points, starting_points[0]);
+  parlay::sequence<result> results(Query_Points.size());
+  for_each_batch(order, QP.batch_size, [&] (auto ids) {
+    std::vector<parlay::sequence<indexType>> starts(ids.size(), starting_points);
+    beam_search_batch(G, ids, Query_Points, Points, Query_Points, Points, starts, QP, false,
+                      [&] (size_t i, result&& r) {results[i] = std::move(r);});
+  });
+  return results;
+}
+
 // backward compatibility (for hnsw)
 template<typename indexType, typename Point, typename PointRange, class GT>
 std::pair<std::pair<parlay::sequence<std::pair<indexType, typename Point::distanceType>>, parlay::sequence<std::pair<indexType, typename Point::distanceType>>>, size_t>
@@ -291,8 +579,9 @@ range_search(Point p, GT &G, PointRange &Points,
   while (position < result.size()) {
     indexType next = result[position++];
     std::vector<indexType> unseen;
-    for (long i = 0; i < G[next].size(); i++) {
-      auto v = G[next][i];
+    auto ngh = G[next];
+    for (long i = 0; i < ngh.size(); i++) {
+      auto v = ngh[i];
       if (seen.count(v) > 0 || Points[v].same_as(p))
         continue;  // skip if already seen
       unseen.push_back(v);
@@ -361,6 +650,79 @@ beamSearchRandom(const PointRange& Query_Points,
   return all_neighbors;
 }
 
+// Calibrates QueryParams::stop_ratio on (a sample of) Sample_Points,
+// searching sample point i from starting_points[i].  The sample should
+// not be the queries whose results are reported, or the ratio is tuned
+// to them.  Returns the smallest ratio, to within 1%, at which the top
+// k found by the searches agree on at least a fraction agreement of
+// their entries with the top k found without the ratio.  Returns 0
+// (i.e. no ratio) if the distance is not a metric or if no ratio up to
+// max_ratio is enough.
+template<typename QueryRange, typename PointRange, typename indexType>
+double calibrate_stop_ratio(const Graph<indexType> &G,
+                            const QueryRange &Sample_Points,
+                            const PointRange &Points,
+                            const parlay::sequence<parlay::sequence<indexType>> &starting_points,
+                            QueryParams QP,
+                            double agreement,
+                            long sample_size = 1000,
+                            double max_ratio = 64) {
+  if (QP.k <= 0 || Points.size() == 0 || !Points[0].is_metric()) return 0;
+  long n = std::min<long>(sample_size, Sample_Points.size());
+  auto top_k = [&] (const QueryParams& QPr) {
+    return parlay::tabulate(n, [&] (long i) {
+      auto frontier = beam_search(Sample_Points[i], G, Points, starting_points[i], QPr).first.first;
+      parlay::sequence<indexType> ids;
+      for (long j = 0; j < std::min<long>(QPr.k, frontier.size()); j++)
+        ids.push_back(frontier[j].first);
+      std::sort(ids.begin(), ids.end());
+      return ids;});
+  };
+  QP.stop_ratio = 0;
+  auto exact = top_k(QP);
+  long total = parlay::reduce(parlay::map(exact, [] (auto& e) {return (long) e.size();}));
+  auto agrees = [&] (double ratio) {
+    QP.stop_ratio = ratio;
+    auto found = top_k(QP);
+    auto same = parlay::tabulate(n, [&] (long i) {
+      long c = 0;
+      for (auto id : found[i])
+        c += std::binary_search(exact[i].begin(), exact[i].end(), id);
+      return c;});
+    return parlay::reduce(same) >= agreement * total;
+  };
+  double lo = 1.0;
+  if (agrees(lo)) return lo;
+  double hi = 2.0;
+  while (!agrees(hi)) {
+    if (hi >= max_ratio) return 0;
+    lo = hi;
+    hi *= 2;
+  }
+  while (hi > 1.01 * lo) {
+    double mid = std::sqrt(lo * hi);
+    if (agrees(mid)) hi = mid;
+    else lo = mid;
+  }
+  return hi;
+}
+
+// calibrate_stop_ratio with the same starting points for every search
+template<typename QueryRange, typename PointRange, typename indexType>
+double calibrate_stop_ratio(const Graph<indexType> &G,
+                            const QueryRange &Sample_Points,
+                            const PointRange &Points,
+                            const parlay::sequence<indexType> &starting_points,
+                            QueryParams QP,
+                            double agreement,
+                            long sample_size = 1000,
+                            double max_ratio = 64) {
+  auto starts = parlay::tabulate(std::min<long>(sample_size, Sample_Points.size()),
+                                 [&] (long i) {return starting_points;});
+  return calibrate_stop_ratio(G, Sample_Points, Points, starts, QP, agreement,
+                              sample_size, max_ratio);
+}
+
 template<typename PointRange, typename indexType>
 parlay::sequence<parlay::sequence<indexType>>
 searchAll(PointRange& Query_Points,
@@ -382,9 +744,16 @@ searchAll(PointRange &Query_Points,
     abort();
   }
   parlay::sequence<parlay::sequence<indexType>> all_neighbors(Query_Points.size());
+  using Point = typename PointRange::Point;
+  using id_dist = std::pair<indexType, typename Point::distanceType>;
+  using result = std::pair<std::pair<parlay::sequence<id_dist>, parlay::sequence<id_dist>>, size_t>;
+  parlay::sequence<result> batched;
+  if (QP.batch_size > 1)
+    batched = batched_beam_search(G, Query_Points, Base_Points, starting_points, QP);
   parlay::parallel_for(0, Query_Points.size(), [&](size_t i) {
     parlay::sequence<indexType> neighbors = parlay::sequence<indexType>(QP.k);
-    auto [pairElts, dist_cmps] = beam_search(Query_Points[i], G, Base_Points, starting_points, QP);
+    auto [pairElts, dist_cmps] = (QP.batch_size > 1) ? std::move(batched[i])
+      : beam_search(Query_Points[i], G, Base_Points, starting_points, QP);
     auto [beamElts, visitedElts] = pairElts;
     for (indexType j = 0; j < QP.k; j++) {
       neighbors[j] = beamElts[j].first;
@@ -397,42 +766,21 @@ searchAll(PointRange &Query_Points,
   return all_neighbors;
 }
 
-// Returns a sequence of nearest neighbors each with their distance
-template<typename Point, typename QPoint, typename QQPoint,
-         typename PointRange, typename QPointRange, typename QQPointRange,
-         typename indexType>
+// Given the beam found by searching with (possibly quantized) points,
+// returns the k nearest with their distance to the full precision points.
+template<typename Point, typename PointRange, typename indexType, typename dist>
 parlay::sequence<std::pair<indexType, typename Point::distanceType>>
-beam_search_rerank(const Point &p,
-                   const QPoint &qp,
-                   const QQPoint &qqp,
-                   const Graph<indexType> &G,
-                   const PointRange &Base_Points,
-                   const QPointRange &Q_Base_Points,
-                   const QQPointRange &QQ_Base_Points,
-                   stats<indexType> &QueryStats,
-                   const parlay::sequence<indexType> starting_points,
-                   const QueryParams &QP,
-                   bool stats = true) {
+rerank_beam(const Point &p,
+            const parlay::sequence<std::pair<indexType, dist>> &beamElts,
+            const PointRange &Base_Points,
+            const QueryParams &QP,
+            bool use_rerank) {
   using dtype = typename Point::distanceType;
   using id_dist = std::pair<indexType, dtype>;
-  auto QPP = QP;
-
-  bool use_rerank = (Base_Points.params.num_bytes() != Q_Base_Points.params.num_bytes());
-  bool use_filtering = (Q_Base_Points.params.num_bytes() != QQ_Base_Points.params.num_bytes());
-  auto [pairElts, dist_cmps] = filtered_beam_search(G,
-                                                    qp, Q_Base_Points,
-                                                    qqp, QQ_Base_Points,
-                                                    starting_points, QPP, use_filtering);
-  auto [beamElts, visitedElts] = pairElts;
   if (beamElts.size() < QP.k) {
     std::cout << "Error: for point id " << p.id() << " beam search returned " << beamElts.size() << " elements, which is less than k = " << QP.k << std::endl;
     abort();
   }
-  
-  if (stats) {
-    QueryStats.increment_visited(p.id(), visitedElts.size());
-    QueryStats.increment_dist(p.id(), dist_cmps);
-  }
 
   if (use_rerank) {
     // recalculate distances with non-quantized points and sort
@@ -464,6 +812,38 @@ beam_search_rerank(const Point &p,
   }
 }
 
+// Returns a sequence of nearest neighbors each with their distance
+template<typename Point, typename QPoint, typename QQPoint,
+         typename PointRange, typename QPointRange, typename QQPointRange,
+         typename indexType>
+parlay::sequence<std::pair<indexType, typename Point::distanceType>>
+beam_search_rerank(const Point &p,
+                   const QPoint &qp,
+                   const QQPoint &qqp,
+                   const Graph<indexType> &G,
+                   const PointRange &Base_Points,
+                   const QPointRange &Q_Base_Points,
+                   const QQPointRange &QQ_Base_Points,
+                   stats<indexType> &QueryStats,
+                   const parlay::sequence<indexType> starting_points,
+                   const QueryParams &QP,
+                   bool stats = true) {
+  auto QPP = QP;
+
+  bool use_rerank = (Base_Points.params.num_bytes() != Q_Base_Points.params.num_bytes());
+  bool use_filtering = (Q_Base_Points.params.num_bytes() != QQ_Base_Points.params.num_bytes());
+  auto [pairElts, dist_cmps] = filtered_beam_search(G,
+                                                    qp, Q_Base_Points,
+                                                    qqp, QQ_Base_Points,
+                                                    starting_points, QPP, use_filtering);
+  auto [beamElts, visitedElts] = pairElts;
+  if (stats) {
+    QueryStats.increment_visited(p.id(), visitedElts.size());
+    QueryStats.increment_dist(p.id(), dist_cmps);
+  }
+  return rerank_beam(p, beamElts, Base_Points, QP, use_rerank);
+}
+
   // Returns a sequence of nearest neighbors each with their distance
 template<typename Point, typename QPoint,
          typename PointRange, typename QPointRange,
@@ -557,7 +937,8 @@ qsearchAll(const PointRange &Query_Points,
            stats<indexType> &QueryStats,
            const indexType starting_point,
            const QueryParams &QP,
-           bool random = false) {
+           bool random = false,
+           const parlay::sequence<indexType> &entry_points = {}) {
   if (QP.k > QP.beamSize) {
     std::cout << "Error: beam search parameter Q = " << QP.beamSize
               << " same size or smaller than k = " << QP.k << std::endl;
@@ -580,6 +961,41 @@ qsearchAll(const PointRange &Query_Points,
                                          QueryStats, starting_points, QP);
       all_neighbors[i] = parlay::map(ngh_dist, [] (auto& p) {return p.first;});
     });
+  } else if (QP.batch_size > 1) {
+    // as beam_search_rerank, with the searches of a batch run together
+    bool use_entry_points = QP.entry_seeds > 0 && entry_points.size() > 0;
+    bool use_rerank = (Base_Points.params.num_bytes() != Q_Base_Points.params.num_bytes());
+    bool use_filtering = (Q_Base_Points.params.num_bytes() != QQ_Base_Points.params.num_bytes());
+    auto order = batch_query_order(G, Q_Query_Points, Q_Base_Points, starting_point);
+    for_each_batch(order, QP.batch_size, [&] (auto ids) {
+      std::vector<parlay::sequence<indexType>> starts(ids.size(), {starting_point});
+      if (use_entry_points)
+        for (size_t j = 0; j < ids.size(); j++) {
+          starts[j] = nearest_entry_points(Q_Query_Points[ids[j]], Q_Base_Points,
+                                           entry_points, QP.entry_seeds);
+          QueryStats.increment_dist(ids[j], entry_points.size());
+        }
+      beam_search_batch(G, ids, Q_Query_Points, Q_Base_Points, QQ_Query_Points, QQ_Base_Points,
+                        starts, QP, use_filtering, [&] (size_t i, auto&& result) {
+        auto& [beamElts, visitedElts] = result.first;
+        QueryStats.increment_visited(i, visitedElts.size());
+        QueryStats.increment_dist(i, result.second);
+        auto ngh_dist = rerank_beam(Query_Points[i], beamElts, Base_Points, QP, use_rerank);
+        all_neighbors[i] = parlay::map(ngh_dist, [] (auto& p) {return p.first;});
+      });
+    });
+  } else if (QP.entry_seeds > 0 && entry_points.size() > 0) {
+    // start each query from the entry points nearest to it
+    parlay::parallel_for(0, Query_Points.size(), [&](size_t i) {
+      auto starting_points = nearest_entry_points(Q_Query_Points[i], Q_Base_Points,
+                                                  entry_points, QP.entry_seeds);
+      QueryStats.increment_dist(i, entry_points.size());
+      auto ngh_dist = beam_search_rerank(Query_Points[i], Q_Query_Points[i], QQ_Query_Points[i],
+                                         G,
+                                         Base_Points, Q_Base_Points, QQ_Base_Points,
+                                         QueryStats, starting_points, QP);
+      all_neighbors[i] = parlay::map(ngh_dist, [] (auto& p) {return p.first;});
+    });
   } else {
     parlay::sequence<indexType> starting_points = {starting_point};
     parlay::parallel_for(0, Query_Points.size(), [&](size_t i) {
@@ -0,0 +1,174 @@
+#include "algorithms/utils/beamSearch.h"
+
+#include <map>
+#include <random>
+#include <vector>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/graph.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using Point = Euclidian_Point<float>;
+
+TEST(BeamSearchTest, PrefetchDepthDoesNotChangeResults) {
+  size_t n = 2000;
+  int d = 16;
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  std::vector<float> data(n * d);
+  for (auto& x : data) x = dist(rng);
+  Point::parameters params(d);
+  std::vector<Point> points;
+  for (size_t i = 0; i < n; i++)
+    points.push_back(Point((uint8_t*) (data.data() + i * d), i, params));
+
+  long max_deg = 24;
+  Graph<unsigned int> G(max_deg, n);
+  for (size_t i = 0; i < n; i++) {
+    std::vector<unsigned int> ngh;
+    for (long j = 0; j < max_deg; j++) ngh.push_back(rng() % n);
+    G[i].update_neighbors(ngh);
+  }
+
+  parlay::sequence<unsigned int> starts = {0};
+  for (long Q : {10, 64}) {
+    QueryParams QP(10, Q, 1.35, n, max_deg);
+    for (size_t q = 0; q < 50; q++) {
+      Point p = points[rng() % n];
+      QP.prefetch_depth = 0;
+      auto [expected, expected_cmps] = beam_search(p, G, points, starts, QP);
+      for (int depth : {1, 2, 4}) {
+        QP.prefetch_depth = depth;
+        auto [r, cmps] = beam_search(p, G, points, starts, QP);
+        EXPECT_EQ(r.first, expected.first) << "depth=" << depth;
+        EXPECT_EQ(r.second, expected.second) << "depth=" << depth;
+        EXPECT_EQ(cmps, expected_cmps) << "depth=" << depth;
+      }
+    }
+  }
+}
+
+TEST(BeamSearchTest, ResultsDoNotDependOnEarlierSearches) {
+  size_t n = 3000;
+  int d = 8;
+  std::mt19937 rng(2);
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  std::vector<float> data(n * d);
+  for (auto& x : data) x = dist(rng);
+  Point::parameters params(d);
+  std::vector<Point> points;
+  for (size_t i = 0; i < n; i++)
+    points.push_back(Point((uint8_t*) (data.data() + i * d), i, params));
+
+  long max_deg = 16;
+  Graph<unsigned int> G(max_deg, n);
+  for (size_t i = 0; i < n; i++) {
+    std::vector<unsigned int> ngh;
+    for (long j = 0; j < max_deg; j++) ngh.push_back(rng() % n);
+    G[i].update_neighbors(ngh);
+  }
+
+  // the first search with each beam size runs on a fresh context, the
+  // later ones on a context left over from searches with other beams
+  std::vector<long> beams = {500, 10, 1000, 64, 10, 1000, 500, 64};
+  parlay::sequence<unsigned int> starts = {0, 1, 2};
+  Point p = points[17];
+  std::map<long, decltype(beam_search(p, G, points, starts, QueryParams()))> first;
+  for (long Q : beams) {
+    QueryParams QP(10, Q, 1.35, n, max_deg);
+    auto r = beam_search(p, G, points, starts, QP);
+    auto& visited = r.first.second;
+    EXPECT_TRUE(std::is_sorted(visited.begin(), visited.end(), [] (auto a, auto b) {
+      return a.second < b.second || (a.second == b.second && a.first < b.first);}));
+    auto [it, fresh] = first.emplace(Q, r);
+    if (fresh) continue;
+    EXPECT_EQ(r.first.first, it->second.first.first) << "Q=" << Q;
+    EXPECT_EQ(r.first.second, it->second.first.second) << "Q=" << Q;
+    EXPECT_EQ(r.second, it->second.second) << "Q=" << Q;
+  }
+}
+
+TEST(BeamSearchTest, AdaptiveTerminationStopsEarly) {
+  size_t n = 3000;
+  int d = 8;
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  std::vector<float> data(n * d);
+  for (auto& x : data) x = dist(rng);
+  Point::parameters params(d);
+  std::vector<Point> points;
+  for (size_t i = 0; i < n; i++)
+    points.push_back(Point((uint8_t*) (data.data() + i * d), i, params));
+
+  long max_deg = 16;
+  Graph<unsigned int> G(max_deg, n);
+  for (size_t i = 0; i < n; i++) {
+    std::vector<unsigned int> ngh;
+    for (long j = 0; j < max_deg; j++) ngh.push_back(rng() % n);
+    G[i].update_neighbors(ngh);
+  }
+
+  parlay::sequence<unsigned int> starts = {0};
+  QueryParams QP(10, 200, 1.35, n, max_deg);
+  long full_visits = 0, patience_visits = 0, ratio_visits = 0;
+  for (size_t q = 0; q < 50; q++) {
+    Point p = points[rng() % n];
+    QP.patience = 0;
+    QP.stop_ratio = 0;
+    auto [full, full_cmps] = beam_search(p, G, points, starts, QP);
+    full_visits += full.second.size();
+
+    // stopping early visits a subset of the vertices of the full search
+    auto subset = [&] (auto& visited) {
+      for (auto v : visited)
+        if (std::find(full.second.begin(), full.second.end(), v) == full.second.end())
+          return false;
+      return true;
+    };
+    QP.patience = 10;
+    auto [r, cmps] = beam_search(p, G, points, starts, QP);
+    EXPECT_TRUE(subset(r.second));
+    EXPECT_LE(cmps, full_cmps);
+    patience_visits += r.second.size();
+
+    QP.patience = 0;
+    QP.stop_ratio = 1.05;
+    auto [s, s_cmps] = beam_search(p, G, points, starts, QP);
+    EXPECT_TRUE(subset(s.second));
+    ratio_visits += s.second.size();
+
+    // with patience beyond the number of visits nothing changes
+    QP.stop_ratio = 0;
+    QP.patience = n;
+    auto [same, same_cmps] = beam_search(p, G, points, starts, QP);
+    EXPECT_EQ(same.first, full.first);
+    EXPECT_EQ(same.second, full.second);
+  }
+  EXPECT_LT(patience_visits, full_visits);
+  EXPECT_LT(ratio_visits, full_visits);
+
+  // the calibrated ratio keeps the requested fraction of the top k
+  std::vector<Point> queries;
+  for (size_t q = 0; q < 100; q++) queries.push_back(points[rng() % n]);
+  QP.patience = 0;
+  QP.stop_ratio = 0;
+  double ratio = calibrate_stop_ratio(G, queries, points, starts, QP, .95);
+  EXPECT_GE(ratio, 1.0);
+  long agree = 0, total = 0;
+  for (auto& p : queries) {
+    QP.stop_ratio = 0;
+    auto full = beam_search(p, G, points, starts, QP).first.first;
+    QP.stop_ratio = ratio;
+    auto r = beam_search(p, G, points, starts, QP).first.first;
+    for (long j = 0; j < QP.k; j++, total++)
+      for (long l = 0; l < std::min<long>(QP.k, r.size()); l++)
+        agree += r[l].first == full[j].first;
+  }
+  EXPECT_GE(agree, .95 * total);
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -0,0 +1,85 @@
+#include <random>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/jl_point.h"
+#include "algorithms/utils/mips_point.h"
+#include "algorithms/utils/point_range.h"
+#include "algorithms/utils/test_points.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using PR = PointRange<Euclidian_Point<float>>;
+
+const std::normal_distribution<float> normal(0.0, 1.0);
+
+// the bits of each coordinate, read back through operator[]
+template <typename Point>
+int ReferenceHamming(const Point& p, const Point& q, int dims) {
+  int count = 0;
+  for (int j = 0; j < dims; j++) count += (p[j] != q[j]);
+  return count;
+}
+
+class BitPointTest : public testing::TestWithParam<unsigned int> {};
+
+TEST_P(BitPointTest, EuclideanBitMatchesReference) {
+  unsigned int d = GetParam();
+  PR A = RandomPoints<Euclidian_Point<float>>(50, d, 1, normal);
+  PointRange<Euclidean_Bit_Point> P(A, Euclidean_Bit_Point::generate_parameters(A));
+  for (long i = 0; i < 50; i++)
+    for (long j = 0; j < 50; j++) {
+      int expected = 0;
+      for (unsigned int c = 0; c < d; c++)
+        expected += (A[i][c] > P.params.median) != (A[j][c] > P.params.median);
+      EXPECT_EQ(P[i].distance(P[j]), expected) << "d=" << d;
+    }
+}
+
+TEST_P(BitPointTest, MipsBitMatchesReference) {
+  unsigned int d = GetParam();
+  PR A = RandomPoints<Euclidian_Point<float>>(50, d, 2, normal);
+  PointRange<Mips_Bit_Point> P(A);
+  for (long i = 0; i < 50; i++)
+    for (long j = 0; j < 50; j++) {
+      int expected = 0;
+      for (unsigned int c = 0; c < d; c++) expected += (A[i][c] > 0) != (A[j][c] > 0);
+      EXPECT_EQ(P[i].distance(P[j]), expected) << "d=" << d;
+    }
+}
+
+TEST_P(BitPointTest, Mips2BitMatchesReference) {
+  unsigned int d = GetParam();
+  PR A = RandomPoints<Euclidian_Point<float>>(50, d, 3, normal);
+  PointRange<Mips_2Bit_Point> P(A);
+  float cut = P.params.cut;
+  auto ternary = [&] (float x) {return x > cut ? 1 : (x < -cut ? -1 : 0);};
+  for (long i = 0; i < 50; i++)
+    for (long j = 0; j < 50; j++) {
+      int dot = 0;
+      for (unsigned int c = 0; c < d; c++) dot += ternary(A[i][c]) * ternary(A[j][c]);
+      EXPECT_EQ(P[i].distance(P[j]), -dot) << "d=" << d;
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Dimensions, BitPointTest, testing::Values(1, 63, 64, 100, 200, 1000));
+
+template <typename Point>
+void ExpectJLMatchesReference(const PR& A) {
+  PointRange<Point> P(A);
+  int bits = P.params.num_bytes() * 8;
+  for (long i = 0; i < 30; i++)
+    for (long j = 0; j < 30; j++)
+      EXPECT_EQ(P[i].distance(P[j]), ReferenceHamming(P[i], P[j], bits));
+}
+
+TEST(JLBitPointTest, MatchesReference) {
+  PR A = RandomPoints<Euclidian_Point<float>>(30, 100, 4, normal);
+  ExpectJLMatchesReference<Euclidean_JL_Sparse_Point<1024>>(A);
+  ExpectJLMatchesReference<Mips_JL_Sparse_Point<512>>(A);
+  ExpectJLMatchesReference<Mips_JL_Bit_Point<256>>(A);
+}
+
+}  // namespace
+}  // namespace parlayANN
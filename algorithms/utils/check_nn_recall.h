@@ -2,11 +2,16 @@
 #define ALGORITHMS_CHECK_NN_RECALL_H_
 
 #include <algorithm>
+#include <map>
 #include <set>
+#include <tuple>
+#include <vector>
 
 #include "beamSearch.h"
 #include "csvfile.h"
+#include "latency_bench.h"
 #include "parse_results.h"
+#include "reorder.h"
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "types.h"
@@ -27,7 +32,9 @@ nn_result checkRecall(const Graph<indexType> &G,
                       const long start_point,
                       const long k,
                       const QueryParams &QP,
-                      const bool verbose) {
+                      const bool verbose,
+                      const parlay::sequence<indexType> &entry_points = {},
+                      const parlay::sequence<indexType> &id_map = {}) {
   using Point = typename PointRange::Point;
 
   if (GT.size() > 0 && k > GT.dimension()) {
@@ -37,6 +44,7 @@ nn_result checkRecall(const Graph<indexType> &G,
   }
 
   parlay::sequence<parlay::sequence<indexType>> all_ngh;
+  parlay::sequence<double> latencies;
 
   parlay::internal::timer t;
   float query_time;
@@ -45,7 +53,26 @@ nn_result checkRecall(const Graph<indexType> &G,
   // to help clear the cache between runs
   auto volatile xx = parlay::random_permutation<long>(5000000);
   t.next_time();
-  if (random) {
+  if (QP.latency) {
+    // one query at a time under the load generator, timing each
+    all_ngh = parlay::sequence<parlay::sequence<indexType>>(Query_Points.size());
+    parlay::random_generator gen;
+    std::uniform_int_distribution<long> dis(0, G.size() - 1);
+    latencies = run_with_load(Query_Points.size(), QP.concurrency, QP.arrival_rate, [&] (size_t i) {
+      auto r = gen[i];
+      parlay::sequence<indexType> starting_points = {(indexType) (random ? dis(r) : start_point)};
+      if (!random && QP.entry_seeds > 0 && entry_points.size() > 0) {
+        starting_points = nearest_entry_points(Q_Query_Points[i], Q_Base_Points,
+                                               entry_points, QP.entry_seeds);
+        QueryStats.increment_dist(i, entry_points.size());
+      }
+      auto ngh_dist = beam_search_rerank(Query_Points[i], Q_Query_Points[i], QQ_Query_Points[i],
+                                         G,
+                                         Base_Points, Q_Base_Points, QQ_Base_Points,
+                                         QueryStats, starting_points, QP);
+      all_ngh[i] = parlay::map(ngh_dist, [] (auto& p) {return p.first;});
+    });
+  } else if (random) {
     all_ngh = qsearchAll<PointRange, QPointRange, QQPointRange, indexType>(Query_Points, Q_Query_Points, QQ_Query_Points,
                                                                            G,
                                                                            Base_Points, Q_Base_Points, QQ_Base_Points,
@@ -54,10 +81,33 @@ nn_result checkRecall(const Graph<indexType> &G,
     all_ngh = qsearchAll<PointRange, QPointRange, QQPointRange, indexType>(Query_Points, Q_Query_Points, QQ_Query_Points,
                                                                            G,
                                                                            Base_Points, Q_Base_Points, QQ_Base_Points,
-                                                                           QueryStats, start_point, QP);
+                                                                           QueryStats, start_point, QP, false, entry_points);
   }
   query_time = t.next_time();
-  
+
+  // on reordered points (see reorder.h) the results are renamed to the
+  // original ids, which the ground truth uses
+  if (id_map.size() > 0)
+    parlay::parallel_for(0, all_ngh.size(), [&] (size_t i) {
+      for (auto& id : all_ngh[i]) id = id_map[id];});
+
+  // with adaptive termination, count the visits each query saved by
+  // rerunning it without (not timed)
+  bool adaptive = QP.k > 0 && (QP.patience > 0 || QP.stop_ratio > 0);
+  parlay::sequence<long> hops_saved;
+  if (adaptive) {
+    QueryParams QP_full = QP;
+    QP_full.patience = 0;
+    QP_full.stop_ratio = 0;
+    stats<indexType> FullStats(Query_Points.size());
+    qsearchAll<PointRange, QPointRange, QQPointRange, indexType>(Query_Points, Q_Query_Points, QQ_Query_Points,
+                                                                 G,
+                                                                 Base_Points, Q_Base_Points, QQ_Base_Points,
+                                                                 FullStats, start_point, QP_full, random, entry_points);
+    hops_saved = parlay::tabulate(Query_Points.size(), [&] (size_t i) {
+      return (long) FullStats.visited[i] - (long) QueryStats.visited[i];});
+  }
+
   float recall = 0.0;
   //TODO deprecate this after further testing
   bool dists_present = true;
@@ -111,7 +161,8 @@ nn_result checkRecall(const Graph<indexType> &G,
     recall = static_cast<float>(numCorrect) / static_cast<float>(k * n);
   }
   float QPS = Query_Points.size() / query_time;
-  if (verbose)
+  auto percentiles = latency_percentiles(latencies);
+  if (verbose) {
     std::cout << "search: Q=" << QP.beamSize << ", k=" << QP.k
               << ", limit=" << QP.limit
       //<< ", dlimit=" << QP.degree_limit
@@ -119,11 +170,21 @@ nn_result checkRecall(const Graph<indexType> &G,
               << ", visited=" << QueryStats.visited_stats()[0]
               << ", comparisons=" << QueryStats.dist_stats()[0]
               << ", QPS=" << QPS
-              << ", ctime=" << 1/(QPS*QueryStats.dist_stats()[0]) * 1e9 << std::endl;
+              << ", ctime=" << 1/(QPS*QueryStats.dist_stats()[0]) * 1e9;
+    if (QP.latency)
+      std::cout << ", latency p50=" << percentiles[0] << "us, p90=" << percentiles[1]
+                << "us, p99=" << percentiles[2] << "us, p99.9=" << percentiles[3] << "us";
+    if (adaptive)
+      std::cout << ", patience=" << QP.patience << ", stop_ratio=" << QP.stop_ratio
+                << ", hops saved=" << (double) parlay::reduce(hops_saved) / hops_saved.size();
+    std::cout << std::endl;
+  }
 
   auto stats_ = {QueryStats.dist_stats(), QueryStats.visited_stats()};
   parlay::sequence<indexType> stats = parlay::flatten(stats_);
   nn_result N(recall, stats, QPS, k, QP.beamSize, QP.cut, Query_Points.size(), QP.limit, QP.degree_limit, k);
+  if (QP.latency) N.set_latency(percentiles);
+  if (adaptive) N.set_hops_saved(hops_saved);
   return N;
 }
 
@@ -149,12 +210,19 @@ void write_to_csv(std::string csv_filename, parlay::sequence<float> buckets,
       << "Tail Visited"
       << "k"
       << "Q"
-      << "cut" << endrow;
+      << "cut"
+      << "p50 latency (us)"
+      << "p90 latency (us)"
+      << "p99 latency (us)"
+      << "p99.9 latency (us)"
+      << "Average hops saved"
+      << "Tail hops saved" << endrow;
   for (int i = 0; i < results.size(); i++) {
     nn_result N = results[i];
     csv << N.num_queries << buckets[i] << N.recall << N.QPS << N.avg_cmps
         << N.tail_cmps << N.avg_visited << N.tail_visited << N.k << N.beamQ
-        << N.cut << endrow;
+        << N.cut << N.p50_latency << N.p90_latency << N.p99_latency
+        << N.p999_latency << N.avg_hops_saved << N.tail_hops_saved << endrow;
   }
   csv << endrow;
   csv << endrow;
@@ -170,15 +238,51 @@ parlay::sequence<long> calculate_limits(size_t upper_bound) {
   return L; //limits;
 }
 
+// Settings of search_and_parse other than the graph and the points.
+// The fields of query that are not swept (batch size, prefetch depth,
+// latency measurement, adaptive termination, entry seeds and rerank
+// factor) apply to every search.  The sweep sets k, the beam width, the
+// cut and the limits.
+template<typename indexType>
+struct search_settings {
+  QueryParams query;
+  bool random = false; // start each query at a random vertex
+  indexType start_point = 0;
+  bool verbose = false;
+  long fixed_beam_width = 0; // only search with this beam width (0 = sweep)
+  double stop_agreement = 0; // calibrate query.stop_ratio, see calibrate_stop_ratio
+  parlay::sequence<indexType> entry_points; // see entry_points.h
+  parlay::sequence<indexType> id_map; // original ids of reordered points (see reorder.h)
+
+  search_settings() {}
+
+  // the search settings given on the commandline
+  search_settings(const BuildParams &BP) {
+    query.rerank_factor = BP.rerank_factor;
+    query.batch_size = BP.batch_size;
+    query.prefetch_depth = BP.prefetch_depth;
+    query.latency = BP.latency;
+    query.concurrency = BP.concurrency;
+    query.arrival_rate = BP.arrival_rate;
+    query.patience = BP.patience;
+    query.stop_ratio = BP.stop_ratio;
+    query.entry_seeds = BP.entry_seeds;
+    verbose = BP.verbose;
+    fixed_beam_width = BP.Q;
+    stop_agreement = BP.stop_agreement;
+    if (!BP.id_map.empty()) id_map = load_id_map<indexType>(BP.id_map.c_str());
+  }
+};
+
 template<typename PointRange, typename indexType>
 void search_and_parse(Graph_ G_,
                       Graph<indexType> &G,
                       PointRange &Base_Points,
                       PointRange &Query_Points,
                       groundTruth<indexType> GT, char* res_file, long k,
-                      bool verbose = false,
-                      long fixed_beam_width = 0) {
-  search_and_parse(G_, G, Base_Points, Query_Points, Base_Points, Query_Points, Base_Points, Query_Points, GT, res_file, k, false, 0u, verbose, fixed_beam_width);
+                      const search_settings<indexType> &S) {
+  search_and_parse(G_, G, Base_Points, Query_Points, Base_Points, Query_Points,
+                   Base_Points, Query_Points, GT, res_file, k, S);
 }
 
 template<typename PointRange, typename QPointRange, typename QQPointRange, typename indexType>
@@ -191,28 +295,56 @@ void search_and_parse(Graph_ G_,
                       QQPointRange &QQ_Base_Points,
                       QQPointRange &QQ_Query_Points,
                       groundTruth<indexType> GT, char* res_file, long k,
-                      bool random = true,
-                      indexType start_point = 0,
-                      bool verbose = false,
-                      long fixed_beam_width = 0,
-                      int rerank_factor = 100) {
+                      const search_settings<indexType> &S) {
   parlay::sequence<nn_result> results;
   std::vector<long> beams;
   std::vector<long> allr;
   std::vector<double> cuts;
 
-  auto check = [&] (const long k, const QueryParams QP) {
+  // The stop ratio is calibrated once per beam on a sample of the base
+  // points, not on the queries whose recall is reported.  Each sample
+  // point starts where checkRecall would start a query.
+  std::map<std::tuple<long, long, long, long>, double> calibrated;
+  auto calibrated_stop_ratio = [&] (const QueryParams& QP) {
+    auto key = std::tuple(QP.k, QP.beamSize, QP.limit, QP.degree_limit);
+    if (calibrated.count(key) == 0) {
+      long n = Q_Base_Points.size();
+      long sample_size = std::min<long>(1000, n);
+      std::vector<typename QPointRange::Point> sample;
+      for (long i = 0; i < sample_size; i++)
+        sample.push_back(Q_Base_Points[i * n / sample_size]);
+      auto starts = parlay::tabulate(sample_size, [&] (long i) {
+        if (S.random) return parlay::sequence<indexType>(1, parlay::hash64(i) % G.size());
+        if (QP.entry_seeds > 0 && S.entry_points.size() > 0)
+          return nearest_entry_points(sample[i], Q_Base_Points, S.entry_points, QP.entry_seeds);
+        return parlay::sequence<indexType>(1, S.start_point);});
+      calibrated[key] = calibrate_stop_ratio(G, sample, Q_Base_Points, starts, QP,
+                                             S.stop_agreement, sample_size);
+    }
+    return calibrated[key];
+  };
+
+  // runs the searches with the settings of S and the k, beam width,
+  // cut and limits of sweep
+  auto check = [&] (const long k, const QueryParams &sweep) {
+    QueryParams QP = S.query;
+    QP.k = sweep.k;
+    QP.beamSize = sweep.beamSize;
+    QP.cut = sweep.cut;
+    QP.limit = sweep.limit;
+    QP.degree_limit = sweep.degree_limit;
+    if (S.stop_agreement > 0 && QP.k > 0)
+      QP.stop_ratio = calibrated_stop_ratio(QP);
     return checkRecall(G,
                        Base_Points, Query_Points,
                        Q_Base_Points, Q_Query_Points,
                        QQ_Base_Points, QQ_Query_Points,
                        GT,
-                       random,
-                       start_point, k, QP, verbose);};
+                       S.random,
+                       S.start_point, k, QP, S.verbose, S.entry_points, S.id_map);};
 
   QueryParams QP;
   QP.limit = (long) G.size();
-  QP.rerank_factor = rerank_factor;
   QP.degree_limit = (long) G.max_degree();
   beams = {10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 22, 24, 26, 28, 30, 32,
     34, 36, 38, 40, 45, 50, 55, 60, 65, 70, 80, 90, 100, 120, 140, 160,
@@ -221,10 +353,10 @@ void search_and_parse(Graph_ G_,
   else allr = {k};
   cuts = {1.35};
 
-  if (fixed_beam_width != 0) {
+  if (S.fixed_beam_width != 0) {
     QP.k = allr[0];
     QP.cut = cuts[0];
-    QP.beamSize = fixed_beam_width;
+    QP.beamSize = S.fixed_beam_width;
     for (int i = 0; i < 5; i++)
       check(QP.k, QP);
   } else {
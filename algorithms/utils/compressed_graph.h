@@ -0,0 +1,281 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+
+#include "graph.h"
+
+namespace parlayANN {
+
+// Read-only graph stored in CSR form with variable length neighbor
+// lists.  Each vertex is encoded as
+//   varint(degree) varint(zigzag(ngh[0] - v)) varint(zigzag(ngh[1] - ngh[0])) ...
+// so that ids close to each other (and to v, for graphs whose vertices
+// have been reordered for locality) take one or two bytes instead of
+// sizeof(indexType).  The gaps are signed so that the neighbors keep
+// their order: lists are usually sorted by distance, and a search with
+// a degree limit relies on it to read the nearest ones.  Unlike Graph,
+// there are no empty slots for vertices with degree below max_degree.
+
+namespace varint {
+
+inline size_t length(uint64_t x) {
+  size_t l = 1;
+  while (x >= 0x80) {x >>= 7; l++;}
+  return l;
+}
+
+inline uint8_t* encode(uint64_t x, uint8_t* out) {
+  while (x >= 0x80) {
+    *out++ = (uint8_t) (x | 0x80);
+    x >>= 7;
+  }
+  *out++ = (uint8_t) x;
+  return out;
+}
+
+inline uint64_t decode(const uint8_t*& in) {
+  uint64_t b = *in++;
+  if (b < 0x80) return b;  // fast path: most deltas fit in one byte
+  uint64_t x = b & 0x7f;
+  int shift = 7;
+  do {
+    b = *in++;
+    x |= (b & 0x7f) << shift;
+    shift += 7;
+  } while (b >= 0x80);
+  return x;
+}
+
+inline uint64_t zigzag(int64_t x) {return ((uint64_t) x << 1) ^ (uint64_t) (x >> 63);}
+inline int64_t unzigzag(uint64_t x) {return (int64_t) (x >> 1) ^ -(int64_t) (x & 1);}
+
+} // end namespace varint
+
+template<typename indexType>
+struct compressedEdgeRange{
+
+  // Forward iterator that decodes one neighbor per increment.
+  struct iterator {
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = indexType;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const indexType*;
+    using reference = indexType;
+
+    indexType operator * () const {return value;}
+    iterator& operator ++ () {
+      if (--remaining > 0) value += (indexType) varint::unzigzag(varint::decode(ptr));
+      return *this;
+    }
+    iterator operator ++ (int) {iterator r = *this; ++(*this); return r;}
+    bool operator == (const iterator& o) const {return remaining == o.remaining;}
+    bool operator != (const iterator& o) const {return remaining != o.remaining;}
+
+    const uint8_t* ptr;
+    size_t remaining;
+    indexType value;
+  };
+
+  size_t size() const {return degree;}
+
+  indexType id() const {return id_;}
+
+  compressedEdgeRange() : start(nullptr), stop(nullptr), degree(0), id_(0) {}
+
+  compressedEdgeRange(const uint8_t* begin, const uint8_t* end, indexType id)
+    : stop(end), id_(id) {
+    start = begin;
+    degree = varint::decode(start);
+    cursor = start;
+    pos = 0;
+  }
+
+  // Neighbors are decoded sequentially, so accessing them in
+  // increasing order (as the search loops do) costs O(1) per access.
+  // Going backwards restarts the decoding from the first neighbor.
+  indexType operator [] (indexType j) const {
+    if (j >= degree) {
+      std::cout << "ERROR: index exceeds degree while accessing neighbors" << std::endl;
+      abort();
+    }
+    if (j < pos) {
+      cursor = start;
+      pos = 0;
+    }
+    while (pos <= j) {
+      last = (indexType) ((pos == 0 ? id_ : last) + varint::unzigzag(varint::decode(cursor)));
+      pos++;
+    }
+    return last;
+  }
+
+  void prefetch() const {
+    for (const uint8_t* p = start; p < stop; p += 64)
+      __builtin_prefetch(p);
+  }
+
+  iterator begin() const {
+    iterator it{start, degree, 0};
+    if (degree > 0)
+      it.value = (indexType) (id_ + varint::unzigzag(varint::decode(it.ptr)));
+    return it;
+  }
+
+  iterator end() const {return iterator{stop, 0, 0};}
+
+private:
+  const uint8_t* start;  // first byte after the degree
+  const uint8_t* stop;
+  size_t degree;
+  indexType id_;
+  mutable const uint8_t* cursor;
+  mutable size_t pos;
+  mutable indexType last;
+};
+
+struct compressed_graph_file_header {
+  static constexpr uint64_t magic_value = 0x3247435f4e4e4150ul; // "PANN_CG2"
+  // files written before the gaps were signed, with sorted lists
+  static constexpr uint64_t sorted_magic_value = 0x3147435f4e4e4150ul; // "PANN_CG1"
+  uint64_t magic;
+  uint64_t num_points;
+  uint64_t max_degree;
+  uint32_t index_bytes;  // sizeof(indexType)
+  uint32_t pad;
+  uint64_t num_edge_bytes;
+};
+
+template<typename indexType_>
+struct Compressed_Graph{
+  using indexType = indexType_;
+
+  long max_degree() const {return maxDeg;}
+  size_t size() const {return n;}
+
+  // bytes used by the offsets and the encoded neighbor lists
+  size_t num_bytes() const {return offsets.size() * sizeof(size_t) + edges.size();}
+
+  Compressed_Graph() : n(0), maxDeg(0) {}
+
+  Compressed_Graph(const Graph<indexType> &G) : n(G.size()), maxDeg(G.max_degree()) {
+    // the j-th gap of the list of vertex i
+    auto gap = [] (size_t i, const edgeRange<indexType> &ngh, size_t j) {
+      return varint::zigzag((int64_t) ngh[j] - (int64_t) (j == 0 ? i : ngh[j-1]));
+    };
+    auto lengths = parlay::tabulate(n, [&] (size_t i) {
+      auto ngh = G[i];
+      size_t l = varint::length(ngh.size());
+      for (size_t j = 0; j < ngh.size(); j++) l += varint::length(gap(i, ngh, j));
+      return l;});
+    auto [o, total] = parlay::scan(lengths);
+    offsets = std::move(o);
+    offsets.push_back(total);
+    edges = parlay::sequence<uint8_t>::uninitialized(total);
+    parlay::parallel_for(0, n, [&] (size_t i) {
+      auto ngh = G[i];
+      uint8_t* out = varint::encode(ngh.size(), edges.begin() + offsets[i]);
+      for (size_t j = 0; j < ngh.size(); j++) out = varint::encode(gap(i, ngh, j), out);
+    });
+  }
+
+  Compressed_Graph(char* gFile) {
+    std::ifstream reader(gFile, std::ios::binary);
+    if (!reader.is_open()) {
+      std::cout << "graph file " << gFile << " not found" << std::endl;
+      abort();
+    }
+    compressed_graph_file_header header;
+    reader.read((char*) &header, sizeof(header));
+    if (reader && header.magic == compressed_graph_file_header::sorted_magic_value) {
+      std::cout << "ERROR: " << gFile << " was written by an older compress_graph "
+                << "that sorted the neighbor lists; compress the graph again" << std::endl;
+      abort();
+    }
+    if (!reader || header.magic != compressed_graph_file_header::magic_value) {
+      std::cout << "ERROR: " << gFile << " is not a compressed graph file" << std::endl;
+      abort();
+    }
+    if (header.index_bytes != sizeof(indexType)) {
+      std::cout << "ERROR: graph file " << gFile << " uses " << header.index_bytes
+                << " byte ids, expected " << sizeof(indexType) << std::endl;
+      abort();
+    }
+    n = header.num_points;
+    maxDeg = header.max_degree;
+    offsets = parlay::sequence<size_t>::uninitialized(n + 1);
+    edges = parlay::sequence<uint8_t>::uninitialized(header.num_edge_bytes);
+    reader.read((char*) offsets.begin(), (n + 1) * sizeof(size_t));
+    reader.read((char*) edges.begin(), edges.size());
+    if (!reader || offsets[n] != edges.size()) {
+      std::cout << "ERROR: graph file " << gFile << " is truncated" << std::endl;
+      abort();
+    }
+    std::cout << "Compressed graph: read " << n << " points with max degree "
+              << maxDeg << " (" << num_bytes() << " bytes)" << std::endl;
+  }
+
+  void save(char* oFile) const {
+    std::cout << "Writing compressed graph with " << n << " points and max degree "
+              << maxDeg << std::endl;
+    compressed_graph_file_header header;
+    header.magic = compressed_graph_file_header::magic_value;
+    header.num_points = n;
+    header.max_degree = maxDeg;
+    header.index_bytes = sizeof(indexType);
+    header.pad = 0;
+    header.num_edge_bytes = edges.size();
+    std::ofstream writer(oFile, std::ios::binary | std::ios::out);
+    writer.write((char*) &header, sizeof(header));
+    writer.write((char*) offsets.begin(), offsets.size() * sizeof(size_t));
+    writer.write((char*) edges.begin(), edges.size());
+    writer.close();
+  }
+
+  compressedEdgeRange<indexType> operator [] (indexType i) const {
+    if (i >= n) {
+      std::cout << "ERROR: graph index out of range: " << i << std::endl;
+      abort();
+    }
+    return compressedEdgeRange<indexType>(edges.begin() + offsets[i],
+                                          edges.begin() + offsets[i+1],
+                                          i);
+  }
+
+private:
+  size_t n;
+  long maxDeg;
+  parlay::sequence<size_t> offsets;
+  parlay::sequence<uint8_t> edges;
+};
+
+} // end namespace
@@ -0,0 +1,113 @@
+#include "algorithms/utils/compressed_graph.h"
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "algorithms/utils/beamSearch.h"
+#include "algorithms/utils/euclidian_point.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+// random graph where neighbors are unsorted and degrees vary from 0 to max_deg
+Graph<unsigned int> RandomGraph(size_t n, long max_deg, unsigned seed) {
+  std::mt19937 rng(seed);
+  Graph<unsigned int> G(max_deg, n);
+  for (size_t i = 0; i < n; i++) {
+    long deg = rng() % (max_deg + 1);
+    std::vector<unsigned int> ngh;
+    for (long j = 0; j < deg; j++) ngh.push_back(rng() % n);
+    G[i].update_neighbors(ngh);
+  }
+  return G;
+}
+
+std::vector<unsigned int> Neighbors(const Graph<unsigned int> &G, unsigned int i) {
+  return std::vector<unsigned int>(G[i].begin(), G[i].end());
+}
+
+// the neighbors keep their order
+TEST(CompressedGraphTest, MatchesGraph) {
+  auto G = RandomGraph(1000, 64, 1);
+  Compressed_Graph<unsigned int> CG(G);
+  EXPECT_EQ(CG.size(), G.size());
+  EXPECT_EQ(CG.max_degree(), G.max_degree());
+  for (unsigned int i = 0; i < G.size(); i++) {
+    auto expected = Neighbors(G, i);
+    auto ngh = CG[i];
+    ASSERT_EQ(ngh.size(), expected.size());
+    EXPECT_EQ(ngh.id(), i);
+    std::vector<unsigned int> iterated(ngh.begin(), ngh.end());
+    EXPECT_EQ(iterated, expected);
+    // in order, then backwards to force the decoder to restart
+    for (size_t j = 0; j < expected.size(); j++) EXPECT_EQ(ngh[j], expected[j]);
+    for (size_t j = expected.size(); j > 0; j--) EXPECT_EQ(ngh[j-1], expected[j-1]);
+  }
+}
+
+TEST(CompressedGraphTest, LargeIdsAndGaps) {
+  // ids far from the vertex id and from each other need multi-byte varints
+  size_t n = 4;
+  Graph<unsigned int> G(3, n);
+  std::vector<unsigned int> a = {4000000000u, 0, 1u << 31};
+  std::vector<unsigned int> b = {3, 2};
+  G[0].update_neighbors(a);
+  G[3].update_neighbors(b);
+  Compressed_Graph<unsigned int> CG(G);
+  for (unsigned int i = 0; i < n; i++) {
+    auto ngh = CG[i];
+    EXPECT_EQ(std::vector<unsigned int>(ngh.begin(), ngh.end()), Neighbors(G, i));
+  }
+}
+
+TEST(CompressedGraphTest, SaveAndLoad) {
+  auto G = RandomGraph(500, 32, 2);
+  Compressed_Graph<unsigned int> CG(G);
+  std::string path = testing::TempDir() + "/compressed_graph_test.cg";
+  CG.save(path.data());
+  Compressed_Graph<unsigned int> loaded(path.data());
+  std::remove(path.c_str());
+  EXPECT_EQ(loaded.size(), CG.size());
+  EXPECT_EQ(loaded.max_degree(), CG.max_degree());
+  EXPECT_EQ(loaded.num_bytes(), CG.num_bytes());
+  for (unsigned int i = 0; i < G.size(); i++) {
+    auto ngh = loaded[i];
+    EXPECT_EQ(std::vector<unsigned int>(ngh.begin(), ngh.end()), Neighbors(G, i));
+  }
+}
+
+TEST(CompressedGraphTest, BeamSearchMatchesGraph) {
+  size_t n = 2000;
+  int d = 16;
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  std::vector<float> data(n * d);
+  for (auto& x : data) x = dist(rng);
+  using Point = Euclidian_Point<float>;
+  Point::parameters params(d);
+  std::vector<Point> points;
+  for (size_t i = 0; i < n; i++)
+    points.push_back(Point((uint8_t*) (data.data() + i * d), i, params));
+
+  // the search visits neighbors in list order, and with a degree limit
+  // only reads a prefix of each list
+  auto G = RandomGraph(n, 24, 4);
+  Compressed_Graph<unsigned int> CG(G);
+
+  parlay::sequence<unsigned int> starts = {0};
+  for (size_t q = 0; q < 50; q++) {
+    QueryParams QP(10, 32, 1.35, n, q % 2 ? 8 : G.max_degree());
+    Point p = points[rng() % n];
+    auto [r1, c1] = filtered_beam_search(G, p, points, p, points, starts, QP);
+    auto [r2, c2] = filtered_beam_search(CG, p, points, p, points, starts, QP);
+    EXPECT_EQ(r1.first, r2.first);
+    EXPECT_EQ(r1.second, r2.second);
+    EXPECT_EQ(c1, c2);
+  }
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -0,0 +1,551 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "graph.h"
+#include "mmap.h"
+#include "types.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <cerrno>
+#include <linux/aio_abi.h>
+#include <sys/syscall.h>
+// defined by linux/fs.h, but used as a variable name in point_range.h
+#undef BLOCK_SIZE
+#undef BLOCK_SIZE_BITS
+#endif
+
+namespace parlayANN {
+
+// An index served from disk, as in DiskANN.  Each vertex is stored as
+// a node holding its full precision point followed by its degree and
+// neighbor list, so that one read returns both.  Nodes are packed
+// into 4KB sectors (or span whole sectors if larger), so a node is
+// fetched with a single sector aligned read.  Only a compressed copy
+// of the points needs to be kept in memory to navigate the graph;
+// the full precision distances of the visited vertices come for free
+// with their neighbor lists and are used to rank the results.
+//
+// File layout: a header in the first sector, then the nodes starting
+// at the second sector.  Within a node the point is padded to a
+// multiple of 8 bytes, followed by a uint32_t degree, padding to the
+// size of indexType, and max_degree neighbor ids.
+struct disk_index_header {
+  static constexpr uint64_t magic_value = 0x3149445f4e4e4150ul; // "PANN_DI1"
+  static constexpr size_t sector_bytes = 4096;
+  uint64_t magic;
+  uint64_t num_points;
+  uint32_t dims;
+  uint32_t point_bytes;      // bytes of a point before padding
+  uint32_t max_degree;
+  uint32_t node_bytes;
+  uint32_t nodes_per_sector; // 0 if a node spans several sectors
+  uint32_t sectors_per_node;
+  uint64_t start_point;
+
+  size_t edges_offset() const {return 8 * ((point_bytes + 7) / 8);}
+  size_t sector(size_t i) const {
+    return 1 + (nodes_per_sector > 0 ? i / nodes_per_sector : i * sectors_per_node);
+  }
+  size_t offset_in_sector(size_t i) const {
+    return nodes_per_sector > 0 ? (i % nodes_per_sector) * node_bytes : 0;
+  }
+};
+
+template<typename indexType>
+disk_index_header make_disk_index_header(size_t n, int dims, int point_bytes,
+                                         long max_degree, indexType start) {
+  constexpr size_t S = disk_index_header::sector_bytes;
+  disk_index_header h;
+  h.magic = disk_index_header::magic_value;
+  h.num_points = n;
+  h.dims = dims;
+  h.point_bytes = point_bytes;
+  h.max_degree = max_degree;
+  size_t ngh_offset = h.edges_offset() + std::max(sizeof(uint32_t), sizeof(indexType));
+  h.node_bytes = 8 * ((ngh_offset + max_degree * sizeof(indexType) + 7) / 8);
+  h.nodes_per_sector = S / h.node_bytes;
+  h.sectors_per_node = (h.node_bytes + S - 1) / S;
+  h.start_point = start;
+  return h;
+}
+
+// Writes G and Points as a disk index (see disk_index_header).
+template<typename PointRange, typename indexType>
+void write_disk_index(char* filename, const Graph<indexType>& G, const PointRange& Points,
+                      indexType start) {
+  constexpr size_t S = disk_index_header::sector_bytes;
+  size_t n = Points.size();
+  if (G.size() != n) {
+    std::cout << "ERROR: graph has " << G.size() << " vertices but there are "
+              << n << " points" << std::endl;
+    abort();
+  }
+  disk_index_header h = make_disk_index_header(n, Points.dimension(), Points.params.num_bytes(),
+                                               G.max_degree(), start);
+  size_t ngh_offset = h.edges_offset() + std::max(sizeof(uint32_t), sizeof(indexType));
+  std::cout << "Writing disk index with " << n << " nodes of " << h.node_bytes
+            << " bytes" << std::endl;
+  std::ofstream writer(filename, std::ios::binary | std::ios::out);
+  parlay::sequence<char> first(S, 0);
+  std::memcpy(first.begin(), &h, sizeof(disk_index_header));
+  writer.write(first.begin(), S);
+
+  // write blocks of whole sectors
+  size_t block_nodes = (h.nodes_per_sector > 0) ? h.nodes_per_sector * 4096 : 4096;
+  for (size_t b = 0; b < n; b += block_nodes) {
+    size_t e = std::min(n, b + block_nodes);
+    size_t first_sector = h.sector(b);
+    size_t end_sector = h.sector(e - 1) + h.sectors_per_node;
+    parlay::sequence<char> buffer((end_sector - first_sector) * S, 0);
+    parlay::parallel_for(b, e, [&] (size_t i) {
+      char* node = buffer.begin() + (h.sector(i) - first_sector) * S + h.offset_in_sector(i);
+      std::memcpy(node, Points.location(i), h.point_bytes);
+      auto ngh = G[i];
+      uint32_t degree = std::min<size_t>(ngh.size(), h.max_degree);
+      std::memcpy(node + h.edges_offset(), &degree, sizeof(uint32_t));
+      indexType* out = (indexType*) (node + ngh_offset);
+      for (uint32_t j = 0; j < degree; j++) out[j] = ngh[j];
+    });
+    writer.write(buffer.begin(), buffer.size());
+  }
+  writer.close();
+}
+
+template<typename Point_, typename indexType>
+struct Disk_Index {
+  using Point = Point_;
+  using parameters = typename Point::parameters;
+  using byte = uint8_t;
+  static constexpr size_t S = disk_index_header::sector_bytes;
+#ifdef __linux__
+  using io_context = aio_context_t;
+#else
+  using io_context = int;
+#endif
+
+  // A node read from disk: its full precision point and neighbors.
+  struct node {
+    Point point;
+    const indexType* neighbors;
+    uint32_t degree;
+    size_t size() const {return degree;}
+    indexType operator [] (size_t j) const {return neighbors[j];}
+  };
+
+  // The full precision points, mapped from the file.  Used to compute
+  // the compressed points by passing it to the PointRange<QPoint>
+  // constructor.
+  struct point_view {
+    const Disk_Index* DI;
+    size_t size() const {return DI->size();}
+    long dimension() const {return DI->header.dims;}
+    Point operator [] (long i) const {
+      byte* p = (byte*) DI->mapped + DI->header.sector(i) * S + DI->header.offset_in_sector(i);
+      return Point(p, i, DI->params);
+    }
+  };
+
+  // Reads nodes for a single search.  Each call to read reuses the
+  // buffer, so the nodes returned by a call are only valid until the
+  // next call.  The nodes of a call that are not in the cache are read
+  // from disk together (see read_batch).  Not thread safe: use one
+  // reader per search.
+  struct reader {
+    reader(const Disk_Index& DI, long max_batch)
+      : DI(DI), max_batch(std::max<long>(max_batch, 1)), io(DI.acquire_io_context()) {
+      size_t bytes = this->max_batch * DI.read_bytes();
+      buffer = std::shared_ptr<byte[]>((byte*) aligned_alloc(S, bytes), std::free);
+    }
+    ~reader() {DI.release_io_context(io);}
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+
+    // reads the nodes for ids, at most max_batch of them
+    const std::vector<node>& read(const std::vector<indexType>& ids) {
+      if ((long) ids.size() > max_batch) {
+        std::cout << "ERROR: reading " << ids.size() << " nodes with a reader for "
+                  << max_batch << std::endl;
+        abort();
+      }
+      slots.clear();
+      misses.clear();
+      for (indexType i : ids) {
+        auto cached = DI.cache_slot.find(i);
+        if (cached != DI.cache_slot.end()) {
+          slots.push_back(cached->second);
+        } else {
+          slots.push_back(-1);
+          misses.push_back(i);
+        }
+      }
+      DI.read_batch(io, buffer.get(), misses);
+      ios += misses.size();
+      cache_hits += ids.size() - misses.size();
+
+      nodes.clear();
+      byte* dest = buffer.get();
+      for (size_t j = 0; j < ids.size(); j++) {
+        indexType i = ids[j];
+        if (slots[j] >= 0) {
+          nodes.push_back(DI.make_node(DI.cache.get() + slots[j] * DI.header.node_bytes, i));
+        } else {
+          nodes.push_back(DI.make_node(dest + DI.header.offset_in_sector(i), i));
+          dest += DI.read_bytes();
+        }
+      }
+      return nodes;
+    }
+
+    const Disk_Index& DI;
+    long max_batch;
+    io_context io;
+    std::shared_ptr<byte[]> buffer;
+    std::vector<long> slots;       // cache slot of each id, or -1
+    std::vector<indexType> misses; // ids to read from disk
+    std::vector<node> nodes;
+    size_t ios = 0;        // reads from disk
+    size_t cache_hits = 0; // nodes found in the cache
+  };
+
+  // Opens the index.  The cache_nodes vertices closest to the start
+  // point (in hops) are read into memory, since almost every search
+  // passes through them.
+  Disk_Index(char* filename, size_t cache_nodes = 0) {
+    fd = open(filename, O_RDONLY | O_DIRECT);
+    if (fd < 0) fd = open(filename, O_RDONLY);  // e.g. tmpfs does not support O_DIRECT
+    if (fd < 0) {
+      std::cout << "ERROR: disk index " << filename << " not found" << std::endl;
+      abort();
+    }
+    auto [fileptr, length] = mmapStringFromFile(filename);
+    mapped = fileptr;
+    mapped_length = length;
+    std::memcpy(&header, mapped, sizeof(disk_index_header));
+    if (header.magic != disk_index_header::magic_value) {
+      std::cout << "ERROR: " << filename << " is not a disk index" << std::endl;
+      abort();
+    }
+    params = parameters(header.dims);
+    if ((uint32_t) params.num_bytes() != header.point_bytes) {
+      std::cout << "ERROR: disk index " << filename << " has " << header.point_bytes
+                << " bytes per point but point type expects " << params.num_bytes()
+                << " (wrong data type?)" << std::endl;
+      abort();
+    }
+    std::cout << "Disk index: " << header.num_points << " points with dimension "
+              << header.dims << ", max degree " << header.max_degree << std::endl;
+    build_cache(cache_nodes);
+  }
+
+  ~Disk_Index() {
+#ifdef __linux__
+    for (io_context ctx : io_contexts) syscall(SYS_io_destroy, ctx);
+#endif
+    if (fd >= 0) close(fd);
+    if (mapped != nullptr) munmap(mapped, mapped_length);
+  }
+
+  Disk_Index(const Disk_Index&) = delete;
+  Disk_Index& operator=(const Disk_Index&) = delete;
+
+  size_t size() const {return header.num_points;}
+  long max_degree() const {return header.max_degree;}
+  indexType start() const {return header.start_point;}
+  size_t num_cached() const {return cache_slot.size();}
+  point_view points() const {return point_view{this};}
+
+  disk_index_header header;
+  parameters params;
+
+private:
+  static constexpr long io_depth = 64; // reads in flight per io context
+
+  size_t read_bytes() const {return header.sectors_per_node * S;}
+
+  // A kernel AIO context for a reader, reused from earlier readers
+  // since setting one up costs a system call and tearing it down can
+  // take much longer.  0 if there is none, e.g. when the system limit
+  // on contexts has been reached.
+  io_context acquire_io_context() const {
+    std::lock_guard<std::mutex> lock(io_mutex);
+    if (!io_contexts.empty()) {
+      io_context ctx = io_contexts.back();
+      io_contexts.pop_back();
+      return ctx;
+    }
+    io_context ctx = 0;
+#ifdef __linux__
+    if (syscall(SYS_io_setup, io_depth, &ctx) < 0) ctx = 0;
+#endif
+    return ctx;
+  }
+
+  void release_io_context(io_context ctx) const {
+    if (ctx == 0) return;
+    std::lock_guard<std::mutex> lock(io_mutex);
+    io_contexts.push_back(ctx);
+  }
+
+  // Reads the nodes ids into consecutive read_bytes() slots of buffer.
+  // With a kernel AIO context, all the reads are submitted before
+  // waiting for any of them, so the device serves them together.
+  // Reads that cannot be submitted are done with parallel preads.
+  void read_batch(io_context ctx, byte* buffer, const std::vector<indexType>& ids) const {
+    size_t done = 0;
+#ifdef __linux__
+    if (ctx != 0) done = read_async(ctx, buffer, ids);
+#endif
+    parlay::parallel_for(done, ids.size(), [&] (size_t j) {
+      read_sectors(buffer + j * read_bytes(), ids[j]);
+    }, 1);
+  }
+
+#ifdef __linux__
+  // Reads ids with kernel AIO, io_depth at a time.  Returns the number
+  // read, a prefix of ids, which is less than all of them if the
+  // kernel refused a submission.
+  size_t read_async(io_context ctx, byte* buffer, const std::vector<indexType>& ids) const {
+    iocb cbs[io_depth];
+    iocb* cb_ptrs[io_depth];
+    io_event events[io_depth];
+    size_t m = ids.size();
+    for (size_t b = 0; b < m; b += io_depth) {
+      long count = std::min<size_t>(io_depth, m - b);
+      for (long j = 0; j < count; j++) {
+        std::memset(&cbs[j], 0, sizeof(iocb));
+        cbs[j].aio_data = b + j;
+        cbs[j].aio_lio_opcode = IOCB_CMD_PREAD;
+        cbs[j].aio_fildes = fd;
+        cbs[j].aio_buf = (uint64_t) (buffer + (b + j) * read_bytes());
+        cbs[j].aio_nbytes = read_bytes();
+        cbs[j].aio_offset = header.sector(ids[b + j]) * S;
+        cb_ptrs[j] = &cbs[j];
+      }
+      long submitted = 0;
+      while (submitted < count) {
+        long r = syscall(SYS_io_submit, ctx, count - submitted, cb_ptrs + submitted);
+        if (r <= 0) break;
+        submitted += r;
+      }
+      long completed = 0;
+      while (completed < submitted) {
+        long r = syscall(SYS_io_getevents, ctx, 1, submitted - completed, events, nullptr);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) {
+          std::cout << "ERROR: failed to wait for disk index reads" << std::endl;
+          abort();
+        }
+        // a failed or short read is redone synchronously
+        for (long e = 0; e < r; e++)
+          if (events[e].res != (int64_t) read_bytes()) {
+            size_t j = events[e].data;
+            read_sectors(buffer + j * read_bytes(), ids[j]);
+          }
+        completed += r;
+      }
+      if (submitted < count) return b + submitted;
+    }
+    return m;
+  }
+#endif
+
+  void read_sectors(byte* dest, indexType i) const {
+    size_t bytes = read_bytes();
+    off_t offset = header.sector(i) * S;
+    size_t done = 0;
+    while (done < bytes) {
+      ssize_t r = pread(fd, dest + done, bytes - done, offset + done);
+      if (r <= 0) {
+        std::cout << "ERROR: failed to read node " << i << " from disk index" << std::endl;
+        abort();
+      }
+      done += r;
+    }
+  }
+
+  node make_node(byte* p, indexType i) const {
+    size_t ngh_offset = header.edges_offset() + std::max(sizeof(uint32_t), sizeof(indexType));
+    uint32_t degree;
+    std::memcpy(&degree, p + header.edges_offset(), sizeof(uint32_t));
+    return node{Point(p, i, params), (const indexType*) (p + ngh_offset), degree};
+  }
+
+  // breadth first from the start point
+  void build_cache(size_t cache_nodes) {
+    cache_nodes = std::min(cache_nodes, size());
+    if (cache_nodes == 0) return;
+    // aligned_alloc needs a size that is a multiple of the alignment
+    size_t cache_bytes = (cache_nodes * header.node_bytes + 63) / 64 * 64;
+    cache = std::shared_ptr<byte[]>((byte*) aligned_alloc(64, cache_bytes), std::free);
+    std::vector<indexType> order = {start()};
+    cache_slot[start()] = 0;
+    std::shared_ptr<byte[]> buffer((byte*) aligned_alloc(S, read_bytes()), std::free);
+    for (size_t j = 0; j < order.size(); j++) {
+      indexType i = order[j];
+      read_sectors(buffer.get(), i);
+      byte* slot = cache.get() + j * header.node_bytes;
+      std::memcpy(slot, buffer.get() + header.offset_in_sector(i), header.node_bytes);
+      node nd = make_node(slot, i);
+      for (uint32_t l = 0; l < nd.degree && order.size() < cache_nodes; l++) {
+        indexType v = nd.neighbors[l];
+        if (cache_slot.count(v)) continue;
+        cache_slot[v] = order.size();
+        order.push_back(v);
+      }
+    }
+    std::cout << "Disk index: cached " << order.size() << " nodes" << std::endl;
+  }
+
+  int fd = -1;
+  char* mapped = nullptr;
+  size_t mapped_length = 0;
+  std::shared_ptr<byte[]> cache;
+  std::unordered_map<indexType, size_t> cache_slot;
+  mutable std::mutex io_mutex;
+  mutable std::vector<io_context> io_contexts; // contexts not in use by a reader
+};
+
+struct disk_search_stats {
+  size_t hops = 0;       // rounds of reads
+  size_t ios = 0;        // nodes read from disk
+  size_t cache_hits = 0; // nodes read from the cache
+  size_t dist_cmps = 0;  // distances with compressed points
+};
+
+// Beam search over a disk index.  The frontier is ranked by distances
+// to the in-memory compressed points Q_Points.  Each round reads the
+// (up to) QP.beam_width closest unexpanded frontier vertices together,
+// computes the full precision distance to each from the point stored
+// with it, and adds its neighbors to the frontier.  Returns the
+// expanded vertices sorted by full precision distance.
+template<typename Point, typename QPoint, typename QPointRange, typename indexType>
+std::pair<parlay::sequence<std::pair<indexType, typename Point::distanceType>>, disk_search_stats>
+disk_beam_search(const Point& p, const QPoint& qp, const QPointRange& Q_Points,
+                 const Disk_Index<Point, indexType>& DI, const QueryParams& QP) {
+  using dtype = typename Point::distanceType;
+  using id_dist = std::pair<indexType, dtype>;
+  struct entry {
+    indexType id;
+    typename QPoint::distanceType dist;
+    bool expanded;
+  };
+  auto less = [] (const entry& a, const entry& b) {
+    return a.dist < b.dist || (a.dist == b.dist && a.id < b.id);
+  };
+
+  long beam_width = std::max<long>(QP.beam_width, 1);
+  size_t beamSize = QP.beamSize;
+  typename Disk_Index<Point, indexType>::reader R(DI, beam_width);
+  disk_search_stats stats;
+
+  // approximate hash filter for seen vertices, as in filtered_beam_search
+  int bits = std::max<int>(10, std::ceil(std::log2(beamSize * beamSize)) - 2);
+  std::vector<indexType> hash_filter(1 << bits, -1);
+  auto has_been_seen = [&] (indexType a) -> bool {
+    int loc = parlay::hash64_2(a) & ((1 << bits) - 1);
+    if (hash_filter[loc] == a) return true;
+    hash_filter[loc] = a;
+    return false;
+  };
+
+  indexType start = DI.start();
+  has_been_seen(start);
+  std::vector<entry> frontier = {entry{start, Q_Points[start].distance(qp), false}};
+  stats.dist_cmps++;
+  std::vector<entry> candidates;
+  std::vector<entry> merged;
+  std::vector<indexType> batch;
+  std::vector<id_dist> expanded;
+  long num_expanded = 0;
+
+  while (num_expanded < QP.limit) {
+    batch.clear();
+    for (auto& e : frontier) {
+      if (e.expanded) continue;
+      e.expanded = true;
+      batch.push_back(e.id);
+      if ((long) batch.size() == beam_width) break;
+    }
+    if (batch.size() == 0) break;
+    num_expanded += batch.size();
+    stats.hops++;
+
+    candidates.clear();
+    for (const auto& nd : R.read(batch)) {
+      expanded.push_back(id_dist(nd.point.id(), p.distance(nd.point)));
+      long num_elts = std::min<long>(nd.size(), QP.degree_limit);
+      for (long j = 0; j < num_elts; j++) {
+        indexType a = nd[j];
+        if (has_been_seen(a)) continue;
+        Q_Points[a].prefetch();
+        candidates.push_back(entry{a, 0, false});
+      }
+    }
+    for (auto& c : candidates) c.dist = Q_Points[c.id].distance(qp);
+    stats.dist_cmps += candidates.size();
+
+    // merge into the frontier, removing duplicates (which the hash
+    // filter can let through) but keeping the copy already there
+    std::sort(candidates.begin(), candidates.end(), less);
+    merged.resize(frontier.size() + candidates.size());
+    std::merge(frontier.begin(), frontier.end(), candidates.begin(), candidates.end(),
+               merged.begin(), less);
+    merged.erase(std::unique(merged.begin(), merged.end(),
+                             [] (const entry& a, const entry& b) {return a.id == b.id;}),
+                 merged.end());
+    merged.resize(std::min(merged.size(), beamSize));
+    std::swap(frontier, merged);
+  }
+  stats.ios = R.ios;
+  stats.cache_hits = R.cache_hits;
+
+  auto cmp = [] (id_dist a, id_dist b) {
+    return a.second < b.second || (a.second == b.second && a.first < b.first);
+  };
+  std::sort(expanded.begin(), expanded.end(), cmp);
+  // the hash filter is approximate so a vertex can be expanded twice
+  expanded.erase(std::unique(expanded.begin(), expanded.end(),
+                             [] (id_dist a, id_dist b) {return a.first == b.first;}),
+                 expanded.end());
+  if (QP.k > 0 && expanded.size() > (size_t) QP.k) expanded.resize(QP.k);
+  return std::pair(parlay::to_sequence(expanded), stats);
+}
+
+} // end namespace
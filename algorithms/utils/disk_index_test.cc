@@ -0,0 +1,155 @@
+#include "algorithms/utils/disk_index.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/graph.h"
+#include "algorithms/utils/point_range.h"
+#include "algorithms/utils/test_points.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using Point = Euclidian_Point<float>;
+using PR = PointRange<Point>;
+
+// exact k nearest neighbor graph with reverse edges added, so that
+// every vertex is reachable
+Graph<unsigned int> KnnGraph(const PR& Points, long k) {
+  size_t n = Points.size();
+  std::vector<std::vector<unsigned int>> ngh(n);
+  for (unsigned int i = 0; i < n; i++) {
+    std::vector<std::pair<float, unsigned int>> d;
+    for (unsigned int j = 0; j < n; j++)
+      if (j != i) d.push_back({Points[i].distance(Points[j]), j});
+    std::sort(d.begin(), d.end());
+    for (long l = 0; l < k; l++) ngh[i].push_back(d[l].second);
+  }
+  for (unsigned int i = 0; i < n; i++)
+    for (long l = 0; l < k; l++) {
+      auto& r = ngh[ngh[i][l]];
+      if (r.size() < 2 * k && std::find(r.begin(), r.end(), i) == r.end()) r.push_back(i);
+    }
+  Graph<unsigned int> G(2 * k, n);
+  for (unsigned int i = 0; i < n; i++) G[i].update_neighbors(ngh[i]);
+  return G;
+}
+
+class DiskIndexTest : public testing::TestWithParam<unsigned int> {};
+
+TEST_P(DiskIndexTest, NodesMatchGraphAndPoints) {
+  // 8 dimensions give several nodes per sector, 2000 a node spanning sectors
+  unsigned int d = GetParam();
+  PR Points = RandomPoints<Point>(300, d, 1);
+  Graph<unsigned int> G(24, Points.size());
+  std::mt19937 rng(2);
+  for (unsigned int i = 0; i < G.size(); i++) {
+    std::vector<unsigned int> ngh;
+    for (long j = 0; j < (long) (rng() % 25); j++) ngh.push_back(rng() % G.size());
+    G[i].update_neighbors(ngh);
+  }
+  std::string path = testing::TempDir() + "/disk_index_test.di";
+  write_disk_index(path.data(), G, Points, 7u);
+  Disk_Index<Point, unsigned int> DI(path.data(), 50);
+  EXPECT_EQ(DI.size(), Points.size());
+  EXPECT_EQ(DI.start(), 7u);
+  EXPECT_EQ(DI.num_cached(), 50);
+
+  auto view = DI.points();
+  typename Disk_Index<Point, unsigned int>::reader R(DI, 4);
+  for (unsigned int i = 0; i < G.size(); i += 4) {
+    std::vector<unsigned int> ids;
+    for (unsigned int j = i; j < std::min<size_t>(i + 4, G.size()); j++) ids.push_back(j);
+    auto& nodes = R.read(ids);
+    ASSERT_EQ(nodes.size(), ids.size());
+    for (size_t l = 0; l < ids.size(); l++) {
+      unsigned int v = ids[l];
+      EXPECT_EQ(nodes[l].point.id(), v);
+      EXPECT_TRUE(nodes[l].point == Points[v]);
+      EXPECT_TRUE(view[v] == Points[v]);
+      ASSERT_EQ(nodes[l].size(), G[v].size());
+      for (size_t j = 0; j < G[v].size(); j++) EXPECT_EQ(nodes[l][j], G[v][j]);
+    }
+  }
+  EXPECT_EQ(R.ios + R.cache_hits, G.size());
+  EXPECT_EQ(R.cache_hits, 50);
+  std::remove(path.c_str());
+}
+
+INSTANTIATE_TEST_SUITE_P(Dimensions, DiskIndexTest, testing::Values(8, 2000));
+
+TEST(DiskIndexReaderTest, ReadsBatchesLargerThanIoDepth) {
+  // the reads of a batch are submitted io_depth (64) at a time
+  PR Points = RandomPoints<Point>(500, 8, 5);
+  Graph<unsigned int> G(8, Points.size());
+  for (unsigned int i = 0; i < G.size(); i++)
+    G[i].update_neighbors(std::vector<unsigned int>{(i + 1) % 500, (i * 7) % 500});
+  std::string path = testing::TempDir() + "/disk_index_batch_test.di";
+  write_disk_index(path.data(), G, Points, 0u);
+  Disk_Index<Point, unsigned int> DI(path.data(), 20);
+
+  std::vector<unsigned int> order(Points.size());
+  for (unsigned int i = 0; i < order.size(); i++) order[i] = i;
+  std::shuffle(order.begin(), order.end(), std::mt19937(6));
+  typename Disk_Index<Point, unsigned int>::reader R(DI, 150);
+  for (size_t b = 0; b < order.size(); b += 150) {
+    std::vector<unsigned int> ids(order.begin() + b,
+                                  order.begin() + std::min<size_t>(b + 150, order.size()));
+    auto& nodes = R.read(ids);
+    ASSERT_EQ(nodes.size(), ids.size());
+    for (size_t l = 0; l < ids.size(); l++) {
+      unsigned int v = ids[l];
+      EXPECT_TRUE(nodes[l].point == Points[v]);
+      ASSERT_EQ(nodes[l].size(), G[v].size());
+      for (size_t j = 0; j < G[v].size(); j++) EXPECT_EQ(nodes[l][j], G[v][j]);
+    }
+  }
+  EXPECT_EQ(R.ios, Points.size() - 20);
+  EXPECT_EQ(R.cache_hits, 20);
+  std::remove(path.c_str());
+}
+
+TEST(DiskBeamSearchTest, FindsNearestNeighbors) {
+  PR Points = RandomPoints<Point>(2000, 8, 3);
+  PR Queries = RandomPoints<Point>(100, 8, 4);
+  auto G = KnnGraph(Points, 16);
+  std::string path = testing::TempDir() + "/disk_index_search_test.di";
+  write_disk_index(path.data(), G, Points, 0u);
+  Disk_Index<Point, unsigned int> DI(path.data());
+  Disk_Index<Point, unsigned int> DI_cached(path.data(), 200);
+
+  // navigate with one byte per coordinate, rank with the floats on disk
+  using QPoint = Euclidian_Point<uint8_t>;
+  auto Disk_Points = DI.points();
+  PointRange<QPoint> Q_Points(Disk_Points);
+  PointRange<QPoint> Q_Queries(Queries, Q_Points.params);
+
+  QueryParams QP(10, 40, 1.35, Points.size(), G.max_degree());
+  size_t found = 0;
+  for (long width : {1, 4}) {
+    QP.beam_width = width;
+    for (unsigned int q = 0; q < Queries.size(); q++) {
+      auto [r, stats] = disk_beam_search(Queries[q], Q_Queries[q], Q_Points, DI, QP);
+      auto [rc, stats_c] = disk_beam_search(Queries[q], Q_Queries[q], Q_Points, DI_cached, QP);
+      EXPECT_EQ(r, rc);
+      EXPECT_EQ(stats.ios, stats_c.ios + stats_c.cache_hits);
+      EXPECT_GT(stats_c.cache_hits, 0);
+      ASSERT_EQ(r.size(), 10);
+      for (size_t j = 1; j < r.size(); j++) EXPECT_LE(r[j-1].second, r[j].second);
+      unsigned int best = 0;
+      for (unsigned int i = 1; i < Points.size(); i++)
+        if (Points[i].distance(Queries[q]) < Points[best].distance(Queries[q])) best = i;
+      if (r[0].first == best) found++;
+    }
+  }
+  EXPECT_GT(found, 180);
+  std::remove(path.c_str());
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -0,0 +1,188 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+
+namespace parlayANN {
+
+// A coarse routing layer for beam search: the medoids of clusters of a
+// sample of the points.  Rather than from one fixed vertex, each search
+// starts from the few entry points nearest its query, which on
+// clustered data saves the hops spent walking to the right cluster.
+//
+// The clusters are found with k-medoids on the sample: the entry points
+// are first chosen farthest first (each the sample point furthest from
+// those already chosen), then in each round every sample point is
+// assigned to its nearest entry point, and each entry point is replaced
+// by the medoid of (a subsample of) its cluster.  Only distances are
+// used, so any point type works.  The result depends only on the
+// points, so it can be recomputed for a graph that is loaded rather
+// than built.
+template<typename indexType, typename PointRange>
+parlay::sequence<indexType> build_entry_points(const PointRange &Points,
+                                               long num_entries,
+                                               long rounds = 4,
+                                               long medoid_sample = 32) {
+  long n = Points.size();
+  num_entries = std::min(num_entries, n);
+  if (num_entries <= 0) return parlay::sequence<indexType>();
+  long sample_size = std::min<long>(n, 32 * num_entries);
+  auto sample = parlay::tabulate(sample_size, [&] (long i) {
+    return (indexType) ((i * n) / sample_size);});
+  using dtype = std::decay_t<decltype(Points[0].distance(Points[0]))>;
+  parlay::sequence<indexType> entries = {sample[0]};
+  auto nearest_d = parlay::tabulate(sample_size, [&] (long i) {
+    return Points[sample[0]].distance(Points[sample[i]]);});
+  while ((long) entries.size() < num_entries) {
+    indexType next = sample[parlay::max_element(nearest_d) - nearest_d.begin()];
+    entries.push_back(next);
+    parlay::parallel_for(0, sample_size, [&] (long i) {
+      nearest_d[i] = std::min<dtype>(nearest_d[i], Points[next].distance(Points[sample[i]]));});
+  }
+
+  for (long round = 0; round < rounds; round++) {
+    auto nearest = parlay::tabulate(sample_size, [&] (long i) {
+      long best = 0;
+      auto best_d = Points[entries[0]].distance(Points[sample[i]]);
+      for (long j = 1; j < num_entries; j++) {
+        auto d = Points[entries[j]].distance(Points[sample[i]]);
+        if (d < best_d) {best = j; best_d = d;}
+      }
+      return std::pair<long, indexType>(best, sample[i]);});
+    auto clusters = parlay::group_by_index(nearest, num_entries);
+    parlay::parallel_for(0, num_entries, [&] (long j) {
+      auto &c = clusters[j];
+      if (c.size() == 0) return;
+      long s = std::min<long>(medoid_sample, c.size());
+      double best_sum = std::numeric_limits<double>::max();
+      for (long a = 0; a < s; a++) {
+        indexType u = c[(a * c.size()) / s];
+        double sum = 0;
+        for (long b = 0; b < s; b++)
+          sum += Points[u].distance(Points[c[(b * c.size()) / s]]);
+        if (sum < best_sum) {best_sum = sum; entries[j] = u;}
+      }
+    }, 1);
+  }
+  return parlay::remove_duplicates(entries);
+}
+
+// the (up to) num entry points nearest to q
+template<typename Point, typename PointRange, typename indexType>
+parlay::sequence<indexType> nearest_entry_points(const Point &q,
+                                                 const PointRange &Points,
+                                                 const parlay::sequence<indexType> &entries,
+                                                 long num) {
+  using dtype = typename Point::distanceType;
+  num = std::min<long>(num, entries.size());
+  parlay::sequence<std::pair<dtype, indexType>> d(entries.size());
+  for (size_t i = 0; i < entries.size(); i++)
+    d[i] = std::pair(Points[entries[i]].distance(q), entries[i]);
+  std::partial_sort(d.begin(), d.begin() + num, d.end());
+  return parlay::tabulate(num, [&] (long i) {return d[i].second;});
+}
+
+// whether points expose their coordinates with operator[]
+template<typename Point, typename = void>
+struct has_coordinates : std::false_type {};
+
+template<typename Point>
+struct has_coordinates<Point, std::void_t<decltype(std::declval<const Point&>()[0])>>
+  : std::true_type {};
+
+// An approximate medoid: the point of a strided sample of candidates
+// with the least total distance to a strided sample of the points.
+// Exact when there are at most sample_size points.
+template<typename indexType, typename PointRange>
+indexType medoid_point(const PointRange &Points, long sample_size = 1000) {
+  long n = Points.size();
+  long m = std::min(n, sample_size);
+  if (m == 0) return 0;
+  auto sum = parlay::tabulate(m, [&] (long a) {
+    indexType u = (a * n) / m;
+    double s = 0;
+    // offset so the two samples differ when n > m
+    for (long b = 0; b < m; b++)
+      s += Points[u].distance(Points[(b * n) / m + n / (2 * m)]);
+    return s;});
+  return (indexType) (((parlay::min_element(sum) - sum.begin()) * n) / m);
+}
+
+// The point nearest, in Euclidean distance, to the mean of the points.
+// The mean is a parallel reduction of the coordinates: each block of
+// points is summed into its own vector, and the blocks are then summed.
+template<typename indexType, typename PointRange>
+indexType centroid_point(const PointRange &Points) {
+  long n = Points.size();
+  long d = Points.dimension();
+  if (n == 0) return 0;
+  long block_size = 1024;
+  long num_blocks = (n - 1) / block_size + 1;
+  auto block_sums = parlay::tabulate(num_blocks, [&] (long b) {
+    std::vector<double> sum(d, 0.0);
+    for (long i = b * block_size; i < std::min(n, (b + 1) * block_size); i++) {
+      auto p = Points[i];
+      for (long j = 0; j < d; j++) sum[j] += p[j];
+    }
+    return sum;});
+  auto mean = parlay::tabulate(d, [&] (long j) {
+    double s = 0;
+    for (long b = 0; b < num_blocks; b++) s += block_sums[b][j];
+    return s / n;});
+  auto dist = parlay::tabulate(n, [&] (long i) {
+    auto p = Points[i];
+    double s = 0;
+    for (long j = 0; j < d; j++) s += (p[j] - mean[j]) * (p[j] - mean[j]);
+    return s;});
+  return (indexType) (parlay::min_element(dist) - dist.begin());
+}
+
+// The start point chosen by method: "0" (the first point), "medoid"
+// or "centroid".  Points without coordinates use the medoid instead
+// of the centroid.
+template<typename indexType, typename PointRange>
+indexType global_start_point(const PointRange &Points, const std::string &method) {
+  using Point = std::decay_t<decltype(Points[0])>;
+  if (method == "0") return 0;
+  if (method == "medoid") return medoid_point<indexType>(Points);
+  if (method == "centroid") {
+    if constexpr (has_coordinates<Point>::value)
+      return centroid_point<indexType>(Points);
+    else return medoid_point<indexType>(Points);
+  }
+  std::cout << "ERROR: unknown start point " << method
+            << ", use 0, medoid or centroid" << std::endl;
+  abort();
+}
+
+} // end namespace
@@ -0,0 +1,81 @@
+#include "algorithms/utils/entry_points.h"
+
+#include <cmath>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/point_range.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using Point = Euclidian_Point<float>;
+
+TEST(EntryPointsTest, OneEntryPointPerCluster) {
+  // 8 well separated clusters of 500 points each, interleaved by id
+  size_t n = 4000;
+  int d = 4;
+  int num_clusters = 8;
+  std::mt19937 rng(2);
+  std::normal_distribution<float> noise(0.0, 0.1);
+  std::vector<float> data(n * d);
+  for (size_t i = 0; i < n; i++)
+    for (int j = 0; j < d; j++)
+      data[i * d + j] = 10 * (j == (i % num_clusters) % d) * (1 + (i % num_clusters) / d) + noise(rng);
+  Point::parameters params(d);
+  std::vector<Point> points;
+  for (size_t i = 0; i < n; i++)
+    points.push_back(Point((uint8_t*) (data.data() + i * d), i, params));
+
+  auto entries = build_entry_points<unsigned int>(points, num_clusters);
+  ASSERT_EQ(entries.size(), num_clusters);
+  std::set<int> clusters;
+  for (auto e : entries) clusters.insert(e % num_clusters);
+  EXPECT_EQ(clusters.size(), num_clusters);
+
+  // the nearest entry point is in the query's cluster, and they are sorted
+  for (size_t q = 0; q < 100; q++) {
+    size_t i = rng() % n;
+    auto nearest = nearest_entry_points(points[i], points, entries, 3);
+    ASSERT_EQ(nearest.size(), 3);
+    EXPECT_EQ(nearest[0] % num_clusters, i % num_clusters);
+    EXPECT_LE(points[nearest[0]].distance(points[i]), points[nearest[1]].distance(points[i]));
+    EXPECT_LE(points[nearest[1]].distance(points[i]), points[nearest[2]].distance(points[i]));
+  }
+
+  EXPECT_EQ(build_entry_points<unsigned int>(points, 0).size(), 0);
+  EXPECT_EQ(nearest_entry_points(points[0], points, entries, 100).size(), num_clusters);
+}
+
+TEST(EntryPointsTest, StartPointIsCentral) {
+  // points on a line, shuffled, so the middle one is both the medoid
+  // and the point nearest the mean
+  size_t n = 501;
+  int d = 2;
+  std::vector<float> data(n * d);
+  for (size_t i = 0; i < n; i++) {
+    float x = (i * 7) % n;
+    data[i * d] = x;
+    data[i * d + 1] = 2 * x;
+  }
+  Point::parameters params(d);
+  std::vector<Point> points;
+  for (size_t i = 0; i < n; i++)
+    points.push_back(Point((uint8_t*) (data.data() + i * d), i, params));
+  PointRange<Point> Points(points, params);
+  unsigned int middle = 0;
+  while ((middle * 7) % n != n / 2) middle++;
+
+  EXPECT_EQ(global_start_point<unsigned int>(Points, "0"), 0);
+  EXPECT_EQ(global_start_point<unsigned int>(Points, "medoid"), middle);
+  EXPECT_EQ(global_start_point<unsigned int>(Points, "centroid"), middle);
+  // with a sample, the medoid is still near the middle
+  unsigned int m = medoid_point<unsigned int>(Points, 50);
+  EXPECT_LE(std::abs(Points[m][0] - (float) (n / 2)), 10);
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -25,12 +25,15 @@
 #include <algorithm>
 #include <iostream>
 #include <bitset>
+#include <cstring>
 
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "parlay/internal/file_map.h"
 
 #include "types.h"
+#include "quantile.h"
+#include "simd_distance.h"
 //#include "NSGDist.h"
 // #include "common/time_loop.h"
 
@@ -52,13 +55,7 @@ float euclidian_distance_(const uint8_t *p, const uint8_t *q, unsigned d) {
 }
 
 float euclidian_distance(const uint8_t *p, const uint8_t *q, unsigned d) {
-  int32_t result = 0;
-  for (int i = 0; i < d; i++) {
-    int32_t qi = (int32_t) p[i];
-    int32_t pi = (int32_t) q[i];
-    result += (qi - pi) * (qi - pi);
-  }
-  return (float)result;
+  return (float) simd::dispatch.l2_uint8(p, q, d);
 }
 
 float euclidian_distance(const uint16_t *p, const uint16_t *q, unsigned d) {
@@ -72,21 +69,11 @@ float euclidian_distance(const uint16_t *p, const uint16_t *q, unsigned d) {
 }
 
 float euclidian_distance(const int8_t *p, const int8_t *q, unsigned d) {
-  int result = 0;
-  for (int i = 0; i < d; i++) {
-    result += ((int32_t)((int16_t)q[i] - (int16_t)p[i])) *
-      ((int32_t)((int16_t)q[i] - (int16_t)p[i]));
-  }
-  return (float)result;
+  return (float) simd::dispatch.l2_int8(p, q, d);
 }
 
 float euclidian_distance(const float *p, const float *q, unsigned d) {
-  //efanna2e::DistanceL2 distfunc;
-  //return distfunc.compare(p, q, d);
-  float result = 0.0;
-  for (int i = 0; i < d; i++)
-    result += (q[i] - p[i]) * (q[i] - p[i]);
-  return (float)result;
+  return simd::dispatch.l2_float(p, q, d);
 }
 
 template<typename T_, long range=(1l << sizeof(T_)*8) - 1>
@@ -110,6 +97,7 @@ struct Euclidian_Point {
 
   static distanceType d_min() {return 0;}
   static bool is_metric() {return true;}
+  static std::string type_tag() {return "Euclidian_Point<" + scalar_type_tag<T>() + "," + std::to_string(range) + ">";}
   T operator[](long i) const {return *(values + i);}
 
   float distance(const Euclidian_Point& x) const {
@@ -213,17 +201,27 @@ struct Euclidian_Point {
     long n = pr.size();
     int dims = pr.dimension();
     using MT = float; // typename PR::Point::T;
-    parlay::sequence<MT> mins(n, 0.0);
-    parlay::sequence<MT> maxs(n, 0.0);
-    parlay::sequence<bool> ni(n, true);
-    parlay::parallel_for(0, n, [&] (long i) {
+    // the min, max and whether all are non-negative integers, in one
+    // pass over the points without materializing anything of length n
+    struct coordinate_range {MT min, max; bool ints;};
+    auto per_point = parlay::delayed_tabulate(n, [&] (size_t i) {
+      coordinate_range r = {0.0, 0.0, true};
+      auto p = pr[i];
       for (int j = 0; j < dims; j++) {
-        ni[i] = ni[i] && (pr[i][j] >= 0) && (pr[i][j] - (long) pr[i][j]) == 0;
-        mins[i]= std::min<MT>(mins[i], pr[i][j]);
-        maxs[i]= std::max<MT>(maxs[i], pr[i][j]);}});
-    float min_val = *parlay::min_element(mins);
-    float max_val = *parlay::max_element(maxs);
-    bool all_ints = *parlay::min_element(ni);
+        MT x = p[j];
+        r.min = std::min(r.min, x);
+        r.max = std::max(r.max, x);
+        r.ints = r.ints && x >= 0 && (x - (long) x) == 0;
+      }
+      return r;
+    });
+    auto combine = [] (coordinate_range a, coordinate_range b) {
+      return coordinate_range{std::min(a.min, b.min), std::max(a.max, b.max), a.ints && b.ints};};
+    auto all = parlay::reduce(per_point,
+                              parlay::make_monoid(combine, coordinate_range{0.0, 0.0, true}));
+    float min_val = all.min;
+    float max_val = all.max;
+    bool all_ints = all.ints;
     if (all_ints) {
       if (sizeof(T) == 1 && max_val < 256) max_val = 255;
       else if (sizeof(T) == 2 && max_val < 65536) max_val = 65536;
@@ -259,18 +257,20 @@ struct Euclidean_JL_Sparse_Point {
       : JL_indices(JL_indices), source_dims(source_dims) {
       std::cout << "JL sparse quantization, dims = " << jl_dims << std::endl;
     }
+    template <typename Archive>
+    void serialize(Archive& ar) {ar(JL_indices); ar(source_dims);}
   };
   
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Euclidean_JL_Sparse_Point<" + std::to_string(jl_dims) + ">";}
   
   int8_t operator [] (long j) const {
     Data* pbits = (Data*) values;
     return (*pbits)[j] ? 1 : -1;}
 
   float distance(const Euclidean_JL_Sparse_Point &q) const {
-    Data* pbits = (Data*) values;
-    Data* qbits = (Data*) q.values;
-    return (*pbits ^ *qbits).count();
+    return simd::dispatch.hamming((const uint64_t*) values, (const uint64_t*) q.values,
+                                  sizeof(Data) / 8);
   }
 
   void prefetch() const {
@@ -346,6 +346,7 @@ struct Euclidean_Bit_Point {
   };
   
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Euclidean_Bit_Point";}
   
   int8_t operator [] (long j) const {
     Data* pbits = (Data*) values;
@@ -353,13 +354,8 @@ struct Euclidean_Bit_Point {
   }
 
   float distance(const Euclidean_Bit_Point &q) const {
-    int num_blocks = (params.dims - 1)/64 + 1;
-    Data* pbits = (Data*) values;
-    Data* qbits = (Data*) q.values;
-    int cnt = 0;
-    for (int i=0; i < num_blocks; i++)
-      cnt +=(*pbits ^ *qbits).count();
-    return cnt;
+    return simd::dispatch.hamming((const uint64_t*) values, (const uint64_t*) q.values,
+                                  params.num_bytes() / 8);
   }
 
   void prefetch() const {
@@ -394,23 +390,16 @@ struct Euclidean_Bit_Point {
   template <typename In_Point>
   static void translate_point(byte* values, const In_Point& p, const parameters& params) {
     Data* pbits = (Data*) values;
+    std::memset(values, 0, params.num_bytes()); // bits past dims are compared too
     for (int i = 0; i < params.dims; i++)
       pbits[i/64][i%64] = p[i] > params.median;
   }
 
   template <typename PR>
-  static parameters generate_parameters(const PR& pr) {
-    long n = pr.size();
-    int dims = pr.dimension();
-    long len = n * dims;
-    parlay::sequence<typename PR::Point::T> vals(len);
-    parlay::parallel_for(0, n, [&] (long i) {
-      for (int j = 0; j < dims; j++) 
-        vals[i * dims + j] = pr[i][j];
-    });
-    parlay::sort_inplace(vals);
-    long median = vals[n*dims/2];
-    return parameters(dims, median);
+  static parameters generate_parameters(const PR& pr,
+                                        long quantile_sample = default_quantile_sample) {
+    long median = coordinate_quantiles(pr, {.5}, quantile_sample)[0];
+    return parameters((int) pr.dimension(), median);
   }
 
 private:
@@ -0,0 +1,289 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+
+#include "euclidian_point.h"
+#include "point_range.h"
+
+namespace parlayANN {
+
+// Reads the rows of a .bin file (the number of points and dimension as
+// 4 byte integers, then the rows) a chunk at a time, so files larger
+// than memory can be processed.
+template<typename T>
+struct bin_reader {
+  bin_reader(char* filename) : reader(filename, std::ios::binary) {
+    if (!reader.is_open()) {
+      std::cout << "Data file " << filename << " not found" << std::endl;
+      abort();
+    }
+    uint64_t magic = 0;
+    reader.read((char*) &magic, sizeof(uint64_t));
+    if (magic == point_file_header::magic_value) {
+      std::cout << "ERROR: " << filename << " is in the serving layout, "
+                << "use the original .bin file" << std::endl;
+      abort();
+    }
+    reader.seekg(0);
+    unsigned int header[2];
+    reader.read((char*) header, sizeof(header));
+    n = header[0];
+    d = header[1];
+  }
+
+  size_t size() const {return n;}
+  unsigned int dimension() const {return d;}
+  size_t position() const {return next;}
+
+  // the next (up to) m rows
+  parlay::sequence<T> read(size_t m) {
+    m = std::min(m, n - next);
+    auto rows = parlay::sequence<T>::uninitialized(m * d);
+    reader.read((char*) rows.begin(), m * d * sizeof(T));
+    if (!reader) {
+      std::cout << "ERROR: data file is truncated" << std::endl;
+      abort();
+    }
+    next += m;
+    return rows;
+  }
+
+private:
+  std::ifstream reader;
+  size_t n;
+  unsigned int d;
+  size_t next = 0;
+};
+
+// Exact k nearest neighbors of a set of queries, with base points
+// added a chunk at a time.  Distances are squared Euclidean, computed
+// as |q|^2 + |b|^2 - 2 q.b, or negative inner products (mips).
+//
+// The inner products are computed as in a matrix multiply.  Each chunk
+// is stored in panels of 16 points, dimension major, so a micro kernel
+// accumulates the inner products of 4 queries with the 16 points of a
+// panel in registers, with one vector multiply-add per query and
+// dimension.  Tiles of queries are run against blocks of panels sized
+// to stay in the L2 cache.  Integer points are accumulated in 32 bit
+// integers, so their distances are exact.  Each query keeps its k
+// nearest in a bounded max-heap, and ties are broken by id.
+//
+// For float points the expanded form loses precision when the norms
+// are much larger than the distances.  So for Euclidean distance each
+// task keeps k + rerank_slack candidates by the expanded form, and the
+// candidates are given the distance of Euclidian_Point (the sum of the
+// squared differences) as they are merged into the heaps of k.  The
+// returned neighbors and distances are then exact unless cancellation
+// moves a true neighbor past more than rerank_slack other points.
+//
+// Tasks are (query tile, slice of the chunk) pairs, so there is enough
+// parallelism even for few queries; each task keeps its own heaps,
+// which are merged once the chunk is done.
+template<typename T>
+struct exact_knn {
+  using A = std::conditional_t<std::is_floating_point_v<T>, float, int32_t>;
+  using wide = std::conditional_t<std::is_floating_point_v<T>, float, int64_t>;
+  using entry = std::pair<float, uint64_t>; // distance, id
+  static constexpr size_t panel_width = 16;
+  static constexpr size_t group = 4;      // queries per micro kernel call
+  static constexpr size_t query_tile = 64;
+  static constexpr long rerank_slack = 16;
+
+  exact_knn(const T* queries, size_t nq, unsigned int d, long k, bool mips)
+    : nq(nq), d(d), k(k), mips(mips),
+      rerank(std::is_floating_point_v<T> && !mips),
+      candidates(rerank ? k + rerank_slack : k),
+      padded((nq + group - 1) / group * group),
+      Q(parlay::sequence<A>(padded * d, 0)),
+      query_norms(nq),
+      heaps(nq * k),
+      sizes(nq, 0) {
+    parlay::parallel_for(0, nq * d, [&] (size_t i) {Q[i] = queries[i];});
+    parlay::parallel_for(0, nq, [&] (size_t i) {query_norms[i] = norm(Q.begin() + i * d, d);});
+  }
+
+  // adds m points, with ids first_id to first_id + m - 1
+  void add(const T* base, size_t m, uint64_t first_id) {
+    if (m == 0 || nq == 0) return;
+    size_t num_panels = (m - 1) / panel_width + 1;
+    auto panels = to_panels(base, m, d);
+    auto base_norms = parlay::tabulate(m, [&] (size_t i) {return norm(base + i * d, d);});
+
+    // panels per block, to fit in about 256KB
+    size_t block = std::max<size_t>(1, (1 << 18) / (panel_width * d * sizeof(A)));
+    size_t num_tiles = (nq + query_tile - 1) / query_tile;
+    size_t slices = std::min<size_t>((num_panels - 1) / block + 1,
+                                     std::max<size_t>(1, (4 * parlay::num_workers()) / num_tiles));
+    size_t slice_panels = (num_panels - 1) / slices + 1;
+    auto partial = parlay::tabulate(num_tiles * slices, [&] (size_t t) {
+      size_t tile = t / slices, slice = t % slices;
+      size_t q_start = tile * query_tile;
+      size_t q_end = std::min(nq, q_start + query_tile);
+      size_t p_start = slice * slice_panels;
+      size_t p_end = std::min(num_panels, p_start + slice_panels);
+      parlay::sequence<entry> local((q_end - q_start) * candidates);
+      parlay::sequence<long> local_sizes(q_end - q_start, 0);
+      A dots[group][panel_width];
+      for (size_t b = p_start; b < p_end; b += block) {
+        for (size_t q = q_start; q < q_end; q += group) {
+          for (size_t p = b; p < std::min(p_end, b + block); p++) {
+            micro_kernel(Q.begin() + q * d, panels.begin() + p * panel_width * d, d, dots);
+            for (size_t g = 0; g < group && q + g < q_end; g++) {
+              for (size_t l = 0; l < panel_width; l++) {
+                size_t i = p * panel_width + l;
+                if (i >= m) break;
+                float dist = mips ? (float) -(wide) dots[g][l]
+                  : (float) (query_norms[q + g] + base_norms[i] - 2 * (wide) dots[g][l]);
+                push(local.begin() + (q + g - q_start) * candidates,
+                     local_sizes[q + g - q_start], candidates, entry(dist, first_id + i));
+              }
+            }
+          }
+        }
+      }
+      return std::pair(std::move(local), std::move(local_sizes));
+    }, 1);
+
+    // merge the heaps of the slices of each tile, with exact distances
+    // when reranking
+    parlay::parallel_for(0, nq, [&] (size_t i) {
+      size_t tile = i / query_tile;
+      size_t r = i - tile * query_tile;
+      for (size_t s = 0; s < slices; s++) {
+        auto& [local, local_sizes] = partial[tile * slices + s];
+        for (long j = 0; j < local_sizes[r]; j++) {
+          entry e = local[r * candidates + j];
+          if (rerank) e.first = exact_distance(i, base + (e.second - first_id) * d);
+          push(heaps.begin() + i * k, sizes[i], k, e);
+        }
+      }
+    });
+  }
+
+  // the (up to) k nearest points to query i so far, by increasing distance
+  parlay::sequence<entry> neighbors(size_t i) const {
+    parlay::sequence<entry> r(heaps.begin() + i * k, heaps.begin() + i * k + sizes[i]);
+    std::sort(r.begin(), r.end());
+    return r;
+  }
+
+  size_t size() const {return nq;}
+
+  // the distance of Euclidian_Point from query i to a base point
+  float exact_distance(size_t i, const T* b) const {
+    if constexpr (std::is_floating_point_v<T>)
+      return euclidian_distance(Q.begin() + i * d, b, d);
+    else return 0;
+  }
+
+  // The m points as panels of panel_width points, each stored
+  // dimension major (the last panel is padded with zeros).
+  static parlay::sequence<A> to_panels(const T* points, size_t m, size_t d) {
+    size_t num_panels = (m + panel_width - 1) / panel_width;
+    auto panels = parlay::sequence<A>::uninitialized(num_panels * panel_width * d);
+    parlay::parallel_for(0, num_panels, [&] (size_t p) {
+      A* out = panels.begin() + p * panel_width * d;
+      for (size_t l = 0; l < panel_width; l++) {
+        size_t i = p * panel_width + l;
+        for (size_t j = 0; j < d; j++)
+          out[j * panel_width + l] = (i < m) ? (A) points[i * d + j] : 0;
+      }
+    });
+    return panels;
+  }
+
+  template<typename X>
+  static wide norm(const X* x, size_t d) {
+    wide s = 0;
+    for (size_t j = 0; j < d; j++) s += (wide) x[j] * (wide) x[j];
+    return s;
+  }
+
+  // Inner products of queries q..q+3 (consecutive rows of length d)
+  // with a panel.  The accumulators are kept as one row of panel_width
+  // per query, so the compiler vectorizes across the points of the panel.
+  static void micro_kernel(const A* q, const A* panel, size_t d,
+                           A (&out)[group][panel_width]) {
+    static_assert(group == 4);
+    A acc0[panel_width] = {}, acc1[panel_width] = {};
+    A acc2[panel_width] = {}, acc3[panel_width] = {};
+    const A* q0 = q;
+    const A* q1 = q + d;
+    const A* q2 = q + 2 * d;
+    const A* q3 = q + 3 * d;
+    for (size_t j = 0; j < d; j++) {
+      const A* p = panel + j * panel_width;
+      A x0 = q0[j], x1 = q1[j], x2 = q2[j], x3 = q3[j];
+      for (size_t l = 0; l < panel_width; l++) {
+        acc0[l] += x0 * p[l];
+        acc1[l] += x1 * p[l];
+        acc2[l] += x2 * p[l];
+        acc3[l] += x3 * p[l];
+      }
+    }
+    for (size_t l = 0; l < panel_width; l++) {
+      out[0][l] = acc0[l];
+      out[1][l] = acc1[l];
+      out[2][l] = acc2[l];
+      out[3][l] = acc3[l];
+    }
+  }
+
+  // adds e to a bounded max-heap of size at most k
+  template<typename Entry>
+  static void push(Entry* heap, long& size, long k, Entry e) {
+    if (size < k) {
+      heap[size++] = e;
+      std::push_heap(heap, heap + size);
+    } else if (e < heap[0]) {
+      std::pop_heap(heap, heap + k);
+      heap[k - 1] = e;
+      std::push_heap(heap, heap + k);
+    }
+  }
+
+private:
+  size_t nq;
+  size_t d;
+  long k;
+  bool mips;
+  bool rerank;
+  long candidates; // kept per task, k + rerank_slack when reranking
+  size_t padded;
+  parlay::sequence<A> Q;
+  parlay::sequence<wide> query_norms;
+  parlay::sequence<entry> heaps;
+  parlay::sequence<long> sizes;
+};
+
+} // end namespace
@@ -0,0 +1,142 @@
+#include "algorithms/utils/exact_knn.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+// brute force k nearest, as (distance, id) by increasing distance
+template<typename T>
+std::vector<std::pair<float, uint64_t>> BruteForce(const std::vector<T>& queries,
+                                                   const std::vector<T>& base,
+                                                   size_t i, size_t d, size_t k,
+                                                   bool mips) {
+  std::vector<std::pair<float, uint64_t>> all;
+  for (size_t b = 0; b < base.size() / d; b++) {
+    double s = 0;
+    for (size_t j = 0; j < d; j++) {
+      double x = queries[i * d + j], y = base[b * d + j];
+      s += mips ? -x * y : (x - y) * (x - y);
+    }
+    all.push_back({(float) s, b});
+  }
+  std::sort(all.begin(), all.end());
+  all.resize(k);
+  return all;
+}
+
+// adds the base in chunks of the given size and checks every query
+template<typename T>
+void CheckAgainstBruteForce(const std::vector<T>& queries, const std::vector<T>& base,
+                            size_t d, size_t k, bool mips, size_t chunk) {
+  size_t nq = queries.size() / d;
+  size_t n = base.size() / d;
+  exact_knn<T> knn(queries.data(), nq, d, k, mips);
+  for (size_t first = 0; first < n; first += chunk)
+    knn.add(base.data() + first * d, std::min(chunk, n - first), first);
+  ASSERT_EQ(knn.size(), nq);
+  for (size_t i = 0; i < nq; i++) {
+    auto all = BruteForce(queries, base, i, d, n, mips);
+    auto result = knn.neighbors(i);
+    ASSERT_EQ(result.size(), k);
+    for (size_t j = 0; j < k; j++) {
+      EXPECT_NEAR(result[j].first, all[j].first,
+                  1e-4 * std::max(1.0f, std::abs(all[j].first)));
+      // and the returned id is at that distance
+      auto it = std::find_if(all.begin(), all.end(), [&] (auto& e) {
+        return e.second == result[j].second;});
+      ASSERT_NE(it, all.end());
+      EXPECT_NEAR(it->first, result[j].first,
+                  1e-4 * std::max(1.0f, std::abs(it->first)));
+    }
+  }
+}
+
+template<typename T, typename Dist>
+std::vector<T> Random(size_t n, Dist dist, std::mt19937& gen) {
+  std::vector<T> v(n);
+  for (auto& x : v) x = (T) dist(gen);
+  return v;
+}
+
+TEST(ExactKnnTest, FloatEuclidean) {
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> u(-1, 1);
+  size_t d = 21;  // not a multiple of anything
+  auto queries = Random<float>(70 * d, u, gen);
+  auto base = Random<float>(500 * d, u, gen);
+  CheckAgainstBruteForce(queries, base, d, 10, false, 500);
+  CheckAgainstBruteForce(queries, base, d, 10, false, 37);
+}
+
+// Points far from the origin and close together, so |q|^2 + |b|^2 -
+// 2 q.b cancels to noise in float, but the reranked neighbors and
+// distances are exact.
+TEST(ExactKnnTest, FloatEuclideanFarFromOrigin) {
+  std::mt19937 gen(4);
+  std::uniform_real_distribution<float> u(-1, 1);
+  size_t d = 24;
+  size_t k = 10;
+  auto queries = Random<float>(20 * d, u, gen);
+  auto base = Random<float>(400 * d, u, gen);
+  for (auto& x : queries) x += 100;
+  for (auto& x : base) x += 100;
+  exact_knn<float> knn(queries.data(), 20, d, k, false);
+  for (size_t first = 0; first < 400; first += 150)
+    knn.add(base.data() + first * d, std::min<size_t>(150, 400 - first), first);
+  for (size_t i = 0; i < 20; i++) {
+    auto all = BruteForce(queries, base, i, d, k, false);
+    auto result = knn.neighbors(i);
+    ASSERT_EQ(result.size(), k);
+    for (size_t j = 0; j < k; j++) {
+      EXPECT_EQ(result[j].second, all[j].second);
+      EXPECT_NEAR(result[j].first, all[j].first, 1e-4 * all[j].first);
+    }
+  }
+}
+
+TEST(ExactKnnTest, FloatMips) {
+  std::mt19937 gen(2);
+  std::uniform_real_distribution<float> u(-1, 1);
+  size_t d = 16;
+  auto queries = Random<float>(9 * d, u, gen);
+  auto base = Random<float>(300 * d, u, gen);
+  CheckAgainstBruteForce(queries, base, d, 7, true, 100);
+}
+
+TEST(ExactKnnTest, Uint8IsExact) {
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<int> u(0, 255);
+  size_t d = 32;
+  auto queries = Random<uint8_t>(5 * d, u, gen);
+  auto base = Random<uint8_t>(400 * d, u, gen);
+  CheckAgainstBruteForce(queries, base, d, 20, false, 64);
+  exact_knn<uint8_t> knn(queries.data(), 5, d, 20, false);
+  knn.add(base.data(), 400, 0);
+  for (size_t i = 0; i < 5; i++) {
+    auto expected = BruteForce(queries, base, i, d, 20, false);
+    auto result = knn.neighbors(i);
+    for (size_t j = 0; j < 20; j++) EXPECT_EQ(result[j], expected[j]);
+  }
+}
+
+TEST(ExactKnnTest, FewerPointsThanK) {
+  std::vector<float> queries = {0, 0};
+  std::vector<float> base = {3, 4, 1, 0};
+  exact_knn<float> knn(queries.data(), 1, 2, 5, false);
+  knn.add(base.data(), 2, 10);
+  auto result = knn.neighbors(0);
+  ASSERT_EQ(result.size(), 2);
+  EXPECT_EQ(result[0], std::make_pair(1.0f, (uint64_t) 11));
+  EXPECT_EQ(result[1], std::make_pair(25.0f, (uint64_t) 10));
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -23,21 +23,67 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <fcntl.h>
 #include <iostream>
+#include <memory>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <vector>
 
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "parlay/internal/file_map.h"
 
 #include "types.h"
+#include "mmap.h"
 
 namespace parlayANN {
+
+// Header of the "serving layout" graph file written by
+// Graph::save_serving_layout.  The fixed-degree adjacency array is
+// stored exactly as it is in memory (maxDeg+1 slots per vertex,
+// starting at a page aligned offset) so it can be mapped in place.
+struct graph_file_header {
+  static constexpr uint64_t magic_value = 0x3147505f4e4e4150ul; // "PANN_PG1"
+  uint64_t magic;
+  uint64_t num_points;
+  uint64_t max_degree;
+  uint32_t index_bytes;  // sizeof(indexType)
+  uint32_t pad;
+  uint64_t data_offset;  // from start of file, multiple of the page size
+  uint64_t start_point;  // 0 in files written before it was recorded
+};
+
+// Trailer appended to a graph file written by Graph::save to record
+// its start point.  It is only written when the start point is not 0,
+// so graphs with the default start keep the original format.
+struct graph_start_trailer {
+  static constexpr uint64_t magic_value = 0x3150535f4e4e4150ul; // "PANN_SP1"
+  uint64_t magic;
+  uint64_t start_point;
+};
   
+// Per-vertex sequence lock used when a graph is read while it is
+// being updated (see Graph::enable_concurrent_reads).  The count is
+// odd while a writer is updating the neighbor list.  There can be at
+// most one writer per vertex at a time, which batch_insert guarantees.
+struct write_guard {
+  std::atomic<uint32_t>* version;
+  write_guard(std::atomic<uint32_t>* version) : version(version) {
+    if (version != nullptr) {
+      version->store(version->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+  }
+  ~write_guard() {
+    if (version != nullptr)
+      version->store(version->load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+};
+
 template<typename indexType>
 struct edgeRange{
 
@@ -47,8 +93,9 @@ struct edgeRange{
 
   edgeRange() : edges(parlay::make_slice<indexType*, indexType*>(nullptr, nullptr)) {}
 
-  edgeRange(indexType* start, indexType* end, indexType id)
-    : edges(parlay::make_slice<indexType*, indexType*>(start,end)), id_(id) {
+  edgeRange(indexType* start, indexType* end, indexType id,
+            std::atomic<uint32_t>* version = nullptr)
+    : edges(parlay::make_slice<indexType*, indexType*>(start,end)), id_(id), version(version) {
     maxDeg = edges.size() - 1;
   }
 
@@ -65,8 +112,9 @@ struct edgeRange{
                 << maxDeg << std::endl;
       abort();
     } else {
-      edges[edges[0]+1] = nbh;
-      edges[0] += 1;
+      write_guard w(version);
+      store(edges[0] + 1, nbh);
+      store(0, edges[0] + 1);
     }
   }
 
@@ -77,9 +125,10 @@ struct edgeRange{
                 << maxDeg << std::endl;
       abort();
     }
-    edges[0] = r.size();
+    write_guard w(version);
+    store(0, r.size());
     for (int i = 0; i < r.size(); i++) {
-      edges[i+1] = r[i];
+      store(i + 1, r[i]);
     }
   }
 
@@ -92,14 +141,16 @@ struct edgeRange{
       std::cout << r.size() << std::endl;
       abort();
     }
+    write_guard w(version);
     for (int i = 0; i < r.size(); i++) {
-      edges[edges[0] + i + 1] = r[i];
+      store(edges[0] + i + 1, r[i]);
     }
-    edges[0] += r.size();
+    store(0, edges[0] + r.size());
   }
 
   void clear_neighbors(){
-    edges[0] = 0;
+    write_guard w(version);
+    store(0, 0);
   }
 
   void prefetch() const {
@@ -108,18 +159,108 @@ struct edgeRange{
       __builtin_prefetch((char*) edges.begin() + i *  64);
   }
 
+  // Sorts a copy, so that the list is only changed by atomic stores.
   template<typename F>
   void sort(F&& less){
-    std::sort(edges.begin() + 1, edges.begin() + 1 + edges[0], less);}
+    std::vector<indexType> sorted(begin(), end());
+    std::sort(sorted.begin(), sorted.end(), less);
+    write_guard w(version);
+    for (size_t i = 0; i < sorted.size(); i++) store(i + 1, sorted[i]);}
 
   indexType* begin() const {return edges.begin() + 1;}
 
   indexType* end() const {return edges.begin() + 1 + edges[0];}
 
 private:
+  // Writes are relaxed atomic stores since concurrent readers (see
+  // snapshotEdgeRange) load the list while it is being written; the
+  // write_guard orders them.
+  void store(size_t i, indexType v) {__atomic_store_n(&edges[i], v, __ATOMIC_RELAXED);}
+
   parlay::slice<indexType*, indexType*> edges;
   long maxDeg;
   indexType id_;
+  std::atomic<uint32_t>* version = nullptr;
+};
+
+// Neighbor list returned by Graph::reader.  prefetch() touches the
+// list in place; any other access first copies it to a buffer, retrying
+// until the copy is not torn by a concurrent writer.  The copy spins
+// while a writer is updating the list, so a reader can wait on a
+// writer (but never on another reader).  The buffer belongs to the
+// reader and is reused, so debug builds check that the list is not
+// used after its buffer has been handed out again.  Neighbors with ids
+// of at least limit (vertices added after the reader was made) are
+// left out, since the reader's arrays may not cover them.
+template<typename indexType>
+struct snapshotEdgeRange{
+
+  snapshotEdgeRange(const indexType* slot, long maxDeg, indexType id, size_t limit,
+                    const std::atomic<uint32_t>* version, indexType* buffer,
+                    const uint64_t* buffer_uses)
+    : slot(slot), maxDeg(maxDeg), id_(id), limit(limit), version(version), buffer(buffer),
+      buffer_uses(buffer_uses), use(*buffer_uses) {}
+
+  size_t size() const {take(); return buffer[0];}
+
+  indexType id() const {return id_;}
+
+  indexType operator [] (indexType j) const {
+    take();
+    if (j >= buffer[0]) {
+      std::cout << "ERROR: index exceeds degree while accessing neighbors" << std::endl;
+      abort();
+    } else return buffer[j+1];
+  }
+
+  void prefetch() const {
+    int l = ((maxDeg + 1) * sizeof(indexType))/64;
+    for (int i = 0; i < l; i++)
+      __builtin_prefetch((char*) slot + i *  64);
+  }
+
+  const indexType* begin() const {take(); return buffer + 1;}
+
+  const indexType* end() const {take(); return buffer + 1 + buffer[0];}
+
+private:
+  void take() const {
+#ifndef NDEBUG
+    if (*buffer_uses != use) {
+      std::cout << "ERROR: neighbor list of " << id_ << " used after its reader "
+                << "buffer was reused" << std::endl;
+      abort();
+    }
+#endif
+    if (taken) return;
+    while (true) {
+      uint32_t v1 = version->load(std::memory_order_acquire);
+      if (v1 & 1) continue;  // writer in progress
+      indexType deg = __atomic_load_n(slot, __ATOMIC_RELAXED);
+      deg = std::min<indexType>(deg, maxDeg);  // a torn read can give any value
+      indexType m = 0;
+      for (indexType i = 1; i <= deg; i++) {
+        indexType v = __atomic_load_n(slot + i, __ATOMIC_RELAXED);
+        if (v < limit) buffer[++m] = v;
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (version->load(std::memory_order_relaxed) == v1) {
+        buffer[0] = m;
+        break;
+      }
+    }
+    taken = true;
+  }
+
+  const indexType* slot;
+  long maxDeg;
+  indexType id_;
+  size_t limit;
+  const std::atomic<uint32_t>* version;
+  indexType* buffer;
+  const uint64_t* buffer_uses;
+  uint64_t use;
+  mutable bool taken = false;
 };
 
 template<typename indexType_>
@@ -127,21 +268,69 @@ struct Graph{
   using indexType = indexType_;
   
   long max_degree() const {return maxDeg;}
-  size_t size() const {return n;}
+  // atomic, since a reader can look at it while the graph is resized
+  size_t size() const {return __atomic_load_n(&n, __ATOMIC_ACQUIRE);}
+
+  // The vertex searches start from, saved with the graph.
+  indexType start_point() const {return start;}
+  void set_start_point(indexType s) {start = s;}
 
   Graph(){}
 
-  void allocate_graph(long maxDeg, size_t n) {
+  // zeroed space for n vertices
+  static std::shared_ptr<indexType[]> new_graph_array(long maxDeg, size_t n) {
     long cnt = n * (maxDeg + 1);
     long num_bytes = cnt * sizeof(indexType);
     indexType* ptr = (indexType*) aligned_alloc(1l << 21, num_bytes);
     madvise(ptr, num_bytes, MADV_HUGEPAGE);
     parlay::parallel_for(0, cnt, [&] (long i) {ptr[i] = 0;});
-    graph = std::shared_ptr<indexType[]>(ptr, std::free);
+    return std::shared_ptr<indexType[]>(ptr, std::free);
   }
 
+  void allocate_graph(long maxDeg, size_t n) {graph = new_graph_array(maxDeg, n);}
+
   Graph(long maxDeg, size_t n) : maxDeg(maxDeg), n(n) {
     allocate_graph(maxDeg, n);
+    capacity = n;
+  }
+
+  // Changes the number of vertices to new_n, keeping the edges of the
+  // first min(n, new_n) vertices.  New vertices have no edges.  Space
+  // is reallocated geometrically, so growing a vertex at a time takes
+  // amortized constant time.
+  //
+  // Readers (see concurrent_reader) can run during a resize, but not
+  // writers.  A reallocation publishes new arrays and then the new
+  // size, and each reader holds on to the arrays and size it started
+  // with, so the old arrays are freed only once the last reader using
+  // them is gone.  Such a reader sees the graph as it was before the
+  // resize.
+  void resize(size_t new_n) {
+    if (new_n > capacity) reserve(std::max<size_t>(new_n, capacity + capacity / 2));
+    if (new_n > n) {
+      indexType* ptr = graph.get();
+      parlay::parallel_for(n * (maxDeg + 1), new_n * (maxDeg + 1),
+                           [&] (size_t i) {ptr[i] = 0;});
+    }
+    __atomic_store_n(&n, new_n, __ATOMIC_RELEASE);
+  }
+
+  // Makes room for new_capacity vertices without changing the size,
+  // so later resizes up to it do not reallocate.
+  void reserve(size_t new_capacity) {
+    if (new_capacity <= capacity) return;
+    auto new_graph = new_graph_array(maxDeg, new_capacity);
+    indexType* src = graph.get();
+    indexType* dst = new_graph.get();
+    parlay::parallel_for(0, n * (maxDeg + 1), [&] (size_t i) {dst[i] = src[i];});
+    std::atomic_store(&graph, std::move(new_graph));
+    if (versions) {
+      std::shared_ptr<std::atomic<uint32_t>[]> new_versions(new std::atomic<uint32_t>[new_capacity]);
+      parlay::parallel_for(0, new_capacity, [&] (size_t i) {
+        new_versions[i] = i < n ? versions[i].load() : 0;});
+      std::atomic_store(&versions, std::move(new_versions));
+    }
+    capacity = new_capacity;
   }
 
   Graph(char* gFile){
@@ -150,6 +339,14 @@ struct Graph{
       std::cout << "graph file " << gFile << " not found" << std::endl;
       abort();
     }
+    uint64_t magic = 0;
+    reader.read((char*)(&magic), sizeof(uint64_t));
+    if (reader && magic == graph_file_header::magic_value) {
+      map_serving_layout(gFile);
+      return;
+    }
+    reader.clear();
+    reader.seekg(0);
 
     //read num points and max degree
     indexType num_points;
@@ -175,6 +372,7 @@ struct Graph{
     offsets.push_back(total);
 
     allocate_graph(max_deg, n);
+    capacity = n;
 
     //write 1000000 vertices at a time
     size_t BLOCK_SIZE = 1000000;
@@ -201,6 +399,13 @@ struct Graph{
       delete[] edges_start;
     }
     delete[] degrees_start;
+
+    graph_start_trailer trailer;
+    reader.read((char*) &trailer, sizeof(trailer));
+    if (reader && trailer.magic == graph_start_trailer::magic_value && trailer.start_point < n) {
+      start = trailer.start_point;
+      std::cout << "Graph: start point " << start << std::endl;
+    }
   }
 
   void save(char* oFile) {
@@ -228,6 +433,63 @@ struct Graph{
       writer.write((char*)data.begin(), data.size() * sizeof(indexType));
       index = ceiling;
     }
+    if (start != 0) {
+      graph_start_trailer trailer = {graph_start_trailer::magic_value, start};
+      writer.write((char*) &trailer, sizeof(trailer));
+    }
+    writer.close();
+  }
+
+  // Maps a file written by save_serving_layout so the graph is served
+  // directly from the page cache.  The mapping is copy-on-write, so
+  // the graph can still be updated (e.g. by further inserts).
+  void map_serving_layout(char* gFile) {
+    auto [fileptr, length] = mmapStringFromFile(gFile, true);
+    graph_file_header header;
+    std::memcpy(&header, fileptr, sizeof(graph_file_header));
+    n = header.num_points;
+    maxDeg = header.max_degree;
+    start = header.start_point;
+    if (header.index_bytes != sizeof(indexType)) {
+      std::cout << "ERROR: graph file " << gFile << " uses " << header.index_bytes
+                << " byte ids, expected " << sizeof(indexType) << std::endl;
+      abort();
+    }
+    if (header.data_offset + n * (maxDeg + 1) * sizeof(indexType) > length) {
+      std::cout << "ERROR: graph file " << gFile << " is truncated" << std::endl;
+      abort();
+    }
+    std::cout << "Graph: mapped " << n << " points with max degree " << maxDeg
+              << " (serving layout)" << std::endl;
+    capacity = n;
+    graph = std::shared_ptr<indexType[]>((indexType*) (fileptr + header.data_offset),
+                                         [fileptr = fileptr, length = length] (indexType*) {
+                                           munmap(fileptr, length);});
+  }
+
+  // Writes the graph in the serving layout (see graph_file_header)
+  // so that later loads can map the file instead of repacking it.
+  void save_serving_layout(char* oFile) const {
+    graph_file_header header;
+    header.magic = graph_file_header::magic_value;
+    header.num_points = n;
+    header.max_degree = maxDeg;
+    header.index_bytes = sizeof(indexType);
+    header.pad = 0;
+    header.data_offset = sysconf(_SC_PAGESIZE);
+    header.start_point = start;
+    std::cout << "Writing graph with " << n << " points and max degree " << maxDeg
+              << " in serving layout" << std::endl;
+    std::ofstream writer(oFile, std::ios::binary | std::ios::out);
+    parlay::sequence<char> preamble(header.data_offset, 0);
+    std::memcpy(preamble.begin(), &header, sizeof(graph_file_header));
+    writer.write(preamble.begin(), preamble.size());
+    size_t BLOCK_SIZE = 1000000;
+    for (size_t index = 0; index < n; index += BLOCK_SIZE) {
+      size_t m = std::min(BLOCK_SIZE, n - index);
+      writer.write((char*) (graph.get() + index * (maxDeg + 1)),
+                   m * (maxDeg + 1) * sizeof(indexType));
+    }
     writer.close();
   }
 
@@ -238,15 +500,81 @@ struct Graph{
     }
     return edgeRange<indexType>(graph.get() + i * (maxDeg + 1),
                                 graph.get() + (i + 1) * (maxDeg + 1),
-                                i);
+                                i,
+                                versions ? versions.get() + i : nullptr);
   }
 
+  // After this is called, every update through operator[] is guarded
+  // by a per-vertex sequence lock, so the graph can be searched through
+  // a reader (see concurrent_reader) while it is being updated, for
+  // example by batch_insert.  Writers never wait on readers, and
+  // readers only wait (spin) on a writer of the list they are copying.
+  // The graph can be resized while readers are active, but not while
+  // it is being updated (see resize).
+  void enable_concurrent_reads() {
+    if (versions) return;
+    versions = std::shared_ptr<std::atomic<uint32_t>[]>(new std::atomic<uint32_t>[capacity]);
+    parlay::parallel_for(0, capacity, [&] (size_t i) {versions[i] = 0;});
+  }
+
+  bool concurrent_reads() const {return std::atomic_load(&versions) != nullptr;}
+
+  // A read-only view of the graph whose neighbor lists are consistent
+  // snapshots, for searching a graph that is being updated.  The view
+  // keeps the graph's arrays and size as of when it was made, so it is
+  // unaffected by a later resize (edges to vertices added since are left
+  // out).  Each search should use its own
+  // reader, and at most two neighbor lists from a reader can be in use
+  // at a time.
+  struct reader {
+    reader(const Graph& G)
+      : n(G.size()), maxDeg(G.maxDeg),
+        graph(std::atomic_load(&G.graph)), versions(std::atomic_load(&G.versions)),
+        buffers(2 * (maxDeg + 1)), uses(2, 0), next(0) {
+      if (!versions) {
+        std::cout << "ERROR: concurrent reader requires enable_concurrent_reads" << std::endl;
+        abort();
+      }
+    }
+
+    long max_degree() const {return maxDeg;}
+    size_t size() const {return n;}
+
+    snapshotEdgeRange<indexType> operator [] (indexType i) const {
+      if (i >= n) {
+        std::cout << "ERROR: graph index out of range: " << i << std::endl;
+        abort();
+      }
+      indexType* buffer = buffers.data() + next * (maxDeg + 1);
+      uses[next]++;
+      const uint64_t* buffer_uses = uses.data() + next;
+      next ^= 1;
+      return snapshotEdgeRange<indexType>(graph.get() + i * (maxDeg + 1), maxDeg, i, n,
+                                          versions.get() + i, buffer, buffer_uses);
+    }
+
+  private:
+    size_t n;
+    long maxDeg;
+    std::shared_ptr<indexType[]> graph;
+    std::shared_ptr<std::atomic<uint32_t>[]> versions;
+    mutable std::vector<indexType> buffers;
+    mutable std::vector<uint64_t> uses; // lists handed out from each buffer
+    mutable int next;
+  };
+
+  reader concurrent_reader() const {return reader(*this);}
+
   ~Graph(){}
 
 private:
   size_t n;
   long maxDeg;
+  size_t capacity = 0;
+  indexType start = 0;
   std::shared_ptr<indexType[]> graph;
+  std::shared_ptr<std::atomic<uint32_t>[]> versions; // only if enable_concurrent_reads
+
 };
 
 } // end namespace
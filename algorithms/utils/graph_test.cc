@@ -0,0 +1,142 @@
+#include "algorithms/utils/graph.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+TEST(GraphTest, ResizeKeepsEdges) {
+  Graph<unsigned int> G(4, 3);
+  std::vector<unsigned int> ngh = {2, 1};
+  G[0].update_neighbors(ngh);
+  G.resize(100);
+  EXPECT_EQ(G.size(), 100);
+  ASSERT_EQ(G[0].size(), 2);
+  EXPECT_EQ(G[0][0], 2);
+  EXPECT_EQ(G[0][1], 1);
+  for (unsigned int i = 1; i < 100; i++) EXPECT_EQ(G[i].size(), 0);
+}
+
+TEST(GraphTest, SavesStartPoint) {
+  Graph<unsigned int> G(4, 10);
+  std::vector<unsigned int> ngh = {3, 7};
+  G[5].update_neighbors(ngh);
+  std::string path = testing::TempDir() + "/graph_test.graph";
+  std::string layout_path = testing::TempDir() + "/graph_test.layout";
+
+  // the default start point is not recorded
+  G.save(path.data());
+  EXPECT_EQ(Graph<unsigned int>(path.data()).start_point(), 0);
+
+  G.set_start_point(5);
+  G.save(path.data());
+  G.save_serving_layout(layout_path.data());
+  for (auto& p : {path, layout_path}) {
+    Graph<unsigned int> H(const_cast<char*>(p.data()));
+    EXPECT_EQ(H.start_point(), 5);
+    ASSERT_EQ(H[5].size(), 2);
+    EXPECT_EQ(H[5][1], 7);
+  }
+  std::remove(path.c_str());
+  std::remove(layout_path.c_str());
+}
+
+// A writer repeatedly replaces neighbor lists with lists whose length
+// and entries are all determined by a single value, so that any torn
+// read seen by the reader is detected.
+TEST(GraphTest, ConcurrentReaderSeesConsistentLists) {
+  long max_deg = 32;
+  size_t n = 2;
+  Graph<unsigned int> G(max_deg, n);
+  G.enable_concurrent_reads();
+  std::atomic<bool> done = false;
+
+  std::thread writer([&] {
+    std::vector<unsigned int> ngh;
+    for (unsigned int k = 1; !done; k++) {
+      ngh.assign(k % max_deg + 1, k);
+      G[k % n].update_neighbors(ngh);
+    }
+  });
+
+  auto R = G.concurrent_reader();
+  for (size_t reads = 0; reads < 1000000; reads++) {
+    unsigned int i = reads % n;
+    auto ngh = R[i];
+    ngh.prefetch();
+    size_t deg = ngh.size();
+    if (deg == 0) continue;
+    unsigned int k = ngh[0];
+    bool consistent = deg == k % max_deg + 1 && k % n == i;
+    for (unsigned int v : ngh) consistent &= (v == k);
+    if (!consistent) {
+      done = true;
+      writer.join();
+      FAIL() << "torn neighbor list for vertex " << i;
+    }
+  }
+  done = true;
+  writer.join();
+}
+
+// A reader made before a resize that reallocates keeps reading the
+// old arrays, and readers made after it see the new size.
+TEST(GraphTest, ReaderOutlivesResize) {
+  Graph<unsigned int> G(4, 3);
+  G.enable_concurrent_reads();
+  std::vector<unsigned int> ngh = {2, 1};
+  G[0].update_neighbors(ngh);
+  auto before = G.concurrent_reader();
+  G.resize(1000);
+  G[0].update_neighbors(std::vector<unsigned int>{999});
+  EXPECT_EQ(before.size(), 3);
+  ASSERT_EQ(before[0].size(), 2);
+  EXPECT_EQ(before[0][1], 1);
+  auto after = G.concurrent_reader();
+  EXPECT_EQ(after.size(), 1000);
+  ASSERT_EQ(after[0].size(), 1);
+  EXPECT_EQ(after[0][0], 999);
+}
+
+// When a resize does not reallocate, a reader made before it shares the
+// arrays, and leaves out edges to the vertices it does not cover.
+TEST(GraphTest, ReaderSkipsNewVertices) {
+  Graph<unsigned int> G(4, 3);
+  G.reserve(10);
+  G.enable_concurrent_reads();
+  auto before = G.concurrent_reader();
+  G.resize(10);
+  G[0].update_neighbors(std::vector<unsigned int>{2, 7, 1});
+  ASSERT_EQ(before[0].size(), 2);
+  EXPECT_EQ(before[0][0], 2);
+  EXPECT_EQ(before[0][1], 1);
+  EXPECT_EQ(G.concurrent_reader()[0].size(), 3);
+}
+
+// Readers search while another thread grows the graph a vertex at a
+// time (reallocating as it goes), which must never read freed space.
+TEST(GraphTest, ReadersDuringResize) {
+  Graph<unsigned int> G(8, 1);
+  G.enable_concurrent_reads();
+  std::atomic<bool> done = false;
+  std::thread grower([&] {
+    for (size_t n = 2; n < 20000; n++) G.resize(n);
+    done = true;
+  });
+  while (!done) {
+    auto R = G.concurrent_reader();
+    unsigned int i = R.size() - 1;
+    EXPECT_EQ(R[i].size(), 0);
+  }
+  grower.join();
+  EXPECT_EQ(G.size(), 19999);
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -36,9 +36,12 @@ struct Mips_JL_Point {
     parameters(std::vector<int8_t> const& JL_vects, int dims, int d)
       // vectors are normalized so few values will be greater than .3
       : JL_vects(JL_vects), dims(dims), mips_params(.3, d) {}
+    template <typename Archive>
+    void serialize(Archive& ar) {ar(JL_vects); ar(mips_params); ar(dims);}
   };
 
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Mips_JL_Point<" + std::to_string(jl_dims) + ">";}
   
   T operator [] (long j) const {return pt[j];}
 
@@ -121,18 +124,20 @@ struct Mips_JL_Bit_Point {
       : JL_vects(JL_vects), source_dims(source_dims), dims(jl_dims) {
       std::cout << "JL dense quantization, dims = " << jl_dims << std::endl;
     }
+    template <typename Archive>
+    void serialize(Archive& ar) {ar(JL_vects); ar(source_dims); ar(dims);}
   };
   
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Mips_JL_Bit_Point<" + std::to_string(jl_dims) + ">";}
   
   int8_t operator [] (long j) const {
     Data* pbits = (Data*) values;
     return (*pbits)[j] ? 1 : -1;}
 
   float distance(const Mips_JL_Bit_Point &q) const {
-    Data* pbits = (Data*) values;
-    Data* qbits = (Data*) q.values;
-    return (*pbits ^ *qbits).count();
+    return simd::dispatch.hamming((const uint64_t*) values, (const uint64_t*) q.values,
+                                  sizeof(Data) / 8);
   }
 
   void prefetch() const {
@@ -210,18 +215,20 @@ struct Mips_JL_Sparse_Point {
       : JL_signs(JL_signs), JL_indices(JL_indices), source_dims(source_dims), dims(jl_dims) {
       std::cout << "JL sparse quantization, dims = " << jl_dims << std::endl;
     }
+    template <typename Archive>
+    void serialize(Archive& ar) {ar(JL_signs); ar(JL_indices); ar(source_dims); ar(dims);}
   };
   
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Mips_JL_Sparse_Point<" + std::to_string(jl_dims) + ">";}
   
   int8_t operator [] (long j) const {
     Data* pbits = (Data*) values;
     return (*pbits)[j] ? 1 : -1;}
 
   float distance(const Mips_JL_Sparse_Point &q) const {
-    Data* pbits = (Data*) values;
-    Data* qbits = (Data*) q.values;
-    return (*pbits ^ *qbits).count();
+    return simd::dispatch.hamming((const uint64_t*) values, (const uint64_t*) q.values,
+                                  sizeof(Data) / 8);
   }
 
   void prefetch() const {
@@ -303,9 +310,12 @@ struct Mips_JL_Sparse_Point_Normalized {
       : JL_signs(JL_signs), JL_indices(JL_indices), source_dims(source_dims), dims(jl_dims) {
       std::cout << "JL sparse quantization, dims = " << jl_dims << std::endl;
     }
+    template <typename Archive>
+    void serialize(Archive& ar) {ar(JL_signs); ar(JL_indices); ar(source_dims); ar(dims);}
   };
   
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Mips_JL_Sparse_Point_Normalized<" + std::to_string(jl_dims) + ">";}
   
   int8_t operator [] (long j) const {
     Data* pbits = (Data*) values;
@@ -316,7 +326,8 @@ struct Mips_JL_Sparse_Point_Normalized {
     Data* qbits = (Data*) q.values;
     float pr = *((float*) (values + sizeof(Data)));
     float qr = *((float*) (q.values + sizeof(Data)));
-    return (*pbits ^ *qbits).count() * pr; // * qr;
+    return simd::dispatch.hamming((const uint64_t*) pbits, (const uint64_t*) qbits,
+                                  sizeof(Data) / 8) * pr; // * qr;
   }
 
   void prefetch() const {
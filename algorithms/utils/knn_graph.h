@@ -0,0 +1,250 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+
+#include "beamSearch.h"
+#include "euclidian_point.h"
+#include "exact_knn.h"
+#include "graph.h"
+#include "mips_point.h"
+#include "types.h"
+
+namespace parlayANN {
+
+// The k nearest neighbor graph of a point set: each point has edges to
+// its k nearest other points, by increasing distance.
+
+// The exact k nearest other points of each of n points of dimension d
+// stored row major (as in a .bin file), with squared Euclidean or
+// negative inner product (mips) distances.  Returns n rows of
+// min(k, n - 1) (distance, id) pairs, each sorted by distance.
+//
+// The points are split into blocks of about 128KB and every pair of
+// blocks is compared once, using the panels and micro kernel of
+// exact_knn.  Since the distance is symmetric, each distance is added
+// to the heaps of both of its points, so half the distances of a
+// query by query join are computed.  The pairs of blocks are scheduled
+// in rounds of a round robin tournament, so no block is in two pairs
+// of a round, and the pairs of a round update their heaps in parallel
+// without locks.
+//
+// As in exact_knn, float Euclidean distances are reranked: each point
+// keeps k + rerank_slack candidates by the expanded form, and they are
+// then ranked by the distance of Euclidian_Point, so the lists and
+// their distances are exact despite cancellation.
+template<typename indexType, typename T>
+parlay::sequence<std::pair<float, indexType>>
+exact_knn_lists(const T* points, size_t n, unsigned int d, long k, bool mips) {
+  using knn = exact_knn<T>;
+  using A = typename knn::A;
+  using wide = typename knn::wide;
+  using entry = std::pair<float, indexType>; // distance, id
+  constexpr size_t panel_width = knn::panel_width;
+  constexpr size_t group = knn::group;
+
+  k = std::min<long>(k, n == 0 ? 0 : n - 1);
+  if (k == 0) return parlay::sequence<entry>();
+  bool rerank = std::is_floating_point_v<T> && !mips;
+  long keep = rerank ? std::min<long>(k + knn::rerank_slack, n - 1) : k;
+  auto panels = knn::to_panels(points, n, d);
+  // padded to whole panels, so a panel's norms can be read together
+  size_t padded = (n + panel_width - 1) / panel_width * panel_width;
+  auto norms = parlay::tabulate(padded, [&] (size_t i) {
+    return i < n ? knn::norm(points + i * d, d) : 0;});
+  parlay::sequence<entry> heaps(n * keep);
+  parlay::sequence<long> sizes(n, 0);
+  // the largest distance in each full heap, so most distances are
+  // rejected with one comparison
+  parlay::sequence<float> worst(n, std::numeric_limits<float>::max());
+  auto push = [&] (size_t i, entry e) {
+    if (e.first > worst[i]) return;
+    knn::push(heaps.begin() + i * keep, sizes[i], keep, e);
+    if (sizes[i] == keep) worst[i] = heaps[i * keep].first;
+  };
+
+  size_t block_points = std::max<size_t>(panel_width, (1 << 17) / (d * sizeof(A)));
+  block_points = block_points / panel_width * panel_width;
+  size_t num_blocks = (n + block_points - 1) / block_points;
+
+  // the rows of block a against the panels of block b, adding each
+  // distance to both heaps (only pairs i < j when a = b)
+  auto compare_blocks = [&] (size_t a, size_t b) {
+    size_t a_start = a * block_points;
+    size_t a_end = std::min(n, a_start + block_points);
+    size_t b_start = b * block_points;
+    size_t b_end = std::min(n, b_start + block_points);
+    size_t rows = (a_end - a_start + group - 1) / group * group;
+    parlay::sequence<A> R(rows * d, 0);
+    for (size_t i = a_start; i < a_end; i++)
+      for (size_t j = 0; j < d; j++) R[(i - a_start) * d + j] = points[i * d + j];
+    A dots[group][panel_width];
+    float dists[group][panel_width];
+    for (size_t p = b_start / panel_width; p * panel_width < b_end; p++) {
+      const A* panel = panels.begin() + p * panel_width * d;
+      for (size_t q = a_start; q < a_end; q += group) {
+        // on the diagonal, skip when every j in the panel is at most every i
+        if (a == b && p * panel_width + panel_width <= q + 1) continue;
+        knn::micro_kernel(R.begin() + (q - a_start) * d, panel, d, dots);
+        const wide* panel_norms = norms.begin() + p * panel_width;
+        for (size_t g = 0; g < group; g++)
+          for (size_t l = 0; l < panel_width; l++)
+            dists[g][l] = mips ? (float) -(wide) dots[g][l]
+              : (float) (norms[q + g] + panel_norms[l] - 2 * (wide) dots[g][l]);
+        for (size_t g = 0; g < group && q + g < a_end; g++) {
+          size_t i = q + g;
+          for (size_t l = 0; l < panel_width; l++) {
+            size_t j = p * panel_width + l;
+            if (j >= b_end) break;
+            if (a == b && j <= i) continue;
+            push(i, entry(dists[g][l], j));
+            push(j, entry(dists[g][l], i));
+          }
+        }
+      }
+    }
+  };
+
+  // the diagonal, then the round robin rounds (with an odd number of
+  // blocks, the pairs with the extra block m - 1 are skipped)
+  parlay::parallel_for(0, num_blocks, [&] (size_t a) {compare_blocks(a, a);}, 1);
+  size_t m = num_blocks + (num_blocks % 2);
+  for (size_t r = 0; r + 1 < m; r++) {
+    parlay::parallel_for(0, m / 2, [&] (size_t i) {
+      size_t a = (i == 0) ? m - 1 : (r + i) % (m - 1);
+      size_t b = (r + m - 1 - i) % (m - 1);
+      if (a < num_blocks && b < num_blocks) compare_blocks(std::min(a, b), std::max(a, b));
+    }, 1);
+  }
+
+  parlay::parallel_for(0, n, [&] (size_t i) {
+    entry* h = heaps.begin() + i * keep;
+    if constexpr (std::is_floating_point_v<T>)
+      if (rerank)
+        for (long j = 0; j < keep; j++)
+          h[j].first = euclidian_distance(points + i * d, points + h[j].second * d, d);
+    std::sort(h, h + keep);});
+  if (keep == k) return heaps;
+  return parlay::tabulate(n * k, [&] (size_t i) {return heaps[i / k * keep + i % k];});
+}
+
+// The exact k nearest neighbor graph of the points, as above.
+template<typename indexType, typename T>
+Graph<indexType> exact_knn_graph(const T* points, size_t n, unsigned int d,
+                                 long k, bool mips) {
+  if (k >= (long) n) {
+    std::cout << "ERROR: k = " << k << " must be smaller than the number of points "
+              << n << std::endl;
+    abort();
+  }
+  auto lists = exact_knn_lists<indexType>(points, n, d, k, mips);
+  Graph<indexType> G(k, n);
+  parlay::parallel_for(0, n, [&] (size_t i) {
+    auto ngh = parlay::tabulate(k, [&] (size_t j) {return lists[i * k + j].second;});
+    G[i].update_neighbors(ngh);
+  });
+  return G;
+}
+
+// Point types whose distance is the squared Euclidean distance or
+// negative inner product of their stored coordinates, so exact_knn_lists
+// computes the same distances (up to rounding).
+template<typename Point>
+struct plain_distance : std::false_type {};
+template<typename T, long range>
+struct plain_distance<Euclidian_Point<T, range>> : std::true_type {
+  static constexpr bool mips = false;};
+template<typename T>
+struct plain_distance<Mips_Point<T>> : std::true_type {
+  static constexpr bool mips = true;};
+
+// exact_knn_lists of the points Points[ids[i]], where the ids in the
+// result are positions in ids.
+template<typename indexType, typename PointRange>
+parlay::sequence<std::pair<float, indexType>>
+exact_knn_lists(const PointRange &Points, const parlay::sequence<size_t> &ids, long k) {
+  using Point = typename PointRange::Point;
+  using T = typename Point::T;
+  static_assert(plain_distance<Point>::value);
+  size_t d = Points.dimension();
+  auto coordinates = parlay::sequence<T>::uninitialized(ids.size() * d);
+  parlay::parallel_for(0, ids.size(), [&] (size_t i) {
+    auto p = Points[ids[i]];
+    for (size_t j = 0; j < d; j++) coordinates[i * d + j] = p[j];});
+  return exact_knn_lists<indexType>(coordinates.begin(), ids.size(), d, k,
+                                    plain_distance<Point>::mips);
+}
+
+// Approximate version, searching the index G with every point.  Each
+// search starts from the point itself, which is its own nearest point,
+// so the beam quickly fills with its neighborhood.  QP.beamSize should
+// be larger than k.
+template<typename indexType, typename PointRange>
+Graph<indexType> approximate_knn_graph(const Graph<indexType> &G,
+                                       const PointRange &Points,
+                                       long k, const QueryParams &QP) {
+  size_t n = Points.size();
+  if (QP.beamSize <= k) {
+    std::cout << "ERROR: beam size " << QP.beamSize << " must be larger than k = "
+              << k << std::endl;
+    abort();
+  }
+  Graph<indexType> H(k, n);
+  parlay::parallel_for(0, n, [&] (size_t i) {
+    parlay::sequence<indexType> start = {(indexType) i};
+    auto beam = beam_search(Points[i], G, Points, start, QP).first.first;
+    auto others = parlay::filter(beam, [&] (auto& p) {return p.first != i;});
+    auto ngh = parlay::tabulate(std::min<size_t>(k, others.size()), [&] (size_t j) {
+      return others[j].first;});
+    H[i].update_neighbors(ngh);
+  }, 1);
+  return H;
+}
+
+// the fraction of the edges of the exact k nearest neighbor graph E
+// that are in G
+template<typename indexType>
+double knn_graph_recall(const Graph<indexType> &G, const Graph<indexType> &E) {
+  auto found = parlay::tabulate(E.size(), [&] (size_t i) {
+    auto g = G[i];
+    auto e = E[i];
+    size_t c = 0;
+    for (size_t j = 0; j < e.size(); j++)
+      for (size_t l = 0; l < g.size(); l++)
+        if (g[l] == e[j]) {c++; break;}
+    return c;});
+  size_t edges = parlay::reduce(parlay::tabulate(E.size(), [&] (size_t i) {
+    return (size_t) E[i].size();}));
+  return edges == 0 ? 1.0 : (double) parlay::reduce(found) / edges;
+}
+
+} // end namespace
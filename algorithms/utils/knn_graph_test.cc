@@ -0,0 +1,97 @@
+#include "algorithms/utils/knn_graph.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/point_range.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using Point = Euclidian_Point<float>;
+
+std::vector<float> RandomPoints(size_t n, size_t d) {
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> u(-1, 1);
+  std::vector<float> v(n * d);
+  for (auto& x : v) x = u(gen);
+  return v;
+}
+
+// the k nearest other points of point i, by brute force
+std::vector<unsigned int> BruteForce(const std::vector<float>& points, size_t d,
+                                     size_t i, size_t k) {
+  std::vector<std::pair<float, unsigned int>> all;
+  for (size_t j = 0; j < points.size() / d; j++) {
+    if (j == i) continue;
+    float s = 0;
+    for (size_t l = 0; l < d; l++) {
+      float x = points[i * d + l] - points[j * d + l];
+      s += x * x;
+    }
+    all.push_back({s, (unsigned int) j});
+  }
+  std::sort(all.begin(), all.end());
+  std::vector<unsigned int> ids;
+  for (size_t j = 0; j < k; j++) ids.push_back(all[j].second);
+  return ids;
+}
+
+TEST(KnnGraphTest, ExactMatchesBruteForce) {
+  // 1300 points of dimension 64 make three blocks, so the round robin
+  // has a skipped pair in each round
+  size_t n = 1300, d = 64, k = 8;
+  auto points = RandomPoints(n, d);
+  auto G = exact_knn_graph<unsigned int>(points.data(), n, d, k, false);
+  ASSERT_EQ(G.size(), n);
+  for (size_t i = 0; i < n; i++) {
+    auto expected = BruteForce(points, d, i, k);
+    ASSERT_EQ(G[i].size(), k);
+    for (size_t j = 0; j < k; j++) EXPECT_EQ(G[i][j], expected[j]) << i;
+  }
+  EXPECT_EQ(knn_graph_recall(G, G), 1.0);
+}
+
+// Points far from the origin and close together, so the expanded form
+// of the distance cancels to noise in float, but the reranked lists
+// are exact.
+TEST(KnnGraphTest, ExactFarFromOrigin) {
+  size_t n = 400, d = 24, k = 10;
+  auto points = RandomPoints(n, d);
+  for (auto& x : points) x += 100;
+  auto lists = exact_knn_lists<unsigned int>(points.data(), n, d, k, false);
+  for (size_t i = 0; i < n; i++) {
+    auto expected = BruteForce(points, d, i, k);
+    for (size_t j = 0; j < k; j++) EXPECT_EQ(lists[i * k + j].second, expected[j]) << i;
+  }
+}
+
+TEST(KnnGraphTest, ApproximateSearchesTheIndex) {
+  size_t n = 1000, d = 8, k = 5;
+  auto points = RandomPoints(n, d);
+  auto E = exact_knn_graph<unsigned int>(points.data(), n, d, k, false);
+  // a denser exact graph serves as the index
+  auto index = exact_knn_graph<unsigned int>(points.data(), n, d, 16, false);
+
+  Point::parameters params(d);
+  std::vector<Point> pts;
+  for (size_t i = 0; i < n; i++)
+    pts.push_back(Point((uint8_t*) (points.data() + i * d), i, params));
+  PointRange<Point> Points(pts, params);
+  QueryParams QP(k + 1, 20, 1.35, n, index.max_degree());
+  auto G = approximate_knn_graph(index, Points, k, QP);
+  ASSERT_EQ(G.size(), n);
+  for (size_t i = 0; i < n; i++) {
+    EXPECT_EQ(G[i].size(), k);
+    for (size_t j = 0; j < G[i].size(); j++) EXPECT_NE(G[i][j], i);
+  }
+  EXPECT_GT(knn_graph_recall(G, E), 0.95);
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -0,0 +1,335 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "beamSearch.h"
+#include "types.h"
+
+namespace parlayANN {
+
+// Labels (e.g. tenants or categories) attached to the points, and
+// optionally one numeric attribute per point (e.g. a price or a
+// date).  The labels of each point are kept sorted in compressed
+// sparse rows, along with the inverse: the points carrying each label.
+template<typename indexType>
+struct point_labels {
+  using label = uint32_t;
+
+  parlay::sequence<size_t> offsets;       // labels of point i are ids[offsets[i]] ... ids[offsets[i+1]-1]
+  parlay::sequence<label> ids;
+  parlay::sequence<size_t> label_offsets; // points with label l are points[label_offsets[l]] ...
+  parlay::sequence<indexType> points;
+  parlay::sequence<float> values;         // empty if there is no numeric attribute
+  size_t num_labels = 0;
+
+  point_labels() : offsets(1, 0), label_offsets(1, 0) {}
+
+  // from the labels of each point, in any order
+  point_labels(const parlay::sequence<parlay::sequence<label>> &per_point) {
+    auto sizes = parlay::map(per_point, [] (auto &l) {return l.size();});
+    auto [offs, total] = parlay::scan(sizes);
+    offs.push_back(total);
+    offsets = std::move(offs);
+    ids = parlay::flatten(per_point);
+    build_inverse();
+  }
+
+  // Reads the sparse matrix format of the big-ann-benchmarks filter
+  // track: int64 rows, columns and nonzeros, then int64 row offsets,
+  // int32 column ids (the labels) and float32 entries (ignored).
+  point_labels(char* filename) {
+    std::ifstream reader(filename, std::ios::binary);
+    if (!reader.is_open()) {
+      std::cout << "ERROR: could not open label file " << filename << std::endl;
+      abort();
+    }
+    int64_t nrow, ncol, nnz;
+    reader.read((char*)&nrow, sizeof(int64_t));
+    reader.read((char*)&ncol, sizeof(int64_t));
+    reader.read((char*)&nnz, sizeof(int64_t));
+    parlay::sequence<int64_t> indptr(nrow + 1);
+    reader.read((char*)indptr.begin(), (nrow + 1) * sizeof(int64_t));
+    parlay::sequence<int32_t> indices(nnz);
+    reader.read((char*)indices.begin(), nnz * sizeof(int32_t));
+    if (!reader || indptr[nrow] != nnz) {
+      std::cout << "ERROR: label file " << filename << " is truncated or corrupt" << std::endl;
+      abort();
+    }
+    offsets = parlay::map(indptr, [] (int64_t o) {return (size_t) o;});
+    ids = parlay::map(indices, [] (int32_t l) {return (label) l;});
+    num_labels = ncol;
+    build_inverse();
+    std::cout << "Labels: detected " << nrow << " points with " << nnz
+              << " labels from " << ncol << " distinct labels" << std::endl;
+  }
+
+  // writes the format read above, with every entry 1
+  void save(char* filename) const {
+    int64_t header[3] = {(int64_t) size(), (int64_t) num_labels, (int64_t) ids.size()};
+    auto indptr = parlay::map(offsets, [] (size_t o) {return (int64_t) o;});
+    auto indices = parlay::map(ids, [] (label l) {return (int32_t) l;});
+    parlay::sequence<float> data(ids.size(), 1.0);
+    std::ofstream writer(filename, std::ios::binary | std::ios::out);
+    writer.write((char*)header, 3 * sizeof(int64_t));
+    writer.write((char*)indptr.begin(), indptr.size() * sizeof(int64_t));
+    writer.write((char*)indices.begin(), indices.size() * sizeof(int32_t));
+    writer.write((char*)data.begin(), data.size() * sizeof(float));
+  }
+
+  // reads the numeric attribute, one float per point, from a .fbin
+  // file with dimension 1
+  void load_values(char* filename) {
+    std::ifstream reader(filename, std::ios::binary);
+    int32_t header[2] = {0, 0};
+    reader.read((char*)header, 2 * sizeof(int32_t));
+    if (!reader || header[0] != (int32_t) size() || header[1] != 1) {
+      std::cout << "ERROR: value file " << filename << " should have one value for each of "
+                << size() << " points" << std::endl;
+      abort();
+    }
+    values = parlay::sequence<float>(size());
+    reader.read((char*)values.begin(), size() * sizeof(float));
+  }
+
+  size_t size() const {return offsets.size() - 1;}
+
+  // the sorted labels of point i
+  auto labels(indexType i) const {
+    return parlay::make_slice(ids.begin() + offsets[i], ids.begin() + offsets[i + 1]);
+  }
+
+  // the points carrying label l, in increasing order
+  auto points_with(label l) const {
+    if (l >= num_labels) return parlay::make_slice(points.end(), points.end());
+    return parlay::make_slice(points.begin() + label_offsets[l],
+                              points.begin() + label_offsets[l + 1]);
+  }
+
+  size_t count(label l) const {return points_with(l).size();}
+
+  bool has_label(indexType i, label l) const {
+    auto ls = labels(i);
+    return std::binary_search(ls.begin(), ls.end(), l);
+  }
+
+  bool share_label(indexType i, indexType j) const {
+    auto a = labels(i), b = labels(j);
+    auto x = a.begin(), y = b.begin();
+    while (x != a.end() && y != b.end()) {
+      if (*x == *y) return true;
+      if (*x < *y) x++; else y++;
+    }
+    return false;
+  }
+
+  // whether r carries every label shared by p and q, i.e. whether a
+  // search restricted to any of those labels can go from p to q via r
+  bool covers(indexType r, indexType p, indexType q) const {
+    auto a = labels(p), b = labels(q);
+    auto x = a.begin(), y = b.begin();
+    while (x != a.end() && y != b.end()) {
+      if (*x == *y) {
+        if (!has_label(r, *x)) return false;
+        x++; y++;
+      } else if (*x < *y) x++; else y++;
+    }
+    return true;
+  }
+
+private:
+  void build_inverse() {
+    parlay::parallel_for(0, size(), [&] (size_t i) {
+      std::sort(ids.begin() + offsets[i], ids.begin() + offsets[i + 1]);});
+    if (ids.size() > 0)
+      num_labels = std::max<size_t>(num_labels, parlay::reduce(ids, parlay::maxm<label>()) + 1);
+    auto pairs = parlay::tabulate(ids.size(), [&] (size_t j) {
+      size_t i = std::upper_bound(offsets.begin(), offsets.end(), j) - offsets.begin() - 1;
+      return std::pair<label, indexType>(ids[j], (indexType) i);});
+    auto groups = parlay::group_by_index(pairs, num_labels);
+    parlay::parallel_for(0, num_labels, [&] (size_t l) {
+      std::sort(groups[l].begin(), groups[l].end());});
+    auto [offs, total] = parlay::scan(parlay::map(groups, [] (auto &g) {return g.size();}));
+    offs.push_back(total);
+    label_offsets = std::move(offs);
+    points = parlay::flatten(groups);
+  }
+};
+
+// A predicate on the labels and value of a point: the point must carry
+// any of the labels (all of them if match_all is set) and its value
+// must lie in [min_value, max_value].  No labels matches every point.
+struct label_filter {
+  std::vector<uint32_t> labels;
+  bool match_all = false;
+  float min_value = -std::numeric_limits<float>::infinity();
+  float max_value = std::numeric_limits<float>::infinity();
+
+  label_filter() {}
+
+  label_filter(std::vector<uint32_t> ls, bool match_all = false)
+    : labels(std::move(ls)), match_all(match_all) {
+    std::sort(labels.begin(), labels.end());
+    labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+  }
+
+  bool has_range() const {
+    return min_value > -std::numeric_limits<float>::infinity() ||
+           max_value < std::numeric_limits<float>::infinity();
+  }
+
+  template<typename indexType>
+  bool operator()(const point_labels<indexType> &L, indexType i) const {
+    if (has_range()) {
+      float v = L.values[i];
+      if (v < min_value || v > max_value) return false;
+    }
+    if (labels.empty()) return true;
+    auto ls = L.labels(i);
+    for (auto l : labels) {
+      bool has = std::binary_search(ls.begin(), ls.end(), l);
+      if (has && !match_all) return true;
+      if (!has && match_all) return false;
+    }
+    return match_all;
+  }
+};
+
+// A start point for each label: the approximate medoid of the points
+// carrying it, i.e. the point of a sample of them with the smallest
+// sum of distances to the rest of the sample.  Labels that no point
+// carries get the largest indexType.
+template<typename indexType, typename PointRange>
+parlay::sequence<indexType> label_start_points(const point_labels<indexType> &L,
+                                               const PointRange &Points,
+                                               long sample_size = 64) {
+  return parlay::tabulate(L.num_labels, [&] (size_t l) {
+    auto pts = L.points_with(l);
+    if (pts.size() == 0) return std::numeric_limits<indexType>::max();
+    long s = std::min<long>(sample_size, pts.size());
+    auto sample = parlay::tabulate(s, [&] (long j) {return pts[j * pts.size() / s];});
+    indexType best = sample[0];
+    double best_sum = std::numeric_limits<double>::max();
+    for (long j = 0; j < s; j++) {
+      double sum = 0;
+      for (long m = 0; m < s; m++)
+        if (m != j) sum += Points[sample[j]].distance(Points[sample[m]]);
+      if (sum < best_sum) {
+        best_sum = sum;
+        best = sample[j];
+      }
+    }
+    return best;
+  }, 1);
+}
+
+// Returns the (up to) k nearest points that match the filter F and
+// for which live(id) is true, sorted by distance, along with the
+// number of distance comparisons.  With labels the search starts from
+// the start points of the labels and only walks through points
+// carrying one of them (the rarest if all are required), which on a
+// graph built with labels (see knn_index) stay connected.  If few
+// enough points carry them they are all compared instead.  Without
+// labels it walks the whole graph from start_point, which needs a graph
+// built without labels.  Numeric ranges are checked on the points the
+// search reaches, so a selective range needs a larger beam.
+template<typename Point, typename PointRange, typename indexType, class GT,
+         class Live = keep_all>
+std::pair<parlay::sequence<std::pair<indexType, typename Point::distanceType>>, size_t>
+label_search(const Point &p, const GT &G, const PointRange &Points,
+             const point_labels<indexType> &L, const label_filter &F,
+             const parlay::sequence<indexType> &label_starts, indexType start_point,
+             const QueryParams &QP, Live live = {}) {
+  using id_dist = std::pair<indexType, typename Point::distanceType>;
+  auto less = [&] (id_dist a, id_dist b) {
+    return a.second < b.second || (a.second == b.second && a.first < b.first);
+  };
+  auto matches = [&] (indexType i) {return F(L, i) && live(i);};
+  if (F.has_range() && L.values.size() != L.size()) {
+    std::cout << "ERROR: filter has a range but the points have no values" << std::endl;
+    abort();
+  }
+
+  // the labels the search walks through
+  std::vector<uint32_t> walk;
+  for (auto l : F.labels)
+    if (L.count(l) > 0) walk.push_back(l);
+    else if (F.match_all) return std::pair(parlay::sequence<id_dist>(), (size_t) 0);
+  if (F.match_all && walk.size() > 1)
+    walk = {*std::min_element(walk.begin(), walk.end(), [&] (auto a, auto b) {
+      return L.count(a) < L.count(b);})};
+  if (!F.labels.empty() && walk.empty())
+    return std::pair(parlay::sequence<id_dist>(), (size_t) 0);
+
+  size_t num_carrying = 0;
+  for (auto l : walk) num_carrying += L.count(l);
+
+  parlay::sequence<id_dist> result;
+  size_t dist_cmps = 0;
+  if (!walk.empty() && num_carrying <= 4 * (size_t) QP.beamSize) {
+    for (auto l : walk)
+      for (indexType i : L.points_with(l))
+        if (matches(i)) {
+          result.push_back(id_dist(i, Points[i].distance(p)));
+          dist_cmps++;
+        }
+  } else {
+    parlay::sequence<indexType> starts = {start_point};
+    if (!walk.empty()) {
+      starts.clear();
+      for (auto l : walk)
+        if (label_starts[l] != std::numeric_limits<indexType>::max())
+          starts.push_back(label_starts[l]);
+      if (starts.empty()) return std::pair(parlay::sequence<id_dist>(), (size_t) 0);
+      starts = parlay::remove_duplicates(starts);
+    }
+    auto keep = [&] (indexType a) {
+      if (walk.empty()) return true;
+      for (auto l : walk) if (L.has_label(a, l)) return true;
+      return false;
+    };
+    auto [pairElts, cmps] = filtered_beam_search(G, p, Points, p, Points, starts,
+                                                 QP, false, keep);
+    dist_cmps = cmps;
+    for (auto x : pairElts.first) if (matches(x.first)) result.push_back(x);
+    for (auto x : pairElts.second) if (matches(x.first)) result.push_back(x);
+  }
+
+  // a point can be reached more than once
+  std::sort(result.begin(), result.end(), less);
+  result.erase(std::unique(result.begin(), result.end(),
+                           [] (auto a, auto b) {return a.first == b.first;}),
+               result.end());
+  if (QP.k >= 0 && result.size() > (size_t) QP.k) result.resize(QP.k);
+  return std::pair(std::move(result), dist_cmps);
+}
+
+} // end namespace
@@ -0,0 +1,132 @@
+#include "algorithms/utils/labels.h"
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/graph.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using Point = Euclidian_Point<float>;
+using Labels = point_labels<unsigned int>;
+
+Labels SmallLabels() {
+  return Labels({{3, 1}, {2}, {1, 2, 3}, {}, {0, 2}});
+}
+
+TEST(LabelsTest, RowsAndInverseAgree) {
+  Labels L = SmallLabels();
+  ASSERT_EQ(L.size(), 5);
+  EXPECT_EQ(L.num_labels, 4);
+  EXPECT_EQ(L.labels(0)[0], 1);  // sorted
+  EXPECT_EQ(L.labels(3).size(), 0);
+  std::vector<std::vector<unsigned int>> expected = {{4}, {0, 2}, {1, 2, 4}, {0, 2}};
+  for (uint32_t l = 0; l < 4; l++) {
+    auto pts = L.points_with(l);
+    EXPECT_EQ(std::vector<unsigned int>(pts.begin(), pts.end()), expected[l]);
+  }
+  EXPECT_EQ(L.count(7), 0);
+  EXPECT_TRUE(L.has_label(2, 3));
+  EXPECT_FALSE(L.has_label(1, 3));
+  EXPECT_TRUE(L.share_label(1, 4));
+  EXPECT_FALSE(L.share_label(0, 4));
+  EXPECT_FALSE(L.share_label(3, 3));
+  // 0 and 2 share {1, 3}
+  EXPECT_TRUE(L.covers(2, 0, 2));
+  EXPECT_FALSE(L.covers(4, 0, 2));
+  EXPECT_TRUE(L.covers(3, 0, 4));  // nothing shared
+}
+
+TEST(LabelsTest, SaveAndLoad) {
+  Labels L = SmallLabels();
+  std::string path = testing::TempDir() + "/labels_test.spmat";
+  L.save(path.data());
+  Labels M(path.data());
+  std::remove(path.c_str());
+  ASSERT_EQ(M.size(), L.size());
+  EXPECT_EQ(M.num_labels, L.num_labels);
+  for (unsigned int i = 0; i < L.size(); i++) {
+    auto a = L.labels(i), b = M.labels(i);
+    EXPECT_EQ(std::vector<uint32_t>(a.begin(), a.end()), std::vector<uint32_t>(b.begin(), b.end()));
+  }
+}
+
+TEST(LabelsTest, FilterMatchesAnyAllAndRange) {
+  Labels L = SmallLabels();
+  L.values = {0.5, 1.5, 2.5, 3.5, 4.5};
+  label_filter any({3, 2});
+  label_filter all({3, 2}, true);
+  label_filter range;
+  range.min_value = 1;
+  range.max_value = 3;
+  std::vector<bool> any_expected = {true, true, true, false, true};
+  std::vector<bool> all_expected = {false, false, true, false, false};
+  std::vector<bool> range_expected = {false, true, true, false, false};
+  for (unsigned int i = 0; i < L.size(); i++) {
+    EXPECT_EQ(any(L, i), any_expected[i]) << i;
+    EXPECT_EQ(all(L, i), all_expected[i]) << i;
+    EXPECT_EQ(range(L, i), range_expected[i]) << i;
+    EXPECT_TRUE(label_filter()(L, i));
+  }
+}
+
+TEST(LabelsTest, SearchReturnsNearestMatches) {
+  size_t n = 2000;
+  int d = 8;
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  std::vector<float> data(n * d);
+  for (auto& x : data) x = dist(rng);
+  Point::parameters params(d);
+  std::vector<Point> points;
+  for (size_t i = 0; i < n; i++)
+    points.push_back(Point((uint8_t*) (data.data() + i * d), i, params));
+  // label 0 is rare enough to be searched exhaustively
+  Labels L(parlay::tabulate(n, [] (size_t i) {
+    return parlay::sequence<uint32_t>{(uint32_t) (i % 50 == 0 ? 0 : 1 + i % 3)};}));
+  L.values = parlay::tabulate(n, [] (size_t i) {return (float) (i % 100);});
+  auto starts = label_start_points(L, points);
+  for (uint32_t l = 0; l < L.num_labels; l++) EXPECT_TRUE(L.has_label(starts[l], l));
+
+  // a graph that only links points with the same label
+  long max_deg = 16;
+  Graph<unsigned int> G(max_deg, n);
+  for (size_t i = 0; i < n; i++) {
+    auto same = L.points_with(L.labels(i)[0]);
+    std::vector<unsigned int> ngh;
+    for (long j = 0; j < max_deg; j++) ngh.push_back(same[rng() % same.size()]);
+    G[i].update_neighbors(ngh);
+  }
+
+  QueryParams QP(5, 20, 1.35, n, max_deg);
+  label_filter rare({0});
+  label_filter common({2});
+  label_filter ranged({0, 2});
+  ranged.max_value = 10;
+  for (size_t q = 0; q < 20; q++) {
+    Point p = points[rng() % n];
+    for (auto F : {rare, common, ranged}) {
+      auto [r, cmps] = label_search(p, G, points, L, F, starts, 0u, QP);
+      EXPECT_LE(r.size(), QP.k);
+      for (size_t j = 0; j < r.size(); j++) {
+        EXPECT_TRUE(F(L, r[j].first));
+        if (j > 0) EXPECT_LE(r[j - 1].second, r[j].second);
+      }
+    }
+    // the rare label is exact
+    auto [r, cmps] = label_search(p, G, points, L, rare, starts, 0u, QP);
+    parlay::sequence<std::pair<unsigned int, float>> exact;
+    for (auto i : L.points_with(0)) exact.push_back({i, points[i].distance(p)});
+    std::sort(exact.begin(), exact.end(), [] (auto a, auto b) {return a.second < b.second;});
+    ASSERT_EQ(r.size(), QP.k);
+    for (long j = 0; j < QP.k; j++) EXPECT_EQ(r[j].first, exact[j].first);
+  }
+}
+
+}  // namespace
+}  // namespace parlayANN
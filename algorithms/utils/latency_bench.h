@@ -0,0 +1,94 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+
+namespace parlayANN {
+
+// Load generators for measuring per-query latency.
+//
+// Closed loop (arrival_rate == 0): `concurrency` workers each issue
+// their next query as soon as the previous one returns, and a query's
+// latency is its own running time.
+//
+// Open loop (arrival_rate > 0): query i arrives at time i / arrival_rate
+// whether or not earlier queries have finished, and is picked up by the
+// next free worker. Its latency is measured from its arrival, so the
+// time spent waiting for a worker counts, as it would for a server that
+// falls behind.
+//
+// Workers are parlay workers, so at most parlay::num_workers() queries
+// run at once. A concurrency of 0 uses all of them.
+
+using latency_clock = std::chrono::steady_clock;
+
+// Runs f(i) for each i in [0, n) and returns the latency of each call
+// in seconds.
+template<typename F>
+parlay::sequence<double> run_with_load(size_t n, long concurrency,
+                                       double arrival_rate, F&& f) {
+  long workers = parlay::num_workers();
+  if (concurrency > 0) workers = std::min(workers, concurrency);
+  parlay::sequence<double> latencies(n);
+  std::atomic<size_t> next = 0;
+  auto start = latency_clock::now();
+  auto arrival = [&] (size_t i) {
+    return start + std::chrono::duration_cast<latency_clock::duration>(
+        std::chrono::duration<double>(i / arrival_rate));};
+  parlay::parallel_for(0, workers, [&] (long w) {
+    size_t i;
+    while ((i = next.fetch_add(1)) < n) {
+      latency_clock::time_point issued;
+      if (arrival_rate > 0) {
+        issued = arrival(i);
+        std::this_thread::sleep_until(issued);
+      } else issued = latency_clock::now();
+      f(i);
+      latencies[i] = std::chrono::duration<double>(latency_clock::now() - issued).count();
+    }
+  }, 1);
+  return latencies;
+}
+
+// The p50, p90, p99 and p99.9 latencies in microseconds, each the
+// smallest latency that at least that fraction of queries are within.
+inline parlay::sequence<double> latency_percentiles(parlay::sequence<double> latencies) {
+  parlay::sequence<double> result(4, 0.0);
+  if (latencies.size() == 0) return result;
+  parlay::sort_inplace(latencies);
+  size_t per_mille[4] = {500, 900, 990, 999};
+  for (int j = 0; j < 4; j++) {
+    size_t rank = (per_mille[j] * latencies.size() + 999) / 1000;
+    result[j] = latencies[std::max<size_t>(rank, 1) - 1] * 1e6;
+  }
+  return result;
+}
+
+} // end namespace
@@ -0,0 +1,67 @@
+#include "algorithms/utils/latency_bench.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+TEST(LatencyPercentilesTest, NearestRank) {
+  // 1..1000 microseconds, shuffled
+  parlay::sequence<double> latencies(1000);
+  for (size_t i = 0; i < 1000; i++) latencies[(i * 7) % 1000] = (i + 1) * 1e-6;
+  auto p = latency_percentiles(latencies);
+  ASSERT_EQ(p.size(), 4);
+  EXPECT_NEAR(p[0], 500, 1e-6);
+  EXPECT_NEAR(p[1], 900, 1e-6);
+  EXPECT_NEAR(p[2], 990, 1e-6);
+  EXPECT_NEAR(p[3], 999, 1e-6);
+
+  // with fewer than 1000 queries p99.9 is the slowest one
+  auto q = latency_percentiles(parlay::sequence<double>({3e-6, 1e-6, 2e-6}));
+  EXPECT_NEAR(q[0], 2, 1e-9);
+  EXPECT_NEAR(q[3], 3, 1e-9);
+  EXPECT_EQ(latency_percentiles(parlay::sequence<double>()), parlay::sequence<double>(4, 0.0));
+}
+
+TEST(RunWithLoadTest, ClosedLoopRunsEachQueryOnce) {
+  size_t n = 200;
+  std::vector<std::atomic<int>> runs(n);
+  auto latencies = run_with_load(n, 0, 0, [&] (size_t i) {
+    runs[i]++;
+    if (i % 50 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  });
+  ASSERT_EQ(latencies.size(), n);
+  for (size_t i = 0; i < n; i++) {
+    EXPECT_EQ(runs[i], 1);
+    if (i % 50 == 0) EXPECT_GE(latencies[i], 2e-3);
+  }
+}
+
+TEST(RunWithLoadTest, OpenLoopFollowsArrivalsAndCountsQueueing) {
+  // arrivals every millisecond, one worker taking 3 milliseconds per
+  // query: each query waits 2 milliseconds longer than the previous one
+  size_t n = 20;
+  auto start = latency_clock::now();
+  auto latencies = run_with_load(n, 1, 1000, [&] (size_t i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(3));
+  });
+  double total = std::chrono::duration<double>(latency_clock::now() - start).count();
+  EXPECT_GE(total, 3e-3 * n);
+  for (size_t i = 1; i < n; i++) EXPECT_GE(latencies[i], latencies[i-1] + 1.5e-3);
+
+  // arrivals every 5 milliseconds, faster queries: no queueing, but
+  // the run lasts until the last arrival
+  start = latency_clock::now();
+  latencies = run_with_load(n, 1, 200, [&] (size_t i) {});
+  total = std::chrono::duration<double>(latency_clock::now() - start).count();
+  EXPECT_GE(total, (n - 1) / 200.0);
+  EXPECT_LT(latency_percentiles(latencies)[0], 2000);
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -25,12 +25,15 @@
 #include <algorithm>
 #include <iostream>
 #include <bitset>
+#include <cstring>
 #include <bit>
 
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "parlay/internal/file_map.h"
 #include "types.h"
+#include "quantile.h"
+#include "simd_distance.h"
 
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -41,27 +44,15 @@
 namespace parlayANN {
 
   float mips_distance(const uint8_t *p, const uint8_t *q, unsigned d) {
-    int result = 0;
-    for (int i = 0; i < d; i++) {
-      result += ((int32_t)q[i]) * ((int32_t)p[i]);
-    }
-    return -((float)result);
+    return -((float) simd::dispatch.dot_uint8(p, q, d));
   }
 
   float mips_distance(const int8_t *p, const int8_t *q, unsigned d) {
-    int result = 0;
-    for (int i = 0; i < d; i++) {
-      result += ((int32_t)q[i]) * ((int32_t)p[i]);
-    }
-    return -((float)result);
+    return -((float) simd::dispatch.dot_int8(p, q, d));
   }
 
   float mips_distance(const float *p, const float *q, unsigned d) {
-    float result = 0;
-    for (int i = 0; i < d; i++) {
-      result += (q[i]) * (p[i]);
-    }
-    return -result;
+    return -simd::dispatch.dot_float(p, q, d);
   }
 
 template<typename T_>
@@ -80,6 +71,7 @@ struct Mips_Point {
 
   static distanceType d_min() {return -std::numeric_limits<float>::max();}
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Mips_Point<" + scalar_type_tag<T>() + ">";}
   T operator [](long i) const {return *(values + i);}
 
   float distance(const Mips_Point<T>& x) const {
@@ -302,6 +294,7 @@ struct Quantized_Mips_Point{
   };
 
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Quantized_Mips_Point<" + std::to_string(bits) + "," + std::to_string(trim) + "," + std::to_string(range) + ">";}
   
   int operator [] (long i) const {
     if constexpr (bits <= 4) {
@@ -330,12 +323,7 @@ struct Quantized_Mips_Point{
   }
 
   distanceType distance_8(byte* p_, byte* q_) const {
-    int8_t* p = (int8_t*) p_;
-    int8_t* q = (int8_t*) q_;
-    int32_t result = 0;
-    for (int i = 0; i < params.dims; i++){
-      result += (int16_t) p[i] * (int16_t) q[i];
-    }
+    int32_t result = simd::dispatch.dot_int8((int8_t*) p_, (int8_t*) q_, params.dims);
     return (distanceType) -result;
   }
 
@@ -528,24 +516,15 @@ struct Mips_2Bit_Point {
   };
 
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Mips_2Bit_Point";}
   
   int operator [] (long i) const {
     abort();
   }
 
   float distance_8(byte* p_, byte* q_) const {
-    word* p = (word*) p_;
-    word* q = (word*) q_;
-    int num_blocks = params.num_bytes() / 16;
-    int16_t total = 0;
-    for (int i = 0; i < num_blocks; i++) {
-      word not_equal = p[2 * i] ^ q[2 * i];
-      word not_zero = p[2 * i + 1] & q[2 * i + 1];
-      int16_t num_neg = pop_count(not_equal & not_zero);
-      int16_t num_not_zero = pop_count(not_zero);
-      total += (2 * num_neg) - num_not_zero;
-    }
-    return total;
+    return simd::dispatch.ternary((const uint64_t*) p_, (const uint64_t*) q_,
+                                  params.num_bytes() / 16);
   }
 
   float distance(const Mips_2Bit_Point &x) const {
@@ -588,12 +567,10 @@ struct Mips_2Bit_Point {
     int num_blocks = params.num_bytes() / 16;
     word* words = (word*) byte_values;
     float cv = params.cut;
+    std::memset(byte_values, 0, params.num_bytes()); // past dims is zero
     for (int i = 0; i < num_blocks; i++) {
       for (int j = 0; j < 64; j++) {
-        if (j + i * 64 >= params.dims) {
-          set_bit(words[2 * i + 1], j, false);
-          return;
-        }
+        if (j + i * 64 >= params.dims) return;
         set_bit(words[2 * i + 1], j, true);
         float pj = p[j + i * 64];
         if (pj < -cv) set_bit(words[2 * i], j, false);
@@ -604,22 +581,12 @@ struct Mips_2Bit_Point {
   }
   
   template <typename PR>
-  static parameters generate_parameters(const PR& pr) {
-    long n = pr.size();
-    int dims = pr.dimension();
-    long len = n * dims;
-    using MT = float;
-    parlay::sequence<MT> vals(len);
-    parlay::parallel_for(0, n, [&] (long i) {
-      for (int j = 0; j < dims; j++) 
-        vals[i * dims + j] = pr[i][j];
-    });
-    parlay::sort_inplace(vals);
-    float cutoff = .3;
-    float min_cut = vals[(long) (cutoff * len)];
-    float max_cut = vals[(long) ((1.0-cutoff) * (len-1))];
-    float cut = std::max(max_cut, -min_cut);
-    return parameters(cut, dims); 
+  static parameters generate_parameters(const PR& pr,
+                                        long quantile_sample = default_quantile_sample) {
+    double cutoff = .3;
+    auto cuts = coordinate_quantiles(pr, {cutoff, 1.0 - cutoff}, quantile_sample);
+    float cut = std::max(cuts[1], -cuts[0]);
+    return parameters(cut, (int) pr.dimension());
   }
 
 private:
@@ -644,6 +611,7 @@ struct Mips_Bit_Point {
   };
   
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Mips_Bit_Point";}
   
   int8_t operator [] (long j) const {
     Data* pbits = (Data*) values;
@@ -651,13 +619,8 @@ struct Mips_Bit_Point {
   }
 
   float distance(const Mips_Bit_Point &q) const {
-    int num_blocks = (params.dims - 1)/64 + 1;
-    Data* pbits = (Data*) values;
-    Data* qbits = (Data*) q.values;
-    int cnt = 0;
-    for (int i=0; i < num_blocks; i++)
-      cnt +=(*pbits ^ *qbits).count();
-    return cnt;
+    return simd::dispatch.hamming((const uint64_t*) values, (const uint64_t*) q.values,
+                                  params.num_bytes() / 8);
   }
 
   void prefetch() const {
@@ -692,6 +655,7 @@ struct Mips_Bit_Point {
   template <typename In_Point>
   static void translate_point(byte* values, const In_Point& p, const parameters& params) {
     Data* pbits = (Data*) values;
+    std::memset(values, 0, params.num_bytes()); // bits past dims are compared too
     for (int i = 0; i < params.dims; i++)
       pbits[i/64][i%64] = (p[i] > 0);
   }
@@ -737,6 +701,7 @@ struct Mips_4Bit_Point {
   };
 
   static bool is_metric() {return false;}
+  static std::string type_tag() {return "Mips_4Bit_Point";}
   
   int operator [] (long i) const {
     abort();
@@ -828,22 +793,12 @@ struct Mips_4Bit_Point {
   }
   
   template <typename PR>
-  static parameters generate_parameters(const PR& pr) {
-    long n = pr.size();
-    int dims = pr.dimension();
-    long len = n * dims;
-    using MT = float;
-    parlay::sequence<MT> vals(len);
-    parlay::parallel_for(0, n, [&] (long i) {
-      for (int j = 0; j < dims; j++) 
-        vals[i * dims + j] = pr[i][j];
-    });
-    parlay::sort_inplace(vals);
-    float cutoff = .3;
-    float min_cut = vals[(long) (cutoff * len)];
-    float max_cut = vals[(long) ((1.0-cutoff) * (len-1))];
-    float cut = std::max(max_cut, -min_cut);
-    return parameters(cut, dims); 
+  static parameters generate_parameters(const PR& pr,
+                                        long quantile_sample = default_quantile_sample) {
+    double cutoff = .3;
+    auto cuts = coordinate_quantiles(pr, {cutoff, 1.0 - cutoff}, quantile_sample);
+    float cut = std::max(cuts[1], -cuts[0]);
+    return parameters(cut, (int) pr.dimension());
   }
 
 private:
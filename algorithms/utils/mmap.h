@@ -3,6 +3,10 @@
 
 #include <algorithm>
 #include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
@@ -11,7 +15,11 @@
 namespace parlayANN {
 
 // returns a pointer and a length
-inline std::pair<char*, size_t> mmapStringFromFile(const char* filename) {
+// If writable is set the mapping is copy-on-write: pages are shared
+// with the page cache (and other processes) until they are written,
+// and writes are never carried back to the file.
+inline std::pair<char*, size_t> mmapStringFromFile(const char* filename,
+                                                   bool writable = false) {
   struct stat sb;
   int fd = open(filename, O_RDONLY);
   if (fd == -1) {
@@ -27,7 +35,9 @@ inline std::pair<char*, size_t> mmapStringFromFile(const char* filename) {
     exit(-1);
   }
   char* p =
-      static_cast<char*>(mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+      static_cast<char*>(mmap(0, sb.st_size,
+                              writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                              MAP_PRIVATE, fd, 0));
   if (p == MAP_FAILED) {
     perror("mmap");
     exit(-1);
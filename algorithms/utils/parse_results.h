@@ -121,6 +121,19 @@ struct nn_result {
 
   long num_queries;
 
+  // query latency percentiles in microseconds (0 if not measured)
+  double p50_latency = 0;
+  double p90_latency = 0;
+  double p99_latency = 0;
+  double p999_latency = 0;
+
+  // visits saved per query by adaptive termination, relative to the
+  // same search without it (only set if adaptive termination is used)
+  bool adaptive = false;
+  double avg_hops_saved = 0;
+  long tail_hops_saved = 0;
+  double stopped_early = 0;  // fraction of queries that saved any
+
   nn_result(double r, parlay::sequence<uint> stats, float qps, int K, int Q,
             float c, long q, int limit, int degree_limit, int gtn)
       : recall(r),
@@ -144,7 +157,30 @@ struct nn_result {
     std::cout << "For " << gtn << "@" << gtn << " recall = " << recall
               << ", QPS = " << QPS << ", Q = " << beamQ << ", cut = " << cut;
     std::cout << ", visited limit = " << limit << ", degree limit: " << degree_limit;
-    std::cout << ", average visited = " << avg_visited << ", average cmps = " << avg_cmps << std::endl;
+    std::cout << ", average visited = " << avg_visited << ", average cmps = " << avg_cmps;
+    if (p50_latency > 0)
+      std::cout << ", latency p50/p90/p99/p99.9 = " << p50_latency << "/" << p90_latency
+                << "/" << p99_latency << "/" << p999_latency << " us";
+    if (adaptive)
+      std::cout << ", hops saved avg/p99 = " << avg_hops_saved << "/" << tail_hops_saved
+                << ", stopped early = " << 100 * stopped_early << "%";
+    std::cout << std::endl;
+  }
+
+  void set_latency(parlay::sequence<double> L) {
+    p50_latency = L[0];
+    p90_latency = L[1];
+    p99_latency = L[2];
+    p999_latency = L[3];
+  }
+
+  void set_hops_saved(parlay::sequence<long> saved) {
+    adaptive = true;
+    if (saved.size() == 0) return;
+    avg_hops_saved = (double) parlay::reduce(saved) / saved.size();
+    parlay::sort_inplace(saved);
+    tail_hops_saved = saved[(size_t) (.99 * saved.size())];
+    stopped_early = (double) parlay::count_if(saved, [] (long s) {return s > 0;}) / saved.size();
   }
 
   void print_verbose() {
@@ -24,12 +24,19 @@
 
 #include <sys/mman.h>
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "parlay/internal/file_map.h"
 #include "types.h"
+#include "mmap.h"
 
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -39,6 +46,133 @@
 
 namespace parlayANN {
 
+// Header of the "serving layout" point file written by
+// PointRange::save_serving_layout.  Rows are stored exactly as they
+// are in memory (each padded to aligned_bytes, starting at a page
+// aligned offset), so the file can be mapped and used in place.
+struct point_file_header {
+  static constexpr uint64_t magic_value = 0x3153505f4e4e4150ul; // "PANN_PS1"
+  uint64_t magic;
+  uint64_t num_points;
+  uint32_t dims;
+  uint32_t num_bytes;      // bytes per point before padding
+  uint64_t aligned_bytes;  // bytes per point after padding
+  uint64_t data_offset;    // from start of file, multiple of the page size
+};
+
+// Header of a quantized point file written by PointRange::save_quantized
+// and read by PointRange::load_quantized.
+// It is followed by the parameters of the point type (scales, cuts,
+// projections or codebooks, see param_writer) and then by the rows in
+// the serving layout, so loading a quantized range does no
+// quantization work and always gives the same codes.
+struct quantized_file_header {
+  static constexpr uint64_t magic_value = 0x3150515f4e4e4150ul; // "PANN_QP1"
+  static constexpr uint32_t current_version = 2;
+  uint64_t magic;
+  uint32_t version;
+  uint32_t num_bytes;      // bytes per point before padding
+  uint64_t num_points;
+  uint64_t aligned_bytes;  // bytes per point after padding
+  uint64_t point_type;     // hash of the point type's type_tag()
+  uint64_t params_bytes;   // size of the parameters after the header
+  uint64_t data_offset;    // from start of file, multiple of the page size
+  uint64_t source_fingerprint;  // see quantized_source
+  uint64_t settings_hash;       // see quantized_source
+};
+
+// FNV-1a hash of a block of bytes, continuing from h.
+inline uint64_t fnv1a(const void* data, size_t length,
+                      uint64_t h = 14695981039346656037ul) {
+  auto bytes = (const unsigned char*) data;
+  for (size_t i = 0; i < length; i++)
+    h = (h ^ bytes[i]) * 1099511628211ul;
+  return h;
+}
+
+// What a quantized range was made from: the number of points, a
+// fingerprint of the points they were quantized from (see
+// PointRange::fingerprint), and the options of the quantization that
+// are not part of the point type (e.g. "pq_bytes=8").  It is saved with
+// the quantized points, and load_or_quantize only reuses a file made
+// from the same source.
+struct quantized_source {
+  uint64_t num_points = 0;
+  uint64_t fingerprint = 0;
+  std::string settings;
+
+  uint64_t settings_hash() const {return fnv1a(settings.data(), settings.size());}
+};
+
+// Serializes the parameters of a point type.  Parameters that are
+// trivially copyable are written as they are.  Others (holding vectors)
+// list their fields in a member
+//   template <typename Archive> void serialize(Archive& ar) {ar(a); ar(b); ...}
+// which is used both for writing and, with param_reader, for reading.
+struct param_writer {
+  std::string bytes;
+
+  template <typename T>
+  void operator()(const T& x) {
+    if constexpr (std::is_trivially_copyable_v<T>)
+      bytes.append((const char*) &x, sizeof(T));
+    else const_cast<T&>(x).serialize(*this);
+  }
+
+  template <typename T>
+  void operator()(const std::vector<T>& v) {
+    (*this)((uint64_t) v.size());
+    if constexpr (std::is_trivially_copyable_v<T>)
+      bytes.append((const char*) v.data(), v.size() * sizeof(T));
+    else for (auto& x : v) (*this)(x);
+  }
+};
+
+struct param_reader {
+  const char* ptr;
+  const char* end;
+
+  // aborts unless count items of the given size are left
+  void check(size_t count, size_t size) {
+    if (count > (size_t) (end - ptr) / size) {
+      std::cout << "ERROR: quantization parameters are truncated" << std::endl;
+      abort();
+    }
+  }
+
+  void take(void* dest, size_t size) {
+    check(size, 1);
+    std::memcpy(dest, ptr, size);
+    ptr += size;
+  }
+
+  template <typename T>
+  void operator()(T& x) {
+    if constexpr (std::is_trivially_copyable_v<T>) take(&x, sizeof(T));
+    else x.serialize(*this);
+  }
+
+  template <typename T>
+  void operator()(std::vector<T>& v) {
+    uint64_t size;
+    (*this)(size);
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      check(size, sizeof(T));
+      v.resize(size);
+      take(v.data(), size * sizeof(T));
+    } else {
+      v.resize(size);
+      for (auto& x : v) (*this)(x);
+    }
+  }
+};
+
+template <typename Point>
+uint64_t point_type_hash() {
+  std::string tag = Point::type_tag();
+  return fnv1a(tag.data(), tag.size());
+}
+
 template<class Point_>
 struct PointRange{
   //using T = T_;
@@ -59,7 +193,7 @@ struct PointRange{
     long total_bytes = n * aligned_bytes;
     byte* ptr = (byte*) aligned_alloc(1l << 21, total_bytes);
     madvise(ptr, total_bytes, MADV_HUGEPAGE);
-    values = std::shared_ptr<byte[]>(ptr, std::free);
+    set_values(std::shared_ptr<byte[]>(ptr, std::free));
     byte* vptr = values.get();
     parlay::parallel_for(0, n, [&] (long i) {
       Point::translate_point(vptr + i * aligned_bytes, pr[i], params);});
@@ -81,6 +215,15 @@ struct PointRange{
         std::cout << "Data file " << filename << " not found" << std::endl;
         std::abort();
       }
+      uint64_t magic = 0;
+      reader.read((char*)(&magic), sizeof(uint64_t));
+      if (reader && magic == point_file_header::magic_value) {
+        map_serving_layout(filename);
+        return;
+      }
+
+      reader.clear();
+      reader.seekg(0);
 
       //read num points and max degree
       unsigned int num_points;
@@ -97,7 +240,7 @@ struct PointRange{
       long total_bytes = n * aligned_bytes;
       byte* ptr = (byte*) aligned_alloc(1l << 21, total_bytes);
       madvise(ptr, total_bytes, MADV_HUGEPAGE);
-      values = std::shared_ptr<byte[]>(ptr, std::free);
+      set_values(std::shared_ptr<byte[]>(ptr, std::free));
       size_t BLOCK_SIZE = 1000000;
       size_t index = 0;
       while(index < n) {
@@ -116,28 +259,281 @@ struct PointRange{
       }
   }
 
-  size_t size() const { return n; }
+  // Maps a file written by save_serving_layout.  Points are served
+  // directly from the page cache, so loading is not proportional to
+  // the file size and processes mapping the same file share memory.
+  // The mapping is copy-on-write, so normalize() still works.
+  void map_serving_layout(char* filename) {
+    auto [fileptr, length] = mmapStringFromFile(filename, true);
+    point_file_header header;
+    std::memcpy(&header, fileptr, sizeof(point_file_header));
+    n = header.num_points;
+    params = parameters(header.dims);
+    aligned_bytes = header.aligned_bytes;
+    if (header.num_bytes != params.num_bytes()) {
+      std::cout << "ERROR: data file " << filename << " has " << header.num_bytes
+                << " bytes per point but point type expects " << params.num_bytes()
+                << " (wrong data type?)" << std::endl;
+      abort();
+    }
+    if (header.data_offset + n * aligned_bytes > length) {
+      std::cout << "ERROR: data file " << filename << " is truncated" << std::endl;
+      abort();
+    }
+    std::cout << "Data: mapped " << n << " points with dimension " << header.dims
+              << " (serving layout)" << std::endl;
+    set_values(std::shared_ptr<byte[]>((byte*) fileptr + header.data_offset,
+                                       [fileptr = fileptr, length = length] (byte*) {
+                                         munmap(fileptr, length);}));
+  }
+
+  // Writes the points in the serving layout (see point_file_header)
+  // so that later loads can map the file instead of copying it.
+  void save_serving_layout(char* filename) const {
+    point_file_header header;
+    header.magic = point_file_header::magic_value;
+    header.num_points = n;
+    header.dims = params.dims;
+    header.num_bytes = params.num_bytes();
+    header.aligned_bytes = aligned_bytes;
+    header.data_offset = sysconf(_SC_PAGESIZE);
+    std::cout << "Writing " << n << " points with dimension " << params.dims
+              << " in serving layout" << std::endl;
+    std::ofstream writer(filename, std::ios::binary | std::ios::out);
+    parlay::sequence<char> preamble(header.data_offset, 0);
+    std::memcpy(preamble.begin(), &header, sizeof(point_file_header));
+    writer.write(preamble.begin(), preamble.size());
+    size_t BLOCK_SIZE = 1000000;
+    for (size_t index = 0; index < n; index += BLOCK_SIZE) {
+      size_t m = std::min(BLOCK_SIZE, n - index);
+      writer.write((char*) location(index), m * aligned_bytes);
+    }
+    writer.close();
+  }
+
+  // Writes the points together with their parameters and the source
+  // they were quantized from (see quantized_file_header).  Meant for
+  // quantized ranges, whose parameters are costly to generate, but
+  // works for any point type.
+  void save_quantized(const char* filename, const quantized_source& source = {}) const {
+    param_writer params_out;
+    params_out(params);
+    quantized_file_header header;
+    header.magic = quantized_file_header::magic_value;
+    header.version = quantized_file_header::current_version;
+    header.num_bytes = params.num_bytes();
+    header.num_points = n;
+    header.aligned_bytes = aligned_bytes;
+    header.point_type = point_type_hash<Point>();
+    header.params_bytes = params_out.bytes.size();
+    header.source_fingerprint = source.fingerprint;
+    header.settings_hash = source.settings_hash();
+    long page = sysconf(_SC_PAGESIZE);
+    header.data_offset = page * ((sizeof(header) + header.params_bytes - 1) / page + 1);
+    std::ofstream writer(filename, std::ios::binary | std::ios::out);
+    if (!writer.is_open()) {
+      std::cout << "ERROR: cannot write quantized points to " << filename << std::endl;
+      abort();
+    }
+    parlay::sequence<char> preamble(header.data_offset, 0);
+    std::memcpy(preamble.begin(), &header, sizeof(header));
+    std::memcpy(preamble.begin() + sizeof(header), params_out.bytes.data(), header.params_bytes);
+    writer.write(preamble.begin(), preamble.size());
+    size_t BLOCK_SIZE = 1000000;
+    for (size_t index = 0; index < n; index += BLOCK_SIZE) {
+      size_t m = std::min(BLOCK_SIZE, n - index);
+      writer.write((char*) location(index), m * aligned_bytes);
+    }
+    writer.close();
+    std::cout << "Wrote " << n << " quantized points to " << filename << std::endl;
+  }
+
+  // Maps a file written by save_quantized, in the same way as
+  // map_serving_layout.
+  static PointRange load_quantized(const char* filename) {
+    PointRange Points;
+    Points.map_quantized(filename);
+    return Points;
+  }
+
+  // The header of a file written by save_quantized, checked against
+  // this point type.
+  // Reads the header of a quantized point file into header, and
+  // returns why the file cannot be loaded into this range (empty if it
+  // can).
+  static std::string check_quantized_header(const char* filename, quantized_file_header& header) {
+    std::ifstream reader(filename, std::ios::binary);
+    reader.read((char*) &header, sizeof(header));
+    if (!reader || header.magic != quantized_file_header::magic_value)
+      return std::string(filename) + " is not a quantized point file";
+    if (header.version != quantized_file_header::current_version)
+      return "quantized point file " + std::string(filename) + " has version "
+        + std::to_string(header.version) + ", expected "
+        + std::to_string(quantized_file_header::current_version);
+    if (header.point_type != point_type_hash<Point>())
+      return "quantized point file " + std::string(filename)
+        + " was written for a different point type";
+    return "";
+  }
+
+  static quantized_file_header read_quantized_header(const char* filename) {
+    quantized_file_header header;
+    std::string problem = check_quantized_header(filename, header);
+    if (!problem.empty()) {
+      std::cout << "ERROR: " << problem << std::endl;
+      abort();
+    }
+    return header;
+  }
+
+  void map_quantized(const char* filename) {
+    quantized_file_header header = read_quantized_header(filename);
+    auto [fileptr, length] = mmapStringFromFile(filename, true);
+    if (header.data_offset < sizeof(header) + header.params_bytes ||
+        header.data_offset + header.num_points * header.aligned_bytes > length) {
+      std::cout << "ERROR: quantized point file " << filename << " is truncated" << std::endl;
+      abort();
+    }
+    param_reader params_in{fileptr + sizeof(header), fileptr + sizeof(header) + header.params_bytes};
+    params = parameters();
+    params_in(params);
+    if (header.num_bytes != params.num_bytes()) {
+      std::cout << "ERROR: quantized point file " << filename << " has " << header.num_bytes
+                << " bytes per point but its parameters give " << params.num_bytes() << std::endl;
+      abort();
+    }
+    n = header.num_points;
+    aligned_bytes = header.aligned_bytes;
+    std::cout << "Data: mapped " << n << " quantized points from " << filename << std::endl;
+    set_values(std::shared_ptr<byte[]>((byte*) fileptr + header.data_offset,
+                                       [fileptr = fileptr, length = length] (byte*) {
+                                         munmap(fileptr, length);}));
+  }
+
+  // atomic, since a reader can look at it during an append
+  size_t size() const { return __atomic_load_n(&n, __ATOMIC_ACQUIRE); }
 
   unsigned int get_dims() const { return params.dims; }
+
+  // A hash of the number of points, their size, and the contents of up
+  // to 4096 evenly spaced points.  Enough to tell a different or
+  // reordered data set from the one a quantized file was made from,
+  // without reading all of a large one.
+  uint64_t fingerprint() const {
+    size_t num_bytes = params.num_bytes();
+    uint64_t h = fnv1a(&n, sizeof(n));
+    h = fnv1a(&num_bytes, sizeof(num_bytes), h);
+    size_t samples = std::min<size_t>(n, 4096);
+    for (size_t i = 0; i < samples; i++)
+      h = fnv1a(location(i * n / samples), num_bytes, h);
+    return h;
+  }
+
+  quantized_source source(std::string settings = "") const {
+    return quantized_source{n, fingerprint(), settings};
+  }
+
+  // Makes room for new_capacity points, so that appending up to that
+  // many does not reallocate.
+  void reserve(size_t new_capacity) {
+    if (new_capacity <= std::max(capacity, n)) return;
+    long total_bytes = new_capacity * aligned_bytes;
+    byte* ptr = (byte*) aligned_alloc(1l << 21, total_bytes);
+    madvise(ptr, total_bytes, MADV_HUGEPAGE);
+    byte* old = values.get();
+    parlay::parallel_for(0, n, [&] (long i) {
+      std::memcpy(ptr + i * aligned_bytes, old + i * aligned_bytes, aligned_bytes);});
+    retired.push_back(std::move(values));
+    set_values(std::shared_ptr<byte[]>(ptr, std::free));
+    capacity = new_capacity;
+  }
+
+  // Appends the points of pr, translated with the parameters of this
+  // range (so quantized ranges keep their scale).  Space is reallocated
+  // geometrically, so appending in small batches takes amortized time
+  // proportional to the number of points appended.
+  //
+  // Readers (e.g. searches through Graph::concurrent_reader) can run
+  // during an append, but not other writers.  The new points are
+  // written before the new size is published.  A reallocation keeps
+  // the old buffer until the range is destroyed, since a reader may
+  // still hold points in it; reserving the final size up front avoids
+  // that extra space.
+  template <typename PR>
+  void append(const PR& pr) {
+    size_t m = pr.size();
+    if (n + m > std::max(capacity, n))
+      reserve(std::max<size_t>(n + m, n + n / 2));
+    byte* vptr = values.get();
+    parlay::parallel_for(0, m, [&] (long i) {
+      Point::translate_point(vptr + (n + i) * aligned_bytes, pr[i], params);});
+    __atomic_store_n(&n, n + m, __ATOMIC_RELEASE);
+  }
   
   Point operator [] (long i) const {
-    if (i > n) {
-      std::cout << "ERROR: point index out of range: " << i << " from range " << n << ", " << std::endl;
+    if (i > size()) {
+      std::cout << "ERROR: point index out of range: " << i << " from range " << size() << ", " << std::endl;
       abort();
     }
-    return Point(values.get()+i*aligned_bytes, i, params);
+    return Point(location(i), i, params);
   }
 
   byte* location(long i) const {
-    return values.get() + i * aligned_bytes;
+    return __atomic_load_n(&base, __ATOMIC_ACQUIRE) + i * aligned_bytes;
   }
   
   parameters params;
 
 private:
+  // Readers go through base, which append switches atomically to a new
+  // buffer; values owns it.
+  void set_values(std::shared_ptr<byte[]> v) {
+    values = std::move(v);
+    __atomic_store_n(&base, values.get(), __ATOMIC_RELEASE);
+  }
+
   std::shared_ptr<byte[]> values;
+  byte* base = nullptr;
+  std::vector<std::shared_ptr<byte[]>> retired; // earlier buffers, see append
   long aligned_bytes;
   size_t n;
+  size_t capacity = 0; // allocated points, if more than n
 };
 
+// Loads the range saved in filename by save_quantized if there is one
+// made from source.  Otherwise builds it with make() and, if the
+// location is writable, saves it there for next time (replacing a file
+// made from another source, or one that cannot be loaded, such as a
+// file of another version or point type).  The file is written under a
+// temporary name and renamed, so processes starting together never see
+// half of it.
+template <typename PR, typename F>
+PR load_or_quantize(const std::string& filename, const quantized_source& source, F&& make) {
+  if (std::ifstream(filename).good()) {
+    quantized_file_header header;
+    std::string problem = PR::check_quantized_header(filename.c_str(), header);
+    if (!problem.empty())
+      std::cout << "Cannot use " << problem << ", quantizing again" << std::endl;
+    else if (header.num_points == source.num_points &&
+             header.source_fingerprint == source.fingerprint &&
+             header.settings_hash == source.settings_hash())
+      return PR::load_quantized(filename.c_str());
+    else
+      std::cout << "Quantized points in " << filename << " were made from "
+                << (header.num_points != source.num_points ? "a different number of points"
+                    : header.source_fingerprint != source.fingerprint ? "different points"
+                    : "different quantization settings")
+                << ", quantizing again" << std::endl;
+  }
+  PR Points = make();
+  std::string tmp = filename + ".tmp" + std::to_string(getpid());
+  if (!std::ofstream(tmp).is_open()) {
+    std::cout << "Not saving quantized points: cannot write to " << filename << std::endl;
+    return Points;
+  }
+  Points.save_quantized(tmp.c_str(), source);
+  std::rename(tmp.c_str(), filename.c_str());
+  return Points;
+}
+
 } // end namespace
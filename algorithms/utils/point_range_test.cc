@@ -0,0 +1,163 @@
+#include "algorithms/utils/point_range.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/jl_point.h"
+#include "algorithms/utils/mips_point.h"
+#include "algorithms/utils/pq_point.h"
+#include "algorithms/utils/test_points.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+// saves the quantized points of Points with QPoint, reloads them, and
+// checks that the codes and the distances to newly quantized queries
+// are the same
+template <typename QPoint, typename PR, typename QueryParams>
+void ExpectRoundTrip(PR& Points, PR& Queries, QueryParams query_params) {
+  using QPR = PointRange<QPoint>;
+  QPR Q_Points(Points);
+  std::string path = testing::TempDir() + "/point_range_test.q";
+  Q_Points.save_quantized(path.c_str());
+  QPR Loaded = QPR::load_quantized(path.c_str());
+  ASSERT_EQ(Loaded.size(), Q_Points.size());
+  int num_bytes = Q_Points.params.num_bytes();
+  ASSERT_EQ(Loaded.params.num_bytes(), num_bytes);
+  for (size_t i = 0; i < Points.size(); i++)
+    ASSERT_EQ(std::memcmp(Loaded.location(i), Q_Points.location(i), num_bytes), 0);
+
+  // queries translated with the loaded parameters get the same codes
+  QPR Q_Queries(Queries, query_params(Q_Points.params));
+  QPR L_Queries(Queries, query_params(Loaded.params));
+  for (size_t q = 0; q < Queries.size(); q++) {
+    for (size_t i = 0; i < Points.size(); i += 7)
+      EXPECT_EQ(Loaded[i].distance(L_Queries[q]), Q_Points[i].distance(Q_Queries[q]));
+  }
+  std::remove(path.c_str());
+}
+
+auto same_params = [] (const auto& p) {return p;};
+
+TEST(QuantizedFileTest, EuclideanRoundTrip) {
+  using PR = PointRange<Euclidian_Point<float>>;
+  PR Points = RandomPoints<Euclidian_Point<float>>(500, 24, 1);
+  PR Queries = RandomPoints<Euclidian_Point<float>>(10, 24, 2);
+  ExpectRoundTrip<Euclidian_Point<uint8_t>>(Points, Queries, same_params);
+  ExpectRoundTrip<Euclidean_Bit_Point>(Points, Queries, same_params);
+  // parameters holding a projection
+  ExpectRoundTrip<Euclidean_JL_Sparse_Point<256>>(Points, Queries, same_params);
+}
+
+TEST(QuantizedFileTest, MipsRoundTrip) {
+  using PR = PointRange<Mips_Point<float>>;
+  PR Points = RandomPoints<Mips_Point<float>>(500, 24, 3);
+  PR Queries = RandomPoints<Mips_Point<float>>(10, 24, 4);
+  ExpectRoundTrip<Quantized_Mips_Point<8,true,255>>(Points, Queries, same_params);
+  ExpectRoundTrip<Mips_2Bit_Point>(Points, Queries, same_params);
+  ExpectRoundTrip<Mips_JL_Sparse_Point<512>>(Points, Queries, same_params);
+  ExpectRoundTrip<Mips_JL_Bit_Point<256>>(Points, Queries, same_params);
+}
+
+TEST(QuantizedFileTest, ProductQuantizedRoundTrip) {
+  using PR = PointRange<Euclidian_Point<float>>;
+  PR Points = RandomPoints<Euclidian_Point<float>>(500, 24, 5);
+  PR Queries = RandomPoints<Euclidian_Point<float>>(10, 24, 6);
+  ExpectRoundTrip<PQ_Point<8>>(Points, Queries, PQ_Point<8>::query_parameters);
+  ExpectRoundTrip<PQ_Point<4>>(Points, Queries, PQ_Point<4>::query_parameters);
+}
+
+TEST(QuantizedFileTest, LoadOrQuantizeBuildsOnce) {
+  using PR = PointRange<Euclidian_Point<float>>;
+  using QPR = PointRange<Euclidian_Point<uint8_t>>;
+  PR Points = RandomPoints<Euclidian_Point<float>>(100, 8, 7);
+  std::string path = testing::TempDir() + "/point_range_test_cached.q";
+  std::remove(path.c_str());
+  int builds = 0;
+  auto make = [&] {builds++; return QPR(Points);};
+  QPR First = load_or_quantize<QPR>(path, Points.source(), make);
+  QPR Second = load_or_quantize<QPR>(path, Points.source(), make);
+  EXPECT_EQ(builds, 1);
+  ASSERT_EQ(Second.size(), First.size());
+  for (size_t i = 0; i < First.size(); i++)
+    EXPECT_EQ(std::memcmp(Second.location(i), First.location(i), 8), 0);
+  std::remove(path.c_str());
+}
+
+TEST(QuantizedFileTest, LoadOrQuantizeRebuildsForOtherSource) {
+  using PR = PointRange<Euclidian_Point<float>>;
+  using QPR = PointRange<Euclidian_Point<uint8_t>>;
+  PR Points = RandomPoints<Euclidian_Point<float>>(100, 8, 9);
+  PR Other = RandomPoints<Euclidian_Point<float>>(100, 8, 10);
+  PR Fewer = RandomPoints<Euclidian_Point<float>>(99, 8, 9);
+  std::string path = testing::TempDir() + "/point_range_test_source.q";
+  std::remove(path.c_str());
+  int builds = 0;
+  auto make = [&] {builds++; return QPR(Points);};
+  load_or_quantize<QPR>(path, Points.source("a=1"), make);
+  load_or_quantize<QPR>(path, Points.source("a=1"), make);
+  EXPECT_EQ(builds, 1);
+  load_or_quantize<QPR>(path, Points.source("a=2"), make);
+  EXPECT_EQ(builds, 2);
+  load_or_quantize<QPR>(path, Other.source("a=2"), make);
+  EXPECT_EQ(builds, 3);
+  load_or_quantize<QPR>(path, Fewer.source("a=2"), make);
+  EXPECT_EQ(builds, 4);
+  std::remove(path.c_str());
+}
+
+// a file of another point type or version is requantized and replaced
+TEST(QuantizedFileTest, LoadOrQuantizeReplacesUnusableFile) {
+  using PR = PointRange<Euclidian_Point<float>>;
+  using QPR = PointRange<Euclidian_Point<uint8_t>>;
+  PR Points = RandomPoints<Euclidian_Point<float>>(100, 8, 12);
+  std::string path = testing::TempDir() + "/point_range_test_stale.q";
+  PointRange<Euclidian_Point<int8_t>>(Points).save_quantized(path.c_str(), Points.source());
+  int builds = 0;
+  auto make = [&] {builds++; return QPR(Points);};
+  load_or_quantize<QPR>(path, Points.source(), make);
+  EXPECT_EQ(builds, 1);
+
+  // an older version
+  quantized_file_header header;
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.read((char*) &header, sizeof(header));
+    header.version = quantized_file_header::current_version - 1;
+    file.seekp(0);
+    file.write((char*) &header, sizeof(header));
+  }
+  load_or_quantize<QPR>(path, Points.source(), make);
+  EXPECT_EQ(builds, 2);
+  load_or_quantize<QPR>(path, Points.source(), make);
+  EXPECT_EQ(builds, 2);
+  std::remove(path.c_str());
+}
+
+TEST(QuantizedFileTest, FingerprintSeesReordering) {
+  using PR = PointRange<Euclidian_Point<float>>;
+  PR Points = RandomPoints<Euclidian_Point<float>>(100, 8, 11);
+  PR Same = RandomPoints<Euclidian_Point<float>>(100, 8, 11);
+  EXPECT_EQ(Points.fingerprint(), Same.fingerprint());
+  auto order = parlay::tabulate(Points.size(), [&] (size_t i) {return Points[(i + 1) % 100];});
+  PR Rotated(order, Points.params);
+  EXPECT_NE(Points.fingerprint(), Rotated.fingerprint());
+}
+
+TEST(QuantizedFileDeathTest, RejectsOtherPointType) {
+  using PR = PointRange<Euclidian_Point<float>>;
+  PR Points = RandomPoints<Euclidian_Point<float>>(100, 8, 8);
+  PointRange<Euclidian_Point<uint8_t>> Q_Points(Points);
+  std::string path = testing::TempDir() + "/point_range_test_type.q";
+  Q_Points.save_quantized(path.c_str());
+  // the error is reported on stdout
+  EXPECT_DEATH(PointRange<Euclidian_Point<int8_t>>::load_quantized(path.c_str()), "");
+  std::remove(path.c_str());
+}
+
+}  // namespace
+}  // namespace parlayANN
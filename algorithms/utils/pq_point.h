@@ -0,0 +1,430 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "simd_distance.h"
+
+namespace parlayANN {
+
+// Product quantization.  The dimensions are split into M contiguous
+// subspaces and each subspace of a point is replaced by the index of
+// the closest of K = 2^bits centroids, which are trained with k-means
+// on a sample of the points.  A point is therefore stored in M bytes
+// (bits = 8) or M/2 bytes (bits = 4).
+//
+// Queries are translated with the parameters returned by
+// query_parameters, in which case the point holds a lookup table with
+// the distance from each subspace of the query to each centroid of
+// that subspace, and the distance to a base point is a sum of M table
+// entries (asymmetric distance computation).  For 4 bit codes the
+// table is quantized to bytes so that the lookups for 64 subspaces
+// are done with a few byte shuffles.  Distances between two base
+// points (e.g. when pruning) use a table of centroid to centroid
+// distances.
+//
+// Intended as the quantized point type of a search (with reranking on
+// the original points), not for building a graph.
+template<int bits = 8, bool mips = false>
+struct PQ_Point {
+  static_assert(bits == 8 || bits == 4, "PQ codes must be 4 or 8 bits");
+  static constexpr int K = 1 << bits;
+  using distanceType = float;
+  using byte = uint8_t;
+
+  // layout of the 4 bit lookup table, see adc4 below
+  static constexpr int block_subspaces = 64;
+  static constexpr int block_bytes = block_subspaces * 16;
+  static constexpr int lut4_offset = 64;
+
+  struct parameters {
+    int dims;    // of the original points
+    int M;       // number of subspaces
+    bool query;  // if true points hold a lookup table instead of codes
+    std::vector<float> centroids; // K centroids for each subspace
+    std::vector<float> sdc;       // K x K centroid distances for each subspace
+
+    int num_bytes() const {
+      if (query)
+        return (bits == 8) ? M * K * sizeof(float)
+          : lut4_offset + num_blocks() * block_bytes;
+      return (bits == 8) ? M : (M + 1) / 2;
+    }
+    int num_blocks() const {return (M + block_subspaces - 1) / block_subspaces;}
+    int start(int m) const {return (long) m * dims / M;}
+    int length(int m) const {return start(m + 1) - start(m);}
+    const float* centroid(int m, int k) const {
+      return centroids.data() + (long) K * start(m) + k * length(m);
+    }
+
+    parameters() : dims(0), M(0), query(false) {}
+    parameters(int dims) : dims(dims), M(0), query(false) {}
+    parameters(int dims, int M, std::vector<float>&& centroids)
+      : dims(dims), M(M), query(false), centroids(std::move(centroids)), sdc((long) M * K * K) {
+      parlay::parallel_for(0, (long) M * K, [&] (long i) {
+        int m = i / K;
+        for (int j = 0; j < K; j++)
+          sdc[i * K + j] = sub_distance(centroid(m, i % K), centroid(m, j), length(m));
+      });
+      std::cout << "PQ quantization, subspaces = " << M << ", bits = " << bits
+                << ", bytes = " << num_bytes() << std::endl;
+    }
+    template <typename Archive>
+    void serialize(Archive& ar) {ar(dims); ar(M); ar(query); ar(centroids); ar(sdc);}
+  };
+
+  static distanceType d_min() {
+    return mips ? -std::numeric_limits<float>::max() : 0;
+  }
+  static bool is_metric() {return !mips;}
+  static std::string type_tag() {return "PQ_Point<" + std::to_string(bits) + "," + std::to_string(mips) + ">";}
+
+  // coordinate i of the centroids a base point is encoded by
+  float operator [] (long i) const {
+    int m = (long) i * params->M / params->dims;
+    while (params->start(m + 1) <= i) m++;
+    while (params->start(m) > i) m--;
+    return params->centroid(m, code(values, m))[i - params->start(m)];
+  }
+
+  float distance(const PQ_Point& x) const {
+    if (x.params->query) return x.adc(values);
+    if (params->query) return adc(x.values);
+    return sdc(x.values);
+  }
+
+  void prefetch() const {
+    int l = (params->num_bytes() - 1)/64 + 1;
+    for (int i=0; i < l; i++)
+      __builtin_prefetch((char*) values + i * 64);
+  }
+
+  bool same_as(const PQ_Point& q) const {
+    return values == q.values;
+  }
+
+  long id() const {return id_;}
+
+  PQ_Point(byte* values, long id, const parameters& p)
+    : values(values), id_(id), params(&p) {}
+
+  bool operator==(const PQ_Point& q) const {
+    return std::memcmp(values, q.values, params->num_bytes()) == 0;
+  }
+
+  void normalize() {
+    std::cout << "can't normalize quantized point" << std::endl;
+    abort();
+  }
+
+  // parameters for translating queries into lookup tables
+  static parameters query_parameters(const parameters& p) {
+    parameters qp;
+    qp.dims = p.dims;
+    qp.M = p.M;
+    qp.query = true;
+    qp.centroids = p.centroids;
+    return qp;
+  }
+
+  template <typename In_Point>
+  static void translate_point(byte* values, const In_Point& p, const parameters& params) {
+    std::vector<float> v(params.dims);
+    for (int j = 0; j < params.dims; j++) v[j] = p[j];
+    if (params.query) {
+      make_lookup_table(values, v.data(), params);
+      return;
+    }
+    if (bits == 4) std::memset(values, 0, params.num_bytes());
+    for (int m = 0; m < params.M; m++) {
+      int best = 0;
+      float best_d = std::numeric_limits<float>::max();
+      for (int k = 0; k < K; k++) {
+        float d = simd::dispatch.l2_float(v.data() + params.start(m), params.centroid(m, k),
+                                          params.length(m));
+        if (d < best_d) {best = k; best_d = d;}
+      }
+      if (bits == 8) values[m] = best;
+      else values[m/2] |= best << (4 * (m & 1));
+    }
+  }
+
+  // Trains the codebooks on a sample of pr.  M is the number of
+  // subspaces, by default one byte of code per 16 dimensions.
+  template <typename PR>
+  static parameters generate_parameters(const PR& pr, int M = 0) {
+    int dims = pr.dimension();
+    if (M <= 0) M = std::max(1, dims / 16) * (8 / bits);
+    M = std::min(M, dims);
+    long n = pr.size();
+    long n_train = std::min<long>(n, 64 * K);
+    parlay::sequence<float> train(n_train * dims);
+    parlay::parallel_for(0, n_train, [&] (long i) {
+      auto p = pr[i * n / n_train];
+      for (int j = 0; j < dims; j++) train[i * dims + j] = p[j];
+    });
+
+    std::vector<float> centroids((long) K * dims);
+    parameters shape(dims);
+    shape.M = M;
+    parlay::parallel_for(0, M, [&] (long m) {
+      kmeans(train.data(), n_train, dims, shape.start(m), shape.length(m),
+             centroids.data() + (long) K * shape.start(m), m);
+    }, 1);
+    return parameters(dims, M, std::move(centroids));
+  }
+
+  // Sum of the 4 bit table entries selected by codes (see
+  // make_lookup_table for the layout).
+  static uint32_t adc4_scalar(const byte* lut, const byte* codes, int code_bytes, int blocks) {
+    uint32_t sum = 0;
+    for (int b = 0; b < blocks; b++)
+      for (int p = 0; p < block_subspaces; p++) {
+        int j = 32 * b + p % 32;
+        if (j >= code_bytes) continue;
+        int c = (p < 32) ? (codes[j] & 15) : (codes[j] >> 4);
+        sum += lut[b * block_bytes + (p % 16) * 64 + (p / 16) * 16 + c];
+      }
+    return sum;
+  }
+
+#ifdef PARLAYANN_SIMD_X86
+  // As adc4_avx512, with the four 128 bit lanes split over two 256 bit
+  // vectors and position k of each lane kept with a blend.  A partial
+  // last block of codes is copied so that nothing past it is read.
+  __attribute__((target("avx2,fma")))
+  static uint32_t adc4_avx2(const byte* lut, const byte* codes, int code_bytes, int blocks) {
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    const __m256i lane_position = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                                   0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    for (int b = 0; b < blocks; b++) {
+      int remaining = code_bytes - 32 * b;
+      __m256i c;
+      if (remaining >= 32) {
+        c = _mm256_loadu_si256((const __m256i*) (codes + 32 * b));
+      } else {
+        alignas(32) byte tail[32] = {};
+        std::memcpy(tail, codes + 32 * b, remaining);
+        c = _mm256_load_si256((const __m256i*) tail);
+      }
+      __m256i lo = _mm256_and_si256(c, low);
+      __m256i hi = _mm256_and_si256(_mm256_srli_epi16(c, 4), low);
+      __m256i r_lo = zero, r_hi = zero;
+      const byte* block = lut + b * block_bytes;
+      for (int k = 0; k < 16; k++) {
+        __m256i keep = _mm256_cmpeq_epi8(lane_position, _mm256_set1_epi8(k));
+        __m256i t_lo = _mm256_loadu_si256((const __m256i*) (block + k * 64));
+        __m256i t_hi = _mm256_loadu_si256((const __m256i*) (block + k * 64 + 32));
+        r_lo = _mm256_blendv_epi8(r_lo, _mm256_shuffle_epi8(t_lo, lo), keep);
+        r_hi = _mm256_blendv_epi8(r_hi, _mm256_shuffle_epi8(t_hi, hi), keep);
+      }
+      total = _mm256_add_epi64(total, _mm256_sad_epu8(r_lo, zero));
+      total = _mm256_add_epi64(total, _mm256_sad_epu8(r_hi, zero));
+    }
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+  }
+
+  // Shuffle k looks up the positions p with p%16 == k of all four
+  // lanes at once, and the masks merge these into a single vector.
+  __attribute__((target(PARLAYANN_AVX512)))
+  static uint32_t adc4_avx512(const byte* lut, const byte* codes, int code_bytes, int blocks) {
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m512i total = _mm512_setzero_si512();
+    for (int b = 0; b < blocks; b++) {
+      int remaining = code_bytes - 32 * b;
+      __mmask32 mask = (remaining >= 32) ? ~0u : ((1u << remaining) - 1);
+      __m256i c = _mm256_maskz_loadu_epi8(mask, codes + 32 * b);
+      __m256i lo = _mm256_and_si256(c, low);
+      __m256i hi = _mm256_and_si256(_mm256_srli_epi16(c, 4), low);
+      __m512i idx = _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+      __m512i r = _mm512_setzero_si512();
+      const byte* block = lut + b * block_bytes;
+      for (int k = 0; k < 16; k++) {
+        __m512i t = _mm512_loadu_si512(block + k * 64);
+        r = _mm512_mask_shuffle_epi8(r, (__mmask64) 0x0001000100010001ull << k, t, idx);
+      }
+      total = _mm512_add_epi64(total, _mm512_sad_epu8(r, _mm512_setzero_si512()));
+    }
+    return _mm512_reduce_add_epi64(total);
+  }
+#endif
+
+  static uint32_t adc4(const byte* lut, const byte* codes, int code_bytes, int blocks) {
+#ifdef PARLAYANN_SIMD_X86
+    if (simd::dispatch.level >= simd::simd_level::avx512)
+      return adc4_avx512(lut, codes, code_bytes, blocks);
+    if (simd::dispatch.level >= simd::simd_level::avx2)
+      return adc4_avx2(lut, codes, code_bytes, blocks);
+#endif
+    return adc4_scalar(lut, codes, code_bytes, blocks);
+  }
+
+private:
+  static float sub_distance(const float* a, const float* b, int d) {
+    if (mips) return -simd::dispatch.dot_float(a, b, d);
+    return simd::dispatch.l2_float(a, b, d);
+  }
+
+  static int code(const byte* values, int m) {
+    if (bits == 8) return values[m];
+    return (values[m/2] >> (4 * (m & 1))) & 15;
+  }
+
+  // Lloyd's algorithm on dimensions [start, start+d) of the training
+  // points, writing K centroids of dimension d to centers.
+  static void kmeans(const float* train, long n, int dims, int start, int d,
+                     float* centers, long seed) {
+    constexpr int rounds = 10;
+    std::vector<float> sub(n * d);
+    for (long i = 0; i < n; i++)
+      for (int j = 0; j < d; j++) sub[i * d + j] = train[i * dims + start + j];
+    std::mt19937 rng(seed);
+    for (int k = 0; k < K; k++)
+      std::memcpy(centers + k * d, sub.data() + (rng() % n) * d, d * sizeof(float));
+
+    parlay::sequence<int> assignment(n);
+    std::vector<double> sums((long) K * d);
+    std::vector<long> counts(K);
+    for (int r = 0; r < rounds; r++) {
+      parlay::parallel_for(0, n, [&] (long i) {
+        int best = 0;
+        float best_d = std::numeric_limits<float>::max();
+        for (int k = 0; k < K; k++) {
+          float dist = simd::dispatch.l2_float(sub.data() + i * d, centers + k * d, d);
+          if (dist < best_d) {best = k; best_d = dist;}
+        }
+        assignment[i] = best;
+      });
+      std::fill(sums.begin(), sums.end(), 0.0);
+      std::fill(counts.begin(), counts.end(), 0);
+      for (long i = 0; i < n; i++) {
+        counts[assignment[i]]++;
+        for (int j = 0; j < d; j++) sums[assignment[i] * d + j] += sub[i * d + j];
+      }
+      for (int k = 0; k < K; k++) {
+        if (counts[k] == 0) { // reseed empty clusters with a random point
+          std::memcpy(centers + k * d, sub.data() + (rng() % n) * d, d * sizeof(float));
+          continue;
+        }
+        for (int j = 0; j < d; j++) centers[k * d + j] = sums[k * d + j] / counts[k];
+      }
+    }
+  }
+
+  // For 8 bits the table is M x K floats.  For 4 bits the entries are
+  // shifted by the minimum of their subspace and scaled to [0,255],
+  // with the scale and sum of the minimums stored in front.  Subspaces
+  // are grouped in blocks of 64, matching 32 bytes of codes, and within
+  // a block position p < 32 is the low nibble of code byte p (subspace
+  // 2p) and position p >= 32 the high nibble of byte p-32 (subspace
+  // 2(p-32)+1).  The 16 entries of position p are stored at offset
+  // (p%16)*64 + (p/16)*16 of the block, so one 64 byte row holds the
+  // tables that a single 512 bit shuffle needs for positions p%16 of
+  // each of its 128 bit lanes.  Missing subspaces have all zero entries.
+  static void make_lookup_table(byte* values, const float* q, const parameters& params) {
+    int M = params.M;
+    if (bits == 8) {
+      float* lut = (float*) values;
+      for (int m = 0; m < M; m++)
+        for (int k = 0; k < K; k++)
+          lut[m * K + k] = sub_distance(q + params.start(m), params.centroid(m, k),
+                                        params.length(m));
+      return;
+    }
+    std::vector<float> table(M * K);
+    std::vector<float> mins(M);
+    float bias = 0.0, range = 0.0;
+    for (int m = 0; m < M; m++) {
+      for (int k = 0; k < K; k++)
+        table[m * K + k] = sub_distance(q + params.start(m), params.centroid(m, k),
+                                        params.length(m));
+      auto [lo, hi] = std::minmax_element(table.begin() + m * K, table.begin() + (m + 1) * K);
+      mins[m] = *lo;
+      bias += *lo;
+      range = std::max(range, *hi - *lo);
+    }
+    float scale = (range > 0) ? 255.0 / range : 1.0;
+    float* header = (float*) values;
+    header[0] = scale;
+    header[1] = bias;
+    byte* lut = values + lut4_offset;
+    std::memset(lut, 0, params.num_blocks() * block_bytes);
+    for (int m = 0; m < M; m++) {
+      int b = m / block_subspaces;
+      int s = m % block_subspaces;
+      int p = (s % 2 == 0) ? s / 2 : 32 + s / 2;
+      byte* row = lut + b * block_bytes + (p % 16) * 64 + (p / 16) * 16;
+      for (int k = 0; k < K; k++)
+        row[k] = (byte) std::lround((table[m * K + k] - mins[m]) * scale);
+    }
+  }
+
+  // asymmetric distance from the query table in values to codes
+  float adc(const byte* codes) const {
+    if (bits == 8) {
+      const float* lut = (const float*) values;
+      int M = params->M;
+      float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+      int m = 0;
+      for (; m + 4 <= M; m += 4) {
+        s0 += lut[m * K + codes[m]];
+        s1 += lut[(m + 1) * K + codes[m + 1]];
+        s2 += lut[(m + 2) * K + codes[m + 2]];
+        s3 += lut[(m + 3) * K + codes[m + 3]];
+      }
+      for (; m < M; m++) s0 += lut[m * K + codes[m]];
+      return (s0 + s1) + (s2 + s3);
+    }
+    const float* header = (const float*) values;
+    return adc4(values + lut4_offset, codes, (params->M + 1) / 2, params->num_blocks())
+      / header[0] + header[1];
+  }
+
+  // symmetric distance between two base points
+  float sdc(const byte* codes) const {
+    const float* table = params->sdc.data();
+    float sum = 0.0;
+    for (int m = 0; m < params->M; m++)
+      sum += table[((long) m * K + code(values, m)) * K + code(codes, m)];
+    return sum;
+  }
+
+  byte* values;
+  long id_;
+  const parameters* params;
+};
+
+} // end namespace
@@ -0,0 +1,146 @@
+#include "algorithms/utils/pq_point.h"
+
+#include <random>
+#include <vector>
+
+#include "algorithms/utils/point_range.h"
+#include "algorithms/utils/simd_distance.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+// row major float matrix usable as the source of a PointRange
+struct Matrix {
+  std::vector<float> data;
+  int d;
+  size_t size() const {return data.size() / d;}
+  long dimension() const {return d;}
+  const float* operator[](long i) const {return data.data() + i * d;}
+};
+
+Matrix RandomMatrix(size_t n, int d, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  Matrix A{std::vector<float>(n * d), d};
+  for (auto& x : A.data) x = dist(rng);
+  return A;
+}
+
+float SquaredDistance(const float* a, const float* b, int d) {
+  float s = 0;
+  for (int j = 0; j < d; j++) s += (a[j] - b[j]) * (a[j] - b[j]);
+  return s;
+}
+
+// distance from a to the reconstruction of p
+template<typename Point>
+float ReconstructedDistance(const float* a, const Point& p, int d) {
+  std::vector<float> r(d);
+  for (int j = 0; j < d; j++) r[j] = p[j];
+  return SquaredDistance(a, r.data(), d);
+}
+
+TEST(PQPointTest, LookupTableMatchesReconstruction) {
+  using QPoint = PQ_Point<8>;
+  int d = 24;
+  auto base = RandomMatrix(2000, d, 1);
+  auto queries = RandomMatrix(20, d, 2);
+  // 24 dimensions do not split evenly into 7 subspaces
+  PointRange<QPoint> Q_Points(base, QPoint::generate_parameters(base, 7));
+  PointRange<QPoint> Q_Queries(queries, QPoint::query_parameters(Q_Points.params));
+  EXPECT_EQ(Q_Points.params.num_bytes(), 7);
+  for (size_t q = 0; q < queries.size(); q++)
+    for (long i = 0; i < 100; i++) {
+      float expected = ReconstructedDistance(queries[q], Q_Points[i], d);
+      EXPECT_NEAR(Q_Points[i].distance(Q_Queries[q]), expected, 1e-4 * (1 + expected));
+      EXPECT_NEAR(Q_Queries[q].distance(Q_Points[i]), expected, 1e-4 * (1 + expected));
+    }
+
+  // symmetric distance between two encoded points
+  for (long i = 0; i < 100; i++) {
+    std::vector<float> r(d);
+    for (int j = 0; j < d; j++) r[j] = Q_Points[i + 1][j];
+    float expected = ReconstructedDistance(r.data(), Q_Points[i], d);
+    EXPECT_NEAR(Q_Points[i].distance(Q_Points[i + 1]), expected, 1e-4 * (1 + expected));
+  }
+}
+
+TEST(PQPointTest, FourBitTableIsCloseToExact) {
+  using QPoint = PQ_Point<4>;
+  for (int M : {7, 64, 130}) {
+    int d = 2 * M;
+    auto base = RandomMatrix(500, d, 3);
+    auto queries = RandomMatrix(10, d, 4);
+    PointRange<QPoint> Q_Points(base, QPoint::generate_parameters(base, M));
+    PointRange<QPoint> Q_Queries(queries, QPoint::query_parameters(Q_Points.params));
+    EXPECT_EQ(Q_Points.params.num_bytes(), (M + 1) / 2);
+    for (size_t q = 0; q < queries.size(); q++)
+      for (long i = 0; i < 100; i++) {
+        float expected = ReconstructedDistance(queries[q], Q_Points[i], d);
+        // each of the M table entries is rounded by at most half of
+        // 1/255 of the largest subspace range, which is at most 8 here
+        EXPECT_NEAR(Q_Points[i].distance(Q_Queries[q]), expected, 4.0 * M / 255);
+      }
+  }
+}
+
+TEST(PQPointTest, FourBitKernelsAgree) {
+  using QPoint = PQ_Point<4>;
+  std::mt19937 rng(5);
+  for (int M : {1, 33, 64, 65, 128, 191, 200}) {
+    int blocks = (M + QPoint::block_subspaces - 1) / QPoint::block_subspaces;
+    int code_bytes = (M + 1) / 2;
+    std::vector<uint8_t> lut(blocks * QPoint::block_bytes);
+    for (auto& x : lut) x = rng();
+    // the tables of missing subspaces are zero
+    for (int m = M; m < 64 * blocks; m++) {
+      int b = m / 64, s = m % 64;
+      int p = (s % 2 == 0) ? s / 2 : 32 + s / 2;
+      std::fill_n(lut.begin() + b * QPoint::block_bytes + (p % 16) * 64 + (p / 16) * 16, 16, 0);
+    }
+    // padding after the codes must not be read
+    std::vector<uint8_t> codes(32 * blocks, 0xff);
+    for (int j = 0; j < code_bytes; j++) codes[j] = rng();
+    uint32_t expected = 0;
+    for (int m = 0; m < M; m++) {
+      int c = (codes[m / 2] >> (4 * (m % 2))) & 15;
+      int b = m / 64, s = m % 64;
+      int p = (s % 2 == 0) ? s / 2 : 32 + s / 2;
+      expected += lut[b * QPoint::block_bytes + (p % 16) * 64 + (p / 16) * 16 + c];
+    }
+    EXPECT_EQ(QPoint::adc4_scalar(lut.data(), codes.data(), code_bytes, blocks), expected);
+    EXPECT_EQ(QPoint::adc4(lut.data(), codes.data(), code_bytes, blocks), expected);
+#ifdef PARLAYANN_SIMD_X86
+    if (simd::detect_simd_level() >= simd::simd_level::avx2)
+      EXPECT_EQ(QPoint::adc4_avx2(lut.data(), codes.data(), code_bytes, blocks), expected);
+    if (simd::detect_simd_level() >= simd::simd_level::avx512)
+      EXPECT_EQ(QPoint::adc4_avx512(lut.data(), codes.data(), code_bytes, blocks), expected);
+#endif
+  }
+}
+
+TEST(PQPointTest, NearestNeighborRanksHigh) {
+  using QPoint = PQ_Point<8>;
+  int d = 32;
+  auto base = RandomMatrix(5000, d, 6);
+  auto queries = RandomMatrix(100, d, 7);
+  PointRange<QPoint> Q_Points(base, QPoint::generate_parameters(base, 16));
+  PointRange<QPoint> Q_Queries(queries, QPoint::query_parameters(Q_Points.params));
+  int found = 0;
+  for (size_t q = 0; q < queries.size(); q++) {
+    long best = 0;
+    for (size_t i = 1; i < base.size(); i++)
+      if (SquaredDistance(queries[q], base[i], d) < SquaredDistance(queries[q], base[best], d))
+        best = i;
+    float best_pq = Q_Points[best].distance(Q_Queries[q]);
+    int closer = 0;
+    for (size_t i = 0; i < base.size(); i++)
+      if (Q_Points[i].distance(Q_Queries[q]) < best_pq) closer++;
+    if (closer < 10) found++;
+  }
+  EXPECT_GT(found, 90);
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -0,0 +1,190 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+
+#include "graph.h"
+#include "types.h"
+
+namespace parlayANN {
+
+// The alpha pruning rule of DiskANN, used by Vamana's robustPrune, and
+// the pruning of a graph built by another method (HCNNG or
+// pyNNDescent) to a bounded degree with it.
+
+// The distances from point p to the points ids, computed in one pass
+// that prefetches a few points ahead.
+template<typename PointRange, typename indexType, typename Seq>
+parlay::sequence<std::pair<indexType, typename PointRange::Point::distanceType>>
+distances_from(const PointRange &Points, indexType p, const Seq &ids) {
+  using distanceType = typename PointRange::Point::distanceType;
+  constexpr size_t lookahead = 4;
+  size_t m = ids.size();
+  auto result = parlay::sequence<std::pair<indexType, distanceType>>::uninitialized(m);
+  auto P = Points[p];
+  for (size_t i = 0; i < std::min(m, lookahead); i++) Points[ids[i]].prefetch();
+  for (size_t i = 0; i < m; i++) {
+    if (i + lookahead < m) Points[ids[i + lookahead]].prefetch();
+    result[i] = std::pair((indexType) ids[i], P.distance(Points[ids[i]]));
+  }
+  return result;
+}
+
+// any kept neighbor can occlude any candidate
+struct always_occludes {
+  template<typename indexType>
+  bool operator()(indexType p_star, indexType p_prime) const {return true;}
+};
+
+// The neighbors of p kept from the (id, distance) candidates, at most
+// R of them.  Candidates are taken closest first, and a candidate p'
+// is dropped if a kept neighbor p* has alpha * d(p*, p') <= d(p, p')
+// and can_occlude(p*, p').  Duplicates and p itself are ignored.  The
+// distances computed are added to distance_comps, if given.
+template<typename indexType, typename PointRange, typename distanceType,
+         typename Occludes = always_occludes>
+parlay::sequence<indexType>
+alpha_prune(const PointRange &Points, indexType p,
+            parlay::sequence<std::pair<indexType, distanceType>> candidates,
+            long R, double alpha, const Occludes& can_occlude = Occludes(),
+            long* distance_comps = nullptr) {
+  std::sort(candidates.begin(), candidates.end(), [] (auto a, auto b) {
+    return a.second < b.second || (a.second == b.second && a.first < b.first);});
+  auto last = std::unique(candidates.begin(), candidates.end(),
+                          [] (auto a, auto b) {return a.first == b.first;});
+  candidates.resize(last - candidates.begin());
+  parlay::sequence<bool> dropped(candidates.size(), false);
+  parlay::sequence<indexType> result;
+  result.reserve(std::min<size_t>(R, candidates.size()));
+  long comps = 0;
+  for (size_t i = 0; i < candidates.size() && (long) result.size() < R; i++) {
+    indexType p_star = candidates[i].first;
+    if (dropped[i] || p_star == p) continue;
+    result.push_back(p_star);
+    auto P_star = Points[p_star];
+    for (size_t j = i + 1; j < candidates.size(); j++) {
+      if (dropped[j]) continue;
+      comps++;
+      indexType p_prime = candidates[j].first;
+      if (alpha * P_star.distance(Points[p_prime]) <= candidates[j].second &&
+          can_occlude(p_star, p_prime))
+        dropped[j] = true;
+    }
+  }
+  if (distance_comps != nullptr) *distance_comps += comps;
+  return result;
+}
+
+// A copy of G with maximum degree R.  First the out edges of each
+// vertex are alpha pruned to at most R.  Then, for each remaining edge
+// u -> v, the reverse edge v -> u is a candidate for v.  As in Vamana,
+// the candidates are all added if v has room for them, and otherwise
+// v is alpha pruned again with them, so a reverse edge only displaces
+// edges it occludes.  Vertices are pruned in parallel.
+template<typename indexType, typename PointRange>
+Graph<indexType> prune_graph(const Graph<indexType> &G, const PointRange &Points,
+                             long R, double alpha) {
+  size_t n = G.size();
+  Graph<indexType> H(R, n);
+  H.set_start_point(G.start_point());
+  parlay::parallel_for(0, n, [&] (size_t i) {
+    auto ngh = G[i];
+    auto ids = parlay::tabulate(ngh.size(), [&] (size_t j) {return ngh[j];});
+    H[i].update_neighbors(alpha_prune(Points, (indexType) i,
+                                      distances_from(Points, (indexType) i, ids), R, alpha));
+  }, 1);
+
+  // the reverse edges not already in the graph, grouped by source
+  auto reverse = parlay::flatten(parlay::tabulate(n, [&] (size_t u) {
+    auto ngh = H[u];
+    auto edges = parlay::tabulate(ngh.size(), [&] (size_t j) {
+      return std::pair(ngh[j], (indexType) u);});
+    return parlay::filter(edges, [&] (auto e) {
+      auto back = H[e.first];
+      for (size_t j = 0; j < back.size(); j++)
+        if (back[j] == e.second) return false;
+      return true;});
+  }));
+  auto grouped = parlay::group_by_key(reverse);
+  auto added = parlay::tabulate(grouped.size(), [&] (size_t i) {
+    auto& [v, sources] = grouped[i];
+    auto ngh = H[v];
+    size_t before = ngh.size();
+    if (before + sources.size() <= (size_t) R) {
+      H[v].append_neighbors(sources);
+      return (long) sources.size();
+    }
+    auto ids = parlay::append(parlay::tabulate(before, [&] (size_t j) {return ngh[j];}),
+                              sources);
+    auto pruned = alpha_prune(Points, v, distances_from(Points, v, ids), R, alpha);
+    H[v].update_neighbors(pruned);
+    // reverse edges kept, less the edges they displaced
+    return (long) pruned.size() - (long) before;
+  }, 1);
+  std::cout << "pruning added " << parlay::reduce(added) << " of "
+            << reverse.size() << " reverse edges" << std::endl;
+  return H;
+}
+
+// The distribution of the out degrees of a graph.
+struct degree_distribution {
+  double average;
+  size_t min, median, p90, p99, max;
+
+  template<typename indexType>
+  degree_distribution(const Graph<indexType> &G) {
+    size_t n = G.size();
+    auto degrees = parlay::sort(parlay::tabulate(n, [&] (size_t i) {
+      return (size_t) G[i].size();}));
+    auto at = [&] (double f) {return n == 0 ? 0 : degrees[std::min(n - 1, (size_t) (f * n))];};
+    average = n == 0 ? 0 : (double) parlay::reduce(degrees) / n;
+    min = at(0);
+    median = at(.5);
+    p90 = at(.9);
+    p99 = at(.99);
+    max = n == 0 ? 0 : degrees[n - 1];
+  }
+
+  void print(std::string label) const {
+    std::cout << label << " degrees: average " << average << ", min " << min
+              << ", median " << median << ", 90% " << p90 << ", 99% " << p99
+              << ", max " << max << std::endl;
+  }
+};
+
+// prune_graph, reporting the degree distributions before and after
+template<typename indexType, typename PointRange>
+void prune_and_report(Graph<indexType> &G, const PointRange &Points, long R, double alpha) {
+  degree_distribution(G).print("Unpruned");
+  G = prune_graph(G, Points, R, alpha);
+  degree_distribution(G).print("Pruned");
+}
+
+} // end namespace
@@ -0,0 +1,87 @@
+#include "algorithms/utils/prune.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/knn_graph.h"
+#include "algorithms/utils/point_range.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using Point = Euclidian_Point<float>;
+
+PointRange<Point> MakePoints(const std::vector<float>& data, size_t d) {
+  Point::parameters params(d);
+  std::vector<Point> pts;
+  for (size_t i = 0; i < data.size() / d; i++)
+    pts.push_back(Point((uint8_t*) (data.data() + i * d), i, params));
+  return PointRange<Point>(pts, params);
+}
+
+TEST(PruneTest, AlphaPruneDropsOccludedCandidates) {
+  // points on a line at 0, 1, 2 and 10
+  std::vector<float> data = {0, 1, 2, 10};
+  auto Points = MakePoints(data, 1);
+  std::vector<unsigned int> ids = {3, 2, 1, 1, 0};
+  auto candidates = distances_from(Points, 0u, ids);
+  ASSERT_EQ(candidates.size(), ids.size());
+  EXPECT_EQ(candidates[0].second, 100);
+
+  // 1 occludes 2 and 10 (which are closer to 1 than to 0)
+  auto kept = alpha_prune(Points, 0u, candidates, 3, 1.0);
+  EXPECT_EQ(std::vector<unsigned int>(kept.begin(), kept.end()),
+            std::vector<unsigned int>({1}));
+  // from 1, with alpha 1.2: 0 and 2 are kept, and 10 is occluded by 2
+  kept = alpha_prune(Points, 1u, distances_from(Points, 1u, std::vector<unsigned int>({0, 2, 3})),
+                     3, 1.2);
+  EXPECT_EQ(std::vector<unsigned int>(kept.begin(), kept.end()),
+            std::vector<unsigned int>({0, 2}));
+}
+
+TEST(PruneTest, PrunedGraphHasBoundedDegree) {
+  size_t n = 1000, d = 8, R = 12;
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> u(-1, 1);
+  std::vector<float> data(n * d);
+  for (auto& x : data) x = u(gen);
+  auto Points = MakePoints(data, d);
+  auto G = exact_knn_graph<unsigned int>(data.data(), n, d, 40, false);
+  G.set_start_point(7);
+
+  auto H = prune_graph(G, Points, R, 1.2);
+  ASSERT_EQ(H.size(), n);
+  EXPECT_EQ(H.max_degree(), R);
+  EXPECT_EQ(H.start_point(), 7);
+  size_t reverse = 0;
+  for (size_t i = 0; i < n; i++) {
+    ASSERT_GT(H[i].size(), 0);
+    EXPECT_LE(H[i].size(), R);
+    for (size_t j = 0; j < H[i].size(); j++) {
+      EXPECT_NE(H[i][j], i);
+      for (size_t l = j + 1; l < H[i].size(); l++) EXPECT_NE(H[i][j], H[i][l]);
+      // the nearest neighbor is never occluded
+      bool in_G = false;
+      for (size_t l = 0; l < G[i].size(); l++) in_G |= (G[i][l] == H[i][j]);
+      if (!in_G) reverse++;
+    }
+    EXPECT_EQ(H[i][0], G[i][0]);
+  }
+  EXPECT_GT(reverse, 0);
+
+  degree_distribution before(G), after(H);
+  EXPECT_EQ(before.min, 40);
+  EXPECT_EQ(before.max, 40);
+  EXPECT_LE(after.max, R);
+  EXPECT_LT(after.average, before.average);
+  EXPECT_LE(after.min, after.median);
+  EXPECT_LE(after.median, after.p90);
+  EXPECT_LE(after.p90, after.p99);
+  EXPECT_LE(after.p99, after.max);
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -0,0 +1,81 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+
+namespace parlayANN {
+
+// Quantiles of the coordinates of a point range, used to choose the
+// parameters of the data dependent quantized point types.
+//
+// Rather than copying and sorting every coordinate, which needs more
+// memory than the points themselves, the quantiles are read from a
+// uniform sample of the coordinates.  The rank of an estimate is off
+// by about 1/(2 sqrt(sample size)) of the number of coordinates, i.e.
+// by 0.025% with the default sample.  Ranges with no more coordinates
+// than the sample size are copied whole, so their quantiles are exact.
+// The sample size is passed down from the generate_parameters of the
+// point types that use quantiles.
+
+constexpr long default_quantile_sample = 1l << 22;
+
+template <typename PR>
+parlay::sequence<float> sample_coordinates(const PR& pr, long sample_size) {
+  long dims = pr.dimension();
+  long len = pr.size() * dims;
+  if (len <= sample_size) {
+    parlay::sequence<float> vals(len);
+    parlay::parallel_for(0, pr.size(), [&] (long i) {
+      auto p = pr[i];
+      for (long j = 0; j < dims; j++) vals[i * dims + j] = p[j];
+    });
+    return vals;
+  }
+  return parlay::tabulate(sample_size, [&] (long i) {
+    long r = parlay::hash64(i) % len;
+    return (float) pr[r / dims][r % dims];
+  });
+}
+
+// the q-quantile of the coordinates for each q in qs (0 <= q <= 1)
+template <typename PR>
+std::vector<float> coordinate_quantiles(const PR& pr, const std::vector<double>& qs,
+                                        long sample_size = default_quantile_sample) {
+  auto vals = sample_coordinates(pr, sample_size);
+  std::vector<float> result(qs.size(), 0.0);
+  if (vals.size() == 0) return result;
+  parlay::sort_inplace(vals);
+  for (size_t i = 0; i < qs.size(); i++) {
+    double q = std::clamp(qs[i], 0.0, 1.0);
+    result[i] = vals[(long) (q * (vals.size() - 1))];
+  }
+  return result;
+}
+
+} // end namespace
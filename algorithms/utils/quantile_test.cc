@@ -0,0 +1,66 @@
+#include "algorithms/utils/quantile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+// row major matrix with the interface of a point range
+struct Matrix {
+  std::vector<float> data;
+  long d;
+  size_t size() const {return data.size() / d;}
+  long dimension() const {return d;}
+  const float* operator[](long i) const {return data.data() + i * d;}
+};
+
+Matrix RandomMatrix(size_t n, long d, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<float> dist(0.0, 1.0);
+  Matrix A{std::vector<float>(n * d), d};
+  for (auto& x : A.data) x = dist(rng);
+  return A;
+}
+
+TEST(QuantileTest, ExactWhenSampleCoversRange) {
+  Matrix A = RandomMatrix(1000, 10, 1);
+  std::vector<float> sorted = A.data;
+  std::sort(sorted.begin(), sorted.end());
+  auto q = coordinate_quantiles(A, {0.0, .3, .5, .7, 1.0}, A.data.size());
+  EXPECT_EQ(q[0], sorted.front());
+  EXPECT_EQ(q[1], sorted[(long) (.3 * (sorted.size() - 1))]);
+  EXPECT_EQ(q[2], sorted[(long) (.5 * (sorted.size() - 1))]);
+  EXPECT_EQ(q[3], sorted[(long) (.7 * (sorted.size() - 1))]);
+  EXPECT_EQ(q[4], sorted.back());
+}
+
+TEST(QuantileTest, SampledRankIsClose) {
+  Matrix A = RandomMatrix(20000, 50, 2);
+  std::vector<float> sorted = A.data;
+  std::sort(sorted.begin(), sorted.end());
+  long sample = 1 << 16;
+  ASSERT_LT(sample, (long) sorted.size());
+  EXPECT_EQ(sample_coordinates(A, sample).size(), sample);
+  std::vector<double> qs = {.01, .3, .5, .7, .99};
+  auto q = coordinate_quantiles(A, qs, sample);
+  for (size_t i = 0; i < qs.size(); i++) {
+    double rank = (std::lower_bound(sorted.begin(), sorted.end(), q[i]) - sorted.begin())
+      / (double) sorted.size();
+    // about eight standard deviations of the rank of a sample quantile
+    EXPECT_NEAR(rank, qs[i], 4.0 / std::sqrt(sample)) << "q=" << qs[i];
+  }
+}
+
+TEST(QuantileTest, EmptyRange) {
+  Matrix A{{}, 4};
+  auto q = coordinate_quantiles(A, {.5});
+  EXPECT_EQ(q[0], 0.0);
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -0,0 +1,191 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/utilities.h"
+
+#include "graph.h"
+#include "mmap.h"
+
+namespace parlayANN {
+
+// Relabeling of a graph and its points so that vertices that are
+// visited together by a search are stored near each other.
+//
+// An order is a permutation given as the old id of each new id, so
+// order[i] is the (original) id of the vertex stored at position i.
+// Searches on the reordered graph and points return new ids; the order
+// itself maps them back to the original ids, and is saved next to the
+// reordered files as an id map.
+
+// Breadth first order from start.  The vertices of each level are
+// numbered in the order they are first reached from the previous
+// level (so the result is deterministic), and vertices not reachable
+// from start are numbered after, breadth first from the smallest
+// unnumbered id.  Since a graph search moves outward from the start
+// point, the vertices it visits together, and the neighbors of each,
+// get nearby ids.
+template<typename indexType>
+parlay::sequence<indexType> bfs_order(const Graph<indexType> &G, indexType start) {
+  size_t n = G.size();
+  indexType none = std::numeric_limits<indexType>::max();
+  auto new_id = parlay::sequence<indexType>(n, none);
+  std::unique_ptr<std::atomic<size_t>[]> first(new std::atomic<size_t>[n]);
+  parlay::parallel_for(0, n, [&] (size_t i) {first[i] = std::numeric_limits<size_t>::max();});
+  parlay::sequence<indexType> order;
+  order.reserve(n);
+
+  auto visit_from = [&] (indexType s) {
+    new_id[s] = order.size();
+    order.push_back(s);
+    parlay::sequence<indexType> frontier = {s};
+    while (frontier.size() > 0) {
+      auto candidates = parlay::flatten(parlay::map(frontier, [&] (indexType v) {
+        auto ngh = G[v];
+        return parlay::tabulate(ngh.size(), [&] (size_t j) {return ngh[j];});}));
+      // keep the first occurrence of each vertex not yet numbered
+      parlay::parallel_for(0, candidates.size(), [&] (size_t i) {
+        if (new_id[candidates[i]] == none)
+          parlay::write_min(&first[candidates[i]], i, std::less<size_t>());});
+      auto next = parlay::pack(candidates, parlay::tabulate(candidates.size(), [&] (size_t i) {
+        return new_id[candidates[i]] == none && first[candidates[i]] == i;}));
+      size_t offset = order.size();
+      parlay::parallel_for(0, next.size(), [&] (size_t i) {
+        new_id[next[i]] = offset + i;
+        first[next[i]] = std::numeric_limits<size_t>::max();});
+      order.append(next);
+      frontier = std::move(next);
+    }
+  };
+
+  if (n == 0) return order;
+  visit_from(start);
+  for (size_t v = 0; v < n; v++)
+    if (new_id[v] == none) visit_from(v);
+  return order;
+}
+
+// the new id of each old id
+template<typename indexType>
+parlay::sequence<indexType> inverse_order(const parlay::sequence<indexType> &order) {
+  parlay::sequence<indexType> new_id(order.size());
+  parlay::parallel_for(0, order.size(), [&] (size_t i) {new_id[order[i]] = i;});
+  return new_id;
+}
+
+// The graph with vertex order[i] stored as vertex i and every neighbor
+// renamed, keeping the order of each neighbor list.
+template<typename indexType>
+Graph<indexType> reorder_graph(const Graph<indexType> &G,
+                               const parlay::sequence<indexType> &order) {
+  auto new_id = inverse_order(order);
+  Graph<indexType> H(G.max_degree(), G.size());
+  parlay::parallel_for(0, G.size(), [&] (size_t i) {
+    auto ngh = G[order[i]];
+    auto renamed = parlay::tabulate(ngh.size(), [&] (size_t j) {return new_id[ngh[j]];});
+    H[i].update_neighbors(renamed);
+  });
+  H.set_start_point(new_id[G.start_point()]);
+  return H;
+}
+
+// Writes the points in the given order as a .bin file (the number of
+// points and dimension as 4 byte integers, then the rows).
+template<typename PointRange, typename indexType>
+void save_reordered_points(const PointRange &Points,
+                           const parlay::sequence<indexType> &order,
+                           char* filename) {
+  size_t n = Points.size();
+  size_t num_bytes = Points.params.num_bytes();
+  std::cout << "Writing " << n << " reordered points with dimension "
+            << Points.dimension() << std::endl;
+  std::ofstream writer(filename, std::ios::binary | std::ios::out);
+  unsigned int preamble[2] = {(unsigned int) n, (unsigned int) Points.dimension()};
+  writer.write((char*) preamble, sizeof(preamble));
+  size_t BLOCK_SIZE = 1000000;
+  for (size_t index = 0; index < n; index += BLOCK_SIZE) {
+    size_t m = std::min(BLOCK_SIZE, n - index);
+    parlay::sequence<char> rows(m * num_bytes);
+    parlay::parallel_for(0, m, [&] (size_t i) {
+      std::memcpy(rows.begin() + i * num_bytes, Points.location(order[index + i]), num_bytes);});
+    writer.write(rows.begin(), rows.size());
+  }
+  writer.close();
+}
+
+// The id map is stored like a one column ground truth file: the number
+// of points and 1 as 4 byte integers, followed by order.
+template<typename indexType>
+void save_id_map(const parlay::sequence<indexType> &order, char* filename) {
+  std::ofstream writer(filename, std::ios::binary | std::ios::out);
+  unsigned int preamble[2] = {(unsigned int) order.size(), 1};
+  writer.write((char*) preamble, sizeof(preamble));
+  auto ids = parlay::map(order, [] (indexType i) {return (uint32_t) i;});
+  writer.write((char*) ids.begin(), ids.size() * sizeof(uint32_t));
+  writer.close();
+}
+
+template<typename indexType>
+parlay::sequence<indexType> load_id_map(const char* filename) {
+  auto [fileptr, length] = mmapStringFromFile(filename);
+  unsigned int n = ((unsigned int*) fileptr)[0];
+  unsigned int d = ((unsigned int*) fileptr)[1];
+  if (d != 1 || length < 8 + n * sizeof(uint32_t)) {
+    std::cout << "ERROR: " << filename << " is not an id map" << std::endl;
+    abort();
+  }
+  uint32_t* ids = (uint32_t*) (fileptr + 8);
+  auto order = parlay::tabulate(n, [&] (size_t i) {return (indexType) ids[i];});
+  munmap(fileptr, length);
+  return order;
+}
+
+// The average over edges (u,v) of log2(1 + |u - v|): roughly the
+// number of bits of distance between the ids of neighboring vertices,
+// which is smaller when neighbors are stored near each other.
+template<typename indexType>
+double average_log_gap(const Graph<indexType> &G) {
+  auto per_vertex = parlay::tabulate(G.size(), [&] (size_t i) {
+    auto ngh = G[i];
+    double s = 0;
+    for (size_t j = 0; j < ngh.size(); j++)
+      s += std::log2(1.0 + std::abs((double) ngh[j] - (double) i));
+    return std::pair<double, size_t>(s, ngh.size());});
+  double total = parlay::reduce(parlay::map(per_vertex, [] (auto p) {return p.first;}));
+  size_t edges = parlay::reduce(parlay::map(per_vertex, [] (auto p) {return p.second;}));
+  return edges == 0 ? 0 : total / edges;
+}
+
+} // end namespace
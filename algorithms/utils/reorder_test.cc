@@ -0,0 +1,70 @@
+#include "algorithms/utils/reorder.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/point_range.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using Point = Euclidian_Point<float>;
+
+// 0 -> 3 -> {1, 5}, 1 -> 3, 5 -> 0, 2 <-> 4 (not reachable from 3)
+Graph<unsigned int> SmallGraph() {
+  Graph<unsigned int> G(3, 6);
+  std::vector<std::vector<unsigned int>> edges = {{3}, {3}, {4}, {5, 1}, {2}, {0}};
+  for (unsigned int i = 0; i < 6; i++) G[i].update_neighbors(edges[i]);
+  G.set_start_point(3);
+  return G;
+}
+
+TEST(ReorderTest, BreadthFirstFromStart) {
+  auto G = SmallGraph();
+  auto order = bfs_order(G, G.start_point());
+  EXPECT_EQ(std::vector<unsigned int>(order.begin(), order.end()),
+            std::vector<unsigned int>({3, 5, 1, 0, 2, 4}));
+  auto new_id = inverse_order(order);
+  for (unsigned int i = 0; i < 6; i++) EXPECT_EQ(order[new_id[i]], i);
+}
+
+TEST(ReorderTest, ReorderedGraphAndPointsAgree) {
+  auto G = SmallGraph();
+  auto order = bfs_order(G, G.start_point());
+  auto H = reorder_graph(G, order);
+  EXPECT_EQ(H.start_point(), 0);
+  for (unsigned int i = 0; i < 6; i++) {
+    ASSERT_EQ(H[i].size(), G[order[i]].size());
+    for (size_t j = 0; j < H[i].size(); j++) EXPECT_EQ(order[H[i][j]], G[order[i]][j]);
+  }
+
+  int d = 3;
+  std::vector<float> data(6 * d);
+  for (size_t i = 0; i < data.size(); i++) data[i] = i;
+  Point::parameters params(d);
+  std::vector<Point> points;
+  for (size_t i = 0; i < 6; i++)
+    points.push_back(Point((uint8_t*) (data.data() + i * d), i, params));
+  PointRange<Point> Points(points, params);
+
+  std::string points_path = testing::TempDir() + "/reorder_test.fbin";
+  std::string map_path = testing::TempDir() + "/reorder_test.map";
+  save_reordered_points(Points, order, points_path.data());
+  save_id_map(order, map_path.data());
+  PointRange<Point> Reordered(points_path.data());
+  auto loaded = load_id_map<unsigned int>(map_path.data());
+  std::remove(points_path.c_str());
+  std::remove(map_path.c_str());
+
+  ASSERT_EQ(loaded, order);
+  ASSERT_EQ(Reordered.size(), 6);
+  for (unsigned int i = 0; i < 6; i++)
+    for (int j = 0; j < d; j++) EXPECT_EQ(Reordered[i][j], Points[order[i]][j]);
+  EXPECT_LT(average_log_gap(H), average_log_gap(G));
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -0,0 +1,199 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "parlay/primitives.h"
+
+namespace parlayANN {
+
+// The working state of a beam search: the frontier, the visited
+// vertices, the temporaries used in each step, and two hash tables
+// for seen and visited vertices.  Searches are short and run many at
+// a time, so rather than allocate all of this on every call each
+// worker thread keeps one context (see thread_search_context below),
+// which grows to the largest beam it has been used for and is then
+// reused by all later searches on that thread.
+//
+// Entries of the visited table are stamped with the epoch of the
+// search that wrote them, and start() just increments the epoch, so the
+// table never has to be cleared between searches.  The seen filter is
+// not stamped: it is much larger and is probed for every neighbor, so
+// doubling its size costs more in cache misses than refilling it.
+template<typename indexType, typename distanceType>
+struct search_context {
+  using id_dist = std::pair<indexType, distanceType>;
+  struct slot {
+    indexType id;
+    uint32_t epoch;
+  };
+
+  // the frontier, kept sorted by distance, and whether each of its
+  // entries has been visited
+  std::vector<id_dist> frontier;
+  std::vector<uint8_t> frontier_visited;
+  std::vector<id_dist> new_frontier;
+  std::vector<uint8_t> new_frontier_visited;
+  // positions in the frontier of the entries not yet visited, in order
+  std::vector<int> unvisited;
+  // visited vertices in the order they were visited
+  std::vector<id_dist> visited;
+
+  // used as temporaries in each step
+  std::vector<id_dist> candidates;
+  std::vector<indexType> filtered;
+  std::vector<indexType> pruned;
+  std::vector<indexType> edges_prefetched;
+  std::vector<indexType> edges_prefetched_next;
+
+  // Prepare for a new search.  The size of the seen filter depends
+  // only on the beam size (and not on earlier searches) so that the
+  // number of distance comparisons is the same from call to call.
+  // Its memory is kept, so refilling it is a sequential write.
+  void start(long beam_size, long max_degree, long num_starts) {
+    if (++epoch == 0) {  // wrapped around, so old stamps are ambiguous
+      for (auto& s : visited_table) s.epoch = 0;
+      epoch = 1;
+    }
+    frontier.clear();
+    frontier_visited.clear();
+    visited.clear();
+    visited_count = 0;
+    int bits = std::max<int>(10, std::ceil(std::log2(beam_size * beam_size)) - 2);
+    seen_mask = (1ul << bits) - 1;
+    seen.resize(1ul << bits);
+    std::fill(seen.begin(), seen.end(), (indexType) -1);
+    if (visited_table.size() < 4 * (size_t) beam_size)
+      grow_visited_table(4 * (size_t) beam_size);
+
+    long front = std::max(beam_size, num_starts);
+    candidates.clear();
+    edges_prefetched.clear();
+    frontier.reserve(front);
+    new_frontier.reserve(front);
+    unvisited.resize(front);
+    visited.reserve(2 * beam_size);
+    candidates.reserve(max_degree + beam_size);
+    filtered.reserve(max_degree);
+    pruned.reserve(max_degree);
+  }
+
+  // Returns true if a has been seen in this search and otherwise
+  // records it as seen.  Can give false negatives, i.e. say that a
+  // has not been seen when it has.
+  bool has_been_seen(indexType a) {
+    indexType& s = seen[parlay::hash64_2(a) & seen_mask];
+    if (s == a) return true;
+    s = a;
+    return false;
+  }
+
+  // as above but without recording a
+  bool maybe_seen(indexType a) const {
+    return seen[parlay::hash64_2(a) & seen_mask] == a;
+  }
+
+  // exact test of whether a has been visited in this search
+  bool was_visited(indexType a) const {
+    size_t mask = visited_table.size() - 1;
+    for (size_t i = parlay::hash64(a) & mask; ; i = (i + 1) & mask) {
+      const slot& s = visited_table[i];
+      if (s.epoch != epoch) return false;
+      if (s.id == a) return true;
+    }
+  }
+
+  void visit(id_dist v) {
+    if (2 * (visited_count + 1) > visited_table.size())
+      grow_visited_table(2 * visited_table.size());
+    if (insert_visited(v.first)) visited.push_back(v);
+  }
+
+private:
+  std::vector<indexType> seen;
+  size_t seen_mask = 0;
+  // open addressing with linear probing, at most half full
+  std::vector<slot> visited_table;
+  size_t visited_count = 0;
+  uint32_t epoch = 0;
+
+  bool insert_visited(indexType a) {
+    size_t mask = visited_table.size() - 1;
+    for (size_t i = parlay::hash64(a) & mask; ; i = (i + 1) & mask) {
+      slot& s = visited_table[i];
+      if (s.epoch != epoch) {
+        s = slot{a, epoch};
+        visited_count++;
+        return true;
+      }
+      if (s.id == a) return false;
+    }
+  }
+
+  void grow_visited_table(size_t size) {
+    size_t n = 16;
+    while (n < size) n *= 2;
+    visited_table.assign(n, slot{0, 0});
+    visited_count = 0;
+    for (auto [a, d] : visited) insert_visited(a);
+  }
+};
+
+// The search context of the calling thread.  While a worker waits
+// to join a fork it can steal another search, which would then take
+// over the same context, so a search must not call a parallel
+// primitive while it uses its context, including when it copies its
+// results out (see copy_out).
+template<typename indexType, typename distanceType>
+search_context<indexType, distanceType>& thread_search_context() {
+  static thread_local search_context<indexType, distanceType> context;
+  return context;
+}
+
+// The search contexts of the calling thread for the searches of a
+// batch (see beam_search_batch), at least count of them.  The same
+// rule as for thread_search_context applies.
+template<typename indexType, typename distanceType>
+std::vector<search_context<indexType, distanceType>>& thread_search_contexts(size_t count) {
+  static thread_local std::vector<search_context<indexType, distanceType>> contexts;
+  if (contexts.size() < count) contexts.resize(count);
+  return contexts;
+}
+
+// A sequential copy of v.  parlay::to_sequence forks for long
+// inputs, which a search must not do while it uses its context.
+template<typename T>
+parlay::sequence<T> copy_out(const std::vector<T>& v) {
+  auto result = parlay::sequence<T>::uninitialized(v.size());
+  std::uninitialized_copy(v.begin(), v.end(), result.begin());
+  return result;
+}
+
+} // end namespace
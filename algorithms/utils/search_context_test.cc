@@ -0,0 +1,47 @@
+#include "algorithms/utils/search_context.h"
+
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+TEST(SearchContextTest, VisitedIsExactAcrossGrowth) {
+  search_context<unsigned int, float> ctx;
+  ctx.start(8, 16, 1);
+  std::set<unsigned int> expected;
+  for (unsigned int i = 0; i < 5000; i++) {
+    unsigned int a = (i * 7919) % 100000;
+    ctx.visit({a, (float) i});
+    expected.insert(a);
+  }
+  ctx.visit({7919, 0.0});  // already visited
+  EXPECT_EQ(ctx.visited.size(), expected.size());
+  for (unsigned int a = 0; a < 100000; a++)
+    EXPECT_EQ(ctx.was_visited(a), expected.count(a) == 1) << a;
+}
+
+TEST(SearchContextTest, StartForgetsEarlierSearches) {
+  search_context<unsigned int, float> ctx;
+  ctx.start(64, 16, 1);
+  for (unsigned int a = 0; a < 1000; a++) {
+    ctx.visit({a, 0.0});
+    ctx.has_been_seen(a);
+  }
+  ctx.start(64, 16, 1);
+  EXPECT_TRUE(ctx.visited.empty());
+  for (unsigned int a = 0; a < 1000; a++) {
+    EXPECT_FALSE(ctx.was_visited(a));
+    EXPECT_FALSE(ctx.maybe_seen(a));
+  }
+  EXPECT_FALSE(ctx.has_been_seen(5));
+  EXPECT_TRUE(ctx.has_been_seen(5));
+  ctx.visit({5, 1.0});
+  EXPECT_TRUE(ctx.was_visited(5));
+  EXPECT_FALSE(ctx.was_visited(6));
+}
+
+}  // namespace
+}  // namespace parlayANN
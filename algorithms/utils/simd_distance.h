@@ -0,0 +1,660 @@
+// This code is part of the Parlay Project
+// Copyright (c) 2024 Guy Blelloch, Magdalen Dobson and the Parlay team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef ALGORITHMS_ANN_SIMD_DISTANCE_H_
+#define ALGORITHMS_ANN_SIMD_DISTANCE_H_
+
+#include <cstdint>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PARLAYANN_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// Distance kernels used by Euclidian_Point and Mips_Point.
+//
+// Each kernel has a portable scalar version and, on x86, AVX2 and
+// AVX-512 versions (the byte kernels also have an AVX-512 VNNI
+// version).  The vector versions are compiled with per-function
+// target attributes, so the binary does not need to be built with
+// -march for the host.  The fastest version supported by the CPU is
+// picked once at startup from cpuid and called through the
+// simd::dispatch table.
+//
+// L2 kernels return the squared distance, dot kernels return the
+// inner product (callers negate it for mips).  Integer kernels
+// accumulate in 32 bits, as the scalar loops always have.
+//
+// The bit kernels serve the one and two bit sketches (Euclidean_Bit_Point,
+// the JL points, Mips_2Bit_Point...) used to filter candidates.
+// hamming counts the differing bits of two arrays of 64 bit words.
+// ternary takes blocks of two words, a sign word and a nonzero word, and
+// returns minus the inner product of the two {-1, 0, 1} vectors.  The
+// AVX2 versions count bits with byte shuffles (Harley-Seal for long
+// inputs), the AVX-512 versions use vpopcntq when the cpu has it.
+
+namespace parlayANN {
+namespace simd {
+
+// *************************************************************
+// Scalar kernels (also the reference for testing)
+// *************************************************************
+
+inline float l2_float_scalar(const float *p, const float *q, unsigned d) {
+  float result = 0.0;
+  for (unsigned i = 0; i < d; i++)
+    result += (q[i] - p[i]) * (q[i] - p[i]);
+  return result;
+}
+
+inline int32_t l2_uint8_scalar(const uint8_t *p, const uint8_t *q, unsigned d) {
+  int32_t result = 0;
+  for (unsigned i = 0; i < d; i++) {
+    int32_t diff = (int32_t) p[i] - (int32_t) q[i];
+    result += diff * diff;
+  }
+  return result;
+}
+
+inline int32_t l2_int8_scalar(const int8_t *p, const int8_t *q, unsigned d) {
+  int32_t result = 0;
+  for (unsigned i = 0; i < d; i++) {
+    int32_t diff = (int32_t) p[i] - (int32_t) q[i];
+    result += diff * diff;
+  }
+  return result;
+}
+
+inline float dot_float_scalar(const float *p, const float *q, unsigned d) {
+  float result = 0.0;
+  for (unsigned i = 0; i < d; i++)
+    result += q[i] * p[i];
+  return result;
+}
+
+inline int32_t dot_uint8_scalar(const uint8_t *p, const uint8_t *q, unsigned d) {
+  int32_t result = 0;
+  for (unsigned i = 0; i < d; i++)
+    result += (int32_t) p[i] * (int32_t) q[i];
+  return result;
+}
+
+inline int32_t dot_int8_scalar(const int8_t *p, const int8_t *q, unsigned d) {
+  int32_t result = 0;
+  for (unsigned i = 0; i < d; i++)
+    result += (int32_t) p[i] * (int32_t) q[i];
+  return result;
+}
+
+inline int32_t hamming_scalar(const uint64_t *p, const uint64_t *q, unsigned words) {
+  int32_t result = 0;
+  for (unsigned i = 0; i < words; i++)
+    result += __builtin_popcountll(p[i] ^ q[i]);
+  return result;
+}
+
+inline int32_t ternary_scalar(const uint64_t *p, const uint64_t *q, unsigned blocks) {
+  int32_t result = 0;
+  for (unsigned i = 0; i < blocks; i++) {
+    uint64_t not_zero = p[2 * i + 1] & q[2 * i + 1];
+    uint64_t negative = (p[2 * i] ^ q[2 * i]) & not_zero;
+    result += 2 * __builtin_popcountll(negative) - __builtin_popcountll(not_zero);
+  }
+  return result;
+}
+
+#ifdef PARLAYANN_SIMD_X86
+
+// *************************************************************
+// AVX2 kernels
+// *************************************************************
+
+__attribute__((target("avx2,fma")))
+inline float hsum_avx2(__m256 v) {
+  __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+  lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+  return _mm_cvtss_f32(lo);
+}
+
+__attribute__((target("avx2,fma")))
+inline int32_t hsum_avx2(__m256i v) {
+  __m128i lo = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+  lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(lo);
+}
+
+__attribute__((target("avx2,fma")))
+inline float l2_float_avx2(const float *p, const float *q, unsigned d) {
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  unsigned i = 0;
+  for (; i + 16 <= d; i += 16) {
+    __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(p + i), _mm256_loadu_ps(q + i));
+    __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(p + i + 8), _mm256_loadu_ps(q + i + 8));
+    sum0 = _mm256_fmadd_ps(d0, d0, sum0);
+    sum1 = _mm256_fmadd_ps(d1, d1, sum1);
+  }
+  if (i + 8 <= d) {
+    __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(p + i), _mm256_loadu_ps(q + i));
+    sum0 = _mm256_fmadd_ps(d0, d0, sum0);
+    i += 8;
+  }
+  float result = hsum_avx2(_mm256_add_ps(sum0, sum1));
+  for (; i < d; i++)
+    result += (q[i] - p[i]) * (q[i] - p[i]);
+  return result;
+}
+
+__attribute__((target("avx2,fma")))
+inline float dot_float_avx2(const float *p, const float *q, unsigned d) {
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  unsigned i = 0;
+  for (; i + 16 <= d; i += 16) {
+    sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(p + i), _mm256_loadu_ps(q + i), sum0);
+    sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(p + i + 8), _mm256_loadu_ps(q + i + 8), sum1);
+  }
+  if (i + 8 <= d) {
+    sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(p + i), _mm256_loadu_ps(q + i), sum0);
+    i += 8;
+  }
+  float result = hsum_avx2(_mm256_add_ps(sum0, sum1));
+  for (; i < d; i++)
+    result += q[i] * p[i];
+  return result;
+}
+
+// Byte kernels widen 16 bytes at a time to 16 bit lanes and use
+// madd to square-and-pair-add into 32 bit lanes.
+__attribute__((target("avx2,fma")))
+inline int32_t l2_uint8_avx2(const uint8_t *p, const uint8_t *q, unsigned d) {
+  __m256i sum = _mm256_setzero_si256();
+  unsigned i = 0;
+  for (; i + 16 <= d; i += 16) {
+    __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (p + i)));
+    __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (q + i)));
+    __m256i diff = _mm256_sub_epi16(a, b);
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(diff, diff));
+  }
+  int32_t result = hsum_avx2(sum);
+  for (; i < d; i++) {
+    int32_t diff = (int32_t) p[i] - (int32_t) q[i];
+    result += diff * diff;
+  }
+  return result;
+}
+
+__attribute__((target("avx2,fma")))
+inline int32_t l2_int8_avx2(const int8_t *p, const int8_t *q, unsigned d) {
+  __m256i sum = _mm256_setzero_si256();
+  unsigned i = 0;
+  for (; i + 16 <= d; i += 16) {
+    __m256i a = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (p + i)));
+    __m256i b = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (q + i)));
+    __m256i diff = _mm256_sub_epi16(a, b);
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(diff, diff));
+  }
+  int32_t result = hsum_avx2(sum);
+  for (; i < d; i++) {
+    int32_t diff = (int32_t) p[i] - (int32_t) q[i];
+    result += diff * diff;
+  }
+  return result;
+}
+
+__attribute__((target("avx2,fma")))
+inline int32_t dot_uint8_avx2(const uint8_t *p, const uint8_t *q, unsigned d) {
+  __m256i sum = _mm256_setzero_si256();
+  unsigned i = 0;
+  for (; i + 16 <= d; i += 16) {
+    __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (p + i)));
+    __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (q + i)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, b));
+  }
+  int32_t result = hsum_avx2(sum);
+  for (; i < d; i++)
+    result += (int32_t) p[i] * (int32_t) q[i];
+  return result;
+}
+
+__attribute__((target("avx2,fma")))
+inline int32_t dot_int8_avx2(const int8_t *p, const int8_t *q, unsigned d) {
+  __m256i sum = _mm256_setzero_si256();
+  unsigned i = 0;
+  for (; i + 16 <= d; i += 16) {
+    __m256i a = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (p + i)));
+    __m256i b = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (q + i)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, b));
+  }
+  int32_t result = hsum_avx2(sum);
+  for (; i < d; i++)
+    result += (int32_t) p[i] * (int32_t) q[i];
+  return result;
+}
+
+#define PARLAYANN_AVX2_POPCNT "avx2,fma,popcnt"
+
+// number of bits set in each 64 bit lane, counted per nibble with a
+// shuffle and summed with sad
+__attribute__((target(PARLAYANN_AVX2_POPCNT)))
+inline __m256i popcount_avx2(__m256i v) {
+  const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+  __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+__attribute__((target(PARLAYANN_AVX2_POPCNT)))
+inline int64_t hsum64_avx2(__m256i v) {
+  __m128i lo = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  return _mm_cvtsi128_si64(lo) + _mm_extract_epi64(lo, 1);
+}
+
+// carry-save adder: adds three bit vectors into a sum and a carry
+__attribute__((target(PARLAYANN_AVX2_POPCNT)))
+inline void csa_avx2(__m256i& carry, __m256i& sum, __m256i a, __m256i b, __m256i c) {
+  __m256i u = _mm256_xor_si256(a, b);
+  carry = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+  sum = _mm256_xor_si256(u, c);
+}
+
+__attribute__((target(PARLAYANN_AVX2_POPCNT)))
+inline __m256i xor_load_avx2(const uint64_t *p, const uint64_t *q, unsigned i) {
+  return _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (p + 4 * i)),
+                          _mm256_loadu_si256((const __m256i*) (q + 4 * i)));
+}
+
+// Harley-Seal: sixteen vectors at a time are reduced with carry-save
+// adders, so only one in sixteen needs a full population count
+__attribute__((target(PARLAYANN_AVX2_POPCNT)))
+inline int32_t hamming_avx2(const uint64_t *p, const uint64_t *q, unsigned words) {
+  __m256i total = _mm256_setzero_si256();
+  __m256i ones = total, twos = total, fours = total, eights = total, sixteens;
+  __m256i twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+  unsigned vecs = words / 4;
+  unsigned i = 0;
+  for (; i + 16 <= vecs; i += 16) {
+    csa_avx2(twos_a, ones, ones, xor_load_avx2(p, q, i), xor_load_avx2(p, q, i + 1));
+    csa_avx2(twos_b, ones, ones, xor_load_avx2(p, q, i + 2), xor_load_avx2(p, q, i + 3));
+    csa_avx2(fours_a, twos, twos, twos_a, twos_b);
+    csa_avx2(twos_a, ones, ones, xor_load_avx2(p, q, i + 4), xor_load_avx2(p, q, i + 5));
+    csa_avx2(twos_b, ones, ones, xor_load_avx2(p, q, i + 6), xor_load_avx2(p, q, i + 7));
+    csa_avx2(fours_b, twos, twos, twos_a, twos_b);
+    csa_avx2(eights_a, fours, fours, fours_a, fours_b);
+    csa_avx2(twos_a, ones, ones, xor_load_avx2(p, q, i + 8), xor_load_avx2(p, q, i + 9));
+    csa_avx2(twos_b, ones, ones, xor_load_avx2(p, q, i + 10), xor_load_avx2(p, q, i + 11));
+    csa_avx2(fours_a, twos, twos, twos_a, twos_b);
+    csa_avx2(twos_a, ones, ones, xor_load_avx2(p, q, i + 12), xor_load_avx2(p, q, i + 13));
+    csa_avx2(twos_b, ones, ones, xor_load_avx2(p, q, i + 14), xor_load_avx2(p, q, i + 15));
+    csa_avx2(fours_b, twos, twos, twos_a, twos_b);
+    csa_avx2(eights_b, fours, fours, fours_a, fours_b);
+    csa_avx2(sixteens, eights, eights, eights_a, eights_b);
+    total = _mm256_add_epi64(total, popcount_avx2(sixteens));
+  }
+  total = _mm256_slli_epi64(total, 4);
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount_avx2(eights), 3));
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount_avx2(fours), 2));
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount_avx2(twos), 1));
+  total = _mm256_add_epi64(total, popcount_avx2(ones));
+  for (; i < vecs; i++)
+    total = _mm256_add_epi64(total, popcount_avx2(xor_load_avx2(p, q, i)));
+  int32_t result = hsum64_avx2(total);
+  for (unsigned j = 4 * vecs; j < words; j++)
+    result += __builtin_popcountll(p[j] ^ q[j]);
+  return result;
+}
+
+// Two blocks per vector.  The nonzero words are swapped into the sign
+// lanes to mask the differing signs, so that even lanes count negative
+// products (weighted 2) and odd lanes nonzero products (weighted -1).
+__attribute__((target(PARLAYANN_AVX2_POPCNT)))
+inline int32_t ternary_avx2(const uint64_t *p, const uint64_t *q, unsigned blocks) {
+  const __m256i sign_lanes = _mm256_setr_epi64x(-1, 0, -1, 0);
+  __m256i total = _mm256_setzero_si256();
+  unsigned i = 0;
+  for (; i + 2 <= blocks; i += 2) {
+    __m256i a = _mm256_loadu_si256((const __m256i*) (p + 2 * i));
+    __m256i b = _mm256_loadu_si256((const __m256i*) (q + 2 * i));
+    __m256i not_zero = _mm256_and_si256(a, b);
+    __m256i swapped = _mm256_shuffle_epi32(not_zero, _MM_SHUFFLE(1, 0, 3, 2));
+    __m256i negative = _mm256_and_si256(_mm256_xor_si256(a, b), swapped);
+    __m256i counted = _mm256_or_si256(_mm256_and_si256(sign_lanes, negative),
+                                      _mm256_andnot_si256(sign_lanes, not_zero));
+    total = _mm256_add_epi64(total, popcount_avx2(counted));
+  }
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i*) lanes, total);
+  int32_t result = 2 * (lanes[0] + lanes[2]) - (lanes[1] + lanes[3]);
+  if (i < blocks)
+    result += ternary_scalar(p + 2 * i, q + 2 * i, 1);
+  return result;
+}
+
+// *************************************************************
+// AVX-512 kernels (tails are handled with masked loads)
+// *************************************************************
+
+#define PARLAYANN_AVX512 "avx512f,avx512bw,avx512vl,avx2,fma"
+#define PARLAYANN_AVX512_VNNI "avx512f,avx512bw,avx512vl,avx512vnni,avx2,fma"
+
+// horizontal sums (written with zero-masked extracts since gcc's
+// _mm512_reduce_add_* and 512->256 casts trip -Wuninitialized)
+__attribute__((target(PARLAYANN_AVX512)))
+inline float hsum_avx512(__m512 v) {
+  __m256 lo = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, _mm512_castps_pd(v), 0));
+  __m256 hi = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, _mm512_castps_pd(v), 1));
+  return hsum_avx2(_mm256_add_ps(lo, hi));
+}
+
+__attribute__((target(PARLAYANN_AVX512)))
+inline int32_t hsum_avx512(__m512i v) {
+  __m256i lo = _mm512_maskz_extracti64x4_epi64(0xFF, v, 0);
+  __m256i hi = _mm512_maskz_extracti64x4_epi64(0xFF, v, 1);
+  return hsum_avx2(_mm256_add_epi32(lo, hi));
+}
+
+__attribute__((target(PARLAYANN_AVX512)))
+inline float l2_float_avx512(const float *p, const float *q, unsigned d) {
+  __m512 sum0 = _mm512_setzero_ps();
+  __m512 sum1 = _mm512_setzero_ps();
+  unsigned i = 0;
+  for (; i + 32 <= d; i += 32) {
+    __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(p + i), _mm512_loadu_ps(q + i));
+    __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(p + i + 16), _mm512_loadu_ps(q + i + 16));
+    sum0 = _mm512_fmadd_ps(d0, d0, sum0);
+    sum1 = _mm512_fmadd_ps(d1, d1, sum1);
+  }
+  for (; i < d; i += 16) {
+    __mmask16 m = (d - i >= 16) ? (__mmask16) 0xFFFF : (__mmask16) ((1u << (d - i)) - 1);
+    __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, p + i), _mm512_maskz_loadu_ps(m, q + i));
+    sum0 = _mm512_fmadd_ps(d0, d0, sum0);
+  }
+  return hsum_avx512(_mm512_add_ps(sum0, sum1));
+}
+
+__attribute__((target(PARLAYANN_AVX512)))
+inline float dot_float_avx512(const float *p, const float *q, unsigned d) {
+  __m512 sum0 = _mm512_setzero_ps();
+  __m512 sum1 = _mm512_setzero_ps();
+  unsigned i = 0;
+  for (; i + 32 <= d; i += 32) {
+    sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(p + i), _mm512_loadu_ps(q + i), sum0);
+    sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(p + i + 16), _mm512_loadu_ps(q + i + 16), sum1);
+  }
+  for (; i < d; i += 16) {
+    __mmask16 m = (d - i >= 16) ? (__mmask16) 0xFFFF : (__mmask16) ((1u << (d - i)) - 1);
+    sum0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, p + i), _mm512_maskz_loadu_ps(m, q + i), sum0);
+  }
+  return hsum_avx512(_mm512_add_ps(sum0, sum1));
+}
+
+// loads 32 bytes (masked to the remaining length) widened to 16 bit lanes
+__attribute__((target(PARLAYANN_AVX512)))
+inline __m512i load_epu8_epi16(const uint8_t *p, unsigned remain) {
+  __mmask32 m = (remain >= 32) ? (__mmask32) 0xFFFFFFFF : (__mmask32) ((1u << remain) - 1);
+  return _mm512_cvtepu8_epi16(_mm256_maskz_loadu_epi8(m, p));
+}
+
+__attribute__((target(PARLAYANN_AVX512)))
+inline __m512i load_epi8_epi16(const int8_t *p, unsigned remain) {
+  __mmask32 m = (remain >= 32) ? (__mmask32) 0xFFFFFFFF : (__mmask32) ((1u << remain) - 1);
+  return _mm512_cvtepi8_epi16(_mm256_maskz_loadu_epi8(m, p));
+}
+
+__attribute__((target(PARLAYANN_AVX512)))
+inline int32_t l2_uint8_avx512(const uint8_t *p, const uint8_t *q, unsigned d) {
+  __m512i sum = _mm512_setzero_si512();
+  for (unsigned i = 0; i < d; i += 32) {
+    __m512i diff = _mm512_sub_epi16(load_epu8_epi16(p + i, d - i),
+                                    load_epu8_epi16(q + i, d - i));
+    sum = _mm512_add_epi32(sum, _mm512_madd_epi16(diff, diff));
+  }
+  return hsum_avx512(sum);
+}
+
+__attribute__((target(PARLAYANN_AVX512)))
+inline int32_t l2_int8_avx512(const int8_t *p, const int8_t *q, unsigned d) {
+  __m512i sum = _mm512_setzero_si512();
+  for (unsigned i = 0; i < d; i += 32) {
+    __m512i diff = _mm512_sub_epi16(load_epi8_epi16(p + i, d - i),
+                                    load_epi8_epi16(q + i, d - i));
+    sum = _mm512_add_epi32(sum, _mm512_madd_epi16(diff, diff));
+  }
+  return hsum_avx512(sum);
+}
+
+__attribute__((target(PARLAYANN_AVX512)))
+inline int32_t dot_uint8_avx512(const uint8_t *p, const uint8_t *q, unsigned d) {
+  __m512i sum = _mm512_setzero_si512();
+  for (unsigned i = 0; i < d; i += 32)
+    sum = _mm512_add_epi32(sum, _mm512_madd_epi16(load_epu8_epi16(p + i, d - i),
+                                                  load_epu8_epi16(q + i, d - i)));
+  return hsum_avx512(sum);
+}
+
+__attribute__((target(PARLAYANN_AVX512)))
+inline int32_t dot_int8_avx512(const int8_t *p, const int8_t *q, unsigned d) {
+  __m512i sum = _mm512_setzero_si512();
+  for (unsigned i = 0; i < d; i += 32)
+    sum = _mm512_add_epi32(sum, _mm512_madd_epi16(load_epi8_epi16(p + i, d - i),
+                                                  load_epi8_epi16(q + i, d - i)));
+  return hsum_avx512(sum);
+}
+
+// VNNI fuses the multiply, pair-add and accumulate into one
+// instruction (vpdpwssd).  We use the 16 bit form since differences
+// of bytes, and products of signed by signed bytes, do not fit the
+// unsigned-by-signed byte form (vpdpbusd).
+__attribute__((target(PARLAYANN_AVX512_VNNI)))
+inline int32_t l2_uint8_vnni(const uint8_t *p, const uint8_t *q, unsigned d) {
+  __m512i sum0 = _mm512_setzero_si512();
+  __m512i sum1 = _mm512_setzero_si512();
+  unsigned i = 0;
+  for (; i + 64 <= d; i += 64) {
+    __m512i d0 = _mm512_sub_epi16(load_epu8_epi16(p + i, 32), load_epu8_epi16(q + i, 32));
+    __m512i d1 = _mm512_sub_epi16(load_epu8_epi16(p + i + 32, 32), load_epu8_epi16(q + i + 32, 32));
+    sum0 = _mm512_dpwssd_epi32(sum0, d0, d0);
+    sum1 = _mm512_dpwssd_epi32(sum1, d1, d1);
+  }
+  for (; i < d; i += 32) {
+    __m512i d0 = _mm512_sub_epi16(load_epu8_epi16(p + i, d - i), load_epu8_epi16(q + i, d - i));
+    sum0 = _mm512_dpwssd_epi32(sum0, d0, d0);
+  }
+  return hsum_avx512(_mm512_add_epi32(sum0, sum1));
+}
+
+__attribute__((target(PARLAYANN_AVX512_VNNI)))
+inline int32_t l2_int8_vnni(const int8_t *p, const int8_t *q, unsigned d) {
+  __m512i sum0 = _mm512_setzero_si512();
+  __m512i sum1 = _mm512_setzero_si512();
+  unsigned i = 0;
+  for (; i + 64 <= d; i += 64) {
+    __m512i d0 = _mm512_sub_epi16(load_epi8_epi16(p + i, 32), load_epi8_epi16(q + i, 32));
+    __m512i d1 = _mm512_sub_epi16(load_epi8_epi16(p + i + 32, 32), load_epi8_epi16(q + i + 32, 32));
+    sum0 = _mm512_dpwssd_epi32(sum0, d0, d0);
+    sum1 = _mm512_dpwssd_epi32(sum1, d1, d1);
+  }
+  for (; i < d; i += 32) {
+    __m512i d0 = _mm512_sub_epi16(load_epi8_epi16(p + i, d - i), load_epi8_epi16(q + i, d - i));
+    sum0 = _mm512_dpwssd_epi32(sum0, d0, d0);
+  }
+  return hsum_avx512(_mm512_add_epi32(sum0, sum1));
+}
+
+__attribute__((target(PARLAYANN_AVX512_VNNI)))
+inline int32_t dot_uint8_vnni(const uint8_t *p, const uint8_t *q, unsigned d) {
+  __m512i sum0 = _mm512_setzero_si512();
+  __m512i sum1 = _mm512_setzero_si512();
+  unsigned i = 0;
+  for (; i + 64 <= d; i += 64) {
+    sum0 = _mm512_dpwssd_epi32(sum0, load_epu8_epi16(p + i, 32), load_epu8_epi16(q + i, 32));
+    sum1 = _mm512_dpwssd_epi32(sum1, load_epu8_epi16(p + i + 32, 32), load_epu8_epi16(q + i + 32, 32));
+  }
+  for (; i < d; i += 32)
+    sum0 = _mm512_dpwssd_epi32(sum0, load_epu8_epi16(p + i, d - i), load_epu8_epi16(q + i, d - i));
+  return hsum_avx512(_mm512_add_epi32(sum0, sum1));
+}
+
+__attribute__((target(PARLAYANN_AVX512_VNNI)))
+inline int32_t dot_int8_vnni(const int8_t *p, const int8_t *q, unsigned d) {
+  __m512i sum0 = _mm512_setzero_si512();
+  __m512i sum1 = _mm512_setzero_si512();
+  unsigned i = 0;
+  for (; i + 64 <= d; i += 64) {
+    sum0 = _mm512_dpwssd_epi32(sum0, load_epi8_epi16(p + i, 32), load_epi8_epi16(q + i, 32));
+    sum1 = _mm512_dpwssd_epi32(sum1, load_epi8_epi16(p + i + 32, 32), load_epi8_epi16(q + i + 32, 32));
+  }
+  for (; i < d; i += 32)
+    sum0 = _mm512_dpwssd_epi32(sum0, load_epi8_epi16(p + i, d - i), load_epi8_epi16(q + i, d - i));
+  return hsum_avx512(_mm512_add_epi32(sum0, sum1));
+}
+
+#define PARLAYANN_AVX512_VPOPCNT "avx512f,avx512bw,avx512vl,avx512vpopcntdq,avx2,fma,popcnt"
+
+__attribute__((target(PARLAYANN_AVX512_VPOPCNT)))
+inline int64_t hsum64_avx512(__m512i v) {
+  __m256i lo = _mm512_maskz_extracti64x4_epi64(0xFF, v, 0);
+  __m256i hi = _mm512_maskz_extracti64x4_epi64(0xFF, v, 1);
+  return hsum64_avx2(_mm256_add_epi64(lo, hi));
+}
+
+__attribute__((target(PARLAYANN_AVX512_VPOPCNT)))
+inline int32_t hamming_vpopcnt(const uint64_t *p, const uint64_t *q, unsigned words) {
+  __m512i total0 = _mm512_setzero_si512();
+  __m512i total1 = _mm512_setzero_si512();
+  unsigned i = 0;
+  for (; i + 16 <= words; i += 16) {
+    total0 = _mm512_add_epi64(total0, _mm512_popcnt_epi64(
+        _mm512_xor_si512(_mm512_loadu_si512(p + i), _mm512_loadu_si512(q + i))));
+    total1 = _mm512_add_epi64(total1, _mm512_popcnt_epi64(
+        _mm512_xor_si512(_mm512_loadu_si512(p + i + 8), _mm512_loadu_si512(q + i + 8))));
+  }
+  for (; i < words; i += 8) {
+    __mmask8 m = (words - i >= 8) ? (__mmask8) 0xFF : (__mmask8) ((1u << (words - i)) - 1);
+    __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi64(m, p + i),
+                                 _mm512_maskz_loadu_epi64(m, q + i));
+    total0 = _mm512_add_epi64(total0, _mm512_popcnt_epi64(x));
+  }
+  return hsum64_avx512(_mm512_add_epi64(total0, total1));
+}
+
+// four blocks per vector, lanes as in ternary_avx2
+__attribute__((target(PARLAYANN_AVX512_VPOPCNT)))
+inline int32_t ternary_vpopcnt(const uint64_t *p, const uint64_t *q, unsigned blocks) {
+  __m512i total = _mm512_setzero_si512();
+  unsigned words = 2 * blocks;
+  for (unsigned i = 0; i < words; i += 8) {
+    __mmask8 m = (words - i >= 8) ? (__mmask8) 0xFF : (__mmask8) ((1u << (words - i)) - 1);
+    __m512i a = _mm512_maskz_loadu_epi64(m, p + i);
+    __m512i b = _mm512_maskz_loadu_epi64(m, q + i);
+    __m512i not_zero = _mm512_and_si512(a, b);
+    __m512i swapped = _mm512_shuffle_epi32(not_zero, _MM_PERM_BADC);
+    __m512i negative = _mm512_and_si512(_mm512_xor_si512(a, b), swapped);
+    __m512i counted = _mm512_mask_blend_epi64(0x55, not_zero, negative);
+    total = _mm512_add_epi64(total, _mm512_popcnt_epi64(counted));
+  }
+  return 2 * hsum64_avx512(_mm512_maskz_mov_epi64(0x55, total))
+    - hsum64_avx512(_mm512_maskz_mov_epi64(0xAA, total));
+}
+
+#endif // PARLAYANN_SIMD_X86
+
+// *************************************************************
+// Dispatch
+// *************************************************************
+
+enum class simd_level {scalar = 0, avx2 = 1, avx512 = 2, avx512_vnni = 3};
+
+struct kernels {
+  simd_level level;
+  const char* name;
+  float (*l2_float)(const float*, const float*, unsigned);
+  int32_t (*l2_uint8)(const uint8_t*, const uint8_t*, unsigned);
+  int32_t (*l2_int8)(const int8_t*, const int8_t*, unsigned);
+  float (*dot_float)(const float*, const float*, unsigned);
+  int32_t (*dot_uint8)(const uint8_t*, const uint8_t*, unsigned);
+  int32_t (*dot_int8)(const int8_t*, const int8_t*, unsigned);
+  int32_t (*hamming)(const uint64_t*, const uint64_t*, unsigned);
+  int32_t (*ternary)(const uint64_t*, const uint64_t*, unsigned);
+};
+
+// best level supported by the cpu we are running on
+inline simd_level detect_simd_level() {
+#ifdef PARLAYANN_SIMD_X86
+  __builtin_cpu_init();
+  bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  bool avx512 = avx2 && __builtin_cpu_supports("avx512f") &&
+    __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+  if (avx512 && __builtin_cpu_supports("avx512vnni")) return simd_level::avx512_vnni;
+  if (avx512) return simd_level::avx512;
+  if (avx2) return simd_level::avx2;
+#endif
+  return simd_level::scalar;
+}
+
+// kernels for a given level, which must be supported by the cpu
+inline kernels select_kernels(simd_level level) {
+  kernels k = {simd_level::scalar, "scalar",
+               l2_float_scalar, l2_uint8_scalar, l2_int8_scalar,
+               dot_float_scalar, dot_uint8_scalar, dot_int8_scalar,
+               hamming_scalar, ternary_scalar};
+#ifdef PARLAYANN_SIMD_X86
+  if (level >= simd_level::avx2)
+    k = {simd_level::avx2, "avx2",
+         l2_float_avx2, l2_uint8_avx2, l2_int8_avx2,
+         dot_float_avx2, dot_uint8_avx2, dot_int8_avx2,
+         hamming_avx2, ternary_avx2};
+  if (level >= simd_level::avx512) {
+    k = {simd_level::avx512, "avx512",
+         l2_float_avx512, l2_uint8_avx512, l2_int8_avx512,
+         dot_float_avx512, dot_uint8_avx512, dot_int8_avx512,
+         hamming_avx2, ternary_avx2};
+    // vpopcntq is not part of every avx512 cpu (e.g. not of Skylake-X)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vpopcntdq")) {
+      k.hamming = hamming_vpopcnt;
+      k.ternary = ternary_vpopcnt;
+    }
+  }
+  if (level >= simd_level::avx512_vnni) {
+    k.level = simd_level::avx512_vnni;
+    k.name = "avx512_vnni";
+    k.l2_uint8 = l2_uint8_vnni;
+    k.l2_int8 = l2_int8_vnni;
+    k.dot_uint8 = dot_uint8_vnni;
+    k.dot_int8 = dot_int8_vnni;
+  }
+#endif
+  return k;
+}
+
+// the table used by all point types, filled in once at startup
+inline const kernels dispatch = select_kernels(detect_simd_level());
+
+} // end namespace simd
+} // end namespace parlayANN
+
+#endif // ALGORITHMS_ANN_SIMD_DISTANCE_H_
@@ -0,0 +1,113 @@
+#include "algorithms/utils/simd_distance.h"
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+namespace {
+
+using simd::simd_level;
+
+// every level the current cpu can run
+std::vector<simd_level> SupportedLevels() {
+  std::vector<simd_level> levels;
+  for (int l = 0; l <= (int) simd::detect_simd_level(); l++)
+    levels.push_back((simd_level) l);
+  return levels;
+}
+
+template <typename T>
+std::vector<T> RandomVector(std::mt19937& rng, unsigned d) {
+  std::vector<T> v(d);
+  if constexpr (std::is_floating_point_v<T>) {
+    std::uniform_real_distribution<float> dist(-1.0, 1.0);
+    for (auto& x : v) x = dist(rng);
+  } else {
+    std::uniform_int_distribution<int> dist(std::numeric_limits<T>::min(),
+                                            std::numeric_limits<T>::max());
+    for (auto& x : v) x = (T) dist(rng);
+  }
+  return v;
+}
+
+TEST(SimdDistanceTest, DispatchMatchesDetectedLevel) {
+  EXPECT_EQ(simd::dispatch.level, simd::detect_simd_level());
+}
+
+TEST(SimdDistanceTest, ByteKernelsMatchScalar) {
+  std::mt19937 rng(1);
+  for (simd_level level : SupportedLevels()) {
+    simd::kernels k = simd::select_kernels(level);
+    for (unsigned d = 0; d < 300; d++) {
+      auto pu = RandomVector<uint8_t>(rng, d);
+      auto qu = RandomVector<uint8_t>(rng, d);
+      auto pi = RandomVector<int8_t>(rng, d);
+      auto qi = RandomVector<int8_t>(rng, d);
+      EXPECT_EQ(k.l2_uint8(pu.data(), qu.data(), d),
+                simd::l2_uint8_scalar(pu.data(), qu.data(), d)) << k.name << " d=" << d;
+      EXPECT_EQ(k.l2_int8(pi.data(), qi.data(), d),
+                simd::l2_int8_scalar(pi.data(), qi.data(), d)) << k.name << " d=" << d;
+      EXPECT_EQ(k.dot_uint8(pu.data(), qu.data(), d),
+                simd::dot_uint8_scalar(pu.data(), qu.data(), d)) << k.name << " d=" << d;
+      EXPECT_EQ(k.dot_int8(pi.data(), qi.data(), d),
+                simd::dot_int8_scalar(pi.data(), qi.data(), d)) << k.name << " d=" << d;
+    }
+  }
+}
+
+TEST(SimdDistanceTest, FloatKernelsMatchScalar) {
+  std::mt19937 rng(2);
+  for (simd_level level : SupportedLevels()) {
+    simd::kernels k = simd::select_kernels(level);
+    for (unsigned d = 0; d < 300; d++) {
+      auto p = RandomVector<float>(rng, d);
+      auto q = RandomVector<float>(rng, d);
+      float tol = 1e-4 * (d + 1);
+      EXPECT_NEAR(k.l2_float(p.data(), q.data(), d),
+                  simd::l2_float_scalar(p.data(), q.data(), d), tol) << k.name << " d=" << d;
+      EXPECT_NEAR(k.dot_float(p.data(), q.data(), d),
+                  simd::dot_float_scalar(p.data(), q.data(), d), tol) << k.name << " d=" << d;
+    }
+  }
+}
+
+TEST(SimdDistanceTest, BitKernelsMatchScalar) {
+  std::mt19937_64 rng(3);
+  for (simd_level level : SupportedLevels()) {
+    simd::kernels k = simd::select_kernels(level);
+    // long enough for several rounds of Harley-Seal
+    for (unsigned words = 0; words < 300; words++) {
+      std::vector<uint64_t> p(words), q(words);
+      for (auto& x : p) x = rng();
+      for (auto& x : q) x = rng();
+      EXPECT_EQ(k.hamming(p.data(), q.data(), words),
+                simd::hamming_scalar(p.data(), q.data(), words)) << k.name << " words=" << words;
+      EXPECT_EQ(k.ternary(p.data(), q.data(), words / 2),
+                simd::ternary_scalar(p.data(), q.data(), words / 2)) << k.name << " words=" << words;
+    }
+  }
+}
+
+TEST(SimdDistanceTest, TernaryIsNegatedInnerProduct) {
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> value(-1, 1);
+  for (unsigned blocks = 1; blocks < 5; blocks++) {
+    std::vector<uint64_t> p(2 * blocks, 0), q(2 * blocks, 0);
+    int dot = 0;
+    for (unsigned j = 0; j < 64 * blocks; j++) {
+      int a = value(rng), b = value(rng);
+      dot += a * b;
+      uint64_t bit = 1ul << (j % 64);
+      if (a != 0) p[2 * (j / 64) + 1] |= bit;
+      if (a > 0) p[2 * (j / 64)] |= bit;
+      if (b != 0) q[2 * (j / 64) + 1] |= bit;
+      if (b > 0) q[2 * (j / 64)] |= bit;
+    }
+    EXPECT_EQ(simd::ternary_scalar(p.data(), q.data(), blocks), -dot);
+  }
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "algorithms/utils/point_range.h"
+#include <gtest/gtest.h>
+
+namespace parlayANN {
+
+// Random points for tests: n points of dimension d drawn from dist,
+// written in .fbin format to a temporary file and loaded from it.
+template <typename Point, typename Dist>
+PointRange<Point> RandomPoints(size_t n, unsigned int d, unsigned seed, Dist dist) {
+  std::mt19937 rng(seed);
+  std::vector<float> data(n * d);
+  for (auto& x : data) x = dist(rng);
+  std::string path = testing::TempDir() + "/random_points_" + std::to_string(seed) +
+    "_" + std::to_string(n) + "_" + std::to_string(d) + ".fbin";
+  std::ofstream writer(path, std::ios::binary);
+  unsigned int num_points = n;
+  writer.write((char*) &num_points, sizeof(unsigned int));
+  writer.write((char*) &d, sizeof(unsigned int));
+  writer.write((char*) data.data(), data.size() * sizeof(float));
+  writer.close();
+  PointRange<Point> Points(path.data());
+  std::remove(path.c_str());
+  return Points;
+}
+
+// as above, uniform in [-1, 1]
+template <typename Point>
+PointRange<Point> RandomPoints(size_t n, unsigned int d, unsigned seed) {
+  return RandomPoints<Point>(n, d, seed, std::uniform_real_distribution<float>(-1.0, 1.0));
+}
+
+}  // namespace parlayANN
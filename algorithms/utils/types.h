@@ -28,13 +28,25 @@
 
 #include <algorithm>
 #include <fstream>
+#include <memory>
+#include <string>
+#include <type_traits>
 
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "mmap.h"
+#include "quantile.h"
 
 namespace parlayANN {
 
+// The name of a coordinate type (e.g. "uint8" or "float32"), used in
+// the type tags of the point types.
+template<typename T>
+std::string scalar_type_tag() {
+  std::string kind = std::is_floating_point_v<T> ? "float" : std::is_signed_v<T> ? "int" : "uint";
+  return kind + std::to_string(8 * sizeof(T));
+}
+
 template<typename T>
 struct groundTruth{
   parlay::slice<T*, T*> coords;
@@ -163,10 +175,12 @@ struct BuildParams{
   long MST_deg; //HCNNG
 
   double delta; //pyNNDescent
+  long prune_degree = 0; // HCNNG and pyNNDescent: degree to prune the graph to, see prune.h (0 = no pruning)
+  double prune_alpha = 1.2; // HCNNG and pyNNDescent: alpha of the pruning
   
   bool verbose;
 
-  int quantize = 0; // use quantization for build and query (0 = none, 1 = one-level, 2 = two-level)
+  int quantize = 0; // use quantization for build and query (0 = none, 1 = one-level, 2 = two-level, 6/7 = 8/4 bit product quantization)
   double radius; // for radius search
   double radius_2; // for radius search
   bool self;
@@ -175,6 +189,22 @@ struct BuildParams{
   long Q = 0; //beam width to pass onto query (0 indicates none specified)
   double trim = 0.0; // for quantization
   double rerank_factor = 100; // for reranking, k * factor = to rerank
+  long batch_size = 0; // queries per batch during search (0 indicates no batching)
+  int prefetch_depth = 0; // lookahead of software prefetching during search
+  int pq_bytes = 0; // bytes per point for product quantization (0 = default)
+  long concurrency = 0; // searches in flight when measuring latency (0 = all workers)
+  double arrival_rate = 0; // queries per second of the open loop latency benchmark (0 = closed loop)
+  bool latency = false; // report per-query latency percentiles
+  long patience = 0; // adaptive termination of searches, see QueryParams (0 = off)
+  double stop_ratio = 0; // adaptive termination of searches, see QueryParams (0 = off)
+  double stop_agreement = 0; // calibrate stop_ratio to keep this fraction of the top k (0 = off)
+  long entry_points = 0; // size of the routing layer of entry points, see entry_points.h (0 = none)
+  long entry_seeds = 4; // entry points each search starts from, if there are any
+  std::string start_point = "medoid"; // vamana start point: "0" (the default before it was chosen), "medoid" or "centroid", see entry_points.h
+  bool compare_start = false; // also search from vertex 0 and report the visits the start point saves
+  std::string quantized_path; // prefix of saved quantized points (empty = do not save)
+  long quantile_sample = default_quantile_sample; // coordinates sampled for quantile based quantization
+  std::string id_map; // original ids of reordered points, given to results (empty = none, see reorder.h)
 
   std::string alg_type;
 
@@ -223,6 +253,15 @@ struct QueryParams{
   long degree_limit;
   int rerank_factor = 100;
   float pad = 1.0;
+  long batch_size = 0; // queries searched together by batched_beam_search (0 = one at a time)
+  int prefetch_depth = 0; // frontier nodes ahead of the current one to prefetch (0 = none)
+  long beam_width = 1; // nodes read from disk together by disk_beam_search
+  bool latency = false; // time each query under the load below (see latency_bench.h)
+  long concurrency = 0; // queries in flight in the closed loop (0 = one per worker)
+  double arrival_rate = 0; // arrivals per second in the open loop (0 = closed loop)
+  long patience = 0; // stop once the top k is unchanged for this many visits (0 = never)
+  double stop_ratio = 0; // stop once the next visit is further than this times the kth distance (0 = never)
+  long entry_seeds = 0; // start from this many of the entry points nearest the query (0 = the start point)
 
   QueryParams(long k, long Q, double cut, long limit, long dg, double rerank_factor = 100) : k(k), beamSize(Q), cut(cut), limit(limit), degree_limit(dg), rerank_factor(rerank_factor) {}
 
@@ -25,8 +25,11 @@
 #include <math.h>
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
 #include <random>
 #include <set>
+#include <vector>
 
 #include "../utils/point_range.h"
 #include "../utils/graph.h"
@@ -36,6 +39,9 @@
 #include "parlay/delayed.h"
 #include "parlay/random.h"
 #include "../utils/beamSearch.h"
+#include "../utils/entry_points.h"
+#include "../utils/labels.h"
+#include "../utils/prune.h"
 
 namespace parlayANN {
 
@@ -50,73 +56,57 @@ struct knn_index {
   using GraphI = Graph<indexType>;
 
   BuildParams BP;
-  std::set<indexType> delete_set;
-  indexType start_point;
+  std::set<indexType> delete_set; // deleted since the last consolidate_deletes
+  // Tombstones, indexed by point id.  Growing them makes a new array,
+  // so that a search running during an insert keeps the one it started
+  // with (see search).
+  using tombstones = std::vector<std::atomic<bool>>;
+  std::shared_ptr<tombstones> deleted = std::make_shared<tombstones>();
+  indexType start_point = 0;
+  const point_labels<indexType>* labels = nullptr; // if set, the graph is built and searched by label
+  parlay::sequence<indexType> label_starts; // start point of each label
+  parlay::sequence<indexType> entry_points; // routing layer, see entry_points.h (empty if none)
 
   knn_index(BuildParams &BP) : BP(BP) {}
 
+  // Builds the graph as in Filtered-DiskANN: each point is inserted by
+  // a search that only walks through points sharing one of its labels,
+  // and pruning keeps an edge unless a closer point carries all the
+  // labels of both its ends, so that the points with any one label
+  // stay connected.  Points that share no label are then rarely linked,
+  // so searches without labels need a graph built without them.  Must
+  // be set before build_index.
+  void set_labels(const point_labels<indexType> &L) {labels = &L;}
+
   indexType get_start() { return start_point; }
 
-  //robustPrune routine as found in DiskANN paper, with the exception
-  //that the new candidate set is added to the field new_nbhs instead
-  //of directly replacing the out_nbh of p
+  // the points a search for q starts from
+  parlay::sequence<indexType> get_starts(const Point &q, PR &Points) {
+    if (entry_points.size() > 0 && BP.entry_seeds > 0)
+      return nearest_entry_points(q, Points, entry_points, BP.entry_seeds);
+    return parlay::sequence<indexType>({start_point});
+  }
+
+  //robustPrune routine as found in DiskANN paper (see alpha_prune in
+  //prune.h), with the exception that the new candidate set is returned
+  //instead of directly replacing the out_nbh of p.  With add, the
+  //current out neighbors of p are candidates too.
   std::pair<parlay::sequence<indexType>, long>
   robustPrune(indexType p, parlay::sequence<pid>& cand,
               GraphI &G, PR &Points, double alpha, bool add = true) {
-    // add out neighbors of p to the candidate set.
-    size_t out_size = G[p].size();
-    std::vector<pid> candidates;
+    parlay::sequence<pid> candidates = cand;
     long distance_comps = 0;
-    for (auto x : cand) candidates.push_back(x);
-
-    if(add){
-      for (size_t i=0; i<out_size; i++) {
-        distance_comps++;
-        candidates.push_back(std::make_pair(G[p][i], Points[G[p][i]].distance(Points[p])));
-      }
-    }
-
-    // Sort the candidate set according to distance from p
-    auto less = [&](std::pair<indexType, distanceType> a, std::pair<indexType, distanceType> b) {
-      return a.second < b.second || (a.second == b.second && a.first < b.first);
-    };
-    std::sort(candidates.begin(), candidates.end(), less);
-
-    // remove any duplicates
-    auto new_end =std::unique(candidates.begin(), candidates.end(),
-			      [&] (auto x, auto y) {return x.first == y.first;});
-    candidates = std::vector(candidates.begin(), new_end);
-
-    std::vector<indexType> new_nbhs;
-    new_nbhs.reserve(BP.R);
-
-    size_t candidate_idx = 0;
-
-    while (new_nbhs.size() < BP.R && candidate_idx < candidates.size()) {
-      // Don't need to do modifications.
-      int p_star = candidates[candidate_idx].first;
-      candidate_idx++;
-      if (p_star == p || p_star == -1) {
-        continue;
-      }
-
-      new_nbhs.push_back(p_star);
-
-      for (size_t i = candidate_idx; i < candidates.size(); i++) {
-        int p_prime = candidates[i].first;
-        if (p_prime != -1) {
-          distance_comps++;
-          distanceType dist_starprime = Points[p_star].distance(Points[p_prime]);
-          distanceType dist_pprime = candidates[i].second;
-          if (alpha * dist_starprime <= dist_pprime) {
-            candidates[i].first = -1;
-          }
-        }
-      }
+    if (add) {
+      auto out = distances_from(Points, p, G[p]);
+      distance_comps += out.size();
+      candidates.append(out);
     }
-
-    auto new_neighbors_seq = parlay::to_sequence(new_nbhs);
-    return std::pair(new_neighbors_seq, distance_comps);
+    // with labels, p* only occludes p' if it carries the labels of both p and p'
+    auto can_occlude = [&] (indexType p_star, indexType p_prime) {
+      return labels == nullptr || labels->covers(p_star, p, p_prime);};
+    auto new_nbhs = alpha_prune(Points, p, std::move(candidates), BP.R, alpha,
+                                can_occlude, &distance_comps);
+    return std::pair(new_nbhs, distance_comps);
   }
 
   //wrapper to allow calling robustPrune on a sequence of candidates
@@ -124,16 +114,9 @@ struct knn_index {
   std::pair<parlay::sequence<indexType>, long>
   robustPrune(indexType p, parlay::sequence<indexType> candidates,
               GraphI &G, PR &Points, double alpha, bool add = true){
-
-    parlay::sequence<pid> cc;
-    long distance_comps = 0;
-    cc.reserve(candidates.size()); // + size_of(p->out_nbh));
-    for (size_t i=0; i<candidates.size(); ++i) {
-      distance_comps++;
-      cc.push_back(std::make_pair(candidates[i], Points[candidates[i]].distance(Points[p])));
-    }
+    auto cc = distances_from(Points, p, candidates);
     auto [ngh_seq, dc] = robustPrune(p, cc, G, Points, alpha, add);
-    return std::pair(ngh_seq, dc + distance_comps);
+    return std::pair(ngh_seq, dc + (long) candidates.size());
   }
 
   // add ngh to candidates without adding any repeats
@@ -145,12 +128,34 @@ struct knn_index {
       if (a.count(ngh[i]) == 0) candidates.push_back(ngh[i]);
   }
 
+  // for an index built by inserts, which must begin with point 0
   void set_start(){start_point = 0;}
 
+  // chooses the start point by BP.start_point, and records it in G
+  void set_start(GraphI &G, PR &Points){
+    parlay::internal::timer t;
+    start_point = global_start_point<indexType>(Points, BP.start_point);
+    G.set_start_point(start_point);
+    std::cout << "Start point (" << BP.start_point << "): " << start_point
+              << ", found in " << t.next_time() << " seconds" << std::endl;
+  }
+
   void build_index(GraphI &G, PR &Points, QPR &QPoints,
                    stats<indexType> &BuildStats, bool sort_neighbors = true){
     std::cout << "Building graph..." << std::endl;
-    set_start();
+    set_start(G, Points);
+    if (labels != nullptr) {
+      if (labels->size() != Points.size()) {
+        std::cout << "ERROR: " << labels->size() << " labels given for "
+                  << Points.size() << " points" << std::endl;
+        abort();
+      }
+      label_starts = label_start_points(*labels, Points);
+    }
+    if (BP.entry_points > 0) {
+      entry_points = build_entry_points<indexType>(Points, BP.entry_points);
+      std::cout << "Routing layer of " << entry_points.size() << " entry points" << std::endl;
+    }
     parlay::sequence<indexType> inserts = parlay::tabulate(Points.size(), [&] (size_t i){
       return static_cast<indexType>(i);});
     if (BP.single_batch != 0) {
@@ -248,15 +253,35 @@ struct knn_index {
         size_t index = shuffled_inserts[i];
         int sp = BP.single_batch ? i : start_point;
         QueryParams QP((long) 0, BP.L, (double) 0.0, (long) Points.size(), (long) G.max_degree());
-        auto [visited, bs_distance_comps] =
-          //beam_search<Point, PointRange, indexType>(Points[index], G, Points, sp, QP);
-          beam_search_rerank__<Point, QPoint, PR, QPR, indexType>(Points[index],
-                                                                 QPoints[index],
-                                                                 G,
-                                                                 Points,
-                                                                 QPoints,
-                                                                 sp,
-                                                                 QP);
+        parlay::sequence<pid> visited;
+        size_t bs_distance_comps;
+        bool use_rerank = (Points.params.num_bytes() != QPoints.params.num_bytes());
+        parlay::sequence<indexType> starts;
+        if (labels != nullptr)
+          for (auto l : labels->labels(index))
+            if (label_starts[l] != std::numeric_limits<indexType>::max())
+              starts.push_back(label_starts[l]);
+        if (starts.size() > 0) {
+          // start from the start points of its labels and only walk
+          // through points sharing one of them
+          auto keep = [&] (indexType a) {return labels->share_label(index, a);};
+          auto [pairElts, dc] = filtered_beam_search(G, Points[index], Points,
+                                                     QPoints[index], QPoints,
+                                                     starts, QP, use_rerank, keep);
+          visited = std::move(pairElts.second);
+          bs_distance_comps = dc;
+        } else {
+          // start from the entry points nearest to it, if there are any
+          bool seeded = entry_points.size() > 0 && BP.entry_seeds > 0 && BP.single_batch == 0;
+          if (seeded)
+            starts = nearest_entry_points(Points[index], Points, entry_points, BP.entry_seeds);
+          else starts = {(indexType) sp};
+          auto [pairElts, dc] = filtered_beam_search(G, Points[index], Points,
+                                                     QPoints[index], QPoints,
+                                                     starts, QP, use_rerank);
+          visited = std::move(pairElts.second);
+          bs_distance_comps = dc + (seeded ? entry_points.size() : 0);
+        }
         BuildStats.increment_dist(index, bs_distance_comps);
         BuildStats.increment_visited(index, visited.size());
 
@@ -315,6 +340,180 @@ struct knn_index {
     t_prune.total();
   }
 
+  bool is_deleted(indexType p) const {
+    return is_deleted(*std::atomic_load(&deleted), p);
+  }
+
+  static bool is_deleted(const tombstones& dead, indexType p) {
+    return p < dead.size() && dead[p].load(std::memory_order_relaxed);
+  }
+
+  // grows the tombstones geometrically to cover n points
+  void grow_tombstones(size_t n) {
+    size_t old_n = deleted->size();
+    if (old_n >= n) return;
+    auto grown = std::make_shared<tombstones>(std::max(n, old_n + old_n / 2));
+    for (size_t i = 0; i < grown->size(); i++)
+      (*grown)[i].store(i < old_n && (*deleted)[i].load(), std::memory_order_relaxed);
+    std::atomic_store(&deleted, std::move(grown));
+  }
+
+  // Inserts new points into an existing index.  The points must
+  // already have been appended to Points (and QPoints, if different),
+  // and the graph is grown to match.  Passing the ids of all points to
+  // an empty index builds it from scratch.
+  void insert(parlay::sequence<indexType> inserts,
+              GraphI &G, PR &Points, QPR &QPoints, bool print = false) {
+    if (Points.size() > G.size()) G.resize(Points.size());
+    grow_tombstones(G.size());
+    if (labels != nullptr) {
+      // labels first seen here start at the first point carrying them
+      label_starts.resize(labels->num_labels, std::numeric_limits<indexType>::max());
+      for (indexType p : inserts)
+        for (auto l : labels->labels(p))
+          if (label_starts[l] == std::numeric_limits<indexType>::max()) label_starts[l] = p;
+    }
+    stats<indexType> InsertStats(G.size());
+    batch_insert(inserts, G, Points, QPoints, InsertStats, BP.alpha, true, 2, .02, print);
+  }
+
+  // Marks points as deleted.  Deleted points are still used to
+  // navigate the graph but are not returned by search, and are
+  // removed from the graph by the next call to consolidate_deletes.
+  // Only the search methods below skip them: searching G directly
+  // (beam_search, searchAll and the benchmark code) can return deleted
+  // points until they are consolidated.
+  void lazy_delete(const parlay::sequence<indexType> &deletes, GraphI &G) {
+    grow_tombstones(G.size());
+    tombstones& dead = *deleted;
+    for (indexType p : deletes) {
+      if (p >= G.size()) {
+        std::cout << "ERROR: invalid point " << p << " given to lazy_delete" << std::endl;
+        abort();
+      }
+      if (dead[p].load(std::memory_order_relaxed)) continue;
+      dead[p].store(true, std::memory_order_relaxed);
+      delete_set.insert(p);
+    }
+  }
+
+  // Removes the points deleted since the last call from the graph, as
+  // in FreshDiskANN: each remaining vertex with an edge to a deleted
+  // vertex replaces that edge with the deleted vertex's out-neighbors,
+  // and the result is pruned back to the degree bound with robustPrune.
+  void consolidate_deletes(GraphI &G, PR &Points) {
+    if (delete_set.empty()) return;
+    parlay::internal::timer t("consolidate time");
+    auto dead = [&, &tomb = *deleted] (indexType v) {return is_deleted(tomb, v);};
+
+    // move the start point off a deleted vertex
+    if (dead(start_point)) {
+      auto ngh = G[start_point];
+      auto live = std::find_if(ngh.begin(), ngh.end(), [&] (indexType v) {
+        return !dead(v);});
+      if (live != ngh.end()) start_point = *live;
+      else {
+        auto all_live = parlay::filter(parlay::iota<indexType>(G.size()), [&] (indexType v) {
+          return !dead(v);});
+        if (all_live.size() == 0) {
+          std::cout << "ERROR: consolidate_deletes cannot delete every point" << std::endl;
+          abort();
+        }
+        start_point = all_live[0];
+      }
+      G.set_start_point(start_point);
+    }
+
+    // and the entry points onto live neighbors (dropping those with none)
+    entry_points = parlay::remove_duplicates(parlay::filter(
+      parlay::map(entry_points, [&] (indexType e) {
+        if (!dead(e)) return e;
+        for (indexType v : G[e]) if (!dead(v)) return v;
+        return e;}),
+      [&] (indexType e) {return !dead(e);}));
+
+    // and the label start points onto live points carrying the label
+    if (labels != nullptr) {
+      parlay::parallel_for(0, label_starts.size(), [&] (size_t l) {
+        if (dead(label_starts[l])) {
+          auto pts = labels->points_with(l);
+          auto live = std::find_if(pts.begin(), pts.end(), [&] (indexType v) {
+            return !dead(v);});
+          label_starts[l] = (live == pts.end()) ? std::numeric_limits<indexType>::max() : *live;
+        }
+      });
+    }
+
+    auto affected = parlay::filter(parlay::iota<indexType>(G.size()), [&] (indexType v) {
+      if (dead(v)) return false;
+      for (indexType u : G[v]) if (dead(u)) return true;
+      return false;
+    });
+
+    parlay::sequence<parlay::sequence<indexType>> new_out(affected.size());
+    parlay::parallel_for(0, affected.size(), [&] (size_t i) {
+      indexType v = affected[i];
+      parlay::sequence<indexType> candidates;
+      for (indexType u : G[v]) {
+        if (!dead(u)) candidates.push_back(u);
+        else for (indexType w : G[u])
+               if (w != v && !dead(w)) candidates.push_back(w);
+      }
+      candidates = parlay::remove_duplicates(candidates);
+      if (candidates.size() <= BP.R) new_out[i] = std::move(candidates);
+      else new_out[i] = robustPrune(v, std::move(candidates), G, Points, BP.alpha, false).first;
+    });
+
+    parlay::parallel_for(0, affected.size(), [&] (size_t i) {
+      G[affected[i]].update_neighbors(new_out[i]);});
+    for (indexType p : delete_set) G[p].clear_neighbors();
+    std::cout << "consolidated " << delete_set.size() << " deletes, updating "
+              << affected.size() << " vertices" << std::endl;
+    delete_set.clear();
+    t.total();
+  }
+
+  // Beam search that does not return deleted points.  When deleted
+  // points crowd live ones out of the results, the search is repeated
+  // with k and the beam widened by the number of deleted points found,
+  // until there are k live results or the beam covers the graph.
+  // If G has concurrent reads enabled, the search goes through a
+  // concurrent_reader, so it can run while points are inserted.
+  parlay::sequence<pid> search(const Point &q, GraphI &G, PR &Points, const QueryParams &QP) {
+    if (G.concurrent_reads()) return search_live(q, G.concurrent_reader(), Points, QP);
+    return search_live(q, G, Points, QP);
+  }
+
+  template<class GT>
+  parlay::sequence<pid> search_live(const Point &q, const GT &G, PR &Points, const QueryParams &QP) {
+    QueryParams Q = QP;
+    auto starts = get_starts(q, Points);
+    auto dead = std::atomic_load(&deleted);
+    while (true) {
+      auto [pairElts, dist_cmps] = filtered_beam_search(G, q, Points, q, Points, starts, Q, false);
+      auto live = parlay::filter(pairElts.first, [&] (pid x) {return !is_deleted(*dead, x.first);});
+      size_t dead = pairElts.first.size() - live.size();
+      if (live.size() >= QP.k || dead == 0 || Q.beamSize >= (long) G.size()) {
+        if (live.size() > QP.k) live.resize(QP.k);
+        return live;
+      }
+      Q.k += dead;
+      Q.beamSize += dead;
+    }
+  }
+
+  // Beam search for the nearest points that match the filter and are
+  // not deleted (see label_search).  Requires labels to have been set.
+  parlay::sequence<pid> search(const Point &q, GraphI &G, PR &Points,
+                               const label_filter &F, const QueryParams &QP) {
+    auto dead = std::atomic_load(&deleted);
+    auto live = [&] (indexType i) {return !is_deleted(*dead, i);};
+    if (G.concurrent_reads())
+      return label_search(q, G.concurrent_reader(), Points, *labels, F, label_starts,
+                          start_point, QP, live).first;
+    return label_search(q, G, Points, *labels, F, label_starts, start_point, QP, live).first;
+  }
+
 };
 
 } // end namespace
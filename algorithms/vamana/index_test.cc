@@ -1,5 +1,247 @@
 #include "algorithms/vamana/index.h"
 
+#include <atomic>
+#include <thread>
+
+#include "algorithms/utils/euclidian_point.h"
+#include "algorithms/utils/test_points.h"
 #include <gtest/gtest.h>
 
+namespace parlayANN {
+namespace {
+
+using Point = Euclidian_Point<float>;
+using PR = PointRange<Point>;
+using Index = knn_index<PR, PR, unsigned int>;
+
 TEST(PlaceHolderTest, BuildPlaceHolder) { EXPECT_EQ(7 * 6, 42); }
+
+// fraction of queries whose nearest live point is found
+double Recall(Index& I, Graph<unsigned int>& G, PR& Points, PR& Queries) {
+  QueryParams QP(1, 20, 1.35, G.size(), G.max_degree());
+  size_t found = 0;
+  for (unsigned int q = 0; q < Queries.size(); q++) {
+    long best = -1;
+    for (unsigned int i = 0; i < Points.size(); i++)
+      if (!I.is_deleted(i) &&
+          (best == -1 || Points[i].distance(Queries[q]) < Points[best].distance(Queries[q])))
+        best = i;
+    auto r = I.search(Queries[q], G, Points, QP);
+    if (r.size() > 0 && r[0].first == best) found++;
+  }
+  return (double) found / Queries.size();
+}
+
+BuildParams Params() {
+  BuildParams BP(16, 32, 1.2, 1);
+  BP.single_batch = 0;
+  return BP;
+}
+
+TEST(DynamicIndexTest, InsertGrowsIndex) {
+  size_t d = 8;
+  PR Points = RandomPoints<Point>(1000, d, 1);
+  PR Queries = RandomPoints<Point>(200, d, 10);
+  BuildParams BP = Params();
+  Index I(BP);
+  Graph<unsigned int> G(BP.R, Points.size());
+  stats<unsigned int> BuildStats(Points.size());
+  I.build_index(G, Points, Points, BuildStats, false);
+
+  PR More = RandomPoints<Point>(500, d, 2);
+  Points.append(More);
+  ASSERT_EQ(Points.size(), 1500);
+  for (unsigned int i = 0; i < More.size(); i++)
+    for (size_t j = 0; j < d; j++)
+      EXPECT_EQ(Points[1000 + i][j], More[i][j]);
+  parlay::sequence<unsigned int> ids = parlay::tabulate(500, [] (unsigned int i) {return 1000 + i;});
+  I.insert(ids, G, Points, Points);
+  EXPECT_EQ(G.size(), 1500);
+  for (unsigned int i = 0; i < G.size(); i++) EXPECT_LE(G[i].size(), BP.R);
+  EXPECT_GT(Recall(I, G, Points, Queries), .9);
+}
+
+TEST(DynamicIndexTest, DeletesAreSkippedAndConsolidated) {
+  PR Points = RandomPoints<Point>(1500, 8, 3);
+  PR Queries = RandomPoints<Point>(200, 8, 11);
+  BuildParams BP = Params();
+  Index I(BP);
+  Graph<unsigned int> G(BP.R, Points.size());
+  stats<unsigned int> BuildStats(Points.size());
+  I.build_index(G, Points, Points, BuildStats, false);
+
+  // delete every third point, including the start point
+  parlay::sequence<unsigned int> deletes;
+  for (unsigned int i = 0; i < Points.size(); i += 3) deletes.push_back(i);
+  I.lazy_delete(deletes, G);
+
+  QueryParams QP(10, 30, 1.35, G.size(), G.max_degree());
+  for (unsigned int i = 0; i < 100; i++) {
+    for (auto [v, dist] : I.search(Points[i], G, Points, QP))
+      EXPECT_FALSE(I.is_deleted(v));
+  }
+
+  I.consolidate_deletes(G, Points);
+  EXPECT_FALSE(I.is_deleted(I.get_start()));
+  for (unsigned int i = 0; i < G.size(); i++) {
+    EXPECT_LE(G[i].size(), BP.R);
+    if (I.is_deleted(i)) EXPECT_EQ(G[i].size(), 0);
+    for (auto v : G[i]) EXPECT_FALSE(I.is_deleted(v));
+  }
+  EXPECT_GT(Recall(I, G, Points, Queries), .9);
+
+  // the index still accepts inserts after consolidation
+  Points.append(RandomPoints<Point>(200, 8, 4));
+  parlay::sequence<unsigned int> ids = parlay::tabulate(200, [] (unsigned int i) {return 1500 + i;});
+  I.insert(ids, G, Points, Points);
+  EXPECT_GT(Recall(I, G, Points, Queries), .9);
+}
+
+// with most points deleted, the beam is mostly deleted points, but
+// search still returns k live ones
+TEST(DynamicIndexTest, SearchReturnsKLivePoints) {
+  PR Points = RandomPoints<Point>(1500, 8, 6);
+  BuildParams BP = Params();
+  Index I(BP);
+  Graph<unsigned int> G(BP.R, Points.size());
+  stats<unsigned int> BuildStats(Points.size());
+  I.build_index(G, Points, Points, BuildStats, false);
+
+  parlay::sequence<unsigned int> deletes;
+  for (unsigned int i = 0; i < Points.size(); i++)
+    if (i % 5 != 0) deletes.push_back(i);
+  I.lazy_delete(deletes, G);
+
+  QueryParams QP(10, 10, 1.35, G.size(), G.max_degree());
+  for (unsigned int i = 0; i < 100; i++) {
+    auto r = I.search(Points[i], G, Points, QP);
+    EXPECT_EQ(r.size(), 10);
+    for (auto [v, dist] : r) EXPECT_FALSE(I.is_deleted(v));
+  }
+}
+
+TEST(DynamicIndexTest, SearchDuringInsert) {
+  PR Points = RandomPoints<Point>(2000, 8, 5);
+  PR Queries = RandomPoints<Point>(200, 8, 12);
+  BuildParams BP = Params();
+  Index I(BP);
+  Graph<unsigned int> G(BP.R, 1000);
+  G.enable_concurrent_reads();
+  I.set_start();
+
+  // searches run against the graph while the second half is inserted,
+  // which first grows the graph
+  I.insert(parlay::tabulate(1000, [] (unsigned int i) {return i;}), G, Points, Points);
+  std::atomic<bool> done = false;
+  std::thread inserter([&] {
+    I.insert(parlay::tabulate(1000, [] (unsigned int i) {return 1000 + i;}), G, Points, Points);
+    done = true;
+  });
+  QueryParams QP(10, 20, 1.35, G.size(), G.max_degree());
+  parlay::sequence<unsigned int> starts = {I.get_start()};
+  size_t searches = 0;
+  while (!done || searches < 100) {
+    auto R = G.concurrent_reader();
+    auto q = Queries[searches++ % Queries.size()];
+    auto [r, cmps] = filtered_beam_search(R, q, Points, q, Points, starts, QP);
+    ASSERT_GT(r.first.size(), 0);
+    for (auto [v, d] : r.first) ASSERT_LT(v, Points.size());
+  }
+  inserter.join();
+  EXPECT_GT(Recall(I, G, Points, Queries), .9);
+}
+
+// points are appended (reallocating their storage) and inserted while
+// knn_index::search runs, which goes through a concurrent reader
+TEST(DynamicIndexTest, SearchDuringIngest) {
+  PR Points = RandomPoints<Point>(500, 8, 6);
+  PR Queries = RandomPoints<Point>(200, 8, 13);
+  BuildParams BP = Params();
+  Index I(BP);
+  Graph<unsigned int> G(BP.R, 500);
+  G.enable_concurrent_reads();
+  I.set_start();
+  I.insert(parlay::tabulate(500, [] (unsigned int i) {return i;}), G, Points, Points);
+  I.lazy_delete({3, 5, 7}, G);
+
+  std::atomic<bool> done = false;
+  std::thread ingester([&] {
+    for (int round = 0; round < 5; round++) {
+      unsigned int n = Points.size();
+      Points.append(RandomPoints<Point>(300, 8, 20 + round));
+      I.insert(parlay::tabulate(300, [&] (unsigned int i) {return n + i;}), G, Points, Points);
+    }
+    done = true;
+  });
+  QueryParams QP(10, 20, 1.35, G.size(), G.max_degree());
+  size_t searches = 0;
+  while (!done || searches < 100) {
+    auto r = I.search(Queries[searches++ % Queries.size()], G, Points, QP);
+    ASSERT_GT(r.size(), 0);
+    for (auto [v, d] : r) {
+      ASSERT_LT(v, Points.size());
+      EXPECT_FALSE(I.is_deleted(v));
+    }
+  }
+  ingester.join();
+  EXPECT_EQ(G.size(), 2000);
+  EXPECT_GT(Recall(I, G, Points, Queries), .9);
+}
+
+// random labels: one of 20 for each point, and a second for every tenth
+point_labels<unsigned int> RandomLabels(size_t n) {
+  return point_labels<unsigned int>(parlay::tabulate(n, [] (size_t i) {
+    parlay::sequence<uint32_t> ls = {(uint32_t) (parlay::hash64(i) % 20)};
+    if (i % 10 == 0) ls.push_back((uint32_t) (parlay::hash64(i + 1) % 20));
+    return ls;}));
+}
+
+// fraction of queries whose nearest point matching the filter is found
+double FilteredRecall(Index& I, Graph<unsigned int>& G, PR& Points, PR& Queries,
+                      const point_labels<unsigned int>& L) {
+  QueryParams QP(1, 20, 1.35, G.size(), G.max_degree());
+  size_t found = 0;
+  for (unsigned int q = 0; q < Queries.size(); q++) {
+    label_filter F({q % 20});
+    long best = -1;
+    for (unsigned int i = 0; i < Points.size(); i++)
+      if (F(L, i) &&
+          (best == -1 || Points[i].distance(Queries[q]) < Points[best].distance(Queries[q])))
+        best = i;
+    auto r = I.search(Queries[q], G, Points, F, QP);
+    for (auto [v, d] : r) EXPECT_TRUE(F(L, v));
+    if (r.size() > 0 && r[0].first == best) found++;
+  }
+  return (double) found / Queries.size();
+}
+
+TEST(FilteredIndexTest, LabelAwareBuildKeepsFilteredRecall) {
+  PR Points = RandomPoints<Point>(3000, 8, 6);
+  PR Queries = RandomPoints<Point>(200, 8, 13);
+  auto L = RandomLabels(Points.size());
+  BuildParams BP = Params();
+
+  Index I(BP);
+  I.set_labels(L);
+  Graph<unsigned int> G(BP.R, Points.size());
+  stats<unsigned int> BuildStats(Points.size());
+  I.build_index(G, Points, Points, BuildStats);
+  for (uint32_t l = 0; l < L.num_labels; l++)
+    EXPECT_TRUE(L.has_label(I.label_starts[l], l));
+  double filtered = FilteredRecall(I, G, Points, Queries, L);
+
+  // the same search on a graph built without labels
+  Index Plain(BP);
+  Graph<unsigned int> PG(BP.R, Points.size());
+  stats<unsigned int> PlainStats(Points.size());
+  Plain.build_index(PG, Points, Points, PlainStats);
+  Plain.set_labels(L);
+  Plain.label_starts = label_start_points(L, Points);
+  double plain = FilteredRecall(Plain, PG, Points, Queries, L);
+
+  EXPECT_GT(filtered, .9);
+  EXPECT_GT(filtered, plain);
+}
+
+}  // namespace
+}  // namespace parlayANN
@@ -28,6 +28,7 @@
 #include "../utils/mips_point.h"
 #include "../utils/euclidian_point.h"
 #include "../utils/jl_point.h"
+#include "../utils/pq_point.h"
 #include "../utils/stats.h"
 #include "../utils/types.h"
 #include "../utils/graph.h"
@@ -38,23 +39,49 @@
 
 namespace parlayANN {
 
+// Searches from the start point and from vertex 0 with the same beam,
+// and reports the visits (hops) per query the start point saves.
+template<typename PointRange, typename QPointRange, typename QQPointRange, typename indexType>
+void compare_start_point(Graph<indexType> &G,
+                         PointRange &Points, PointRange &Query_Points,
+                         QPointRange &Q_Points, QPointRange &Q_Query_Points,
+                         QQPointRange &QQ_Points, QQPointRange &QQ_Query_Points,
+                         groundTruth<indexType> &GT, indexType start_point, long k, long Q,
+                         const parlay::sequence<indexType> &id_map = {}) {
+  QueryParams QP(k, Q, 1.35, G.size(), G.max_degree());
+  auto search_from = [&] (indexType s) {
+    return checkRecall(G, Points, Query_Points, Q_Points, Q_Query_Points,
+                       QQ_Points, QQ_Query_Points, GT, false, s, k, QP, false, {}, id_map);};
+  nn_result from_start = search_from(start_point);
+  nn_result from_zero = search_from(0);
+  std::cout << "start point " << start_point << " vs vertex 0 (Q=" << Q << "): visited "
+            << from_start.avg_visited << " vs " << from_zero.avg_visited
+            << " (hops saved " << (long) from_zero.avg_visited - (long) from_start.avg_visited
+            << "), comparisons " << from_start.avg_cmps << " vs " << from_zero.avg_cmps
+            << ", recall " << from_start.recall << " vs " << from_zero.recall << std::endl;
+}
+
+// graph_time is the time taken to build a graph given as built
+// (reported as the index time).
 template<typename PointRange, typename QPointRange, typename QQPointRange, typename indexType>
 void ANN_Quantized(Graph<indexType> &G, long k, BuildParams &BP,
                    PointRange &Query_Points, QPointRange &Q_Query_Points, QQPointRange &QQ_Query_Points,
                    groundTruth<indexType> GT, char *res_file,
                    bool graph_built,
-                   PointRange &Points, QPointRange &Q_Points, QQPointRange &QQ_Points) {
+                   PointRange &Points, QPointRange &Q_Points, QQPointRange &QQ_Points,
+                   double graph_time = 0) {
   parlay::internal::timer t("ANN");
 
-  bool verbose = BP.verbose;
   using findex = knn_index<QPointRange, QQPointRange, indexType>;
   findex I(BP);
   indexType start_point;
   double idx_time;
   stats<unsigned int> BuildStats(G.size());
   if(graph_built){
-    idx_time = 0;
-    start_point = 0;
+    idx_time = graph_time;
+    start_point = G.start_point();
+    if (BP.entry_points > 0)
+      I.entry_points = build_entry_points<indexType>(Q_Points, BP.entry_points);
   } else{
     I.build_index(G, Q_Points, QQ_Points, BuildStats);
     start_point = I.get_start();
@@ -76,13 +103,18 @@ void ANN_Quantized(Graph<indexType> &G, long k, BuildParams &BP,
                                                         [] (auto x) {return (long) x;}));
 
   if(Query_Points.size() != 0) {
+    search_settings<indexType> S(BP);
+    S.start_point = start_point;
+    S.entry_points = I.entry_points;
     search_and_parse(G_, G,
                      Points, Query_Points,
                      Q_Points, Q_Query_Points,
                      QQ_Points, QQ_Query_Points,
-                     GT,
-                     res_file, k, false, start_point,
-                     verbose, BP.Q, BP.rerank_factor);
+                     GT, res_file, k, S);
+    if (BP.compare_start)
+      compare_start_point(G, Points, Query_Points, Q_Points, Q_Query_Points,
+                          QQ_Points, QQ_Query_Points, GT, start_point, k,
+                          BP.Q > 0 ? BP.Q : std::max<long>(2 * k, 10), S.id_map);
   } else if (BP.self) {
     if (BP.range) {
       parlay::internal::timer t_range("range search time");
@@ -109,18 +141,67 @@ void ANN_Quantized(Graph<indexType> &G, long k, BuildParams &BP,
   }
 }
 
+// The quantized points of the given level ("q" or "qq") are loaded
+// from BP.quantized_path if they were saved there by an earlier run
+// from the same Points and settings, and are saved there otherwise.
+template<typename QPR, typename PointRange_, typename F>
+QPR quantized_points(BuildParams &BP, const char* level, const PointRange_ &Points, F make,
+                     std::string settings = "") {
+  if (BP.quantized_path.empty()) return make();
+  if (!settings.empty()) settings += " ";
+  settings += "quantile_sample=" + std::to_string(BP.quantile_sample);
+  return load_or_quantize<QPR>(BP.quantized_path + "." + level, Points.source(settings), make);
+}
+
+// Searches with product quantized points (reranking with the original
+// points).  The codes are too coarse to build a good graph from, so if
+// the graph is not given it is built on the original points first.
+template<typename QPoint, typename PointRange_, typename indexType>
+void ANN_PQ(Graph<indexType> &G, long k, BuildParams &BP,
+            PointRange_ &Query_Points,
+            groundTruth<indexType> GT, char *res_file,
+            bool graph_built, PointRange_ &Points) {
+  double graph_time = 0;
+  if (!graph_built) {
+    parlay::internal::timer t("ANN");
+    knn_index<PointRange_, PointRange_, indexType> I(BP);
+    stats<unsigned int> BuildStats(G.size());
+    I.build_index(G, Points, Points, BuildStats);
+    graph_time = t.next_time();
+    std::cout << "built graph on original points in " << graph_time << " seconds" << std::endl;
+  }
+  using QPR = PointRange<QPoint>;
+  int M = BP.pq_bytes * ((QPoint::K == 16) ? 2 : 1); // 0 gives the default size
+  auto Q_Points = quantized_points<QPR>(BP, "q", Points, [&] {
+    return QPR(Points, QPoint::generate_parameters(Points, M));}, "pq_bytes=" + std::to_string(M));
+  QPR Q_Query_Points(Query_Points, QPoint::query_parameters(Q_Points.params));
+  ANN_Quantized(G, k, BP, Query_Points, Q_Query_Points, Q_Query_Points,
+                GT, res_file, true, Points, Q_Points, Q_Points, graph_time);
+}
+
 template<typename Point, typename PointRange_, typename indexType>
 void ANN(Graph<indexType> &G, long k, BuildParams &BP,
          PointRange_ &Query_Points,
          groundTruth<indexType> GT, char *res_file,
          bool graph_built, PointRange_ &Points) {
-  if (BP.quantize != 0) {
+  if (BP.quantize == 6 || BP.quantize == 7) {
+    std::cout << "product quantizing first pass of search" << std::endl;
+    if (Point::is_metric()) {
+      if (BP.quantize == 6)
+        ANN_PQ<PQ_Point<8>>(G, k, BP, Query_Points, GT, res_file, graph_built, Points);
+      else ANN_PQ<PQ_Point<4>>(G, k, BP, Query_Points, GT, res_file, graph_built, Points);
+    } else {
+      if (BP.quantize == 6)
+        ANN_PQ<PQ_Point<8,true>>(G, k, BP, Query_Points, GT, res_file, graph_built, Points);
+      else ANN_PQ<PQ_Point<4,true>>(G, k, BP, Query_Points, GT, res_file, graph_built, Points);
+    }
+  } else if (BP.quantize != 0) {
     std::cout << "quantizing build and first pass of search to 1 byte" << std::endl;
     if (Point::is_metric()) {
       using QT = uint8_t;
       using QPoint = Euclidian_Point<QT>;
       using QPR = PointRange<QPoint>;
-      QPR Q_Points(Points);  // quantized to one byte
+      auto Q_Points = quantized_points<QPR>(BP, "q", Points, [&] {return QPR(Points);});
       QPR Q_Query_Points(Query_Points, Q_Points.params);
       if (BP.quantize == 1) {
         ANN_Quantized(G, k, BP, Query_Points, Q_Query_Points, Q_Query_Points,
@@ -128,14 +209,15 @@ void ANN(Graph<indexType> &G, long k, BuildParams &BP,
       } else if (BP.quantize == 2) {
         using QQPoint = Euclidean_Bit_Point;
         using QQPR = PointRange<QQPoint>;
-        QQPR QQ_Points(Points);
+        auto QQ_Points = quantized_points<QQPR>(BP, "qq", Points, [&] {
+          return QQPR(Points, QQPoint::generate_parameters(Points, BP.quantile_sample));});
         QQPR QQ_Query_Points(Query_Points, QQ_Points.params);
         ANN_Quantized(G, k, BP, Query_Points, Q_Query_Points, QQ_Query_Points,
                       GT, res_file, graph_built, Points, Q_Points, QQ_Points);
       } else if (BP.quantize == 3) {
         using QQPoint = Euclidean_JL_Sparse_Point<1024>;
         using QQPR = PointRange<QQPoint>;
-        QQPR QQ_Points(Points);
+        auto QQ_Points = quantized_points<QQPR>(BP, "qq", Points, [&] {return QQPR(Points);});
         QQPR QQ_Query_Points(Query_Points, QQ_Points.params);
         ANN_Quantized(G, k, BP, Query_Points, Q_Query_Points, QQ_Query_Points,
                       GT, res_file, graph_built, Points, Q_Points, QQ_Points);
@@ -145,7 +227,7 @@ void ANN(Graph<indexType> &G, long k, BuildParams &BP,
       //using QPoint = Euclidian_Point<uint8_t>;
       using QPoint = Quantized_Mips_Point<8,true,255>;
       using QPR = PointRange<QPoint>;
-      QPR Q_Points(Points);
+      auto Q_Points = quantized_points<QPR>(BP, "q", Points, [&] {return QPR(Points);});
       QPR Q_Query_Points(Query_Points, Q_Points.params);
       if (BP.quantize == 1) {
         ANN_Quantized(G, k, BP, Query_Points, Q_Query_Points, Q_Query_Points,
@@ -160,7 +242,8 @@ void ANN(Graph<indexType> &G, long k, BuildParams &BP,
       } else if (BP.quantize == 3) {
         using QQPoint = Mips_2Bit_Point;
         using QQPR = PointRange<QQPoint>;
-        QQPR QQ_Points(Points);
+        auto QQ_Points = quantized_points<QQPR>(BP, "qq", Points, [&] {
+          return QQPR(Points, QQPoint::generate_parameters(Points, BP.quantile_sample));});
         QQPR QQ_Query_Points(Query_Points, QQ_Points.params);
         ANN_Quantized(G, k, BP, Query_Points, Q_Query_Points, QQ_Query_Points,
                       GT, res_file, graph_built, Points, Q_Points, QQ_Points);
@@ -168,14 +251,14 @@ void ANN(Graph<indexType> &G, long k, BuildParams &BP,
         using QQPoint = Mips_JL_Sparse_Point<512>;
         //using QQPoint = Mips_JL_Bit_Point<512>;
         using QQPR = PointRange<QQPoint>;
-        QQPR QQ_Points(Points);
+        auto QQ_Points = quantized_points<QQPR>(BP, "qq", Points, [&] {return QQPR(Points);});
         QQPR QQ_Query_Points(Query_Points, QQ_Points.params);
         ANN_Quantized(G, k, BP, Query_Points, Q_Query_Points, QQ_Query_Points,
                       GT, res_file, graph_built, Points, Q_Points, QQ_Points);
       } else if (BP.quantize == 5) {
         using QQPoint = Mips_JL_Sparse_Point<1024>;
         using QQPR = PointRange<QQPoint>;
-        QQPR QQ_Points(Points);
+        auto QQ_Points = quantized_points<QQPR>(BP, "qq", Points, [&] {return QQPR(Points);});
         QQPR QQ_Query_Points(Query_Points, QQ_Points.params);
         ANN_Quantized(G, k, BP, Query_Points, Q_Query_Points, QQ_Query_Points,
                       GT, res_file, graph_built, Points, Q_Points, QQ_Points);
@@ -0,0 +1,42 @@
+/*
+  Converts a graph to the compressed (CSR + varint) format read by
+  Compressed_Graph, and reports the memory used by both.
+
+  Example usage:
+    ./compress_graph -graph_path ~/data/sift/sift-1M_64_128 \
+    -graph_outfile ~/data/sift/sift-1M_64_128.cg
+*/
+
+#include <iostream>
+#include <cstdint>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "utils/graph.h"
+#include "utils/compressed_graph.h"
+#include "../algorithms/bench/parse_command_line.h"
+
+using namespace parlayANN;
+
+int main(int argc, char* argv[]) {
+  commandLine P(argc,argv,
+  "[-graph_path <g>] [-graph_outfile <o>]");
+
+  char* gFile = P.getOptionValue("-graph_path");
+  char* oFile = P.getOptionValue("-graph_outfile");
+
+  if (gFile == NULL || oFile == NULL) {
+    std::cout << "Error: -graph_path and -graph_outfile are required" << std::endl;
+    abort();
+  }
+
+  Graph<unsigned int> G(gFile);
+  Compressed_Graph<unsigned int> CG(G);
+  size_t edges = parlay::reduce(parlay::tabulate(G.size(), [&] (size_t i) {
+    return G[i].size();}));
+  size_t graph_bytes = G.size() * (G.max_degree() + 1) * sizeof(unsigned int);
+  std::cout << "Graph: " << graph_bytes << " bytes, compressed: " << CG.num_bytes()
+            << " bytes (" << (double) CG.num_bytes() / std::max<size_t>(edges, 1)
+            << " bytes per edge)" << std::endl;
+  CG.save(oFile);
+  return 0;
+}
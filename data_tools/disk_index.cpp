@@ -0,0 +1,144 @@
+/*
+  Writes a graph and its points as a disk index, or searches a disk
+  index keeping only one byte per coordinate of each point in memory.
+
+  Example usage:
+    ./disk_index -base_path ~/data/sift/sift-1M -data_type uint8 \
+    -graph_path ~/data/sift/sift-1M_64_128 -index_outfile ~/data/sift/sift-1M_64_128.di
+
+    ./disk_index -index_path ~/data/sift/sift-1M_64_128.di -data_type uint8 \
+    -dist_func Euclidian -query_path ~/data/sift/query-10K -gt_path ~/data/sift/GT \
+    -k 10 -Q 64 -beam_width 4 -cache_nodes 100000
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "utils/disk_index.h"
+#include "utils/euclidian_point.h"
+#include "utils/mips_point.h"
+#include "utils/point_range.h"
+#include "utils/graph.h"
+#include "utils/types.h"
+#include "../algorithms/bench/parse_command_line.h"
+
+using namespace parlayANN;
+
+template<typename Point>
+void write_index(char* bFile, char* gFile, char* oFile) {
+  PointRange<Point> Points(bFile);
+  Graph<unsigned int> G(gFile);
+  write_disk_index(oFile, G, Points, G.start_point());
+}
+
+template<typename Point, typename QPoint>
+void search_index(char* iFile, char* qFile, char* gtFile, QueryParams QP, size_t cache_nodes) {
+  Disk_Index<Point, unsigned int> DI(iFile, cache_nodes);
+  auto Disk_Points = DI.points();
+  PointRange<QPoint> Q_Points(Disk_Points);
+  PointRange<Point> Query_Points(qFile);
+  PointRange<QPoint> Q_Query_Points(Query_Points, Q_Points.params);
+  groundTruth<unsigned int> GT(gtFile);
+  QP.limit = DI.size();
+  QP.degree_limit = DI.max_degree();
+  size_t nq = Query_Points.size();
+
+  parlay::internal::timer t;
+  auto results = parlay::tabulate(nq, [&] (size_t i) {
+    return disk_beam_search(Query_Points[i], Q_Query_Points[i], Q_Points, DI, QP);});
+  double time = t.next_time();
+
+  auto total = [&] (auto f) {
+    return (double) parlay::reduce(parlay::map(results, f)) / nq;};
+  double ios = total([] (auto& r) {return r.second.ios;});
+  double hops = total([] (auto& r) {return r.second.hops;});
+  double hits = total([] (auto& r) {return r.second.cache_hits;});
+  double cmps = total([] (auto& r) {return r.second.dist_cmps;});
+  double recall = 0.0;
+  if (GT.size() > 0) {
+    size_t correct = 0;
+    for (size_t i = 0; i < nq; i++) {
+      std::set<unsigned int> reported;
+      for (auto [id, d] : results[i].first) reported.insert(id);
+      for (long l = 0; l < QP.k; l++)
+        correct += reported.count(GT.coordinates(i, l));
+    }
+    recall = (double) correct / (QP.k * nq);
+  }
+  std::cout << "disk search: Q=" << QP.beamSize << ", k=" << QP.k
+            << ", beam_width=" << QP.beam_width << ", recall=" << recall
+            << ", QPS=" << nq / time << ", ios=" << ios << ", cache_hits=" << hits
+            << ", hops=" << hops << ", comparisons=" << cmps << std::endl;
+}
+
+template<typename T>
+void search_index(char* iFile, char* qFile, char* gtFile, std::string df,
+                  QueryParams QP, size_t cache_nodes) {
+  if (df == "Euclidian")
+    search_index<Euclidian_Point<T>, Euclidian_Point<uint8_t>>(iFile, qFile, gtFile, QP, cache_nodes);
+  else if (df == "mips")
+    search_index<Mips_Point<T>, Quantized_Mips_Point<8,true,255>>(iFile, qFile, gtFile, QP, cache_nodes);
+  else {
+    std::cout << "Error: specify distance type Euclidian or mips" << std::endl;
+    abort();
+  }
+}
+
+int main(int argc, char* argv[]) {
+  commandLine P(argc,argv,
+  "[-base_path <b>] [-graph_path <g>] [-index_outfile <o>] [-data_type <d>] "
+      "[-index_path <i>] [-query_path <q>] [-gt_path <gt>] [-dist_func <df>] "
+      "[-k <k>] [-Q <Q>] [-beam_width <w>] [-cache_nodes <c>]");
+
+  char* bFile = P.getOptionValue("-base_path");
+  char* gFile = P.getOptionValue("-graph_path");
+  char* oFile = P.getOptionValue("-index_outfile");
+  char* iFile = P.getOptionValue("-index_path");
+  char* qFile = P.getOptionValue("-query_path");
+  char* gtFile = P.getOptionValue("-gt_path");
+  char* vectype = P.getOptionValue("-data_type");
+  char* dfc = P.getOptionValue("-dist_func");
+  long k = P.getOptionLongValue("-k", 10);
+  long Q = P.getOptionLongValue("-Q", 64);
+  long beam_width = P.getOptionLongValue("-beam_width", 4);
+  long cache_nodes = P.getOptionLongValue("-cache_nodes", 0);
+
+  if (vectype == NULL) {
+    std::cout << "Error: -data_type is required" << std::endl;
+    abort();
+  }
+  std::string tp = std::string(vectype);
+  if (tp != "float" && tp != "uint8" && tp != "int8") {
+    std::cout << "Error: data type not specified correctly, specify int8, uint8, or float" << std::endl;
+    abort();
+  }
+
+  if (bFile != NULL) {
+    if (gFile == NULL || oFile == NULL) {
+      std::cout << "Error: -base_path requires -graph_path and -index_outfile" << std::endl;
+      abort();
+    }
+    if (tp == "float") write_index<Euclidian_Point<float>>(bFile, gFile, oFile);
+    else if (tp == "uint8") write_index<Euclidian_Point<uint8_t>>(bFile, gFile, oFile);
+    else write_index<Euclidian_Point<int8_t>>(bFile, gFile, oFile);
+  }
+
+  if (iFile != NULL) {
+    if (qFile == NULL || dfc == NULL) {
+      std::cout << "Error: -index_path requires -query_path and -dist_func" << std::endl;
+      abort();
+    }
+    QueryParams QP(k, std::max(k, Q), 1.35, 0, 0);
+    QP.beam_width = beam_width;
+    std::string df = std::string(dfc);
+    if (tp == "float") search_index<float>(iFile, qFile, gtFile, df, QP, cache_nodes);
+    else if (tp == "uint8") search_index<uint8_t>(iFile, qFile, gtFile, df, QP, cache_nodes);
+    else search_index<int8_t>(iFile, qFile, gtFile, df, QP, cache_nodes);
+  }
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+/*
+  Times the distance functions of the bit sketch point types against a
+  word at a time std::bitset reference, and checks that they agree.
+
+  Example usage:
+    ./distance_bench -base_path ~/data/sift/sift-1M -data_type uint8 -pairs 10000000
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "utils/euclidian_point.h"
+#include "utils/jl_point.h"
+#include "utils/mips_point.h"
+#include "utils/point_range.h"
+#include "utils/simd_distance.h"
+#include "../algorithms/bench/parse_command_line.h"
+
+using namespace parlayANN;
+using word = std::bitset<64>;
+
+// number of differing bits
+int reference_hamming(const uint8_t* p, const uint8_t* q, int num_bytes) {
+  const word* pw = (const word*) p;
+  const word* qw = (const word*) q;
+  int count = 0;
+  for (int i = 0; i < num_bytes / 8; i++)
+    count += (pw[i] ^ qw[i]).count();
+  return count;
+}
+
+// negated inner product of blocks of [sign, nonzero] words
+int reference_ternary(const uint8_t* p, const uint8_t* q, int num_bytes) {
+  const word* pw = (const word*) p;
+  const word* qw = (const word*) q;
+  int total = 0;
+  for (int i = 0; i < num_bytes / 16; i++) {
+    word not_zero = pw[2 * i + 1] & qw[2 * i + 1];
+    word negative = (pw[2 * i] ^ qw[2 * i]) & not_zero;
+    total += (not_zero.count() - negative.count()) - negative.count();
+  }
+  return -total;
+}
+
+template<typename QPoint, typename PR, typename Reference>
+void time_distances(std::string name, const PR& Points, long pairs, Reference reference) {
+  PointRange<QPoint> Q_Points(Points);
+  int num_bytes = Q_Points.params.num_bytes();
+  // pairs among the first points only, so that the loops time the
+  // distance computations rather than cache misses
+  long range = std::min<long>(Q_Points.size(), 1024);
+  auto ids = parlay::tabulate(2 * pairs, [&] (long i) {
+    return (long) (parlay::hash64(i) % range);});
+  for (long i = 0; i < range; i++) reference(Q_Points.location(i), Q_Points.location(0), num_bytes);
+
+  parlay::internal::timer t;
+  double kernel_sum = 0;
+  for (long i = 0; i < pairs; i++)
+    kernel_sum += Q_Points[ids[2 * i]].distance(Q_Points[ids[2 * i + 1]]);
+  double kernel_time = t.next_time();
+  double reference_sum = 0;
+  for (long i = 0; i < pairs; i++)
+    reference_sum += reference(Q_Points.location(ids[2 * i]), Q_Points.location(ids[2 * i + 1]), num_bytes);
+  double reference_time = t.next_time();
+
+  long mismatches = 0;
+  for (long i = 0; i < pairs; i++) {
+    long a = ids[2 * i], b = ids[2 * i + 1];
+    mismatches += (reference(Q_Points.location(a), Q_Points.location(b), num_bytes)
+                   != Q_Points[a].distance(Q_Points[b]));
+  }
+
+  std::cout << name << ": bytes=" << num_bytes
+            << ", kernel=" << 1e9 * kernel_time / pairs << "ns"
+            << ", reference=" << 1e9 * reference_time / pairs << "ns"
+            << ", speedup=" << reference_time / kernel_time
+            << ", mismatches=" << mismatches << std::endl;
+  if (mismatches > 0 || kernel_sum != reference_sum) {
+    std::cout << "ERROR: " << name << " does not match the reference" << std::endl;
+    abort();
+  }
+}
+
+template<typename T>
+void run(char* bFile, long pairs) {
+  PointRange<Euclidian_Point<T>> Points(bFile);
+  std::cout << "kernels: " << simd::dispatch.name << ", points: " << Points.size()
+            << ", dims: " << Points.dimension() << std::endl;
+  time_distances<Euclidean_Bit_Point>("Euclidean_Bit_Point", Points, pairs, reference_hamming);
+  time_distances<Euclidean_JL_Sparse_Point<1024>>("Euclidean_JL_Sparse_Point<1024>", Points, pairs, reference_hamming);
+  time_distances<Mips_Bit_Point>("Mips_Bit_Point", Points, pairs, reference_hamming);
+  time_distances<Mips_2Bit_Point>("Mips_2Bit_Point", Points, pairs, reference_ternary);
+  time_distances<Mips_JL_Bit_Point<512>>("Mips_JL_Bit_Point<512>", Points, pairs, reference_hamming);
+  time_distances<Mips_JL_Sparse_Point<1024>>("Mips_JL_Sparse_Point<1024>", Points, pairs, reference_hamming);
+}
+
+int main(int argc, char* argv[]) {
+  commandLine P(argc,argv,
+  "[-base_path <b>] [-data_type <d>] [-pairs <p>]");
+
+  char* bFile = P.getOptionValue("-base_path");
+  char* vectype = P.getOptionValue("-data_type");
+  long pairs = P.getOptionLongValue("-pairs", 1000000);
+
+  if (bFile == NULL || vectype == NULL) {
+    std::cout << "Error: -base_path and -data_type are required" << std::endl;
+    abort();
+  }
+  std::string tp = std::string(vectype);
+  if (tp == "float") run<float>(bFile, pairs);
+  else if (tp == "uint8") run<uint8_t>(bFile, pairs);
+  else if (tp == "int8") run<int8_t>(bFile, pairs);
+  else {
+    std::cout << "Error: data type not specified correctly, specify int8, uint8, or float" << std::endl;
+    abort();
+  }
+  return 0;
+}
@@ -0,0 +1,168 @@
+/*
+  Builds a Vamana graph with and without labels and compares searches
+  for the nearest points carrying a label: on the graph built with
+  labels, on the graph built without them, and by filtering the
+  results of an unfiltered search.  Without label files each point and
+  query gets one label drawn from a Zipf distribution.
+
+  Example usage:
+    ./filtered_search -base_path ~/data/yfcc/base.u8bin -data_type uint8 \
+    -dist_func Euclidian -query_path ~/data/yfcc/query.u8bin \
+    -label_path ~/data/yfcc/base.metadata.spmat -query_label_path ~/data/yfcc/query.metadata.spmat \
+    -R 64 -L 128 -k 10 -Q 64
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <set>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "utils/beamSearch.h"
+#include "utils/euclidian_point.h"
+#include "utils/labels.h"
+#include "utils/mips_point.h"
+#include "utils/point_range.h"
+#include "utils/graph.h"
+#include "utils/stats.h"
+#include "utils/types.h"
+#include "../algorithms/bench/parse_command_line.h"
+#include "../algorithms/vamana/index.h"
+
+using namespace parlayANN;
+using Labels = point_labels<unsigned int>;
+
+// one label per point, label l with probability proportional to 1/(l+1)
+Labels zipf_labels(size_t n, long num_labels, size_t seed) {
+  parlay::sequence<double> cdf(num_labels);
+  double total = 0;
+  for (long l = 0; l < num_labels; l++) cdf[l] = (total += 1.0 / (l + 1));
+  return Labels(parlay::tabulate(n, [&] (size_t i) {
+    double u = (parlay::hash64(i + seed * n) % 1000000) / 1000000.0 * total;
+    uint32_t l = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    return parlay::sequence<uint32_t>{std::min<uint32_t>(l, num_labels - 1)};}));
+}
+
+template<typename PR, typename Search>
+void time_search(std::string name, PR& Query_Points, const Labels& QL,
+                 const parlay::sequence<std::set<unsigned int>>& truth, long k, Search search) {
+  size_t nq = Query_Points.size();
+  parlay::internal::timer t;
+  auto results = parlay::tabulate(nq, [&] (size_t i) {
+    label_filter F(std::vector<uint32_t>(QL.labels(i).begin(), QL.labels(i).end()));
+    return search(Query_Points[i], F);});
+  double time = t.next_time();
+  size_t correct = 0, total = 0;
+  for (size_t i = 0; i < nq; i++) {
+    for (auto [id, d] : results[i].first) correct += truth[i].count(id);
+    total += truth[i].size();
+  }
+  double cmps = (double) parlay::reduce(parlay::map(results, [] (auto& r) {return r.second;})) / nq;
+  std::cout << name << ": recall=" << (double) correct / std::max<size_t>(total, 1)
+            << ", QPS=" << nq / time << ", comparisons=" << cmps << std::endl;
+}
+
+template<typename Point>
+void run(char* bFile, char* qFile, char* lFile, char* qlFile, long num_labels,
+         BuildParams BP, long k, long Q) {
+  using PR = PointRange<Point>;
+  PR Points(bFile);
+  PR Query_Points(qFile);
+  Labels L = (lFile != NULL) ? Labels(lFile) : zipf_labels(Points.size(), num_labels, 1);
+  Labels QL = (qlFile != NULL) ? Labels(qlFile) : zipf_labels(Query_Points.size(), num_labels, 2);
+  size_t nq = Query_Points.size();
+
+  // exact nearest matching points
+  auto truth = parlay::tabulate(nq, [&] (size_t i) {
+    label_filter F(std::vector<uint32_t>(QL.labels(i).begin(), QL.labels(i).end()));
+    parlay::sequence<std::pair<unsigned int, float>> matches;
+    for (auto l : F.labels)
+      for (auto j : L.points_with(l))
+        matches.push_back({j, Points[j].distance(Query_Points[i])});
+    std::sort(matches.begin(), matches.end(), [] (auto a, auto b) {
+      return a.second < b.second || (a.second == b.second && a.first < b.first);});
+    std::set<unsigned int> nearest;
+    for (auto [j, d] : matches) {
+      if (nearest.size() == k) break;
+      nearest.insert(j);
+    }
+    return nearest;});
+
+  parlay::internal::timer t;
+  knn_index<PR, PR, unsigned int> Filtered(BP);
+  Filtered.set_labels(L);
+  Graph<unsigned int> FG(BP.R, Points.size());
+  stats<unsigned int> FStats(Points.size());
+  Filtered.build_index(FG, Points, Points, FStats);
+  std::cout << "label build time: " << t.next_time() << std::endl;
+  knn_index<PR, PR, unsigned int> Plain(BP);
+  Graph<unsigned int> PG(BP.R, Points.size());
+  stats<unsigned int> PStats(Points.size());
+  Plain.build_index(PG, Points, Points, PStats);
+  std::cout << "plain build time: " << t.next_time() << std::endl;
+  auto plain_label_starts = label_start_points(L, Points);
+
+  QueryParams QP(k, Q, 1.35, Points.size(), BP.R);
+  time_search("label graph", Query_Points, QL, truth, k, [&] (auto q, auto& F) {
+    return label_search(q, FG, Points, L, F, Filtered.label_starts, 0u, QP);});
+  time_search("plain graph, label walk", Query_Points, QL, truth, k, [&] (auto q, auto& F) {
+    return label_search(q, PG, Points, L, F, plain_label_starts, 0u, QP);});
+  time_search("plain graph, post-filter", Query_Points, QL, truth, k, [&] (auto q, auto& F) {
+    parlay::sequence<unsigned int> starts = {0};
+    auto [pairElts, cmps] = beam_search(q, PG, Points, starts, QP);
+    auto matches = parlay::filter(pairElts.first, [&] (auto x) {return F(L, x.first);});
+    if (matches.size() > k) matches.resize(k);
+    return std::pair(matches, cmps);});
+}
+
+int main(int argc, char* argv[]) {
+  commandLine P(argc,argv,
+  "[-base_path <b>] [-query_path <q>] [-data_type <d>] [-dist_func <df>] "
+      "[-label_path <l>] [-query_label_path <ql>] [-num_labels <nl>] "
+      "[-R <deg>] [-L <bm>] [-alpha <a>] [-k <k>] [-Q <Q>]");
+
+  char* bFile = P.getOptionValue("-base_path");
+  char* qFile = P.getOptionValue("-query_path");
+  char* lFile = P.getOptionValue("-label_path");
+  char* qlFile = P.getOptionValue("-query_label_path");
+  char* vectype = P.getOptionValue("-data_type");
+  char* dfc = P.getOptionValue("-dist_func");
+  long num_labels = P.getOptionLongValue("-num_labels", 100);
+  long R = P.getOptionLongValue("-R", 32);
+  long L = P.getOptionLongValue("-L", 64);
+  double alpha = P.getOptionDoubleValue("-alpha", 1.2);
+  long k = P.getOptionLongValue("-k", 10);
+  long Q = P.getOptionLongValue("-Q", 64);
+
+  if (bFile == NULL || qFile == NULL || vectype == NULL || dfc == NULL) {
+    std::cout << "Error: -base_path, -query_path, -data_type and -dist_func are required" << std::endl;
+    abort();
+  }
+  if ((lFile == NULL) != (qlFile == NULL)) {
+    std::cout << "Error: give both -label_path and -query_label_path, or neither" << std::endl;
+    abort();
+  }
+  BuildParams BP(R, L, alpha, 2);
+  std::string tp = std::string(vectype);
+  std::string df = std::string(dfc);
+  if (df != "Euclidian" && df != "mips") {
+    std::cout << "Error: specify distance type Euclidian or mips" << std::endl;
+    abort();
+  }
+  if (tp == "float") {
+    if (df == "Euclidian") run<Euclidian_Point<float>>(bFile, qFile, lFile, qlFile, num_labels, BP, k, Q);
+    else run<Mips_Point<float>>(bFile, qFile, lFile, qlFile, num_labels, BP, k, Q);
+  } else if (tp == "uint8") {
+    if (df == "Euclidian") run<Euclidian_Point<uint8_t>>(bFile, qFile, lFile, qlFile, num_labels, BP, k, Q);
+    else run<Mips_Point<uint8_t>>(bFile, qFile, lFile, qlFile, num_labels, BP, k, Q);
+  } else if (tp == "int8") {
+    if (df == "Euclidian") run<Euclidian_Point<int8_t>>(bFile, qFile, lFile, qlFile, num_labels, BP, k, Q);
+    else run<Mips_Point<int8_t>>(bFile, qFile, lFile, qlFile, num_labels, BP, k, Q);
+  } else {
+    std::cout << "Error: data type not specified correctly, specify int8, uint8, or float" << std::endl;
+    abort();
+  }
+  return 0;
+}
@@ -0,0 +1,109 @@
+/*
+  Computes the k nearest neighbor graph of a base set (each point with
+  edges to its k nearest other points) and writes it in the graph
+  format.  It is exact by default, or approximate when given an index
+  to search with every base point.  Given -exact_graph_path, it also
+  reports the fraction of the edges of that (exact) graph it found.
+
+  Example usage:
+    ./knn_graph -base_path ~/data/sift/sift-1M -data_type uint8 \
+    -dist_func Euclidian -k 10 -graph_outfile ~/data/sift/sift-1M.knn10
+
+    ./knn_graph -base_path ~/data/sift/sift-1M -data_type uint8 \
+    -dist_func Euclidian -k 10 -graph_path ~/data/sift/sift-1M_64_128 -Q 32 \
+    -graph_outfile ~/data/sift/sift-1M.aknn10
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "utils/euclidian_point.h"
+#include "utils/mips_point.h"
+#include "utils/point_range.h"
+#include "utils/graph.h"
+#include "utils/types.h"
+#include "utils/exact_knn.h"
+#include "utils/knn_graph.h"
+#include "../algorithms/bench/parse_command_line.h"
+
+using namespace parlayANN;
+
+template<typename T>
+Graph<unsigned int> exact_graph(char* bFile, long k, bool mips) {
+  bin_reader<T> reader(bFile);
+  auto points = reader.read(reader.size());
+  return exact_knn_graph<unsigned int>(points.begin(), reader.size(),
+                                       reader.dimension(), k, mips);
+}
+
+template<typename Point>
+Graph<unsigned int> approximate_graph(char* bFile, char* gFile, long k, long Q) {
+  PointRange<Point> Points(bFile);
+  Graph<unsigned int> G(gFile);
+  if (Points.size() != G.size()) {
+    std::cout << "Error: " << Points.size() << " points but the graph has "
+              << G.size() << " vertices" << std::endl;
+    abort();
+  }
+  QueryParams QP(k + 1, Q, 1.35, G.size(), G.max_degree());
+  return approximate_knn_graph(G, Points, k, QP);
+}
+
+template<typename T>
+Graph<unsigned int> knn_graph(char* bFile, char* gFile, long k, bool mips, long Q) {
+  if (gFile == NULL) return exact_graph<T>(bFile, k, mips);
+  else if (mips) return approximate_graph<Mips_Point<T>>(bFile, gFile, k, Q);
+  else return approximate_graph<Euclidian_Point<T>>(bFile, gFile, k, Q);
+}
+
+int main(int argc, char* argv[]) {
+  commandLine P(argc,argv,
+  "[-base_path <b>] [-data_type <d>] [-dist_func <df>] [-k <k>] "
+      "[-graph_outfile <o>] [-graph_path <g>] [-Q <Q>] [-exact_graph_path <e>]");
+
+  char* bFile = P.getOptionValue("-base_path");
+  char* vectype = P.getOptionValue("-data_type");
+  char* dfc = P.getOptionValue("-dist_func");
+  char* oFile = P.getOptionValue("-graph_outfile");
+  char* gFile = P.getOptionValue("-graph_path");
+  char* eFile = P.getOptionValue("-exact_graph_path");
+  long k = P.getOptionLongValue("-k", 10);
+  // beam size for the approximate graph
+  long Q = P.getOptionLongValue("-Q", 2 * k);
+  if (k <= 0) P.badArgument();
+
+  if (bFile == NULL || vectype == NULL || dfc == NULL || oFile == NULL) {
+    std::cout << "Error: -base_path, -data_type, -dist_func and -graph_outfile are required"
+              << std::endl;
+    abort();
+  }
+  std::string df = std::string(dfc);
+  if (df != "Euclidian" && df != "mips") {
+    std::cout << "Error: invalid distance type: specify Euclidian or mips" << std::endl;
+    abort();
+  }
+  bool mips = (df == "mips");
+
+  std::string tp = std::string(vectype);
+  parlay::internal::timer t;
+  Graph<unsigned int> G;
+  if (tp == "float") G = knn_graph<float>(bFile, gFile, k, mips, Q);
+  else if (tp == "uint8") G = knn_graph<uint8_t>(bFile, gFile, k, mips, Q);
+  else if (tp == "int8") G = knn_graph<int8_t>(bFile, gFile, k, mips, Q);
+  else {
+    std::cout << "Error: data type not specified correctly, specify int8, uint8, or float" << std::endl;
+    abort();
+  }
+  std::cout << (gFile == NULL ? "exact" : "approximate") << " " << k
+            << "-nn graph time: " << t.next_time() << std::endl;
+
+  if (eFile != NULL) {
+    Graph<unsigned int> E(eFile);
+    std::cout << "fraction of exact edges found: " << knn_graph_recall(G, E) << std::endl;
+  }
+  G.save(oFile);
+  return 0;
+}
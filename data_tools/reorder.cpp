@@ -0,0 +1,76 @@
+/*
+  Relabels a graph and its base file breadth first from the start
+  point, so that vertices visited together by a search are stored
+  together, and writes the map from new to original ids.  Pass the map
+  to the neighbors executables with -id_map to check recall against
+  the original ground truth.
+
+  Example usage:
+    ./reorder -base_path ~/data/sift/sift-1M -data_type uint8 \
+    -graph_path ~/data/sift/sift-1M_64_128 \
+    -base_outfile ~/data/sift/sift-1M.bfs -graph_outfile ~/data/sift/sift-1M_64_128.bfs \
+    -map_outfile ~/data/sift/sift-1M.bfs.map
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "utils/euclidian_point.h"
+#include "utils/point_range.h"
+#include "utils/graph.h"
+#include "utils/reorder.h"
+#include "../algorithms/bench/parse_command_line.h"
+
+using namespace parlayANN;
+
+template<typename T>
+void reorder(char* bFile, char* gFile, char* boFile, char* goFile, char* mFile) {
+  PointRange<Euclidian_Point<T>> Points(bFile);
+  Graph<unsigned int> G(gFile);
+  if (Points.size() != G.size()) {
+    std::cout << "Error: " << Points.size() << " points but the graph has "
+              << G.size() << " vertices" << std::endl;
+    abort();
+  }
+  parlay::internal::timer t;
+  auto order = bfs_order(G, G.start_point());
+  Graph<unsigned int> H = reorder_graph(G, order);
+  std::cout << "reorder time: " << t.next_time() << std::endl;
+  std::cout << "average log2 id gap of edges: " << average_log_gap(G)
+            << " before, " << average_log_gap(H) << " after" << std::endl;
+  save_reordered_points(Points, order, boFile);
+  H.save(goFile);
+  save_id_map(order, mFile);
+}
+
+int main(int argc, char* argv[]) {
+  commandLine P(argc,argv,
+  "[-base_path <b>] [-data_type <d>] [-graph_path <g>] "
+      "[-base_outfile <bo>] [-graph_outfile <go>] [-map_outfile <m>]");
+
+  char* bFile = P.getOptionValue("-base_path");
+  char* gFile = P.getOptionValue("-graph_path");
+  char* boFile = P.getOptionValue("-base_outfile");
+  char* goFile = P.getOptionValue("-graph_outfile");
+  char* mFile = P.getOptionValue("-map_outfile");
+  char* vectype = P.getOptionValue("-data_type");
+
+  if (bFile == NULL || gFile == NULL || boFile == NULL || goFile == NULL ||
+      mFile == NULL || vectype == NULL) {
+    std::cout << "Error: -base_path, -data_type, -graph_path, -base_outfile, "
+              << "-graph_outfile and -map_outfile are required" << std::endl;
+    abort();
+  }
+  std::string tp = std::string(vectype);
+  if (tp == "float") reorder<float>(bFile, gFile, boFile, goFile, mFile);
+  else if (tp == "uint8") reorder<uint8_t>(bFile, gFile, boFile, goFile, mFile);
+  else if (tp == "int8") reorder<int8_t>(bFile, gFile, boFile, goFile, mFile);
+  else {
+    std::cout << "Error: data type not specified correctly, specify int8, uint8, or float" << std::endl;
+    abort();
+  }
+  return 0;
+}
@@ -0,0 +1,66 @@
+/*
+  Converts a .bin data file (and optionally a graph) to the serving
+  layout, which PointRange and Graph map directly instead of reading
+  and repacking.
+
+  Example usage:
+    ./serving_layout -base_path ~/data/sift/sift-1M -data_type uint8 \
+    -out_path ~/data/sift/sift-1M.serve \
+    -graph_path ~/data/sift/sift-1M_64_128 -graph_outfile ~/data/sift/sift-1M_64_128.serve
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "utils/euclidian_point.h"
+#include "utils/point_range.h"
+#include "utils/graph.h"
+#include "../algorithms/bench/parse_command_line.h"
+
+using namespace parlayANN;
+
+template<typename T>
+void convert_points(char* iFile, char* oFile) {
+  PointRange<Euclidian_Point<T>> Points(iFile);
+  Points.save_serving_layout(oFile);
+}
+
+int main(int argc, char* argv[]) {
+  commandLine P(argc,argv,
+  "[-base_path <b>] [-data_type <d>] [-out_path <o>] "
+      "[-graph_path <g>] [-graph_outfile <go>]");
+
+  char* bFile = P.getOptionValue("-base_path");
+  char* oFile = P.getOptionValue("-out_path");
+  char* gFile = P.getOptionValue("-graph_path");
+  char* goFile = P.getOptionValue("-graph_outfile");
+  char* vectype = P.getOptionValue("-data_type");
+
+  if (bFile != NULL) {
+    if (oFile == NULL || vectype == NULL) {
+      std::cout << "Error: -base_path requires -out_path and -data_type" << std::endl;
+      abort();
+    }
+    std::string tp = std::string(vectype);
+    if (tp == "float") convert_points<float>(bFile, oFile);
+    else if (tp == "uint8") convert_points<uint8_t>(bFile, oFile);
+    else if (tp == "int8") convert_points<int8_t>(bFile, oFile);
+    else {
+      std::cout << "Error: data type not specified correctly, specify int8, uint8, or float" << std::endl;
+      abort();
+    }
+  }
+
+  if (gFile != NULL) {
+    if (goFile == NULL) {
+      std::cout << "Error: -graph_path requires -graph_outfile" << std::endl;
+      abort();
+    }
+    Graph<unsigned int> G(gFile);
+    G.save_serving_layout(goFile);
+  }
+
+  return 0;
+}
@@ -30,6 +30,7 @@
 #include "../algorithms/utils/jl_point.h"
 #include "../algorithms/utils/stats.h"
 #include "../algorithms/utils/beamSearch.h"
+#include "../algorithms/utils/reorder.h"
 #include "../algorithms/HNSW/HNSW.hpp"
 #include "pybind11/numpy.h"
 
@@ -79,24 +80,46 @@ struct GraphIndex{
 
   std::optional<ANN::HNSW<Desc_HNSW<T, Point>>> HNSW_index;
 
-  GraphIndex(std::string &data_path, std::string &index_path, bool is_hnsw=false)
+  // for points and a graph written by the reorder tool, the original id
+  // of each point and its inverse.  Results are returned with the
+  // original ids.
+  parlay::sequence<unsigned int> id_map;
+  parlay::sequence<unsigned int> new_id;
+
+  unsigned int original_id(unsigned int i) const {return id_map.size() > 0 ? id_map[i] : i;}
+  unsigned int current_id(unsigned int i) const {return id_map.size() > 0 ? new_id[i] : i;}
+
+  GraphIndex(std::string &data_path, std::string &index_path, bool is_hnsw=false,
+             std::string id_map_path = "")
     : use_quantization(false) {
     Points = PointRange<Point>(data_path.data());
+    if (!id_map_path.empty()) {
+      id_map = load_id_map<unsigned int>(id_map_path.c_str());
+      if (id_map.size() != Points.size()) {
+        std::cout << "id map size and point size do not match" << std::endl;
+        abort();
+      }
+      new_id = inverse_order(id_map);
+    }
     
+    // quantized points are kept next to the index (as <index>.q and
+    // <index>.qq) so that reloading it skips the quantization
     if (sizeof(T) > 1) {
       use_quantization = true;
+      std::string q_path = index_path + ".q";
+      std::string qq_path = index_path + ".qq";
       if (Point::is_metric()) {
         //E_Points = ERange(Points);
-        EQuant_Points = EQuantRange(Points);
+        EQuant_Points = load_or_quantize<EQuantRange>(q_path, Points.source(), [&] {return EQuantRange(Points);});
         if (Points.dimension() > 800)
-          EQQuant_Points = EQQuantRange(Points);
+          EQQuant_Points = load_or_quantize<EQQuantRange>(qq_path, Points.source(), [&] {return EQQuantRange(Points);});
       } else {
         for (int i=0; i < Points.size(); i++) 
           Points[i].normalize();
-        MQuant_Points = MQuantRange(Points);
+        MQuant_Points = load_or_quantize<MQuantRange>(q_path, Points.source(), [&] {return MQuantRange(Points);});
         // only double quantize for high dimensionality
         if (Points.dimension() > 200)
-          MQQuant_Points = MQQuantRange(Points);
+          MQQuant_Points = load_or_quantize<MQQuantRange>(qq_path, Points.source(), [&] {return MQQuantRange(Points);});
       }
     }
 
@@ -208,7 +231,7 @@ struct GraphIndex{
       Point q = Point((uint8_t*) v.data(), 0, Points.params);
       auto frontier = search_dispatch(q, QP, quant);
       for(int j=0; j<knn; j++){
-        ids.mutable_data(i)[j] = frontier[j].first;
+        ids.mutable_data(i)[j] = original_id(frontier[j].first);
         dists.mutable_data(i)[j] = frontier[j].second;
       }
     });
@@ -230,7 +253,7 @@ struct GraphIndex{
     Point p = Point((uint8_t*) v, 0, Points.params);
     auto frontier = search_dispatch(p, QP, quant);
     for(int j=0; j<knn; j++) 
-      ids.mutable_data()[j] = frontier[j].first;
+      ids.mutable_data()[j] = original_id(frontier[j].first);
     return std::move(ids);
   }
 
@@ -248,7 +271,7 @@ struct GraphIndex{
       auto p = QueryPoints[i];
       auto frontier = search_dispatch(p, QP, quant);
       for(int j=0; j<knn; j++){
-        ids.mutable_data(i)[j] = frontier[j].first;
+        ids.mutable_data(i)[j] = original_id(frontier[j].first);
         dists.mutable_data(i)[j] = frontier[j].second;
       }
     });
@@ -276,9 +299,9 @@ struct GraphIndex{
       for (unsigned int l = 0; l < k; l++)
         results.push_back(GT.coordinates(i,l));
       if (resolve_eq_distances) {
-        last_dist = QueryPoints[i].distance(Points[GT.coordinates(i, k-1)]);
+        last_dist = QueryPoints[i].distance(Points[current_id(GT.coordinates(i, k-1))]);
         for (unsigned int l = k; l < GT.dimension(); l++) {
-          auto p = Points[GT.coordinates(i, l)];
+          auto p = Points[current_id(GT.coordinates(i, l))];
           if (QueryPoints[i].distance(p) == last_dist) {
             cnt++;
             results.push_back(GT.coordinates(i,l));
@@ -63,8 +63,8 @@ template <typename T, typename Point> inline void add_variant(py::module_ &m, co
           "data_file_path"_a, "index_output_path"_a, "graph_degree"_a, "beam_width"_a, "alpha"_a, "two_pass"_a);
 
     py::class_<GraphIndex<T, Point>>(m, variant.index_name.c_str())
-      .def(py::init<std::string &, std::string &, bool>(),
-           "index_path"_a, "data_path"_a, "hnsw"_a=false)
+      .def(py::init<std::string &, std::string &, bool, std::string>(),
+           "index_path"_a, "data_path"_a, "hnsw"_a=false, "id_map_path"_a="")
       //do we want to add options like visited limit, or leave those as defaults?
       .def("batch_search", &GraphIndex<T, Point>::batch_search, "queries"_a, "knn"_a,
            "beam_width"_a, "quant"_a, "visit_limit"_a)
@@ -93,23 +93,23 @@ def build_hnsw_index(metric, dtype, data_dir, index_dir, R, efc, m_l, alpha):
         raise Exception('Invalid metric ' + metric)
 
         
-def load_index(metric, dtype, data_dir, index_dir, hnsw=False):
+def load_index(metric, dtype, data_dir, index_dir, hnsw=False, id_map_path=''):
     if metric == 'Euclidian':
         if dtype == 'uint8':
-            return UInt8EuclidianIndex(data_dir, index_dir, hnsw)
+            return UInt8EuclidianIndex(data_dir, index_dir, hnsw, id_map_path)
         elif dtype == 'int8':
-            return Int8EuclidianIndex(data_dir, index_dir, hnsw)
+            return Int8EuclidianIndex(data_dir, index_dir, hnsw, id_map_path)
         elif dtype == 'float':
-            return FloatEuclidianIndex(data_dir, index_dir, hnsw)
+            return FloatEuclidianIndex(data_dir, index_dir, hnsw, id_map_path)
         else:
             raise Exception('Invalid data type')
     elif metric == 'mips':
         if dtype == 'uint8':
-            return UInt8MipsIndex(data_dir, index_dir, hnsw)
+            return UInt8MipsIndex(data_dir, index_dir, hnsw, id_map_path)
         elif dtype == 'int8':
-            return Int8MipsIndex(data_dir, index_dir, hnsw)
+            return Int8MipsIndex(data_dir, index_dir, hnsw, id_map_path)
         elif dtype == 'float':
-            return FloatMipsIndex(data_dir, index_dir, hnsw)
+            return FloatMipsIndex(data_dir, index_dir, hnsw, id_map_path)
         else:
             raise Exception('Invalid data type')
     else: